@@ -154,9 +154,11 @@ class AppDelegate: NSObject, NSApplicationDelegate, NonModalAlertWindowControlle
     private var serviceProviderHelper = ServiceProviderInputHelper()
 
     func updateUserPhrases() {
-        LanguageModelManager.loadUserPhrases(enableForPlainBopomofo: Preferences.enableUserPhrasesInPlainBopomofo)
-        LanguageModelManager.loadUserPhraseReplacement()
+        LanguageModelManager.reloadUserPhrases(enableForPlainBopomofo: Preferences.enableUserPhrasesInPlainBopomofo, completion: nil)
+        watchUserPhrases()
+    }
 
+    private func watchUserPhrases() {
         fsStreamHelper?.delegate = nil
         fsStreamHelper?.stop()
         fsStreamHelper = FSEventStreamHelper(path: LanguageModelManager.dataFolderPath, queue: DispatchQueue(label: "User Phrases"))
@@ -166,7 +168,8 @@ class AppDelegate: NSObject, NSApplicationDelegate, NonModalAlertWindowControlle
 
     func applicationDidFinishLaunching(_ notification: Notification) {
         LanguageModelManager.setupDataModelValueConverter()
-        updateUserPhrases()
+        LanguageModelManager.loadDataModels()
+        watchUserPhrases()
 
         if UserDefaults.standard.object(forKey: kCheckUpdateAutomatically) == nil {
             UserDefaults.standard.set(true, forKey: kCheckUpdateAutomatically)
@@ -275,8 +278,7 @@ class AppDelegate: NSObject, NSApplicationDelegate, NonModalAlertWindowControlle
 extension AppDelegate: FSEventStreamHelperDelegate {
     func helper(_ helper: FSEventStreamHelper, didReceive events: [FSEventStreamHelper.Event]) {
         DispatchQueue.main.async {
-            LanguageModelManager.loadUserPhrases(enableForPlainBopomofo: Preferences.enableUserPhrasesInPlainBopomofo)
-            LanguageModelManager.loadUserPhraseReplacement()
+            LanguageModelManager.reloadUserPhrases(enableForPlainBopomofo: Preferences.enableUserPhrasesInPlainBopomofo, completion: nil)
         }
     }
 }
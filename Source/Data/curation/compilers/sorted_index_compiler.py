@@ -0,0 +1,94 @@
+import argparse
+import struct
+
+from .compiler_utils import HEADER
+
+# Must match the format defined in Source/Engine/ParselessPhraseDB.h.
+INDEX_MAGIC = b"MBPIDX01"
+INDEX_VERSION = 3
+INDEX_KEY_PREFIX_LENGTH = 12
+INDEX_SUFFIX = ".idx"
+
+
+FNV_OFFSET_BASIS = 14695981039346656037
+FNV_PRIME = 1099511628211
+UINT64_MASK = (1 << 64) - 1
+
+
+FINGERPRINT_SAMPLE_COUNT = 64
+FINGERPRINT_SAMPLE_LENGTH = 64
+
+
+def hash_bytes(value, data):
+    """FNV-1a over 8-byte little-endian words, then over the remaining bytes."""
+    full_length = len(data) - len(data) % 8
+    for (word,) in struct.iter_unpack("<Q", data[:full_length]):
+        value = ((value ^ word) * FNV_PRIME) & UINT64_MASK
+    for byte in data[full_length:]:
+        value = ((value ^ byte) * FNV_PRIME) & UINT64_MASK
+    return value
+
+
+def fingerprint(data):
+    """Hashes the length, then evenly spread samples of the data."""
+    value = ((FNV_OFFSET_BASIS ^ len(data)) * FNV_PRIME) & UINT64_MASK
+    if len(data) <= FINGERPRINT_SAMPLE_COUNT * FINGERPRINT_SAMPLE_LENGTH:
+        return hash_bytes(value, data)
+
+    last = len(data) - FINGERPRINT_SAMPLE_LENGTH
+    for i in range(FINGERPRINT_SAMPLE_COUNT):
+        offset = last * i // (FINGERPRINT_SAMPLE_COUNT - 1)
+        value = hash_bytes(value, data[offset : offset + FINGERPRINT_SAMPLE_LENGTH])
+    return value
+
+
+def build_index(data):
+    """Builds the compiled row index for the bytes of a sorted database."""
+    if len(data) > 0xFFFFFFFF:
+        raise ValueError("Database too large to be indexed")
+
+    header = HEADER.encode("utf-8")
+    pos = len(header) if data.startswith(header) else 0
+
+    rows = []
+    while pos < len(data):
+        eol = data.find(b"\n", pos)
+        if eol == -1:
+            eol = len(data)
+        if eol != pos:
+            prefix = data[pos : pos + INDEX_KEY_PREFIX_LENGTH]
+            prefix += b"\0" * (INDEX_KEY_PREFIX_LENGTH - len(prefix))
+            rows.append(struct.pack("<I", pos) + prefix)
+        pos = eol + 1
+
+    output = INDEX_MAGIC
+    output += struct.pack(
+        "<IIQQQ",
+        INDEX_VERSION,
+        INDEX_KEY_PREFIX_LENGTH,
+        len(data),
+        len(rows),
+        fingerprint(data),
+    )
+    return output + b"".join(rows)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="build the compiled row index for a sorted database"
+    )
+    parser.add_argument("input", help="path to the sorted database")
+    parser.add_argument(
+        "--output", help="path to the index; defaults to the input path plus .idx"
+    )
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    with open(args.output or args.input + INDEX_SUFFIX, "wb") as f:
+        f.write(build_index(data))
+
+
+if __name__ == "__main__":
+    main()
@@ -106,23 +106,51 @@ static AssociatedPhrasesV2::Phrase PhraseFromRow(const std::string_view& v) {
 AssociatedPhrasesV2::~AssociatedPhrasesV2() { close(); }
 
 bool AssociatedPhrasesV2::open(const char* path) {
+  return open(path, kMappingOptions);
+}
+
+bool AssociatedPhrasesV2::open(const char* path,
+                               const MemoryMappedFile::Options& options) {
   if (db_ != nullptr) {
     return false;
   }
 
-  bool result = mmapedFile_.open(path);
-  if (!result) {
+  mmapedFile_ = MemoryMappedFile::OpenShared(path, options);
+  if (mmapedFile_ == nullptr) {
     return false;
   }
 
   db_ = std::make_unique<ParselessPhraseDB>(
-      mmapedFile_.data(), mmapedFile_.length(), /*validate_pragma=*/true);
+      mmapedFile_->data(), mmapedFile_->length(), /*validate_pragma=*/true);
+
+  // Use the compiled index if there is one.
+  std::string indexPath = std::string(path) + std::string(SORTED_INDEX_SUFFIX);
+  mmapedIndexFile_ = MemoryMappedFile::OpenShared(indexPath.c_str(), options);
+  if (mmapedIndexFile_ != nullptr &&
+      !db_->attachIndex(mmapedIndexFile_->data(), mmapedIndexFile_->length())) {
+    mmapedIndexFile_ = nullptr;
+  }
   return true;
 }
 
 void AssociatedPhrasesV2::close() {
   db_ = nullptr;
-  mmapedFile_.close();
+  mmapedFile_ = nullptr;
+  mmapedIndexFile_ = nullptr;
+}
+
+bool AssociatedPhrasesV2::isUpToDate(const char* path) const {
+  if (mmapedFile_ == nullptr || !mmapedFile_->isUpToDate(path)) {
+    return false;
+  }
+
+  // The index must not have been added, replaced, or removed either.
+  std::string indexPath = std::string(path) + std::string(SORTED_INDEX_SUFFIX);
+  if (mmapedIndexFile_ != nullptr) {
+    return mmapedIndexFile_->isUpToDate(indexPath.c_str());
+  }
+  MemoryMappedFile::FileIdentity identity;
+  return !MemoryMappedFile::StatFile(indexPath.c_str(), &identity);
 }
 
 bool AssociatedPhrasesV2::isLoaded() const { return db_ != nullptr; }
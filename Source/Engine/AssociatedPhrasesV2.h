@@ -38,10 +38,23 @@ class AssociatedPhrasesV2 {
  public:
   ~AssociatedPhrasesV2();
 
+  // The lookups binary-search the data, and so the files are mapped for
+  // random access, and read into memory in the background upon open.
+  static constexpr MemoryMappedFile::Options kMappingOptions = {
+      MemoryMappedFile::AccessPattern::RANDOM, /*willNeed=*/true};
+
+  // Opens the data file at path. If a compiled index exists at path plus
+  // SORTED_INDEX_SUFFIX and matches the data file, it is used for lookups.
+  // Both files are mapped with the options, kMappingOptions by default.
   bool open(const char* path);
+  bool open(const char* path, const MemoryMappedFile::Options& options);
   void close();
   bool isLoaded() const;
 
+  // Whether the files at path are the open files, unchanged since they were
+  // opened, in which case opening them again would give the same model.
+  bool isUpToDate(const char* path) const;
+
   // Allows the use of existing in-memory db.
   bool open(std::unique_ptr<ParselessPhraseDB> db);
 
@@ -83,7 +96,8 @@ class AssociatedPhrasesV2 {
  protected:
   std::vector<Phrase> findPhrases(const std::string& internalPrefix) const;
 
-  MemoryMappedFile mmapedFile_;
+  std::shared_ptr<const MemoryMappedFile> mmapedFile_;
+  std::shared_ptr<const MemoryMappedFile> mmapedIndexFile_;
   std::unique_ptr<ParselessPhraseDB> db_;
 };
 
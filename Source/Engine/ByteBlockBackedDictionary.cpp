@@ -21,17 +21,15 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-#if defined(__AVX512F__)
-#include <immintrin.h>
+#include "ByteBlockBackedDictionary.h"
 
-#include <cstdint>
-#else
-#error AVX512 support required
-#endif
-#endif
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <utility>
 
-#include "ByteBlockBackedDictionary.h"
+#include "ByteBlockScanner.h"
 
 namespace McBopomofo {
 
@@ -47,16 +45,6 @@ const char* AdvanceToNextNonWhitespace(const char* ptr, const char* end) {
   return ptr;
 }
 
-const char* AdvanceToNextCRLF(const char* ptr, const char* end) {
-  while (ptr != end) {
-    if (const char c = *ptr; c == '\r' || c == '\n') {
-      break;
-    }
-    ++ptr;
-  }
-  return ptr;
-}
-
 const char* AdvanceToNextContentCharacter(const char* ptr, const char* end,
                                           size_t& lineCounter) {
   while (ptr != end) {
@@ -74,208 +62,22 @@ const char* AdvanceToNextContentCharacter(const char* ptr, const char* end,
   return ptr;
 }
 
-const char* AdvanceToNextNonContentCharacter(const char* ptr, const char* end) {
-  while (ptr != end) {
-    if (const char c = *ptr; c == ' ' || c == '\t' || c == '\r' || c == '\n') {
-      break;
-    }
-    ++ptr;
-  }
-  return ptr;
-}
-
-#ifndef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-const char* FindFirstNULL(const char* ptr, const char* end,
-                          size_t* firstLineNumber = nullptr) {
-  const char* i = ptr;
-  while (i != end) {
-    if (*i == 0) {
-      break;
-    }
-    ++i;
-  }
-
-  // Only count the line number if there is indeed a NULL.
-  if (i != end && firstLineNumber != nullptr) {
-    size_t lineCounter = 1;
-    while (ptr != i) {
-      if (*ptr == '\n') {
-        ++lineCounter;
-      }
-      ++ptr;
-    }
-    *firstLineNumber = lineCounter;
-  }
-
-  return i;
-}
-#endif
-
 bool IsCRLF(char c) { return c == '\n' || c == '\r'; }
 
 bool IsWhitespace(char c) { return c == ' ' || c == '\t'; }
 
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-
-const char* AVX512_AdvanceToNextCRLF(const char* ptr,
-                                     const char* unaligned32End,
-                                     const char* end) {
-  const __m256i lfs = _mm256_set1_epi8('\n');
-  const __m256i crs = _mm256_set1_epi8('\r');
-
-  while (ptr < unaligned32End) {
-    const __m256i block = _mm256_loadu_epi8(ptr);
-    const __mmask32 foundLFs = _mm256_cmpeq_epi8_mask(block, lfs);
-    const __mmask32 foundCRs = _mm256_cmpeq_epi8_mask(block, crs);
-    const __mmask32 mask = _kor_mask32(foundLFs, foundCRs);
-    if (mask != 0) {
-      return ptr + _tzcnt_u32(mask);
-    }
-
-    ptr += 32;
-  }
-
-  return AdvanceToNextCRLF(ptr, end);
-}
-
-// Four chars: 0x09 (T), 0x0a (L), 0x0d (C), 0x20 (S)
-// T maps to 0x01
-// L maps to 0x02
-// C maps to 0x04
-// T|L|C = 0x07
-// S maps to 0x08
-alignas(32) constexpr uint8_t LO_NIBBLES_LOOKUP[32] = {
-    0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02,
-    0x00, 0x00, 0x04, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x01, 0x02, 0x00, 0x00, 0x04, 0x00, 0x00,
-};
-
-alignas(32) constexpr uint8_t HI_NIBBLES_LOOKUP[32] = {
-    0x07, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x07, 0x00, 0x08, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-};
-
-const char* AVX512_AdvanceToNextNonContentCharacter(const char* ptr,
-                                                    const char* unaligned32End,
-                                                    const char* end) {
-  while (ptr < unaligned32End) {
-    const __m256i input = _mm256_loadu_epi8(ptr);
-
-    const __m256i mask = _mm256_set1_epi8(0x0f);
-    const __m256i loNibbles = _mm256_and_si256(input, mask);
-    const __m256i hiNibbles =
-        _mm256_and_si256(_mm256_srli_epi16(input, 4), mask);
-    const __m256i loTbl =
-        _mm256_load_si256(reinterpret_cast<const __m256i*>(LO_NIBBLES_LOOKUP));
-    const __m256i lo = _mm256_shuffle_epi8(loTbl, loNibbles);
-    const __m256i hiTbl =
-        _mm256_load_si256(reinterpret_cast<const __m256i*>(HI_NIBBLES_LOOKUP));
-    const __m256i hi = _mm256_shuffle_epi8(hiTbl, hiNibbles);
-    const __m256i intersection = _mm256_and_si256(lo, hi);
-    const __mmask32 nonContentMask =
-        _mm256_cmpneq_epi8_mask(intersection, _mm256_setzero_si256());
-    if (nonContentMask != 0) {
-      return ptr + _tzcnt_u32(nonContentMask);
-    }
-    ptr += 32;
-  }
-
-  return AdvanceToNextNonContentCharacter(ptr, end);
-}
-
-constexpr uintptr_t ALIGN64 = 64;
-constexpr uintptr_t ALIGN64_MASK = ALIGN64 - 1;
-
-const char* AVX512_FindFirstNULL(const char* ptr, const char* end,
-                                 size_t* firstLineNumber = nullptr) {
-  const char* i = ptr;
-  bool found = false;
-  if ((reinterpret_cast<uintptr_t>(i) & ALIGN64_MASK) != 0) {
-    const char* headEnd = reinterpret_cast<const char*>(
-        reinterpret_cast<uintptr_t>(i + ALIGN64_MASK) & ~ALIGN64_MASK);
-    headEnd = headEnd < end ? headEnd : end;
-    while (i != headEnd) {
-      if (*i == '\0') {
-        found = true;
-        break;
-      }
-      ++i;
-    }
-  }
-
-  if (!found && i != end) {
-    const char* middleEnd = reinterpret_cast<const char*>(
-        reinterpret_cast<uintptr_t>(end) & ~ALIGN64_MASK);
-    const __m512i zeros = _mm512_setzero_si512();
-    while (i != middleEnd) {
-      const __m512i block = _mm512_load_si512(i);
-      const __mmask64 mask = _mm512_cmpeq_epi8_mask(block, zeros);
-      if (mask != 0) {
-        found = true;
-        i += _tzcnt_u32(mask);
-        break;
-      }
-      i += ALIGN64;
-    }
-  }
-
-  if (!found) {
-    while (i != end) {
-      if (*i == 0) {
-        found = true;
-        break;
-      }
-      ++i;
-    }
-  }
-
-  if (!found || firstLineNumber == nullptr) {
-    return i;
-  }
-
-  size_t lineCounter = 1;
-  if ((reinterpret_cast<uintptr_t>(ptr) & ALIGN64_MASK) != 0) {
-    const char* headEnd = reinterpret_cast<const char*>(
-        reinterpret_cast<uintptr_t>(ptr + ALIGN64_MASK) & ~ALIGN64_MASK);
-    headEnd = headEnd < i ? headEnd : i;
-    while (ptr != headEnd) {
-      if (*ptr == '\n') {
-        ++lineCounter;
-      }
-      ++ptr;
-    }
-  }
-
-  if (ptr != i) {
-    const char* middleEnd = reinterpret_cast<const char*>(
-        reinterpret_cast<uintptr_t>(i) & ~ALIGN64_MASK);
-    const __m512i linefeeds = _mm512_set1_epi8('\n');
-    while (ptr != middleEnd) {
-      const __m512i block = _mm512_load_si512(ptr);
-      const __mmask64 mask = _mm512_cmpeq_epi8_mask(block, linefeeds);
-      lineCounter += _mm_popcnt_u64(mask);
-      ptr += ALIGN64;
-    }
-  }
-
-  while (ptr != i) {
-    if (*ptr == '\n') {
-      ++lineCounter;
-    }
-    ++ptr;
-  }
-  *firstLineNumber = lineCounter;
-  return i;
-}
-
-#endif
-
 }  // namespace
 
 void ByteBlockBackedDictionary::clear() {
-  dict_.clear();
+  keys_.clear();
+  slots_.clear();
+  values_.clear();
+  valueRanges_.clear();
+  unusedValueCount_ = 0;
+  sortedKeys_.clear();
+  appendedSortedKeys_.clear();
   issues_.clear();
+  nextLineNumber_ = 1;
 }
 
 bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
@@ -289,7 +91,24 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
   }
 
   clear();
+  return parseEntries(block, size, columnOrder);
+}
 
+bool ByteBlockBackedDictionary::append(const char* block, size_t size,
+                                       ColumnOrder columnOrder) {
+  if (block == nullptr) {
+    return false;
+  }
+
+  if (size == 0) {
+    return false;
+  }
+
+  return parseEntries(block, size, columnOrder);
+}
+
+bool ByteBlockBackedDictionary::parseEntries(const char* block, size_t size,
+                                             ColumnOrder columnOrder) {
   // Special case if block is a null-ended C string. This is the only place
   // NUL is allowed.
   if (block[size - 1] == 0) {
@@ -299,28 +118,24 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
   const char* ptr = block;
   const char* end = ptr + size;
 
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-  const char* unaligned32End =
-      reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(end) - 32);
-  if (unaligned32End < ptr) {
-    unaligned32End = ptr;
-  }
-#endif
+  const ByteBlockScanner& scanner = ByteBlockScanner::best();
 
   // Validate that no NULL characters are in the text.
   size_t errorAtLine = 0;
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-  const char* ctrlCharPtr = AVX512_FindFirstNULL(ptr, end, &errorAtLine);
-#else
-  const char* ctrlCharPtr = FindFirstNULL(ptr, end, &errorAtLine);
-#endif
+  const char* ctrlCharPtr = scanner.findFirstNULL(ptr, end, &errorAtLine);
 
   if (ctrlCharPtr != end) {
-    issues_.emplace_back(Issue::Type::NULL_CHARACTER_IN_TEXT, errorAtLine);
+    issues_.emplace_back(Issue::Type::NULL_CHARACTER_IN_TEXT,
+                         nextLineNumber_ + errorAtLine - 1);
     return false;
   }
 
-  size_t lineCounter = 1;
+  size_t lineCounter = nextLineNumber_;
+  size_t oldKeyCount = keys_.size();
+
+  // The values in the text order, and the key index of each of them.
+  std::vector<std::string_view> entryValues;
+  std::vector<uint32_t> entryKeys;
 
   if (columnOrder == ColumnOrder::KEY_THEN_VALUE) {
     while (ptr != end) {
@@ -330,20 +145,12 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       if (*ptr == '#') {
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-        ptr = AVX512_AdvanceToNextCRLF(ptr, unaligned32End, end);
-#else
-        ptr = AdvanceToNextCRLF(ptr, end);
-#endif
+        ptr = scanner.advanceToNextCRLF(ptr, end);
         continue;
       }
 
       const char* keyStart = ptr;
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-      ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#else
-      ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+      ptr = scanner.advanceToNextNonContentCharacter(ptr, end);
       const char* keyEnd = ptr;
 
       ptr = AdvanceToNextNonWhitespace(ptr, end);
@@ -356,11 +163,7 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       const char* valueStart = ptr;
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-      ptr = AVX512_AdvanceToNextCRLF(ptr, unaligned32End, end);
-#else
-      ptr = AdvanceToNextCRLF(ptr, end);
-#endif
+      ptr = scanner.advanceToNextCRLF(ptr, end);
       const char* valueEnd = ptr;
 
       if (valueEnd == valueStart) {
@@ -395,7 +198,8 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
 
       std::string_view key(keyStart, keyEnd - keyStart);
       std::string_view value(valueStart, valueEnd - valueStart);
-      dict_[key].emplace_back(value);
+      entryKeys.push_back(insertKey(key));
+      entryValues.push_back(value);
     }
   } else {
     while (ptr != end) {
@@ -405,20 +209,12 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       if (*ptr == '#') {
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-        ptr = AVX512_AdvanceToNextCRLF(ptr, unaligned32End, end);
-#else
-        ptr = AdvanceToNextCRLF(ptr, end);
-#endif
+        ptr = scanner.advanceToNextCRLF(ptr, end);
         continue;
       }
 
       const char* valueStart = ptr;
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-      ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#else
-      ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+      ptr = scanner.advanceToNextNonContentCharacter(ptr, end);
       const char* valueEnd = ptr;
 
       ptr = AdvanceToNextNonWhitespace(ptr, end);
@@ -430,11 +226,7 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       const char* maybeKeyStart = ptr;
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-      ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#else
-      ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+      ptr = scanner.advanceToNextNonContentCharacter(ptr, end);
       const char* maybeKeyEnd = ptr;
       if (maybeKeyStart == maybeKeyEnd) {
         if (issues_.size() < MAX_ISSUES) {
@@ -457,34 +249,243 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
         // More content incoming.
         valueEnd = maybeKeyEnd;
         maybeKeyStart = ptr;
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-        ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#else
-        ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+        ptr = scanner.advanceToNextNonContentCharacter(ptr, end);
         maybeKeyEnd = ptr;
       }
 
       std::string_view key(maybeKeyStart, maybeKeyEnd - maybeKeyStart);
       std::string_view value(valueStart, valueEnd - valueStart);
-      dict_[key].emplace_back(value);
+      entryKeys.push_back(insertKey(key));
+      entryValues.push_back(value);
     }
   }
 
+  addValues(entryKeys, std::move(entryValues), oldKeyCount);
+  addSortedKeys(oldKeyCount);
+  nextLineNumber_ = lineCounter;
   return true;
 }
 
 bool ByteBlockBackedDictionary::hasKey(const std::string_view& key) const {
-  return dict_.find(key) != dict_.end();
+  return findKey(key) != kNotFound;
+}
+
+bool ByteBlockBackedDictionary::hasKeyWithPrefix(
+    const std::string_view& prefix) const {
+  auto hasPrefix = [&prefix](const std::vector<std::string_view>& keys) {
+    auto it = std::lower_bound(keys.cbegin(), keys.cend(), prefix);
+    return it != keys.cend() && it->substr(0, prefix.length()) == prefix;
+  };
+  return hasPrefix(sortedKeys_) || hasPrefix(appendedSortedKeys_);
+}
+
+ByteBlockBackedDictionary::ValueSpan ByteBlockBackedDictionary::getValues(
+    const std::string_view& key) const {
+  uint32_t index = findKey(key);
+  if (index == kNotFound) {
+    return {};
+  }
+  const ValueRange& range = valueRanges_[index];
+  return {values_.data() + range.begin, range.size};
 }
 
-std::vector<std::string_view> ByteBlockBackedDictionary::getValues(
+std::string_view ByteBlockBackedDictionary::getFirstValue(
     const std::string_view& key) const {
-  const auto it = dict_.find(key);
-  if (it == dict_.cend()) {
+  uint32_t index = findKey(key);
+  if (index == kNotFound) {
     return {};
   }
-  return it->second;
+  return values_[valueRanges_[index].begin];
+}
+
+uint32_t ByteBlockBackedDictionary::findKey(
+    const std::string_view& key) const {
+  if (slots_.empty()) {
+    return kNotFound;
+  }
+
+  size_t mask = slots_.size() - 1;
+  size_t i = std::hash<std::string_view>()(key) & mask;
+  while (slots_[i] != kNotFound) {
+    if (keys_[slots_[i]] == key) {
+      return slots_[i];
+    }
+    i = (i + 1) & mask;
+  }
+  return kNotFound;
+}
+
+uint32_t ByteBlockBackedDictionary::insertKey(const std::string_view& key) {
+  // Lines with the same key are usually next to each other.
+  if (!keys_.empty() && keys_.back() == key) {
+    return static_cast<uint32_t>(keys_.size() - 1);
+  }
+
+  // Keep the load factor at or below 1/2.
+  if ((keys_.size() + 1) * 2 > slots_.size()) {
+    growTable();
+  }
+
+  size_t mask = slots_.size() - 1;
+  size_t i = std::hash<std::string_view>()(key) & mask;
+  while (slots_[i] != kNotFound) {
+    if (keys_[slots_[i]] == key) {
+      return slots_[i];
+    }
+    i = (i + 1) & mask;
+  }
+
+  auto index = static_cast<uint32_t>(keys_.size());
+  slots_[i] = index;
+  keys_.push_back(key);
+  return index;
+}
+
+void ByteBlockBackedDictionary::growTable() {
+  size_t slotCount = slots_.empty() ? 64 : slots_.size() * 2;
+  slots_.assign(slotCount, kNotFound);
+
+  size_t mask = slotCount - 1;
+  for (uint32_t index = 0; index < keys_.size(); ++index) {
+    size_t i = std::hash<std::string_view>()(keys_[index]) & mask;
+    while (slots_[i] != kNotFound) {
+      i = (i + 1) & mask;
+    }
+    slots_[i] = index;
+  }
+}
+
+void ByteBlockBackedDictionary::addValues(
+    const std::vector<uint32_t>& entryKeys,
+    std::vector<std::string_view> entryValues, size_t oldKeyCount) {
+  valueRanges_.resize(keys_.size());
+
+  // Since key indices are assigned in the text order, the new values are
+  // already grouped if the indices never decrease, which is the case for
+  // sorted text. If they all belong to new keys, they can simply be appended.
+  if (std::is_sorted(entryKeys.begin(), entryKeys.end()) &&
+      (entryKeys.empty() || entryKeys.front() >= oldKeyCount)) {
+    auto offset = static_cast<uint32_t>(values_.size());
+    for (size_t i = 0; i < entryKeys.size(); ++i) {
+      ValueRange& range = valueRanges_[entryKeys[i]];
+      if (range.size == 0) {
+        range.begin = offset + static_cast<uint32_t>(i);
+      }
+      ++range.size;
+    }
+    if (values_.empty()) {
+      values_ = std::move(entryValues);
+    } else {
+      values_.insert(values_.end(), entryValues.begin(), entryValues.end());
+    }
+    return;
+  }
+
+  // If all keys are new, lay out the values with a counting sort by key
+  // index, which keeps the values of each key in the text order.
+  if (oldKeyCount == 0) {
+    for (uint32_t index : entryKeys) {
+      ++valueRanges_[index].size;
+    }
+    uint32_t offset = 0;
+    for (ValueRange& range : valueRanges_) {
+      range.begin = offset;
+      offset += range.size;
+    }
+
+    std::vector<std::string_view> grouped(entryValues.size());
+    std::vector<uint32_t> next(keys_.size());
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      next[i] = valueRanges_[i].begin;
+    }
+    for (size_t i = 0; i < entryKeys.size(); ++i) {
+      grouped[next[entryKeys[i]]++] = entryValues[i];
+    }
+    values_ = std::move(grouped);
+    return;
+  }
+
+  // Otherwise, move the values of each key that gets new values to the end,
+  // followed by the new values. This only touches the keys in the new block.
+  std::vector<uint32_t> order(entryKeys.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&entryKeys](auto a, auto b) {
+    return entryKeys[a] < entryKeys[b];
+  });
+
+  size_t movedValueCount = 0;
+  for (size_t i = 0; i < order.size(); ++i) {
+    uint32_t index = entryKeys[order[i]];
+    if (index < oldKeyCount && (i == 0 || entryKeys[order[i - 1]] != index)) {
+      movedValueCount += valueRanges_[index].size;
+    }
+  }
+  // Reserve so that pushing back existing values does not invalidate them,
+  // but grow geometrically, as reserving the exact size every time would
+  // copy all values on every append.
+  size_t valueCount = values_.size() + movedValueCount + entryValues.size();
+  if (valueCount > values_.capacity()) {
+    values_.reserve(std::max(valueCount, values_.capacity() * 2));
+  }
+
+  for (size_t i = 0; i < order.size();) {
+    uint32_t index = entryKeys[order[i]];
+    ValueRange& range = valueRanges_[index];
+    auto begin = static_cast<uint32_t>(values_.size());
+    for (uint32_t j = range.begin; j < range.begin + range.size; ++j) {
+      values_.push_back(values_[j]);
+    }
+    unusedValueCount_ += range.size;
+    for (; i < order.size() && entryKeys[order[i]] == index; ++i) {
+      values_.push_back(entryValues[order[i]]);
+    }
+    range.begin = begin;
+    range.size = static_cast<uint32_t>(values_.size()) - begin;
+  }
+
+  if (unusedValueCount_ > values_.size() / 2) {
+    compactValues();
+  }
+}
+
+void ByteBlockBackedDictionary::addSortedKeys(size_t oldKeyCount) {
+  if (oldKeyCount == 0) {
+    sortedKeys_.assign(keys_.begin(), keys_.end());
+    std::sort(sortedKeys_.begin(), sortedKeys_.end());
+    return;
+  }
+
+  size_t appendedCount = appendedSortedKeys_.size();
+  appendedSortedKeys_.insert(appendedSortedKeys_.end(),
+                             keys_.begin() + oldKeyCount, keys_.end());
+  auto newKeys = appendedSortedKeys_.begin() + appendedCount;
+  std::sort(newKeys, appendedSortedKeys_.end());
+  std::inplace_merge(appendedSortedKeys_.begin(), newKeys,
+                     appendedSortedKeys_.end());
+
+  // Merging moves all keys, but it only happens after sortedKeys_.size() / 16
+  // keys have been appended, so the cost per appended key stays constant.
+  if (appendedSortedKeys_.size() * 16 > sortedKeys_.size()) {
+    size_t sortedCount = sortedKeys_.size();
+    sortedKeys_.insert(sortedKeys_.end(), appendedSortedKeys_.begin(),
+                       appendedSortedKeys_.end());
+    std::inplace_merge(sortedKeys_.begin(), sortedKeys_.begin() + sortedCount,
+                       sortedKeys_.end());
+    appendedSortedKeys_.clear();
+  }
+}
+
+void ByteBlockBackedDictionary::compactValues() {
+  std::vector<std::string_view> compacted;
+  compacted.reserve(values_.size() - unusedValueCount_);
+  for (ValueRange& range : valueRanges_) {
+    auto begin = static_cast<uint32_t>(compacted.size());
+    compacted.insert(compacted.end(), values_.begin() + range.begin,
+                     values_.begin() + range.begin + range.size);
+    range.begin = begin;
+  }
+  values_ = std::move(compacted);
+  unusedValueCount_ = 0;
 }
 
 }  // namespace McBopomofo
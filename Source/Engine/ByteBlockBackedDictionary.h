@@ -24,8 +24,10 @@
 #ifndef SRC_ENGINE_BYTEBLOCKBACKEDDICTIONARY_H_
 #define SRC_ENGINE_BYTEBLOCKBACKEDDICTIONARY_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
 #include <string_view>
-#include <unordered_map>
 #include <vector>
 
 namespace McBopomofo {
@@ -59,6 +61,13 @@ namespace McBopomofo {
 // found in the text resulting in a parsing error. Note, it is safe to pass
 // a null-terminated C string to the parser, which treats it as a special case.
 //
+// The keys are kept in a flat open-addressing hash table, and the values of
+// all keys are kept in one array, grouped by key and in the order they appear
+// in the text. The table maps each key to its range in the array. This way,
+// parsing does not allocate per key, and getValues() returns a view of the
+// range without copying. Text can also be appended after it is parsed, and
+// the cost of that depends on the appended text, not on what came before.
+//
 // On memory safety: you are responsible for ensuring that the block of bytes
 // is alive during the dictionary's lifetime. To gain efficiency, the dictionary
 // uses std::string_view instead of copying key and value strings out of the
@@ -85,21 +94,121 @@ class ByteBlockBackedDictionary {
     VALUE_THEN_KEY,
   };
 
+  // A read-only view of the values of a key. It is valid until the dictionary
+  // is cleared or parses another block.
+  class ValueSpan {
+   public:
+    ValueSpan() = default;
+    ValueSpan(const std::string_view* data, size_t size)
+        : data_(data), size_(size) {}
+
+    [[nodiscard]] const std::string_view* begin() const { return data_; }
+    [[nodiscard]] const std::string_view* end() const { return data_ + size_; }
+    [[nodiscard]] size_t size() const { return size_; }
+    [[nodiscard]] bool empty() const { return size_ == 0; }
+    const std::string_view& operator[](size_t i) const { return data_[i]; }
+
+    [[nodiscard]] const std::string_view& at(size_t i) const {
+      if (i >= size_) {
+        throw std::out_of_range("ValueSpan::at");
+      }
+      return data_[i];
+    }
+
+   private:
+    const std::string_view* data_ = nullptr;
+    size_t size_ = 0;
+  };
+
   void clear();
   bool parse(const char* block, size_t size,
              ColumnOrder columnOrder = ColumnOrder::KEY_THEN_VALUE);
 
+  // Parses a block of text that follows the text parsed so far, for example,
+  // the lines newly appended to a file, and adds its entries. The block must
+  // start at a line boundary, and both blocks must stay alive. Line numbers in
+  // the issues continue from the text parsed so far. If the block contains a
+  // NUL, an issue is added, and the existing entries are kept.
+  bool append(const char* block, size_t size,
+              ColumnOrder columnOrder = ColumnOrder::KEY_THEN_VALUE);
+
   [[nodiscard]] bool hasKey(const std::string_view& key) const;
-  [[nodiscard]] std::vector<std::string_view> getValues(
+
+  // Returns true if any key starts with the prefix.
+  [[nodiscard]] bool hasKeyWithPrefix(const std::string_view& prefix) const;
+
+  // Returns the values of the key, or an empty span if the key is not found.
+  [[nodiscard]] ValueSpan getValues(const std::string_view& key) const;
+
+  // Returns the first value of the key, or an empty view if the key is not
+  // found.
+  [[nodiscard]] std::string_view getFirstValue(
       const std::string_view& key) const;
 
   const std::vector<Issue>& issues() const { return issues_; }
 
+  // The line number where the next appended block starts.
+  [[nodiscard]] size_t nextLineNumber() const { return nextLineNumber_; }
+
  private:
   static constexpr size_t MAX_ISSUES = 100;
 
+  static constexpr uint32_t kNotFound = UINT32_MAX;
+
+  // Returns the index of the key in keys_, or kNotFound.
+  [[nodiscard]] uint32_t findKey(const std::string_view& key) const;
+
+  // Returns the index of the key in keys_, adding the key if it's new.
+  uint32_t insertKey(const std::string_view& key);
+
+  // Doubles the hash table and re-inserts all keys.
+  void growTable();
+
+  bool parseEntries(const char* block, size_t size, ColumnOrder columnOrder);
+
+  // Adds the values, which are in the text order, after the existing values
+  // of their keys, and updates valueRanges_. entryKeys holds the key index of
+  // each value. Keys at or after oldKeyCount are new.
+  void addValues(const std::vector<uint32_t>& entryKeys,
+                 std::vector<std::string_view> entryValues,
+                 size_t oldKeyCount);
+
+  // Adds the keys at or after oldKeyCount to the sorted keys.
+  void addSortedKeys(size_t oldKeyCount);
+
+  // Lays out the values of all keys again, in the key order, dropping the
+  // unused values.
+  void compactValues();
+
   std::vector<Issue> issues_;
-  std::unordered_map<std::string_view, std::vector<std::string_view>> dict_;
+
+  // The keys in the order they first appear in the text.
+  std::vector<std::string_view> keys_;
+
+  // The hash table. Each slot holds an index into keys_, or kNotFound.
+  std::vector<uint32_t> slots_;
+
+  struct ValueRange {
+    uint32_t begin;
+    uint32_t size;
+  };
+
+  // The values of key i are the valueRanges_[i].size values starting at
+  // values_[valueRanges_[i].begin]. When an appended block adds values to an
+  // existing key, the key's values are moved to the end of values_, and the
+  // old ones are left unused until there are enough of them to compact.
+  std::vector<std::string_view> values_;
+  std::vector<ValueRange> valueRanges_;
+  size_t unusedValueCount_ = 0;
+
+  // The keys in sorted order, for prefix queries. Keys added by append() are
+  // first kept in the smaller appendedSortedKeys_, so that appending a few
+  // keys does not move all of them, and are merged once there are many.
+  std::vector<std::string_view> sortedKeys_;
+  std::vector<std::string_view> appendedSortedKeys_;
+
+  // The line number where the next appended block starts.
+  size_t nextLineNumber_ = 1;
 };
 
 }  // namespace McBopomofo
@@ -25,6 +25,7 @@
 
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "ByteBlockBackedDictionary.h"
 
@@ -80,6 +81,52 @@ void BM_ByteBlockBackedDictionaryValueColumnFirstParseTest(
 }
 BENCHMARK(BM_ByteBlockBackedDictionaryValueColumnFirstParseTest);
 
+// A file shaped like a large user phrase file: many keys with a few values
+// each.
+const std::string& GetManyKeysTestData() {
+  static const std::string data = []() {
+    std::stringstream sst;
+    for (int i = 0; i < 50000; ++i) {
+      sst << "phrase_" << i << " reading_" << i % 20000 << "\n";
+    }
+    return sst.str();
+  }();
+  return data;
+}
+
+void BM_ByteBlockBackedDictionaryManyKeysParseTest(benchmark::State& state) {
+  const std::string& testData = GetManyKeysTestData();
+
+  for (auto _ : state) {
+    McBopomofo::ByteBlockBackedDictionary dictionary;
+    dictionary.parse(
+        testData.c_str(), testData.size(),
+        McBopomofo::ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+  }
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryManyKeysParseTest);
+
+void BM_ByteBlockBackedDictionaryGetValuesTest(benchmark::State& state) {
+  const std::string& testData = GetManyKeysTestData();
+  McBopomofo::ByteBlockBackedDictionary dictionary;
+  dictionary.parse(
+      testData.c_str(), testData.size(),
+      McBopomofo::ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+
+  // Half of the keys are not in the dictionary.
+  std::vector<std::string> keys;
+  for (int i = 0; i < 40000; ++i) {
+    keys.push_back("reading_" + std::to_string(i));
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    auto values = dictionary.getValues(keys[i++ % keys.size()]);
+    benchmark::DoNotOptimize(values);
+  }
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryGetValuesTest);
+
 };  // namespace
 
 BENCHMARK_MAIN();
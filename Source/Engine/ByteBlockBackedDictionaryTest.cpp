@@ -21,6 +21,8 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <string>
+
 #include "ByteBlockBackedDictionary.h"
 #include "gtest/gtest.h"
 
@@ -280,4 +282,148 @@ TEST(ByteBlockBackedDictionaryTest, ComplexEntriesValueThenKey) {
   ASSERT_EQ(dict.getValues("comment").at(0), "value1 \t key1  #");
 }
 
+TEST(ByteBlockBackedDictionaryTest, KeyWithPrefix) {
+  constexpr char data[] = "a-b v1\na-c v2\nb v3\n# c-d comment";
+  ByteBlockBackedDictionary dict;
+  ASSERT_TRUE(dict.parse(data, sizeof(data)));
+  EXPECT_TRUE(dict.hasKeyWithPrefix(""));
+  EXPECT_TRUE(dict.hasKeyWithPrefix("a"));
+  EXPECT_TRUE(dict.hasKeyWithPrefix("a-"));
+  EXPECT_TRUE(dict.hasKeyWithPrefix("a-c"));
+  EXPECT_TRUE(dict.hasKeyWithPrefix("b"));
+  EXPECT_FALSE(dict.hasKeyWithPrefix("a-b-"));
+  EXPECT_FALSE(dict.hasKeyWithPrefix("b-"));
+  EXPECT_FALSE(dict.hasKeyWithPrefix("c"));
+
+  dict.clear();
+  EXPECT_FALSE(dict.hasKeyWithPrefix(""));
+}
+
+TEST(ByteBlockBackedDictionaryTest, ValuesOfInterleavedKeysKeepTextOrder) {
+  constexpr char data[] = "a 1\nb 2\na 3\nc 4\nb 5\na 6";
+  ByteBlockBackedDictionary dict;
+  ASSERT_TRUE(dict.parse(data, sizeof(data)));
+
+  auto values = dict.getValues("a");
+  ASSERT_EQ(values.size(), 3);
+  EXPECT_EQ(values[0], "1");
+  EXPECT_EQ(values[1], "3");
+  EXPECT_EQ(values[2], "6");
+  EXPECT_EQ(dict.getFirstValue("b"), "2");
+  EXPECT_EQ(dict.getValues("b").at(1), "5");
+  EXPECT_EQ(dict.getValues("c").size(), 1);
+  EXPECT_TRUE(dict.getValues("d").empty());
+  EXPECT_TRUE(dict.getFirstValue("d").empty());
+  EXPECT_THROW((void)dict.getValues("c").at(1), std::out_of_range);
+
+  dict.clear();
+  EXPECT_FALSE(dict.hasKey("a"));
+  EXPECT_TRUE(dict.getValues("a").empty());
+}
+
+TEST(ByteBlockBackedDictionaryTest, ManyKeys) {
+  constexpr int kKeys = 5000;
+  std::string data;
+  for (int i = 0; i < kKeys; ++i) {
+    data += "key" + std::to_string(i) + " value" + std::to_string(i) + "\n";
+  }
+  // Add a second value to every tenth key.
+  for (int i = 0; i < kKeys; i += 10) {
+    data += "key" + std::to_string(i) + " again" + std::to_string(i) + "\n";
+  }
+
+  ByteBlockBackedDictionary dict;
+  ASSERT_TRUE(dict.parse(data.c_str(), data.length()));
+  for (int i = 0; i < kKeys; ++i) {
+    std::string key = "key" + std::to_string(i);
+    auto values = dict.getValues(key);
+    ASSERT_EQ(values.size(), i % 10 == 0 ? 2 : 1) << key;
+    EXPECT_EQ(values[0], "value" + std::to_string(i));
+    if (i % 10 == 0) {
+      EXPECT_EQ(values[1], "again" + std::to_string(i));
+    }
+  }
+  EXPECT_FALSE(dict.hasKey("key" + std::to_string(kKeys)));
+}
+
+TEST(ByteBlockBackedDictionaryTest, AppendMergesEntries) {
+  std::string data = "a 1\nb 2\nc 3\n";
+  size_t parsedSize = data.length();
+  data += "b 4\nd\nab 5\na 6\n";
+
+  ByteBlockBackedDictionary dict;
+  ASSERT_TRUE(dict.parse(data.c_str(), parsedSize));
+  EXPECT_FALSE(dict.hasKey("ab"));
+  ASSERT_TRUE(dict.append(data.c_str() + parsedSize,
+                          data.length() - parsedSize));
+
+  auto values = dict.getValues("a");
+  ASSERT_EQ(values.size(), 2);
+  EXPECT_EQ(values[0], "1");
+  EXPECT_EQ(values[1], "6");
+  values = dict.getValues("b");
+  ASSERT_EQ(values.size(), 2);
+  EXPECT_EQ(values[0], "2");
+  EXPECT_EQ(values[1], "4");
+  EXPECT_EQ(dict.getValues("c").size(), 1);
+  EXPECT_EQ(dict.getFirstValue("ab"), "5");
+  EXPECT_FALSE(dict.hasKey("d"));
+  EXPECT_TRUE(dict.hasKeyWithPrefix("a"));
+  EXPECT_TRUE(dict.hasKeyWithPrefix("ab"));
+  EXPECT_FALSE(dict.hasKeyWithPrefix("abc"));
+
+  // Line numbers continue from the parsed text.
+  ASSERT_EQ(dict.issues().size(), 1);
+  EXPECT_EQ(dict.issues().at(0).type,
+            ByteBlockBackedDictionary::Issue::Type::MISSING_SECOND_COLUMN);
+  EXPECT_EQ(dict.issues().at(0).lineNumber, 5);
+
+  // Parsing again starts over.
+  ASSERT_TRUE(dict.parse(data.c_str(), parsedSize));
+  EXPECT_EQ(dict.getValues("a").size(), 1);
+  EXPECT_FALSE(dict.hasKey("ab"));
+  EXPECT_TRUE(dict.issues().empty());
+}
+
+TEST(ByteBlockBackedDictionaryTest, ManyAppends) {
+  constexpr int kKeys = 100;
+  constexpr int kAppends = 500;
+  std::string data;
+  for (int i = 0; i < kKeys; ++i) {
+    data += "key" + std::to_string(i) + " 0\n";
+  }
+
+  // Keep the blocks alive; each appends a value to an existing key and adds
+  // a new key.
+  std::vector<std::string> blocks;
+  for (int i = 1; i <= kAppends; ++i) {
+    blocks.push_back("key" + std::to_string(i % kKeys) + " " +
+                     std::to_string(i) + "\nnew" + std::to_string(i) + " " +
+                     std::to_string(i) + "\n");
+  }
+
+  ByteBlockBackedDictionary dict;
+  ASSERT_TRUE(dict.parse(data.c_str(), data.length()));
+  for (const auto& block : blocks) {
+    ASSERT_TRUE(dict.append(block.c_str(), block.length()));
+  }
+
+  for (int i = 0; i < kKeys; ++i) {
+    auto values = dict.getValues("key" + std::to_string(i));
+    ASSERT_EQ(values.size(), 1 + kAppends / kKeys);
+    EXPECT_EQ(values[0], "0");
+    for (size_t j = 1; j < values.size(); ++j) {
+      int appended = i == 0 ? j * kKeys : (j - 1) * kKeys + i;
+      EXPECT_EQ(values[j], std::to_string(appended));
+    }
+  }
+  for (int i = 1; i <= kAppends; ++i) {
+    EXPECT_EQ(dict.getFirstValue("new" + std::to_string(i)),
+              std::to_string(i));
+  }
+  EXPECT_TRUE(dict.hasKeyWithPrefix("new49"));
+  EXPECT_TRUE(dict.hasKeyWithPrefix("key99"));
+  EXPECT_FALSE(dict.hasKeyWithPrefix("new501"));
+}
+
 }  // namespace McBopomofo
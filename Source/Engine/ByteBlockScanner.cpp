@@ -0,0 +1,390 @@
+// Copyright (c) 2025 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ByteBlockScanner.h"
+
+#include <cstdint>
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BYTE_BLOCK_SCANNER_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace McBopomofo {
+
+namespace {
+
+const char* AdvanceToNextCRLF(const char* ptr, const char* end) {
+  while (ptr != end) {
+    if (const char c = *ptr; c == '\r' || c == '\n') {
+      break;
+    }
+    ++ptr;
+  }
+  return ptr;
+}
+
+const char* AdvanceToNextNonContentCharacter(const char* ptr, const char* end) {
+  while (ptr != end) {
+    if (const char c = *ptr; c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+      break;
+    }
+    ++ptr;
+  }
+  return ptr;
+}
+
+size_t CountLineFeeds(const char* ptr, const char* end) {
+  size_t count = 0;
+  while (ptr != end) {
+    if (*ptr == '\n') {
+      ++count;
+    }
+    ++ptr;
+  }
+  return count;
+}
+
+const char* FindFirstNULL(const char* ptr, const char* end,
+                          size_t* firstLineNumber) {
+  const char* i = ptr;
+  while (i != end) {
+    if (*i == 0) {
+      break;
+    }
+    ++i;
+  }
+
+  // Only count the line number if there is indeed a NULL.
+  if (i != end && firstLineNumber != nullptr) {
+    *firstLineNumber = CountLineFeeds(ptr, i) + 1;
+  }
+  return i;
+}
+
+#ifdef BYTE_BLOCK_SCANNER_X86_SIMD
+
+// Each SIMD scanner processes the text in blocks with unaligned loads, and
+// leaves the tail shorter than a block to the scalar scanner.
+
+// Returns the offset of the first '\r' or '\n' in the 16 bytes at ptr, or
+// 16 if there is none.
+__attribute__((target("sse2"))) inline int SSE2_FindCRLFInBlock(
+    const char* ptr) {
+  const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+  const int mask = _mm_movemask_epi8(
+      _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')),
+                   _mm_cmpeq_epi8(block, _mm_set1_epi8('\r'))));
+  return mask != 0 ? __builtin_ctz(mask) : 16;
+}
+
+// Returns the offset of the first ' ', '\t', '\r', or '\n' in the 16 bytes
+// at ptr, or 16 if there is none.
+__attribute__((target("sse2"))) inline int
+SSE2_FindNonContentCharacterInBlock(const char* ptr) {
+  const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+  const __m128i whitespaces =
+      _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')),
+                   _mm_cmpeq_epi8(block, _mm_set1_epi8('\t')));
+  const __m128i crlfs =
+      _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')),
+                   _mm_cmpeq_epi8(block, _mm_set1_epi8('\r')));
+  const int mask = _mm_movemask_epi8(_mm_or_si128(whitespaces, crlfs));
+  return mask != 0 ? __builtin_ctz(mask) : 16;
+}
+
+__attribute__((target("sse2"))) const char* SSE2_AdvanceToNextCRLF(
+    const char* ptr, const char* end) {
+  while (end - ptr >= 16) {
+    if (int offset = SSE2_FindCRLFInBlock(ptr); offset != 16) {
+      return ptr + offset;
+    }
+    ptr += 16;
+  }
+  return AdvanceToNextCRLF(ptr, end);
+}
+
+__attribute__((target("sse2"))) const char*
+SSE2_AdvanceToNextNonContentCharacter(const char* ptr, const char* end) {
+  while (end - ptr >= 16) {
+    if (int offset = SSE2_FindNonContentCharacterInBlock(ptr); offset != 16) {
+      return ptr + offset;
+    }
+    ptr += 16;
+  }
+  return AdvanceToNextNonContentCharacter(ptr, end);
+}
+
+__attribute__((target("sse2"))) size_t SSE2_CountLineFeeds(const char* ptr,
+                                                           const char* end) {
+  const __m128i lfs = _mm_set1_epi8('\n');
+  size_t count = 0;
+  while (end - ptr >= 16) {
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, lfs)));
+    ptr += 16;
+  }
+  return count + CountLineFeeds(ptr, end);
+}
+
+__attribute__((target("sse2"))) const char* SSE2_FindFirstNULL(
+    const char* ptr, const char* end, size_t* firstLineNumber) {
+  const __m128i zeros = _mm_setzero_si128();
+  const char* i = ptr;
+  while (end - i >= 16) {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(i));
+    const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, zeros));
+    if (mask != 0) {
+      i += __builtin_ctz(mask);
+      break;
+    }
+    i += 16;
+  }
+  while (i != end && *i != 0) {
+    ++i;
+  }
+
+  if (i != end && firstLineNumber != nullptr) {
+    *firstLineNumber = SSE2_CountLineFeeds(ptr, i) + 1;
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) const char* AVX2_AdvanceToNextCRLF(
+    const char* ptr, const char* end) {
+  // Most lines are short, so check the first 16 bytes before using the wider
+  // blocks.
+  if (end - ptr >= 16) {
+    if (int offset = SSE2_FindCRLFInBlock(ptr); offset != 16) {
+      return ptr + offset;
+    }
+    ptr += 16;
+  }
+
+  const __m256i lfs = _mm256_set1_epi8('\n');
+  const __m256i crs = _mm256_set1_epi8('\r');
+  while (end - ptr >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+    const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_or_si256(_mm256_cmpeq_epi8(block, lfs),
+                        _mm256_cmpeq_epi8(block, crs))));
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
+    }
+    ptr += 32;
+  }
+  return SSE2_AdvanceToNextCRLF(ptr, end);
+}
+
+__attribute__((target("avx2"))) const char*
+AVX2_AdvanceToNextNonContentCharacter(const char* ptr, const char* end) {
+  // Most columns are short, so check the first 16 bytes before using the
+  // wider blocks.
+  if (end - ptr >= 16) {
+    if (int offset = SSE2_FindNonContentCharacterInBlock(ptr); offset != 16) {
+      return ptr + offset;
+    }
+    ptr += 16;
+  }
+
+  const __m256i spaces = _mm256_set1_epi8(' ');
+  const __m256i tabs = _mm256_set1_epi8('\t');
+  const __m256i lfs = _mm256_set1_epi8('\n');
+  const __m256i crs = _mm256_set1_epi8('\r');
+  while (end - ptr >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+    const __m256i whitespaces = _mm256_or_si256(
+        _mm256_cmpeq_epi8(block, spaces), _mm256_cmpeq_epi8(block, tabs));
+    const __m256i crlfs = _mm256_or_si256(_mm256_cmpeq_epi8(block, lfs),
+                                          _mm256_cmpeq_epi8(block, crs));
+    const auto mask = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_or_si256(whitespaces, crlfs)));
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
+    }
+    ptr += 32;
+  }
+  return SSE2_AdvanceToNextNonContentCharacter(ptr, end);
+}
+
+__attribute__((target("avx2"))) size_t AVX2_CountLineFeeds(const char* ptr,
+                                                           const char* end) {
+  const __m256i lfs = _mm256_set1_epi8('\n');
+  size_t count = 0;
+  while (end - ptr >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+    count += __builtin_popcount(static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, lfs))));
+    ptr += 32;
+  }
+  return count + SSE2_CountLineFeeds(ptr, end);
+}
+
+__attribute__((target("avx2"))) const char* AVX2_FindFirstNULL(
+    const char* ptr, const char* end, size_t* firstLineNumber) {
+  const __m256i zeros = _mm256_setzero_si256();
+  const char* i = ptr;
+  while (end - i >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(i));
+    const auto mask = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zeros)));
+    if (mask != 0) {
+      i += __builtin_ctz(mask);
+      break;
+    }
+    i += 32;
+  }
+  while (i != end && *i != 0) {
+    ++i;
+  }
+
+  if (i != end && firstLineNumber != nullptr) {
+    *firstLineNumber = AVX2_CountLineFeeds(ptr, i) + 1;
+  }
+  return i;
+}
+
+__attribute__((target("avx512f,avx512bw"))) size_t AVX512_CountLineFeeds(
+    const char* ptr, const char* end) {
+  const __m512i lfs = _mm512_set1_epi8('\n');
+  size_t count = 0;
+  while (end - ptr >= 64) {
+    const __m512i block = _mm512_loadu_si512(ptr);
+    count += __builtin_popcountll(_mm512_cmpeq_epi8_mask(block, lfs));
+    ptr += 64;
+  }
+  return count + AVX2_CountLineFeeds(ptr, end);
+}
+
+__attribute__((target("avx512f,avx512bw"))) const char* AVX512_FindFirstNULL(
+    const char* ptr, const char* end, size_t* firstLineNumber) {
+  const __m512i zeros = _mm512_setzero_si512();
+  const char* i = ptr;
+  while (end - i >= 64) {
+    const __m512i block = _mm512_loadu_si512(i);
+    const __mmask64 mask = _mm512_cmpeq_epi8_mask(block, zeros);
+    if (mask != 0) {
+      i += __builtin_ctzll(mask);
+      break;
+    }
+    i += 64;
+  }
+  while (i != end && *i != 0) {
+    ++i;
+  }
+
+  if (i != end && firstLineNumber != nullptr) {
+    *firstLineNumber = AVX512_CountLineFeeds(ptr, i) + 1;
+  }
+  return i;
+}
+
+bool CPUSupports(ByteBlockScanner::Level level) {
+  __builtin_cpu_init();
+  switch (level) {
+    case ByteBlockScanner::Level::SCALAR:
+      return true;
+    case ByteBlockScanner::Level::SSE2:
+      return __builtin_cpu_supports("sse2");
+    case ByteBlockScanner::Level::AVX2:
+      return __builtin_cpu_supports("avx2");
+    case ByteBlockScanner::Level::AVX512:
+      return __builtin_cpu_supports("avx512f") &&
+             __builtin_cpu_supports("avx512bw");
+  }
+  return false;
+}
+
+#else
+
+bool CPUSupports(ByteBlockScanner::Level level) {
+  return level == ByteBlockScanner::Level::SCALAR;
+}
+
+#endif  // BYTE_BLOCK_SCANNER_X86_SIMD
+
+}  // namespace
+
+const ByteBlockScanner* ByteBlockScanner::forLevel(Level level) {
+  static constexpr ByteBlockScanner kScalar(Level::SCALAR, "scalar",
+                                            AdvanceToNextCRLF,
+                                            AdvanceToNextNonContentCharacter,
+                                            FindFirstNULL);
+#ifdef BYTE_BLOCK_SCANNER_X86_SIMD
+  static constexpr ByteBlockScanner kSSE2(Level::SSE2, "sse2",
+                                          SSE2_AdvanceToNextCRLF,
+                                          SSE2_AdvanceToNextNonContentCharacter,
+                                          SSE2_FindFirstNULL);
+  static constexpr ByteBlockScanner kAVX2(Level::AVX2, "avx2",
+                                          AVX2_AdvanceToNextCRLF,
+                                          AVX2_AdvanceToNextNonContentCharacter,
+                                          AVX2_FindFirstNULL);
+  // The columns and lines that the parser advances over are short, and the
+  // 64-byte blocks are slower than the 32-byte ones for them. AVX-512 is only
+  // used for the scans over the whole text.
+  static constexpr ByteBlockScanner kAVX512(
+      Level::AVX512, "avx512", AVX2_AdvanceToNextCRLF,
+      AVX2_AdvanceToNextNonContentCharacter, AVX512_FindFirstNULL);
+#endif
+
+  if (!CPUSupports(level)) {
+    return nullptr;
+  }
+
+  switch (level) {
+    case Level::SCALAR:
+      return &kScalar;
+#ifdef BYTE_BLOCK_SCANNER_X86_SIMD
+    case Level::SSE2:
+      return &kSSE2;
+    case Level::AVX2:
+      return &kAVX2;
+    case Level::AVX512:
+      return &kAVX512;
+#else
+    default:
+      return nullptr;
+#endif
+  }
+  return nullptr;
+}
+
+const ByteBlockScanner& ByteBlockScanner::best() {
+  static const ByteBlockScanner* scanner = []() {
+    for (Level level : {Level::AVX512, Level::AVX2, Level::SSE2}) {
+      if (const ByteBlockScanner* s = forLevel(level); s != nullptr) {
+        return s;
+      }
+    }
+    return forLevel(Level::SCALAR);
+  }();
+  return *scanner;
+}
+
+}  // namespace McBopomofo
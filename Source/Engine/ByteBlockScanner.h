@@ -0,0 +1,98 @@
+// Copyright (c) 2025 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_ENGINE_BYTEBLOCKSCANNER_H_
+#define SRC_ENGINE_BYTEBLOCKSCANNER_H_
+
+#include <cstddef>
+
+namespace McBopomofo {
+
+// Scanners that find the special characters in a block of text for
+// ByteBlockBackedDictionary. There is a scalar implementation and, on x86,
+// SSE2, AVX2, and AVX-512 implementations, all of which return the same
+// results. The best one that the CPU supports is picked at runtime. Other
+// architectures use the scalar implementation.
+class ByteBlockScanner {
+ public:
+  enum class Level {
+    SCALAR,
+    SSE2,
+    AVX2,
+    AVX512,
+  };
+
+  // Returns the scanner of the best level supported by the CPU.
+  static const ByteBlockScanner& best();
+
+  // Returns the scanner of the level, or nullptr if the level is not supported
+  // by the build or the CPU.
+  static const ByteBlockScanner* forLevel(Level level);
+
+  [[nodiscard]] Level level() const { return level_; }
+  [[nodiscard]] const char* name() const { return name_; }
+
+  // Returns the first '\r' or '\n' in [ptr, end), or end if there is none.
+  const char* advanceToNextCRLF(const char* ptr, const char* end) const {
+    return advanceToNextCRLF_(ptr, end);
+  }
+
+  // Returns the first ' ', '\t', '\r', or '\n' in [ptr, end), or end if there
+  // is none.
+  const char* advanceToNextNonContentCharacter(const char* ptr,
+                                               const char* end) const {
+    return advanceToNextNonContentCharacter_(ptr, end);
+  }
+
+  // Returns the first NUL in [ptr, end), or end if there is none. If a NUL is
+  // found and firstLineNumber is not nullptr, the 1-based line number of the
+  // NUL is stored in it.
+  const char* findFirstNULL(const char* ptr, const char* end,
+                            size_t* firstLineNumber = nullptr) const {
+    return findFirstNULL_(ptr, end, firstLineNumber);
+  }
+
+ private:
+  using AdvanceFunction = const char* (*)(const char*, const char*);
+  using FindFunction = const char* (*)(const char*, const char*, size_t*);
+
+  constexpr ByteBlockScanner(Level level, const char* name,
+                             AdvanceFunction advanceToNextCRLF,
+                             AdvanceFunction advanceToNextNonContentCharacter,
+                             FindFunction findFirstNULL)
+      : level_(level),
+        name_(name),
+        advanceToNextCRLF_(advanceToNextCRLF),
+        advanceToNextNonContentCharacter_(advanceToNextNonContentCharacter),
+        findFirstNULL_(findFirstNULL) {}
+
+  Level level_;
+  const char* name_;
+  AdvanceFunction advanceToNextCRLF_;
+  AdvanceFunction advanceToNextNonContentCharacter_;
+  FindFunction findFirstNULL_;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_ENGINE_BYTEBLOCKSCANNER_H_
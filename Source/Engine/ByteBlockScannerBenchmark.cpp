@@ -0,0 +1,154 @@
+// Copyright (c) 2025 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <sstream>
+#include <string>
+
+#include "ByteBlockScanner.h"
+
+namespace {
+
+// About 1 MB of text shaped like a phrase file.
+const std::string& GetTestData() {
+  static const std::string data = []() {
+    std::stringstream sst;
+    for (int i = 0; sst.tellp() < (1 << 20); ++i) {
+      sst << "phrase_" << i << " ㄅㄆㄇㄈ-ㄉㄊㄋㄌ-" << i % 1000
+          << " -5.5\n";
+    }
+    return sst.str();
+  }();
+  return data;
+}
+
+const McBopomofo::ByteBlockScanner* GetScanner(benchmark::State& state) {
+  const auto* scanner = McBopomofo::ByteBlockScanner::forLevel(
+      static_cast<McBopomofo::ByteBlockScanner::Level>(state.range(0)));
+  if (scanner == nullptr) {
+    state.SkipWithError("Not supported by the CPU");
+  } else {
+    state.SetLabel(scanner->name());
+  }
+  return scanner;
+}
+
+void AddLevels(benchmark::internal::Benchmark* b) {
+  for (auto level : {McBopomofo::ByteBlockScanner::Level::SCALAR,
+                     McBopomofo::ByteBlockScanner::Level::SSE2,
+                     McBopomofo::ByteBlockScanner::Level::AVX2,
+                     McBopomofo::ByteBlockScanner::Level::AVX512}) {
+    b->Arg(static_cast<int>(level));
+  }
+}
+
+// Advances from one line break to the next, like the parser skipping a line.
+void BM_ByteBlockScannerAdvanceToNextCRLF(benchmark::State& state) {
+  const auto* scanner = GetScanner(state);
+  if (scanner == nullptr) {
+    return;
+  }
+  const std::string& testData = GetTestData();
+  const char* end = testData.data() + testData.size();
+
+  for (auto _ : state) {
+    const char* ptr = testData.data();
+    while (ptr != end) {
+      ptr = scanner->advanceToNextCRLF(ptr, end);
+      if (ptr != end) {
+        ++ptr;
+      }
+    }
+    benchmark::DoNotOptimize(ptr);
+  }
+  state.SetBytesProcessed(state.iterations() * testData.size());
+}
+BENCHMARK(BM_ByteBlockScannerAdvanceToNextCRLF)->Apply(AddLevels);
+
+// Advances from one column to the next, like the parser finding the columns.
+void BM_ByteBlockScannerAdvanceToNextNonContentCharacter(
+    benchmark::State& state) {
+  const auto* scanner = GetScanner(state);
+  if (scanner == nullptr) {
+    return;
+  }
+  const std::string& testData = GetTestData();
+  const char* end = testData.data() + testData.size();
+
+  for (auto _ : state) {
+    const char* ptr = testData.data();
+    while (ptr != end) {
+      ptr = scanner->advanceToNextNonContentCharacter(ptr, end);
+      if (ptr != end) {
+        ++ptr;
+      }
+    }
+    benchmark::DoNotOptimize(ptr);
+  }
+  state.SetBytesProcessed(state.iterations() * testData.size());
+}
+BENCHMARK(BM_ByteBlockScannerAdvanceToNextNonContentCharacter)
+    ->Apply(AddLevels);
+
+// Scans the whole text, which is what happens for every valid file.
+void BM_ByteBlockScannerFindFirstNULL(benchmark::State& state) {
+  const auto* scanner = GetScanner(state);
+  if (scanner == nullptr) {
+    return;
+  }
+  const std::string& testData = GetTestData();
+  const char* end = testData.data() + testData.size();
+
+  for (auto _ : state) {
+    size_t line = 0;
+    benchmark::DoNotOptimize(
+        scanner->findFirstNULL(testData.data(), end, &line));
+  }
+  state.SetBytesProcessed(state.iterations() * testData.size());
+}
+BENCHMARK(BM_ByteBlockScannerFindFirstNULL)->Apply(AddLevels);
+
+// Finds a NUL at the end of the text and counts the lines before it.
+void BM_ByteBlockScannerFindFirstNULLWithLineNumber(benchmark::State& state) {
+  const auto* scanner = GetScanner(state);
+  if (scanner == nullptr) {
+    return;
+  }
+  std::string testData = GetTestData();
+  testData.back() = '\0';
+  const char* end = testData.data() + testData.size();
+
+  for (auto _ : state) {
+    size_t line = 0;
+    benchmark::DoNotOptimize(
+        scanner->findFirstNULL(testData.data(), end, &line));
+    benchmark::DoNotOptimize(line);
+  }
+  state.SetBytesProcessed(state.iterations() * testData.size());
+}
+BENCHMARK(BM_ByteBlockScannerFindFirstNULLWithLineNumber)->Apply(AddLevels);
+
+};  // namespace
+
+BENCHMARK_MAIN();
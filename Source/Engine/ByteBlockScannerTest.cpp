@@ -0,0 +1,154 @@
+// Copyright (c) 2025 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "ByteBlockScanner.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+namespace {
+
+std::vector<const ByteBlockScanner*> SupportedScanners() {
+  std::vector<const ByteBlockScanner*> scanners;
+  for (auto level :
+       {ByteBlockScanner::Level::SCALAR, ByteBlockScanner::Level::SSE2,
+        ByteBlockScanner::Level::AVX2, ByteBlockScanner::Level::AVX512}) {
+    if (const auto* scanner = ByteBlockScanner::forLevel(level);
+        scanner != nullptr) {
+      scanners.push_back(scanner);
+    }
+  }
+  return scanners;
+}
+
+// Returns a random text of the length. Each character is a special
+// character with the probability of 1 / sparsity.
+std::string RandomText(std::mt19937& rng, size_t length, int sparsity) {
+  constexpr char kSpecialCharacters[] = {' ', '\t', '\r', '\n', '\0'};
+  std::uniform_int_distribution<int> special(0, sparsity - 1);
+  std::uniform_int_distribution<int> specialIndex(
+      0, sizeof(kSpecialCharacters) - 1);
+  std::uniform_int_distribution<int> content(0x21, 0xff);
+
+  std::string text(length, 'a');
+  for (auto& c : text) {
+    c = special(rng) == 0 ? kSpecialCharacters[specialIndex(rng)]
+                          : static_cast<char>(content(rng));
+  }
+  return text;
+}
+
+}  // namespace
+
+TEST(ByteBlockScannerTest, ScalarAndBestAreAlwaysSupported) {
+  const auto* scalar =
+      ByteBlockScanner::forLevel(ByteBlockScanner::Level::SCALAR);
+  ASSERT_NE(scalar, nullptr);
+  EXPECT_EQ(scalar->level(), ByteBlockScanner::Level::SCALAR);
+
+  const auto& best = ByteBlockScanner::best();
+  EXPECT_EQ(ByteBlockScanner::forLevel(best.level()), &best);
+  EXPECT_GE(best.level(), ByteBlockScanner::Level::SCALAR);
+}
+
+TEST(ByteBlockScannerTest, SimpleScans) {
+  constexpr char text[] = "key value\r\nkey2\tvalue2\n\0tail";
+  const char* end = text + sizeof(text) - 1;
+
+  for (const auto* scanner : SupportedScanners()) {
+    SCOPED_TRACE(scanner->name());
+    EXPECT_EQ(scanner->advanceToNextCRLF(text, end), text + 9);
+    EXPECT_EQ(scanner->advanceToNextNonContentCharacter(text, end), text + 3);
+    EXPECT_EQ(scanner->advanceToNextNonContentCharacter(text + 11, end),
+              text + 15);
+
+    size_t line = 0;
+    EXPECT_EQ(scanner->findFirstNULL(text, end, &line), text + 23);
+    EXPECT_EQ(line, 3);
+
+    line = 0;
+    EXPECT_EQ(scanner->findFirstNULL(text, text + 23, &line), text + 23);
+    EXPECT_EQ(line, 0);  // Not set if there is no NUL.
+    EXPECT_EQ(scanner->advanceToNextCRLF(end, end), end);
+  }
+}
+
+TEST(ByteBlockScannerTest, AllScannersMatchScalarOnRandomInputs) {
+  const auto* scalar =
+      ByteBlockScanner::forLevel(ByteBlockScanner::Level::SCALAR);
+  std::mt19937 rng(20251016);
+  std::uniform_int_distribution<size_t> lengths(0, 300);
+
+  for (int round = 0; round < 2000; ++round) {
+    // From dense to very sparse special characters, to cover both the block
+    // loops and the scalar tails.
+    int sparsity = 1 << (round % 10);
+    std::string text = RandomText(rng, lengths(rng), sparsity);
+    const char* begin = text.data();
+    const char* end = begin + text.size();
+
+    for (const auto* scanner : SupportedScanners()) {
+      SCOPED_TRACE(scanner->name());
+      // Scan from every offset, like the parser does, so that unaligned
+      // starts are covered.
+      for (const char* ptr = begin; ptr <= end; ++ptr) {
+        ASSERT_EQ(scanner->advanceToNextCRLF(ptr, end),
+                  scalar->advanceToNextCRLF(ptr, end));
+        ASSERT_EQ(scanner->advanceToNextNonContentCharacter(ptr, end),
+                  scalar->advanceToNextNonContentCharacter(ptr, end));
+      }
+
+      size_t line = 0;
+      size_t expectedLine = 0;
+      ASSERT_EQ(scanner->findFirstNULL(begin, end, &line),
+                scalar->findFirstNULL(begin, end, &expectedLine));
+      ASSERT_EQ(line, expectedLine);
+    }
+  }
+}
+
+TEST(ByteBlockScannerTest, FindFirstNULLCountsLinesInLargeText) {
+  std::string text;
+  for (int i = 0; i < 1000; ++i) {
+    text += "a line with some text\n";
+  }
+  text += "the NUL is here: ";
+  text.push_back('\0');
+  text += "\nmore text";
+
+  for (const auto* scanner : SupportedScanners()) {
+    SCOPED_TRACE(scanner->name());
+    size_t line = 0;
+    const char* found =
+        scanner->findFirstNULL(text.data(), text.data() + text.size(), &line);
+    EXPECT_EQ(found - text.data(), 1000 * 22 + 17);
+    EXPECT_EQ(line, 1001);
+  }
+}
+
+}  // namespace McBopomofo
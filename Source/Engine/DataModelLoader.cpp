@@ -0,0 +1,183 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "DataModelLoader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include "MemoryMappedFile.h"
+
+namespace McBopomofo {
+
+using Clock = std::chrono::steady_clock;
+
+static std::chrono::microseconds Since(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() -
+                                                               start);
+}
+
+// Reads the file into the page cache, where the mapping that the model makes
+// of it later finds it.
+static void Prefault(const std::string& path) {
+  MemoryMappedFile::Options options;
+  options.populate = true;
+  MemoryMappedFile file;
+  file.open(path.c_str(), options);
+}
+
+DataModelLoader::DataModelLoader() : DataModelLoader(Options()) {}
+
+DataModelLoader::DataModelLoader(Options options)
+    : options_(std::move(options)) {}
+
+void DataModelLoader::addLanguageModel(std::string name, McBopomofoLM* lm,
+                                       std::string path) {
+  McBopomofoLM::ReloadRequest request;
+  request.languageModelPath = path;
+  components_.push_back({std::move(name),
+                         {std::move(path)},
+                         [lm, request] { return lm->reload(request); }});
+}
+
+void DataModelLoader::addAssociatedPhrases(std::string name,
+                                           McBopomofoLM* lm,
+                                           std::string path) {
+  McBopomofoLM::ReloadRequest request;
+  request.associatedPhrasesPath = path;
+  components_.push_back({std::move(name),
+                         {std::move(path)},
+                         [lm, request] { return lm->reload(request); }});
+}
+
+void DataModelLoader::addUserPhrases(std::string name, McBopomofoLM* lm,
+                                     std::string userPhrasesPath,
+                                     std::string excludedPhrasesPath) {
+  McBopomofoLM::ReloadRequest request;
+  std::vector<std::string> paths;
+  if (!userPhrasesPath.empty()) {
+    request.userPhrasesPath = userPhrasesPath;
+    paths.push_back(std::move(userPhrasesPath));
+  }
+  if (!excludedPhrasesPath.empty()) {
+    request.excludedPhrasesPath = excludedPhrasesPath;
+    paths.push_back(std::move(excludedPhrasesPath));
+  }
+  components_.push_back({std::move(name), std::move(paths),
+                         [lm, request] { return lm->reload(request); }});
+}
+
+void DataModelLoader::addPhraseReplacementMap(std::string name,
+                                              McBopomofoLM* lm,
+                                              std::string path) {
+  McBopomofoLM::ReloadRequest request;
+  request.phraseReplacementPath = path;
+  components_.push_back({std::move(name),
+                         {std::move(path)},
+                         [lm, request] { return lm->reload(request); }});
+}
+
+void DataModelLoader::addVariantAnnotator(std::string name,
+                                          VariantAnnotator* annotator,
+                                          std::string puaPath,
+                                          std::string variantsPath) {
+  // The two databases are kept apart in the annotator, and so they can be
+  // loaded at the same time.
+  components_.push_back({name + " PUA",
+                         {puaPath},
+                         [annotator, puaPath] {
+                           return annotator->loadPUAFile(puaPath);
+                         }});
+  components_.push_back({name + " variants",
+                         {variantsPath},
+                         [annotator, variantsPath] {
+                           return annotator->loadVariantsFile(variantsPath);
+                         }});
+}
+
+DataModelLoader::ComponentStats DataModelLoader::LoadComponent(
+    const Component& component, bool prefault) {
+  ComponentStats stats;
+  stats.name = component.name;
+  for (const auto& path : component.paths) {
+    std::error_code error;
+    auto size = std::filesystem::file_size(path, error);
+    if (!error) {
+      stats.bytes += static_cast<size_t>(size);
+    }
+  }
+
+  if (prefault) {
+    auto start = Clock::now();
+    for (const auto& path : component.paths) {
+      Prefault(path);
+    }
+    stats.prefaultTime = Since(start);
+  }
+
+  auto start = Clock::now();
+  stats.loaded = component.load();
+  stats.loadTime = Since(start);
+  return stats;
+}
+
+DataModelLoader::Stats DataModelLoader::load() {
+  auto start = Clock::now();
+  Stats stats;
+  stats.components.resize(components_.size());
+
+  // The threads take the components in the order they were added, so the
+  // ones added first, which the caller needs first, are ready first.
+  std::atomic<size_t> next = 0;
+  auto work = [this, &stats, &next] {
+    for (size_t i = next++; i < components_.size(); i = next++) {
+      stats.components[i] = LoadComponent(components_[i], options_.prefault);
+    }
+  };
+
+  size_t threadCount =
+      std::min(std::max<size_t>(options_.threadCount, 1), components_.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  components_.clear();
+  stats.totalTime = Since(start);
+  return stats;
+}
+
+bool DataModelLoader::Stats::allLoaded() const {
+  return std::all_of(components.begin(), components.end(),
+                     [](const ComponentStats& c) { return c.loaded; });
+}
+
+}  // namespace McBopomofo
@@ -0,0 +1,123 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_ENGINE_DATAMODELLOADER_H_
+#define SRC_ENGINE_DATAMODELLOADER_H_
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "McBopomofoLM.h"
+#include "VariantAnnotator.h"
+
+namespace McBopomofo {
+
+// Loads the data models that the input method needs at startup, such as the
+// language models of the input modes, the associated phrases, the variant
+// annotator databases, and the user files, on a few threads at once. Each
+// model is opened and validated on its own, and the models that go into the
+// same McBopomofoLM are published into it one by one, without waiting for
+// each other to load. load() returns once all of them are ready, with the
+// time each one took.
+//
+// The models are loaded into the objects given, which must outlive the call
+// to load(), and must not be loaded into by others meanwhile.
+class DataModelLoader {
+ public:
+  static constexpr size_t kDefaultThreadCount = 4;
+
+  struct Options {
+    // The number of threads loading the models, including the calling one.
+    size_t threadCount = kDefaultThreadCount;
+
+    // Reads each file through before opening it, so that its pages are in
+    // memory by the time the model is used, and the first lookups do not
+    // wait for the disk.
+    bool prefault = false;
+  };
+
+  DataModelLoader();
+  explicit DataModelLoader(Options options);
+
+  void addLanguageModel(std::string name, McBopomofoLM* lm, std::string path);
+  void addAssociatedPhrases(std::string name, McBopomofoLM* lm,
+                            std::string path);
+
+  // Either path may be empty, in which case that file is not loaded.
+  void addUserPhrases(std::string name, McBopomofoLM* lm,
+                      std::string userPhrasesPath,
+                      std::string excludedPhrasesPath);
+  void addPhraseReplacementMap(std::string name, McBopomofoLM* lm,
+                               std::string path);
+
+  // Loads both databases of the annotator, as two components.
+  void addVariantAnnotator(std::string name, VariantAnnotator* annotator,
+                           std::string puaPath, std::string variantsPath);
+
+  struct ComponentStats {
+    std::string name;
+    bool loaded = false;
+
+    // The total size of the files of the component.
+    size_t bytes = 0;
+
+    std::chrono::microseconds prefaultTime{0};
+    std::chrono::microseconds loadTime{0};
+  };
+
+  struct Stats {
+    // In the order the components were added.
+    std::vector<ComponentStats> components;
+
+    // The wall-clock time of the whole load.
+    std::chrono::microseconds totalTime{0};
+
+    [[nodiscard]] bool allLoaded() const;
+  };
+
+  // Loads the components added so far, and returns once all of them are
+  // ready. The components are then cleared, so that the loader can be reused.
+  Stats load();
+
+ private:
+  struct Component {
+    std::string name;
+    std::vector<std::string> paths;
+
+    // Returns false if the component cannot be loaded or is not valid.
+    std::function<bool()> load;
+  };
+
+  static ComponentStats LoadComponent(const Component& component,
+                                      bool prefault);
+
+  Options options_;
+  std::vector<Component> components_;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_ENGINE_DATAMODELLOADER_H_
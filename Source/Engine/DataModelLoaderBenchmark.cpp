@@ -0,0 +1,168 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "DataModelLoader.h"
+#include "ParselessPhraseDB.h"
+
+namespace {
+
+using McBopomofo::DataModelLoader;
+using McBopomofo::McBopomofoLM;
+using McBopomofo::VariantAnnotator;
+
+// Roughly the shape of the shipped data: two large language models, the
+// associated phrases, the variant annotator databases, and user files in the
+// thousands of lines.
+constexpr int kReadings = 40000;
+constexpr int kValuesPerReading = 4;
+constexpr int kAssociatedPhrases = 100000;
+constexpr int kVariants = 20000;
+constexpr int kUserPhrases = 5000;
+
+std::filesystem::path DataDirectory() {
+  return std::filesystem::temp_directory_path() /
+         "org.openvanilla.mcbopomofo.datamodelloaderbenchmark";
+}
+
+std::string DataPath(const std::string& name) {
+  return (DataDirectory() / name).string();
+}
+
+void WriteDataFiles() {
+  static bool written = false;
+  if (written) {
+    return;
+  }
+  written = true;
+  std::filesystem::create_directories(DataDirectory());
+
+  for (const char* name : {"data.txt", "data-plain-bpmf.txt"}) {
+    std::ofstream lm(DataPath(name), std::ios::binary);
+    lm << McBopomofo::SORTED_PRAGMA_HEADER;
+    for (int r = 0; r < kReadings; ++r) {
+      for (int v = 0; v < kValuesPerReading; ++v) {
+        lm << "r" << (100000 + r) << " v" << r << "_" << v << " " << -2.0 - v
+           << "\n";
+      }
+    }
+  }
+
+  std::ofstream ap(DataPath("associated-phrases-v2.txt"), std::ios::binary);
+  ap << McBopomofo::SORTED_PRAGMA_HEADER;
+  for (int i = 0; i < kAssociatedPhrases; ++i) {
+    ap << "v" << (100000 + i) << "-r" << i << "-w" << i << "-s" << i << " "
+       << -5.0 << "\n";
+  }
+
+  std::ofstream pua(DataPath("bpmfvs-pua.txt"), std::ios::binary);
+  std::ofstream variants(DataPath("bpmfvs-variants.txt"), std::ios::binary);
+  pua << McBopomofo::SORTED_PRAGMA_HEADER;
+  variants << McBopomofo::SORTED_PRAGMA_HEADER;
+  for (int i = 0; i < kVariants; ++i) {
+    pua << "r" << (100000 + i) << " p" << i << "\n";
+    variants << "v" << (100000 + i) << "-r" << i << " v" << i << "x\n";
+  }
+
+  std::ofstream up(DataPath("data.user.txt"), std::ios::binary);
+  std::ofstream ep(DataPath("exclude-phrases.txt"), std::ios::binary);
+  std::ofstream rm(DataPath("phrases-replacement.txt"), std::ios::binary);
+  for (int i = 0; i < kUserPhrases; ++i) {
+    up << "u" << i << " r" << (100000 + i * 7 % kReadings) << "\n";
+    ep << "v" << i << "_0 r" << (100000 + i) << "\n";
+    rm << "v" << i << "_1 w" << i << "\n";
+  }
+}
+
+// Loads everything that loadDataModels and the user file loading in
+// LanguageModelManager do, with the thread count and prefaulting given by the
+// arguments. The per-component times are averaged over the iterations.
+void BM_DataModelLoaderLoad(benchmark::State& state) {
+  WriteDataFiles();
+  DataModelLoader::Options options;
+  options.threadCount = static_cast<size_t>(state.range(0));
+  options.prefault = state.range(1) != 0;
+
+  DataModelLoader::Stats total;
+  for (auto _ : state) {
+    McBopomofoLM lm;
+    McBopomofoLM plainLM;
+    VariantAnnotator annotator;
+    DataModelLoader loader(options);
+    loader.addLanguageModel("data", &lm, DataPath("data.txt"));
+    loader.addAssociatedPhrases("associated", &lm,
+                                DataPath("associated-phrases-v2.txt"));
+    loader.addLanguageModel("plain", &plainLM,
+                            DataPath("data-plain-bpmf.txt"));
+    loader.addAssociatedPhrases("plainAssociated", &plainLM,
+                                DataPath("associated-phrases-v2.txt"));
+    loader.addVariantAnnotator("bpmfvs", &annotator,
+                               DataPath("bpmfvs-pua.txt"),
+                               DataPath("bpmfvs-variants.txt"));
+    loader.addUserPhrases("user", &lm, DataPath("data.user.txt"),
+                          DataPath("exclude-phrases.txt"));
+    loader.addPhraseReplacementMap("replacement", &lm,
+                                   DataPath("phrases-replacement.txt"));
+    auto stats = loader.load();
+    if (!stats.allLoaded()) {
+      state.SkipWithError("Cannot load the data models");
+      break;
+    }
+
+    if (total.components.empty()) {
+      total = stats;
+    } else {
+      for (size_t i = 0; i < stats.components.size(); ++i) {
+        total.components[i].prefaultTime += stats.components[i].prefaultTime;
+        total.components[i].loadTime += stats.components[i].loadTime;
+      }
+      total.totalTime += stats.totalTime;
+    }
+  }
+
+  for (const auto& component : total.components) {
+    state.counters[component.name + "_us"] = benchmark::Counter(
+        static_cast<double>(
+            (component.prefaultTime + component.loadTime).count()),
+        benchmark::Counter::kAvgIterations);
+  }
+  state.counters["total_us"] =
+      benchmark::Counter(static_cast<double>(total.totalTime.count()),
+                         benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_DataModelLoaderLoad)
+    ->ArgNames({"threads", "prefault"})
+    ->Args({1, 0})
+    ->Args({4, 0})
+    ->Args({1, 1})
+    ->Args({4, 1})
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
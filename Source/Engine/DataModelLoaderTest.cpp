@@ -0,0 +1,189 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "DataModelLoader.h"
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+namespace {
+
+constexpr std::string_view kLanguageModelData =
+    "# format org.openvanilla.mcbopomofo.sorted\n"
+    "ㄇㄧㄥˊ 明 -3.07936356\n"
+    "ㄇㄧㄥˊ 名 -3.12166252\n"
+    "ㄉㄨㄥˋ 動 -2.83459585\n"
+    "ㄉㄨㄥˋ-ㄗㄨㄛˋ 動作 -4.17449149\n";
+
+constexpr std::string_view kPlainLanguageModelData =
+    "# format org.openvanilla.mcbopomofo.sorted\n"
+    "ㄇㄧㄥˊ 名 -3.12166252\n"
+    "ㄉㄨㄥˋ 洞 -4.31757780\n";
+
+constexpr std::string_view kAssociatedPhrasesData =
+    "# format org.openvanilla.mcbopomofo.sorted\n"
+    "名-ㄇㄧㄥˊ-下-ㄒㄧㄚˋ -5.7106\n";
+
+constexpr std::string_view kUserPhrasesData = "茗 ㄇㄧㄥˊ\n";
+
+constexpr std::string_view kExcludedPhrasesData = "動作 ㄉㄨㄥˋ-ㄗㄨㄛˋ\n";
+
+constexpr std::string_view kPhraseReplacementData = "動 动\n";
+
+constexpr std::string_view kPUAData =
+    u8"# format org.openvanilla.mcbopomofo.sorted\n"
+    u8"ㄍㄚˋ \uF145\n";
+
+constexpr std::string_view kVariantsData =
+    u8"# format org.openvanilla.mcbopomofo.sorted\n"
+    u8"個-ㄍㄜˋ 個\n";
+
+}  // namespace
+
+class DataModelLoaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() /
+           ("org.openvanilla.mcbopomofo.datamodelloadertest." +
+            std::string(::testing::UnitTest::GetInstance()
+                            ->current_test_info()
+                            ->name()));
+    std::filesystem::remove_all(dir_);
+    std::filesystem::create_directories(dir_);
+    WriteFile("data.txt", kLanguageModelData);
+    WriteFile("data-plain-bpmf.txt", kPlainLanguageModelData);
+    WriteFile("associated-phrases-v2.txt", kAssociatedPhrasesData);
+    WriteFile("data.user.txt", kUserPhrasesData);
+    WriteFile("exclude-phrases.txt", kExcludedPhrasesData);
+    WriteFile("phrases-replacement.txt", kPhraseReplacementData);
+    WriteFile("bpmfvs-pua.txt", kPUAData);
+    WriteFile("bpmfvs-variants.txt", kVariantsData);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  void WriteFile(const std::string& name, std::string_view data) {
+    std::ofstream(dir_ / name, std::ios::binary)
+        .write(data.data(), static_cast<std::streamsize>(data.length()));
+  }
+
+  std::string path(const std::string& name) { return (dir_ / name).string(); }
+
+  std::filesystem::path dir_;
+};
+
+TEST_F(DataModelLoaderTest, LoadsAllModels) {
+  McBopomofoLM lm;
+  McBopomofoLM plainLM;
+  VariantAnnotator annotator;
+
+  DataModelLoader::Options options;
+  options.prefault = true;
+  DataModelLoader loader(options);
+  loader.addLanguageModel("data", &lm, path("data.txt"));
+  loader.addAssociatedPhrases("associated phrases", &lm,
+                              path("associated-phrases-v2.txt"));
+  loader.addUserPhrases("user phrases", &lm, path("data.user.txt"),
+                        path("exclude-phrases.txt"));
+  loader.addPhraseReplacementMap("phrase replacement", &lm,
+                                 path("phrases-replacement.txt"));
+  loader.addLanguageModel("data-plain-bpmf", &plainLM,
+                          path("data-plain-bpmf.txt"));
+  loader.addAssociatedPhrases("plain associated phrases", &plainLM,
+                              path("associated-phrases-v2.txt"));
+  loader.addVariantAnnotator("bpmfvs", &annotator, path("bpmfvs-pua.txt"),
+                             path("bpmfvs-variants.txt"));
+  auto stats = loader.load();
+
+  EXPECT_TRUE(stats.allLoaded());
+  std::vector<std::string> names;
+  for (const auto& component : stats.components) {
+    names.push_back(component.name);
+    EXPECT_GT(component.bytes, 0) << component.name;
+    EXPECT_LE(component.loadTime, stats.totalTime) << component.name;
+  }
+  EXPECT_EQ(names, (std::vector<std::string>{
+                       "data", "associated phrases", "user phrases",
+                       "phrase replacement", "data-plain-bpmf",
+                       "plain associated phrases", "bpmfvs PUA",
+                       "bpmfvs variants"}));
+  EXPECT_EQ(stats.components[2].bytes,
+            kUserPhrasesData.length() + kExcludedPhrasesData.length());
+
+  EXPECT_TRUE(lm.isDataModelLoaded());
+  EXPECT_TRUE(lm.isAssociatedPhrasesV2Loaded());
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "茗");
+  EXPECT_TRUE(lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ").empty());
+  lm.setPhraseReplacementEnabled(true);
+  EXPECT_EQ(lm.getUnigrams("ㄉㄨㄥˋ")[0].value(), "动");
+  EXPECT_FALSE(lm.findAssociatedPhrasesV2("名", {"ㄇㄧㄥˊ"}).empty());
+
+  EXPECT_TRUE(plainLM.isDataModelLoaded());
+  EXPECT_TRUE(plainLM.isAssociatedPhrasesV2Loaded());
+  EXPECT_EQ(plainLM.getUnigrams("ㄉㄨㄥˋ")[0].value(), "洞");
+
+  EXPECT_TRUE(annotator.loaded());
+  EXPECT_EQ(annotator.annotateSingleCharacter("個", "ㄍㄜˋ").annotatedString,
+            "個");
+}
+
+TEST_F(DataModelLoaderTest, ReportsComponentsThatFailToLoad) {
+  McBopomofoLM lm;
+  VariantAnnotator annotator;
+  WriteFile("invalid.txt", "ㄇㄧㄥˊ 明 -3.07936356\n");
+
+  DataModelLoader::Options options;
+  options.threadCount = 1;
+  DataModelLoader loader(options);
+  loader.addLanguageModel("missing", &lm, path("missing.txt"));
+  loader.addLanguageModel("invalid", &lm, path("invalid.txt"));
+  loader.addAssociatedPhrases("associated phrases", &lm,
+                              path("associated-phrases-v2.txt"));
+  loader.addVariantAnnotator("bpmfvs", &annotator, path("invalid.txt"),
+                             path("bpmfvs-variants.txt"));
+  auto stats = loader.load();
+
+  EXPECT_FALSE(stats.allLoaded());
+  ASSERT_EQ(stats.components.size(), 5);
+  EXPECT_FALSE(stats.components[0].loaded);
+  EXPECT_EQ(stats.components[0].bytes, 0);
+  EXPECT_FALSE(stats.components[1].loaded);
+  EXPECT_TRUE(stats.components[2].loaded);
+  EXPECT_FALSE(stats.components[3].loaded);
+  EXPECT_TRUE(stats.components[4].loaded);
+  EXPECT_FALSE(lm.isDataModelLoaded());
+  EXPECT_TRUE(lm.isAssociatedPhrasesV2Loaded());
+  EXPECT_FALSE(annotator.loaded());
+
+  // The loader is emptied by each load.
+  EXPECT_TRUE(loader.load().components.empty());
+}
+
+}  // namespace McBopomofo
@@ -26,8 +26,11 @@
 #include <algorithm>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -38,59 +41,301 @@ namespace McBopomofo {
 static constexpr std::string_view kMacroPrefix = "MACRO@";
 static constexpr double kMacroScore = -8.0;
 
+McBopomofoLM::McBopomofoLM() {
+  auto snapshot = std::make_shared<Snapshot>();
+  snapshot->languageModel_ = std::make_shared<ParselessLM>();
+  snapshot->userPhrases_ = std::make_shared<UserPhrasesLM>();
+  snapshot->excludedPhrases_ = std::make_shared<UserPhrasesLM>();
+  snapshot->phraseReplacement_ = std::make_shared<PhraseReplacementMap>();
+  snapshot->associatedPhrasesV2_ = std::make_shared<AssociatedPhrasesV2>();
+  snapshot_ = std::move(snapshot);
+}
+
+McBopomofoLM::~McBopomofoLM() {
+  {
+    std::lock_guard<std::mutex> lock(reloadMutex_);
+    stopReloadThread_ = true;
+  }
+  reloadCondition_.notify_all();
+  if (reloadThread_.joinable()) {
+    reloadThread_.join();
+  }
+}
+
+std::shared_ptr<const McBopomofoLM::Snapshot> McBopomofoLM::snapshot() const {
+  return std::atomic_load(&snapshot_);
+}
+
+void McBopomofoLM::publish(const std::function<bool(Snapshot&)>& change) {
+  std::lock_guard<std::mutex> lock(publishMutex_);
+  auto next = std::make_shared<Snapshot>(*std::atomic_load(&snapshot_));
+  if (!change(*next)) {
+    return;
+  }
+  next->generation_ = ++lastGeneration_;
+  std::atomic_store(&snapshot_,
+                    std::shared_ptr<const Snapshot>(std::move(next)));
+
+  // Also releases the view unigrams of the models that have been replaced.
+  std::lock_guard<std::mutex> cacheLock(unigramCacheMutex_);
+  resetUnigramCache(lastGeneration_);
+}
+
 void McBopomofoLM::loadLanguageModel(const char* languageModelDataPath) {
   if (languageModelDataPath) {
-    languageModel_.close();
-    languageModel_.open(languageModelDataPath);
+    publish([languageModelDataPath](Snapshot& snapshot) {
+      auto languageModel = std::make_shared<ParselessLM>();
+      languageModel->open(languageModelDataPath);
+      snapshot.languageModel_ = std::move(languageModel);
+      return true;
+    });
   }
 }
 
 bool McBopomofoLM::isDataModelLoaded() const {
-  return languageModel_.isLoaded();
+  return snapshot()->languageModel_->isLoaded();
 }
 
 void McBopomofoLM::loadAssociatedPhrasesV2(const char* associatedPhrasesPath) {
   if (associatedPhrasesPath) {
-    associatedPhrasesV2_.close();
-    associatedPhrasesV2_.open(associatedPhrasesPath);
+    publish([associatedPhrasesPath](Snapshot& snapshot) {
+      auto associatedPhrases = std::make_shared<AssociatedPhrasesV2>();
+      associatedPhrases->open(associatedPhrasesPath);
+      snapshot.associatedPhrasesV2_ = std::move(associatedPhrases);
+      return true;
+    });
+  }
+}
+
+// Returns the user phrases reopened from the path. Reopening only parses the
+// lines appended since the last load, which is how phrases are usually added,
+// but the published model must not change, and so that is done on a copy. The
+// copy shares the entries parsed upon open, and only copies the appended ones.
+static std::shared_ptr<const UserPhrasesLM> ReopenUserPhrases(
+    const std::shared_ptr<const UserPhrasesLM>& userPhrases,
+    const char* path) {
+  if (userPhrases->isUpToDate(path)) {
+    return userPhrases;
   }
+  auto reopened = std::make_shared<UserPhrasesLM>(*userPhrases);
+  reopened->reopen(path);
+  return reopened;
 }
 
 void McBopomofoLM::loadUserPhrases(const char* userPhrasesDataPath,
                                    const char* excludedPhrasesDataPath) {
-  userPhrases_.close();
-  excludedPhrases_.close();
+  publish([userPhrasesDataPath, excludedPhrasesDataPath](Snapshot& snapshot) {
+    if (userPhrasesDataPath) {
+      snapshot.userPhrasesDataPath_ = userPhrasesDataPath;
+      snapshot.userPhrases_ =
+          ReopenUserPhrases(snapshot.userPhrases_, userPhrasesDataPath);
+    } else {
+      snapshot.userPhrases_ = std::make_shared<UserPhrasesLM>();
+      snapshot.userPhrasesDataPath_.reset();
+    }
+
+    if (excludedPhrasesDataPath) {
+      snapshot.excludedPhrasesDataPath_ = excludedPhrasesDataPath;
+      snapshot.excludedPhrases_ = ReopenUserPhrases(snapshot.excludedPhrases_,
+                                                    excludedPhrasesDataPath);
+    } else {
+      snapshot.excludedPhrases_ = std::make_shared<UserPhrasesLM>();
+      snapshot.excludedPhrasesDataPath_.reset();
+    }
+    return true;
+  });
+}
 
-  if (userPhrasesDataPath) {
-    userPhrasesDataPath_ = userPhrasesDataPath;
-    userPhrases_.open(userPhrasesDataPath);
+bool McBopomofoLM::isAssociatedPhrasesV2Loaded() const {
+  return snapshot()->associatedPhrasesV2_->isLoaded();
+}
+
+void McBopomofoLM::loadPhraseReplacementMap(const char* phraseReplacementPath) {
+  publish([phraseReplacementPath](Snapshot& snapshot) {
+    auto phraseReplacement = std::make_shared<PhraseReplacementMap>();
+    if (phraseReplacementPath) {
+      snapshot.phraseReplacementPath_ = phraseReplacementPath;
+      phraseReplacement->open(phraseReplacementPath);
+    } else {
+      snapshot.phraseReplacementPath_.reset();
+    }
+    snapshot.phraseReplacement_ = std::move(phraseReplacement);
+    return true;
+  });
+}
+
+void McBopomofoLM::reloadAsync(ReloadRequest request,
+                               std::function<void(bool)> completion) {
+  std::lock_guard<std::mutex> lock(reloadMutex_);
+  if (pendingReload_.has_value()) {
+    auto merge = [](std::optional<std::string>& path,
+                    std::optional<std::string>& laterPath) {
+      if (laterPath.has_value()) {
+        path = std::move(laterPath);
+      }
+    };
+    merge(pendingReload_->languageModelPath, request.languageModelPath);
+    merge(pendingReload_->associatedPhrasesPath,
+          request.associatedPhrasesPath);
+    merge(pendingReload_->userPhrasesPath, request.userPhrasesPath);
+    merge(pendingReload_->excludedPhrasesPath, request.excludedPhrasesPath);
+    merge(pendingReload_->phraseReplacementPath,
+          request.phraseReplacementPath);
   } else {
-    userPhrasesDataPath_.reset();
+    pendingReload_ = std::move(request);
+  }
+  if (completion) {
+    pendingReloadCompletions_.push_back(std::move(completion));
   }
 
-  if (excludedPhrasesDataPath) {
-    excludedPhrasesDataPath_ = excludedPhrasesDataPath;
-    excludedPhrases_.open(excludedPhrasesDataPath);
-  } else {
-    excludedPhrasesDataPath_.reset();
+  if (!reloadThread_.joinable()) {
+    reloadThread_ = std::thread(&McBopomofoLM::runReloadThread, this);
   }
+  reloadCondition_.notify_all();
 }
 
-bool McBopomofoLM::isAssociatedPhrasesV2Loaded() const {
-  return associatedPhrasesV2_.isLoaded();
+void McBopomofoLM::waitForReloads() {
+  std::unique_lock<std::mutex> lock(reloadMutex_);
+  reloadCondition_.wait(
+      lock, [this] { return !pendingReload_.has_value() && !reloading_; });
 }
 
-void McBopomofoLM::loadPhraseReplacementMap(const char* phraseReplacementPath) {
-  phraseReplacement_.close();
+void McBopomofoLM::runReloadThread() {
+  std::unique_lock<std::mutex> lock(reloadMutex_);
+  while (true) {
+    reloadCondition_.wait(lock, [this] {
+      return stopReloadThread_ || pendingReload_.has_value();
+    });
+    // The pending request, if any, is still handled when stopping.
+    if (!pendingReload_.has_value()) {
+      return;
+    }
 
-  if (phraseReplacementPath) {
-    phraseReplacementPath_ = phraseReplacementPath;
-    phraseReplacement_.open(phraseReplacementPath);
-  } else {
-    phraseReplacementPath_.reset();
+    ReloadRequest request = std::move(*pendingReload_);
+    pendingReload_.reset();
+    std::vector<std::function<void(bool)>> completions;
+    completions.swap(pendingReloadCompletions_);
+    reloading_ = true;
+    lock.unlock();
+
+    bool published = reload(request);
+    for (const auto& completion : completions) {
+      completion(published);
+    }
+
+    lock.lock();
+    reloading_ = false;
+    reloadCondition_.notify_all();
   }
 }
 
+bool McBopomofoLM::reload(const ReloadRequest& request) {
+  // The loading is done without holding publishMutex_, so that the loads
+  // and setting changes made meanwhile do not wait for it. The user phrases
+  // are reopened from the snapshot current when the reload starts, and the
+  // models whose files have not changed since are kept as they are. A model
+  // that fails to load keeps the old one, and the rest are still published.
+  auto current = snapshot();
+  bool loadedAll = true;
+
+  std::shared_ptr<const ParselessLM> languageModel;
+  if (request.languageModelPath.has_value() &&
+      current->languageModel_->isUpToDate(
+          request.languageModelPath->c_str())) {
+    languageModel = current->languageModel_;
+  } else if (request.languageModelPath.has_value()) {
+    auto model = std::make_shared<ParselessLM>();
+    // A file with no valid data would leave the user with no candidates.
+    if (model->open(request.languageModelPath->c_str()) &&
+        model->hasKeyWithPrefix("")) {
+      languageModel = std::move(model);
+    } else {
+      loadedAll = false;
+    }
+  }
+
+  std::shared_ptr<const AssociatedPhrasesV2> associatedPhrases;
+  if (request.associatedPhrasesPath.has_value() &&
+      current->associatedPhrasesV2_->isUpToDate(
+          request.associatedPhrasesPath->c_str())) {
+    associatedPhrases = current->associatedPhrasesV2_;
+  } else if (request.associatedPhrasesPath.has_value()) {
+    auto model = std::make_shared<AssociatedPhrasesV2>();
+    if (model->open(request.associatedPhrasesPath->c_str())) {
+      associatedPhrases = std::move(model);
+    } else {
+      loadedAll = false;
+    }
+  }
+
+  // An empty path unloads the user file, as a nullptr does for the load*()
+  // methods.
+  auto reopenUserPhrases = [](const std::shared_ptr<const UserPhrasesLM>& lm,
+                              const std::optional<std::string>& path)
+      -> std::shared_ptr<const UserPhrasesLM> {
+    if (!path.has_value()) {
+      return nullptr;
+    }
+    if (path->empty()) {
+      return std::make_shared<UserPhrasesLM>();
+    }
+    return ReopenUserPhrases(lm, path->c_str());
+  };
+  std::shared_ptr<const UserPhrasesLM> userPhrases =
+      reopenUserPhrases(current->userPhrases_, request.userPhrasesPath);
+  std::shared_ptr<const UserPhrasesLM> excludedPhrases =
+      reopenUserPhrases(current->excludedPhrases_, request.excludedPhrasesPath);
+
+  std::shared_ptr<const PhraseReplacementMap> phraseReplacement;
+  if (request.phraseReplacementPath.has_value() &&
+      !request.phraseReplacementPath->empty() &&
+      current->phraseReplacement_->isUpToDate(
+          request.phraseReplacementPath->c_str())) {
+    phraseReplacement = current->phraseReplacement_;
+  } else if (request.phraseReplacementPath.has_value()) {
+    auto map = std::make_shared<PhraseReplacementMap>();
+    if (!request.phraseReplacementPath->empty()) {
+      map->open(request.phraseReplacementPath->c_str());
+    }
+    phraseReplacement = std::move(map);
+  }
+
+  // Nothing is published if every model is the one already in use.
+  auto setPath = [](std::optional<std::filesystem::path>& path,
+                    const std::string& newPath) {
+    if (newPath.empty()) {
+      path.reset();
+    } else {
+      path = newPath;
+    }
+  };
+  publish([&](Snapshot& snapshot) {
+    bool changed = false;
+    auto replace = [&changed](auto& model, const auto& newModel) {
+      if (newModel != nullptr && newModel != model) {
+        model = newModel;
+        changed = true;
+      }
+    };
+    replace(snapshot.languageModel_, languageModel);
+    replace(snapshot.associatedPhrasesV2_, associatedPhrases);
+    replace(snapshot.userPhrases_, userPhrases);
+    replace(snapshot.excludedPhrases_, excludedPhrases);
+    replace(snapshot.phraseReplacement_, phraseReplacement);
+    if (userPhrases != nullptr) {
+      setPath(snapshot.userPhrasesDataPath_, *request.userPhrasesPath);
+    }
+    if (excludedPhrases != nullptr) {
+      setPath(snapshot.excludedPhrasesDataPath_, *request.excludedPhrasesPath);
+    }
+    if (phraseReplacement != nullptr) {
+      setPath(snapshot.phraseReplacementPath_, *request.phraseReplacementPath);
+    }
+    return changed;
+  });
+  return loadedAll;
+}
+
 static McBopomofoLM::IssueType TranslateIssue(
     ByteBlockBackedDictionary::Issue::Type t) {
   switch (t) {
@@ -107,27 +352,28 @@ static McBopomofoLM::IssueType TranslateIssue(
 std::vector<McBopomofoLM::UserFileIssue> McBopomofoLM::getUserFileIssues()
     const {
   std::vector<McBopomofoLM::UserFileIssue> issues;
+  auto s = snapshot();
 
-  if (userPhrasesDataPath_.has_value()) {
-    for (const auto& issue : userPhrases_.getParsingIssues()) {
+  if (s->userPhrasesDataPath_.has_value()) {
+    for (const auto& issue : s->userPhrases_->getParsingIssues()) {
       issues.emplace_back(McBopomofoLM::UserFileType::USER_PHRASES,
-                          userPhrasesDataPath_.value(),
+                          s->userPhrasesDataPath_.value(),
                           TranslateIssue(issue.type), issue.lineNumber);
     }
   }
 
-  if (excludedPhrasesDataPath_.has_value()) {
-    for (const auto& issue : excludedPhrases_.getParsingIssues()) {
+  if (s->excludedPhrasesDataPath_.has_value()) {
+    for (const auto& issue : s->excludedPhrases_->getParsingIssues()) {
       issues.emplace_back(McBopomofoLM::UserFileType::EXCLUDED_PHRASES,
-                          excludedPhrasesDataPath_.value(),
+                          s->excludedPhrasesDataPath_.value(),
                           TranslateIssue(issue.type), issue.lineNumber);
     }
   }
 
-  if (phraseReplacementPath_.has_value()) {
-    for (const auto& issue : phraseReplacement_.getParsingIssues()) {
+  if (s->phraseReplacementPath_.has_value()) {
+    for (const auto& issue : s->phraseReplacement_->getParsingIssues()) {
       issues.emplace_back(McBopomofoLM::UserFileType::PHRASE_REPLACEMENT_MAP,
-                          phraseReplacementPath_.value(),
+                          s->phraseReplacementPath_.value(),
                           TranslateIssue(issue.type), issue.lineNumber);
     }
   }
@@ -137,40 +383,113 @@ std::vector<McBopomofoLM::UserFileIssue> McBopomofoLM::getUserFileIssues()
 
 std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
 McBopomofoLM::getUnigrams(const std::string& key) {
+  return snapshot()->getUnigrams(key);
+}
+
+std::vector<std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>
+McBopomofoLM::batchGetUnigrams(const std::vector<std::string>& keys) {
+  return snapshot()->batchGetUnigrams(keys);
+}
+
+void McBopomofoLM::batchGetRankedUnigrams(
+    const std::vector<std::string>& keys,
+    std::vector<RankedUnigrams>* results) {
+  static const RankedUnigrams kSpaceUnigrams = std::make_shared<
+      const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>(
+      1, Formosa::Gramambular2::LanguageModel::Unigram(" ", 0));
+
+  results->resize(keys.size());
+  auto s = snapshot();
+
+  // The bulk of the lookups is in the language model, which can do them in
+  // one pass. The user phrases are in hash maps and are looked up per key.
+  std::vector<size_t> missIndices;
+  std::vector<std::string> missKeys;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (keys[i] == " ") {
+      (*results)[i] = kSpaceUnigrams;
+    } else if (!findCachedUnigrams(keys[i], s->generation_, &(*results)[i])) {
+      missIndices.push_back(i);
+      missKeys.push_back(keys[i]);
+    }
+  }
+
+  if (missKeys.empty()) {
+    return;
+  }
+
+  auto globalUnigrams = s->languageModel_->batchGetUnigrams(missKeys);
+  for (size_t j = 0; j < missKeys.size(); ++j) {
+    bool hasMacro = false;
+    auto unigrams = s->mergeUnigrams(missKeys[j], globalUnigrams[j], &hasMacro);
+    RankByScore(&unigrams);
+    auto ranked = std::make_shared<
+        const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>(
+        std::move(unigrams));
+    if (!hasMacro) {
+      cacheUnigrams(missKeys[j], s->generation_, ranked);
+    }
+    (*results)[missIndices[j]] = std::move(ranked);
+  }
+}
+
+std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
+McBopomofoLM::Snapshot::getUnigrams(const std::string& key) const {
   if (key == " ") {
     std::vector<Formosa::Gramambular2::LanguageModel::Unigram> spaceUnigrams;
     spaceUnigrams.emplace_back(" ", 0);
     return spaceUnigrams;
   }
+  return mergeUnigrams(key, languageModel_->getUnigrams(key));
+}
 
-  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> allUnigrams;
-  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> userUnigrams;
-
-  std::unordered_set<std::string> excludedValues;
-  std::unordered_set<std::string> insertedValues;
+std::vector<std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>
+McBopomofoLM::Snapshot::batchGetUnigrams(
+    const std::vector<std::string>& keys) const {
+  auto globalUnigrams = languageModel_->batchGetUnigrams(keys);
+  std::vector<std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>
+      results(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (keys[i] == " ") {
+      results[i].emplace_back(" ", 0);
+    } else {
+      results[i] = mergeUnigrams(keys[i], globalUnigrams[i]);
+    }
+  }
+  return results;
+}
 
-  if (excludedPhrases_.hasUnigrams(key)) {
-    std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-        excludedUnigrams = excludedPhrases_.getUnigrams(key);
-    std::transform(excludedUnigrams.begin(), excludedUnigrams.end(),
-                   std::inserter(excludedValues, excludedValues.end()),
-                   [](const Formosa::Gramambular2::LanguageModel::Unigram& u) {
-                     return u.value();
-                   });
+std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
+McBopomofoLM::Snapshot::mergeUnigrams(
+    const std::string& key,
+    const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>&
+        rawGlobalUnigrams,
+    bool* hasMacro) const {
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> excludedUnigrams;
+  if (excludedPhrases_->hasUnigrams(key)) {
+    excludedUnigrams = excludedPhrases_->getUnigrams(key);
   }
 
-  if (userPhrases_.hasUnigrams(key)) {
-    std::vector<Formosa::Gramambular2::LanguageModel::Unigram> rawUserUnigrams =
-        userPhrases_.getUnigrams(key);
-    userUnigrams = filterAndTransformUnigrams(rawUserUnigrams, excludedValues,
-                                              insertedValues);
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> rawUserUnigrams;
+  if (userPhrases_->hasUnigrams(key)) {
+    rawUserUnigrams = userPhrases_->getUnigrams(key);
   }
 
-  if (languageModel_.hasUnigrams(key)) {
-    std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-        rawGlobalUnigrams = languageModel_.getUnigrams(key);
-    allUnigrams = filterAndTransformUnigrams(rawGlobalUnigrams, excludedValues,
-                                             insertedValues);
+  // The user unigrams always come first, followed by the global ones. Reserve
+  // for all of them since insertedValues holds views into the results.
+  thread_local ValueSet insertedValues;
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> allUnigrams;
+  allUnigrams.reserve(rawUserUnigrams.size() + rawGlobalUnigrams.size());
+  insertedValues.reset(rawUserUnigrams.size() + rawGlobalUnigrams.size());
+
+  bool foundMacro = false;
+  filterAndTransformUnigrams(rawUserUnigrams, excludedUnigrams,
+                             insertedValues, allUnigrams, foundMacro);
+  size_t userUnigramCount = allUnigrams.size();
+  filterAndTransformUnigrams(rawGlobalUnigrams, excludedUnigrams,
+                             insertedValues, allUnigrams, foundMacro);
+  if (hasMacro != nullptr) {
+    *hasMacro = foundMacro;
   }
 
   // This relies on the fact that we always use the default separator.
@@ -192,27 +511,21 @@ McBopomofoLM::getUnigrams(const std::string& key) {
   // be able to compete with it. Without the rewrite, ㄉㄨㄥˋ-ㄗㄨㄛˋ
   // would always result in "丼" + "作" instead of "動作" because the
   // node for "丼" would dominate the walk.
-  if (isKeyMultiSyllable || allUnigrams.empty()) {
-    allUnigrams.insert(allUnigrams.begin(), userUnigrams.begin(),
-                       userUnigrams.end());
-  } else if (!userUnigrams.empty()) {
-    // Find the highest score from the existing allUnigrams.
+  if (!isKeyMultiSyllable && userUnigramCount > 0 &&
+      userUnigramCount < allUnigrams.size()) {
+    // Find the highest score from the global unigrams.
     double topScore = std::numeric_limits<double>::lowest();
-    for (const auto& unigram : allUnigrams) {
-      topScore = std::max(topScore, unigram.score());
+    for (size_t i = userUnigramCount; i < allUnigrams.size(); ++i) {
+      topScore = std::max(topScore, allUnigrams[i].score());
     }
 
     // Boost by a very small number. This is the score for user phrases.
     constexpr double epsilon = 0.000000001;
     double boostedScore = topScore + epsilon;
 
-    std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-        rewrittenUserUnigrams;
-    for (const auto& unigram : userUnigrams) {
-      rewrittenUserUnigrams.emplace_back(unigram.value(), boostedScore);
+    for (size_t i = 0; i < userUnigramCount; ++i) {
+      allUnigrams[i] = allUnigrams[i].withScore(boostedScore);
     }
-    allUnigrams.insert(allUnigrams.begin(), rewrittenUserUnigrams.begin(),
-                       rewrittenUserUnigrams.end());
   }
 
   return allUnigrams;
@@ -223,16 +536,43 @@ bool McBopomofoLM::hasUnigrams(const std::string& key) {
     return true;
   }
 
-  if (!excludedPhrases_.hasUnigrams(key)) {
-    return userPhrases_.hasUnigrams(key) || languageModel_.hasUnigrams(key);
+  auto s = snapshot();
+  if (!s->excludedPhrases_->hasUnigrams(key)) {
+    return s->userPhrases_->hasUnigrams(key) ||
+           s->languageModel_->hasUnigrams(key);
   }
 
   return !getUnigrams(key).empty();
 }
 
+bool McBopomofoLM::Snapshot::hasUnigrams(const std::string& key) const {
+  if (key == " ") {
+    return true;
+  }
+
+  if (!excludedPhrases_->hasUnigrams(key)) {
+    return userPhrases_->hasUnigrams(key) || languageModel_->hasUnigrams(key);
+  }
+
+  return !getUnigrams(key).empty();
+}
+
+bool McBopomofoLM::hasKeyWithPrefix(const std::string& prefix) {
+  return snapshot()->hasKeyWithPrefix(prefix);
+}
+
+bool McBopomofoLM::Snapshot::hasKeyWithPrefix(const std::string& prefix) const {
+  return userPhrases_->hasKeyWithPrefix(prefix) ||
+         languageModel_->hasKeyWithPrefix(prefix);
+}
+
 std::string McBopomofoLM::getReading(const std::string& value) const {
+  return snapshot()->getReading(value);
+}
+
+std::string McBopomofoLM::Snapshot::getReading(const std::string& value) const {
   std::vector<ParselessLM::FoundReading> foundReadings =
-      languageModel_.getReadings(value);
+      languageModel_->getReadings(value);
   double topScore = std::numeric_limits<double>::lowest();
   std::string topValue;
   for (const auto& foundReading : foundReadings) {
@@ -247,117 +587,291 @@ std::string McBopomofoLM::getReading(const std::string& value) const {
 std::vector<AssociatedPhrasesV2::Phrase> McBopomofoLM::findAssociatedPhrasesV2(
     const std::string& prefixValue,
     const std::vector<std::string>& prefixReadings) const {
-  return associatedPhrasesV2_.findPhrases(prefixValue, prefixReadings);
+  return snapshot()->findAssociatedPhrasesV2(prefixValue, prefixReadings);
+}
+
+std::vector<AssociatedPhrasesV2::Phrase>
+McBopomofoLM::Snapshot::findAssociatedPhrasesV2(
+    const std::string& prefixValue,
+    const std::vector<std::string>& prefixReadings) const {
+  return associatedPhrasesV2_->findPhrases(prefixValue, prefixReadings);
 }
 
 void McBopomofoLM::setPhraseReplacementEnabled(bool enabled) {
-  phraseReplacementEnabled_ = enabled;
+  publish([enabled](Snapshot& snapshot) {
+    if (snapshot.phraseReplacementEnabled_ == enabled) {
+      return false;
+    }
+    snapshot.phraseReplacementEnabled_ = enabled;
+    return true;
+  });
 }
 
 bool McBopomofoLM::phraseReplacementEnabled() const {
-  return phraseReplacementEnabled_;
+  return snapshot()->phraseReplacementEnabled_;
 }
 
 void McBopomofoLM::setExternalConverterEnabled(bool enabled) {
-  externalConverterEnabled_ = enabled;
+  publish([enabled](Snapshot& snapshot) {
+    if (snapshot.externalConverterEnabled_ == enabled) {
+      return false;
+    }
+    snapshot.externalConverterEnabled_ = enabled;
+    return true;
+  });
 }
 
 bool McBopomofoLM::externalConverterEnabled() const {
-  return externalConverterEnabled_;
+  return snapshot()->externalConverterEnabled_;
 }
 
 void McBopomofoLM::setExternalConverter(
     std::function<std::string(const std::string&)> externalConverter) {
-  externalConverter_ = std::move(externalConverter);
+  publish([&externalConverter](Snapshot& snapshot) {
+    snapshot.externalConverter_ = std::move(externalConverter);
+    return true;
+  });
 }
 
 void McBopomofoLM::setMacroConverter(
     std::function<std::string(const std::string&)> macroConverter) {
-  macroConverter_ = std::move(macroConverter);
+  publish([&macroConverter](Snapshot& snapshot) {
+    snapshot.macroConverter_ = std::move(macroConverter);
+    return true;
+  });
 }
 
 std::string McBopomofoLM::convertMacro(const std::string& input) const {
+  return snapshot()->convertMacro(input);
+}
+
+std::string McBopomofoLM::Snapshot::convertMacro(
+    const std::string& input) const {
   if (macroConverter_ != nullptr) {
     return macroConverter_(input);
   }
   return input;
 }
 
-std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-McBopomofoLM::filterAndTransformUnigrams(
-    const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>& unigrams,
-    const std::unordered_set<std::string>& excludedValues,
-    std::unordered_set<std::string>& insertedValues) const {
-  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> results;
+void McBopomofoLM::setUnigramCacheCapacity(size_t capacity) {
+  std::lock_guard<std::mutex> lock(unigramCacheMutex_);
+  unigramCacheCapacity_ = capacity;
+  while (unigramCacheList_.size() > unigramCacheCapacity_) {
+    unigramCacheMap_.erase(unigramCacheList_.back().first);
+    unigramCacheList_.pop_back();
+    ++unigramCacheStats_.evictions;
+  }
+}
+
+size_t McBopomofoLM::unigramCacheCapacity() const {
+  std::lock_guard<std::mutex> lock(unigramCacheMutex_);
+  return unigramCacheCapacity_;
+}
+
+McBopomofoLM::UnigramCacheStats McBopomofoLM::unigramCacheStats() const {
+  std::lock_guard<std::mutex> lock(unigramCacheMutex_);
+  return unigramCacheStats_;
+}
 
-  for (auto&& unigram : unigrams) {
-    // excludedValues filters out the unigrams with the original value.
+uint64_t McBopomofoLM::unigramCacheGeneration() const {
+  return snapshot()->generation_;
+}
+
+void McBopomofoLM::resetUnigramCache(uint64_t generation) {
+  unigramCacheGeneration_ = generation;
+  unigramCacheMap_.clear();
+  unigramCacheList_.clear();
+}
+
+bool McBopomofoLM::findCachedUnigrams(const std::string& key,
+                                      uint64_t generation,
+                                      RankedUnigrams* unigrams) {
+  std::unique_lock<std::mutex> lock(unigramCacheMutex_, std::try_to_lock);
+  if (!lock.owns_lock() || unigramCacheCapacity_ == 0) {
+    return false;
+  }
+
+  // A lookup that started before the latest snapshot was published must not
+  // see the results for that snapshot.
+  if (generation != unigramCacheGeneration_) {
+    ++unigramCacheStats_.misses;
+    return false;
+  }
+
+  auto mapIter = unigramCacheMap_.find(key);
+  if (mapIter == unigramCacheMap_.end()) {
+    ++unigramCacheStats_.misses;
+    return false;
+  }
+
+  ++unigramCacheStats_.hits;
+  auto listIter = mapIter->second;
+  unigramCacheList_.splice(unigramCacheList_.begin(), unigramCacheList_,
+                           listIter);
+  *unigrams = listIter->second;
+  return true;
+}
+
+void McBopomofoLM::cacheUnigrams(const std::string& key, uint64_t generation,
+                                 const RankedUnigrams& unigrams) {
+  std::unique_lock<std::mutex> lock(unigramCacheMutex_, std::try_to_lock);
+  if (!lock.owns_lock() || unigramCacheCapacity_ == 0 ||
+      generation != unigramCacheGeneration_) {
+    return;
+  }
+
+  auto [mapIter, inserted] =
+      unigramCacheMap_.emplace(key, unigramCacheList_.end());
+  if (!inserted) {
+    // Another thread looked up the same key meanwhile.
+    return;
+  }
+  unigramCacheList_.emplace_front(key, unigrams);
+  mapIter->second = unigramCacheList_.begin();
+  if (unigramCacheList_.size() > unigramCacheCapacity_) {
+    unigramCacheMap_.erase(unigramCacheList_.back().first);
+    unigramCacheList_.pop_back();
+    ++unigramCacheStats_.evictions;
+  }
+}
+
+void McBopomofoLM::Snapshot::ValueSet::reset(size_t size) {
+  size_t slotCount = 16;
+  while (slotCount < size * 2) {
+    slotCount *= 2;
+  }
+  if (slots_.size() < slotCount) {
+    slots_.resize(slotCount);
+  }
+  mask_ = slotCount - 1;
+  std::fill(slots_.begin(), slots_.begin() + slotCount, std::string_view());
+}
+
+bool McBopomofoLM::Snapshot::ValueSet::insert(std::string_view value) {
+  // An empty slot has a null data pointer, which no value view has.
+  size_t i = std::hash<std::string_view>()(value) & mask_;
+  while (slots_[i].data() != nullptr) {
+    if (slots_[i] == value) {
+      return false;
+    }
+    i = (i + 1) & mask_;
+  }
+  slots_[i] = value;
+  return true;
+}
+
+void McBopomofoLM::Snapshot::filterAndTransformUnigrams(
+    const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>& unigrams,
+    const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>&
+        excludedUnigrams,
+    ValueSet& insertedValues,
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram>& results,
+    bool& hasMacro) const {
+  std::string converted;
+  for (const auto& unigram : unigrams) {
+    // excludedUnigrams filters out the unigrams with the original value.
     // insertedValues filters out the ones with the converted value
-    const std::string& rawValue = unigram.value();
-    if (excludedValues.find(rawValue) != excludedValues.end()) {
+    std::string_view rawValue = unigram.valueView();
+    bool excluded = false;
+    for (const auto& excludedUnigram : excludedUnigrams) {
+      if (excludedUnigram.valueView() == rawValue) {
+        excluded = true;
+        break;
+      }
+    }
+    if (excluded) {
       continue;
     }
 
-    std::string value = rawValue;
+    // Points to either rawValue or `converted`.
+    std::string_view value = rawValue;
     if (phraseReplacementEnabled_) {
-      std::string replacement = phraseReplacement_.valueForKey(value);
+      std::string_view replacement = phraseReplacement_->valueForKey(value);
       if (!replacement.empty()) {
-        if (value != replacement) {
-          value = replacement;
-        }
-      }
-    }
-    if (macroConverter_ != nullptr) {
-      std::string replacement = macroConverter_(value);
-      if (value != replacement) {
         value = replacement;
       }
     }
 
+    bool isMacro = value.size() > kMacroPrefix.size() &&
+                   value.compare(0, kMacroPrefix.size(), kMacroPrefix) == 0;
+    hasMacro = hasMacro || isMacro;
+    if (isMacro && macroConverter_ != nullptr) {
+      converted = macroConverter_(std::string(value));
+      value = converted;
+      isMacro = value.size() > kMacroPrefix.size() &&
+                value.compare(0, kMacroPrefix.size(), kMacroPrefix) == 0;
+    }
+
     // Check if the string is an unsupported macro
-    if (unigram.score() == kMacroScore && value.size() > kMacroPrefix.size() &&
-        value.compare(0, kMacroPrefix.size(), kMacroPrefix) == 0) {
+    if (isMacro && unigram.score() == kMacroScore) {
       continue;
     }
 
     if (externalConverterEnabled_ && externalConverter_ != nullptr) {
-      std::string replacement = externalConverter_(value);
-      if (value != replacement) {
-        value = replacement;
-      }
+      converted = externalConverter_(std::string(value));
+      value = converted;
     }
-    if (insertedValues.find(value) == insertedValues.end()) {
-      results.emplace_back(value, unigram.score(), rawValue);
-      insertedValues.insert(value);
+
+    // Only a transformed value needs its own copy.
+    if (value == rawValue) {
+      if (insertedValues.insert(rawValue)) {
+        results.push_back(unigram);
+      }
+    } else {
+      // Check against the copy, since `value` may point to `converted`.
+      results.emplace_back(std::string(value), unigram.score(),
+                           std::string(rawValue));
+      if (!insertedValues.insert(results.back().valueView())) {
+        results.pop_back();
+      }
     }
   }
-  return results;
 }
 
 void McBopomofoLM::loadLanguageModel(std::unique_ptr<ParselessPhraseDB> db) {
-  languageModel_.close();
-  languageModel_.open(std::move(db));
+  publish([&db](Snapshot& snapshot) {
+    auto languageModel = std::make_shared<ParselessLM>();
+    languageModel->open(std::move(db));
+    snapshot.languageModel_ = std::move(languageModel);
+    return true;
+  });
 }
 
 void McBopomofoLM::loadAssociatedPhrasesV2(
     std::unique_ptr<ParselessPhraseDB> db) {
-  associatedPhrasesV2_.close();
-  associatedPhrasesV2_.open(std::move(db));
+  publish([&db](Snapshot& snapshot) {
+    auto associatedPhrases = std::make_shared<AssociatedPhrasesV2>();
+    associatedPhrases->open(std::move(db));
+    snapshot.associatedPhrasesV2_ = std::move(associatedPhrases);
+    return true;
+  });
 }
 
 void McBopomofoLM::loadUserPhrases(const char* data, size_t length) {
-  userPhrases_.close();
-  userPhrases_.load(data, length);
+  publish([data, length](Snapshot& snapshot) {
+    auto userPhrases = std::make_shared<UserPhrasesLM>();
+    userPhrases->load(data, length);
+    snapshot.userPhrases_ = std::move(userPhrases);
+    return true;
+  });
 }
 
 void McBopomofoLM::loadExcludedPhrases(const char* data, size_t length) {
-  excludedPhrases_.close();
-  excludedPhrases_.load(data, length);
+  publish([data, length](Snapshot& snapshot) {
+    auto excludedPhrases = std::make_shared<UserPhrasesLM>();
+    excludedPhrases->load(data, length);
+    snapshot.excludedPhrases_ = std::move(excludedPhrases);
+    return true;
+  });
 }
 
 void McBopomofoLM::loadPhraseReplacementMap(const char* data, size_t length) {
-  phraseReplacement_.close();
-  phraseReplacement_.load(data, length);
+  publish([data, length](Snapshot& snapshot) {
+    auto phraseReplacement = std::make_shared<PhraseReplacementMap>();
+    phraseReplacement->load(data, length);
+    snapshot.phraseReplacement_ = std::move(phraseReplacement);
+    return true;
+  });
 }
 
 }  // namespace McBopomofo
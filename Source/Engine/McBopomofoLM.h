@@ -24,12 +24,19 @@
 #ifndef SRC_ENGINE_MCBOPOMOFOLM_H_
 #define SRC_ENGINE_MCBOPOMOFOLM_H_
 
+#include <condition_variable>
+#include <cstdint>
 #include <filesystem>
 #include <functional>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "AssociatedPhrasesV2.h"
@@ -57,15 +64,128 @@ namespace McBopomofo {
 // phrases, excluded phrases, and replacement map). The LM's owner, usually the
 // input method controller, needs to take care of checking for updates and
 // telling McBopomofoLM to reload as needed.
+//
+// The models and the conversion settings are kept in an immutable Snapshot.
+// Loading a model or changing a setting builds a new snapshot and publishes
+// it atomically, and so lookups, which each use the snapshot current when
+// they start, can be done from any number of threads at once, also while
+// models are being loaded; readers never wait for a load to finish and never
+// see a half-loaded model. Loads and setting changes are serialized.
+// reloadAsync() goes further and does the loading itself on a background
+// thread, so that the thread asking for the reload does not wait either.
+//
+// The ranked results of batchGetRankedUnigrams(), which is what the reading
+// grid uses, are kept in an LRU cache and shared with the callers, so that a
+// cache hit only copies a pointer. Publishing a new snapshot bumps the cache
+// generation and empties the cache. Results that contain macro conversions,
+// which may change over time, are not cached.
 class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
  public:
-  McBopomofoLM() = default;
+  McBopomofoLM();
+
+  // Waits for the pending reloads, if any.
+  ~McBopomofoLM() override;
 
   McBopomofoLM(const McBopomofoLM&) = delete;
   McBopomofoLM(McBopomofoLM&&) = delete;
   McBopomofoLM& operator=(const McBopomofoLM&) = delete;
   McBopomofoLM& operator=(McBopomofoLM&&) = delete;
 
+  // The models and the conversion settings at one point in time. All methods
+  // are const, and a snapshot never changes once published, so it can be
+  // shared by threads without locking. A snapshot keeps its models alive, and
+  // its results stay consistent with each other, however many times the
+  // McBopomofoLM is reloaded meanwhile. The converters are called from the
+  // threads doing the lookups, and so they must be thread-safe themselves.
+  class Snapshot {
+   public:
+    // See McBopomofoLM::getUnigrams() and the like. This does not use the
+    // unigram cache.
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram> getUnigrams(
+        const std::string& key) const;
+    bool hasUnigrams(const std::string& key) const;
+    bool hasKeyWithPrefix(const std::string& prefix) const;
+    std::vector<std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>
+    batchGetUnigrams(const std::vector<std::string>& keys) const;
+
+    std::string getReading(const std::string& value) const;
+
+    std::vector<AssociatedPhrasesV2::Phrase> findAssociatedPhrasesV2(
+        const std::string& prefixValue,
+        const std::vector<std::string>& prefixReadings) const;
+
+    std::string convertMacro(const std::string& input) const;
+
+    // Each published snapshot has a greater generation than the previous one.
+    [[nodiscard]] uint64_t generation() const { return generation_; }
+
+   private:
+    friend class McBopomofoLM;
+
+    // A flat open-addressing set of values. It only holds views, and one per
+    // thread is reused across lookups so that deduplicating the values does
+    // not allocate.
+    class ValueSet {
+     public:
+      // Empties the set and makes room for at least `size` values.
+      void reset(size_t size);
+
+      // Returns false if the value is already in the set.
+      bool insert(std::string_view value);
+
+     private:
+      std::vector<std::string_view> slots_;
+      size_t mask_ = 0;
+    };
+
+    // Merges the unigrams of the user phrases for the key with the unigrams
+    // from the language model, taking the excluded phrases into account. If
+    // hasMacro is not null, it is set to whether any value, after the phrase
+    // replacement, was a macro.
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram> mergeUnigrams(
+        const std::string& key,
+        const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>&
+            rawGlobalUnigrams,
+        bool* hasMacro = nullptr) const;
+
+    // Filters and converts the input unigrams and appends them to `results`.
+    // Unigrams whose values are found in `excludedUnigrams` are removed, and
+    // the kept values will be inserted to the `insertedValues` set. The set
+    // holds views into `results`, so `results` must have enough capacity
+    // reserved for all the unigrams. `hasMacro` is set to true if any value,
+    // after the phrase replacement, is a macro.
+    void filterAndTransformUnigrams(
+        const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>&
+            unigrams,
+        const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>&
+            excludedUnigrams,
+        ValueSet& insertedValues,
+        std::vector<Formosa::Gramambular2::LanguageModel::Unigram>& results,
+        bool& hasMacro) const;
+
+    uint64_t generation_ = 0;
+
+    std::shared_ptr<const ParselessLM> languageModel_;
+    std::shared_ptr<const UserPhrasesLM> userPhrases_;
+    std::shared_ptr<const UserPhrasesLM> excludedPhrases_;
+    std::shared_ptr<const PhraseReplacementMap> phraseReplacement_;
+    std::shared_ptr<const AssociatedPhrasesV2> associatedPhrasesV2_;
+
+    std::optional<std::filesystem::path> userPhrasesDataPath_;
+    std::optional<std::filesystem::path> excludedPhrasesDataPath_;
+    std::optional<std::filesystem::path> phraseReplacementPath_;
+
+    bool phraseReplacementEnabled_ = false;
+
+    bool externalConverterEnabled_ = false;
+    std::function<std::string(const std::string&)> externalConverter_;
+
+    std::function<std::string(const std::string&)> macroConverter_;
+  };
+
+  // Returns the current snapshot. Holding on to it keeps its models loaded.
+  std::shared_ptr<const Snapshot> snapshot() const;
+
   // Loads (or reloads, if already loaded) the primary language model data file.
   void loadLanguageModel(const char* languageModelDataPath);
 
@@ -85,6 +205,45 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
   // Loads (or reloads if already loaded) the phrase replacement mapping file.
   void loadPhraseReplacementMap(const char* phraseReplacementPath);
 
+  // The files to load with reloadAsync(). The models whose paths are not
+  // given are kept as they are. An empty path unloads a user file, as a
+  // nullptr does for loadUserPhrases() and loadPhraseReplacementMap().
+  struct ReloadRequest {
+    std::optional<std::string> languageModelPath;
+    std::optional<std::string> associatedPhrasesPath;
+    std::optional<std::string> userPhrasesPath;
+    std::optional<std::string> excludedPhrasesPath;
+    std::optional<std::string> phraseReplacementPath;
+  };
+
+  // Loads the files of the request on a background thread, and then
+  // publishes all of the new models in one snapshot, so that lookups see
+  // either all of the old models or all of the new ones. If the language
+  // model cannot be opened or has no data, or the associated phrases cannot
+  // be opened, the old one is kept, and the other models of the request are
+  // still published. The user files are loaded as loadUserPhrases() and
+  // loadPhraseReplacementMap() do. The models whose files have not changed
+  // since they were loaded are kept, and so a reload where nothing changed
+  // costs a stat() per file and publishes nothing.
+  //
+  // This returns right away. A request made while another one is waiting is
+  // merged into it, with the paths given by the later request winning. The
+  // completion, if any, is called on the background thread, with whether
+  // every model of the request was loaded, once the request has been
+  // handled. A reload publishes over the changes made by the load*() methods
+  // while it was loading.
+  void reloadAsync(ReloadRequest request,
+                   std::function<void(bool)> completion = nullptr);
+
+  // Blocks until the reloads requested so far are done.
+  void waitForReloads();
+
+  // Same as reloadAsync(), but loads the files on the calling thread, and
+  // returns whether every model of the request was loaded. Only the
+  // publishing is serialized, and so different models of the LM can be loaded
+  // from several threads at once.
+  bool reload(const ReloadRequest& request);
+
   // Returns a list of unigrams for the reading. For example, if the reading is
   // "ㄇㄚ", the return may be [unigram("嗎"), unigram("媽") and so on.
   std::vector<Formosa::Gramambular2::LanguageModel::Unigram> getUnigrams(
@@ -92,6 +251,20 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
 
   bool hasUnigrams(const std::string& key) override;
 
+  // Excluded phrases only remove unigrams, and so only the user phrases and
+  // the language model are consulted.
+  bool hasKeyWithPrefix(const std::string& prefix) override;
+
+  // Same as calling getUnigrams() for each of the keys, but the lookups in the
+  // language model are done in one batch.
+  std::vector<std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>
+  batchGetUnigrams(const std::vector<std::string>& keys) override;
+
+  // The same lookups, ranked by score, through the unigram cache.
+  void batchGetRankedUnigrams(
+      const std::vector<std::string>& keys,
+      std::vector<RankedUnigrams>* results) override;
+
   std::string getReading(const std::string& value) const;
 
   std::vector<AssociatedPhrasesV2::Phrase> findAssociatedPhrasesV2(
@@ -110,6 +283,27 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
       std::function<std::string(const std::string&)> macroConverter);
   std::string convertMacro(const std::string& input) const;
 
+  static constexpr size_t kDefaultUnigramCacheCapacity = 1024;
+
+  // Sets the maximum number of readings whose unigrams are cached. 0 disables
+  // the cache.
+  void setUnigramCacheCapacity(size_t capacity);
+  size_t unigramCacheCapacity() const;
+
+  // Lookups that find the cache in use by another thread skip the cache, and
+  // are not counted.
+  struct UnigramCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+  };
+
+  UnigramCacheStats unigramCacheStats() const;
+
+  // Returns the cache generation, which is bumped whenever the cached results
+  // become invalid. This is the generation of the current snapshot.
+  uint64_t unigramCacheGeneration() const;
+
   // Methods to allow loading in-memory data for testing purposes.
   void loadLanguageModel(std::unique_ptr<ParselessPhraseDB> db);
   void loadAssociatedPhrasesV2(std::unique_ptr<ParselessPhraseDB> db);
@@ -144,32 +338,55 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
   std::vector<UserFileIssue> getUserFileIssues() const;
 
  protected:
-  // Filters and converts the input unigrams and returns a new list of unigrams.
-  // Unigrams whose values are found in `excludedValues` are removed, and the
-  // kept values will be inserted to the `insertedValues` set.
-  std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-  filterAndTransformUnigrams(
-      const std::vector<Formosa::Gramambular2::LanguageModel::Unigram>&
-          unigrams,
-      const std::unordered_set<std::string>& excludedValues,
-      std::unordered_set<std::string>& insertedValues) const;
-
-  ParselessLM languageModel_;
-  UserPhrasesLM userPhrases_;
-  UserPhrasesLM excludedPhrases_;
-  PhraseReplacementMap phraseReplacement_;
-  AssociatedPhrasesV2 associatedPhrasesV2_;
-
-  std::optional<std::filesystem::path> userPhrasesDataPath_;
-  std::optional<std::filesystem::path> excludedPhrasesDataPath_;
-  std::optional<std::filesystem::path> phraseReplacementPath_;
-
-  bool phraseReplacementEnabled_ = false;
-
-  bool externalConverterEnabled_ = false;
-  std::function<std::string(const std::string&)> externalConverter_;
-
-  std::function<std::string(const std::string&)> macroConverter_;
+  // Publishes a copy of the current snapshot, as changed by the function,
+  // which is called with the loads and setting changes serialized. If the
+  // function returns false, nothing is published.
+  void publish(const std::function<bool(Snapshot&)>& change);
+
+  // Returns true and shares the cached unigrams for the key, if found for the
+  // snapshot of the generation.
+  bool findCachedUnigrams(const std::string& key, uint64_t generation,
+                          RankedUnigrams* unigrams);
+  // Caches the ranked unigrams of the snapshot of the generation for the key.
+  // The unigrams must not contain macro conversions.
+  void cacheUnigrams(const std::string& key, uint64_t generation,
+                     const RankedUnigrams& unigrams);
+
+  // Empties the unigram cache and moves it on to the generation. The cache
+  // mutex must be held.
+  void resetUnigramCache(uint64_t generation);
+
+  // Handles the reload requests until the LM is destroyed.
+  void runReloadThread();
+
+  // Only accessed with std::atomic_load() and std::atomic_store().
+  std::shared_ptr<const Snapshot> snapshot_;
+
+  // Serializes the loads and setting changes.
+  std::mutex publishMutex_;
+  uint64_t lastGeneration_ = 0;
+
+  typedef std::pair<std::string, RankedUnigrams> KeyUnigramsPair;
+
+  // The unigram cache, guarded by unigramCacheMutex_. Lookups only try to
+  // lock it, and skip the cache if another thread holds it.
+  mutable std::mutex unigramCacheMutex_;
+  size_t unigramCacheCapacity_ = kDefaultUnigramCacheCapacity;
+  uint64_t unigramCacheGeneration_ = 0;
+  UnigramCacheStats unigramCacheStats_;
+  std::list<KeyUnigramsPair> unigramCacheList_;
+  std::unordered_map<std::string, std::list<KeyUnigramsPair>::iterator>
+      unigramCacheMap_;
+
+  // The reload thread, started by the first reloadAsync(), and the request
+  // waiting for it, guarded by reloadMutex_.
+  std::mutex reloadMutex_;
+  std::condition_variable reloadCondition_;
+  std::optional<ReloadRequest> pendingReload_;
+  std::vector<std::function<void(bool)>> pendingReloadCompletions_;
+  bool reloading_ = false;
+  bool stopReloadThread_ = false;
+  std::thread reloadThread_;
 };
 
 }  // namespace McBopomofo
@@ -0,0 +1,164 @@
+// Copyright (c) 2025 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "McBopomofoLM.h"
+#include "ParselessPhraseDB.h"
+#include "gramambular2/allocation_counter.h"
+
+namespace {
+
+using Formosa::Gramambular2::HeapAllocationCount;
+
+// Roughly the shape of a real setup: a large language model, and user
+// phrases, excluded phrases, and a phrase replacement map in the hundreds.
+constexpr int kReadings = 2000;
+constexpr int kValuesPerReading = 12;
+constexpr int kUserPhrases = 400;
+constexpr int kExcludedPhrases = 50;
+constexpr int kReplacements = 200;
+
+std::string Reading(int r) { return "r" + std::to_string(10000 + r); }
+
+std::string Value(int r, int v) {
+  return "v" + std::to_string(10000 + r) + "_" + std::to_string(v);
+}
+
+struct TestData {
+  std::string languageModel;
+  std::string userPhrases;
+  std::string excludedPhrases;
+  std::string replacements;
+};
+
+const TestData& GetTestData() {
+  static const TestData data = []() {
+    TestData d;
+    std::stringstream lm;
+    lm << McBopomofo::SORTED_PRAGMA_HEADER;
+    for (int r = 0; r < kReadings; ++r) {
+      for (int v = 0; v < kValuesPerReading; ++v) {
+        lm << Reading(r) << " " << Value(r, v) << " " << -2.0 - v << "\n";
+      }
+    }
+    d.languageModel = lm.str();
+
+    // The phrase files are in the value-then-key order.
+    std::stringstream up;
+    for (int i = 0; i < kUserPhrases; ++i) {
+      int r = i * 7 % kReadings;
+      up << "u" << i << " " << Reading(r) << "\n";
+    }
+    d.userPhrases = up.str();
+
+    std::stringstream ep;
+    for (int i = 0; i < kExcludedPhrases; ++i) {
+      int r = i * 13 % kReadings;
+      ep << Value(r, i % kValuesPerReading) << " " << Reading(r) << "\n";
+    }
+    d.excludedPhrases = ep.str();
+
+    std::stringstream rm;
+    for (int i = 0; i < kReplacements; ++i) {
+      int r = i * 11 % kReadings;
+      rm << Value(r, 0) << " " << Value(r, 0) << "x\n";
+    }
+    d.replacements = rm.str();
+    return d;
+  }();
+  return data;
+}
+
+void LoadTestData(McBopomofo::McBopomofoLM* lm) {
+  const TestData& data = GetTestData();
+  lm->loadLanguageModel(std::make_unique<McBopomofo::ParselessPhraseDB>(
+      data.languageModel.c_str(), data.languageModel.length()));
+  lm->loadUserPhrases(data.userPhrases.c_str(), data.userPhrases.length());
+  lm->loadExcludedPhrases(data.excludedPhrases.c_str(),
+                          data.excludedPhrases.length());
+  lm->loadPhraseReplacementMap(data.replacements.c_str(),
+                               data.replacements.length());
+  lm->setPhraseReplacementEnabled(true);
+  lm->setMacroConverter([](const std::string& macro) { return macro; });
+}
+
+void BM_McBopomofoLMGetUnigrams(benchmark::State& state) {
+  McBopomofo::McBopomofoLM lm;
+  LoadTestData(&lm);
+
+  // Measures the lookups themselves, not the cache.
+  lm.setUnigramCacheCapacity(0);
+
+  std::vector<std::string> readings;
+  for (int r = 0; r < kReadings; ++r) {
+    readings.push_back(Reading(r));
+  }
+
+  size_t i = 0;
+  size_t allocations = HeapAllocationCount();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(lm.getUnigrams(readings[i++ % kReadings]));
+  }
+  state.counters["allocs/lookup"] = benchmark::Counter(
+      static_cast<double>(HeapAllocationCount() - allocations),
+      benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_McBopomofoLMGetUnigrams);
+
+// The ranked lookups that the reading grid makes, with every reading in the
+// cache, as when the user goes on typing in the same sentence.
+void BM_McBopomofoLMCachedRankedUnigrams(benchmark::State& state) {
+  McBopomofo::McBopomofoLM lm;
+  LoadTestData(&lm);
+
+  constexpr int kCachedReadings = 256;
+  std::vector<std::string> readings;
+  for (int r = 0; r < kCachedReadings; ++r) {
+    readings.push_back(Reading(r));
+  }
+  std::vector<Formosa::Gramambular2::LanguageModel::RankedUnigrams> results;
+  lm.batchGetRankedUnigrams(readings, &results);
+
+  std::vector<std::string> keys(1);
+  size_t i = 0;
+  size_t allocations = HeapAllocationCount();
+  for (auto _ : state) {
+    keys[0] = readings[i++ % kCachedReadings];
+    lm.batchGetRankedUnigrams(keys, &results);
+    benchmark::DoNotOptimize(results[0]);
+  }
+  state.counters["allocs/lookup"] = benchmark::Counter(
+      static_cast<double>(HeapAllocationCount() - allocations),
+      benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_McBopomofoLMCachedRankedUnigrams);
+
+};  // namespace
+
+BENCHMARK_MAIN();
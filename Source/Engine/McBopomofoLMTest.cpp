@@ -21,10 +21,17 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <atomic>
 #include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <memory>
+#include <optional>
 #include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "McBopomofoLM.h"
 #include "gtest/gtest.h"
@@ -73,6 +80,17 @@ constexpr char kPhreaseReplacementMapData[] = R"(
 澀谷 渋谷
 )";
 
+// Looks up the key the way the reading grid does, through the unigram cache.
+static std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
+GetCachedUnigrams(McBopomofoLM& lm, const std::string& key) {
+  std::vector<Formosa::Gramambular2::LanguageModel::RankedUnigrams> results;
+  lm.batchGetRankedUnigrams({key}, &results);
+  if (results[0] == nullptr) {
+    return {};
+  }
+  return *results[0];
+}
+
 TEST(McBopomofoLMTest, PrimaryLanguageModel) {
   McBopomofoLM lm;
   auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
@@ -114,6 +132,47 @@ TEST(McBopomofoLMTest, UserPhrases) {
   EXPECT_EQ(unigrams[0].value(), "茗");
 }
 
+TEST(McBopomofoLMTest, BatchGetUnigramsMatchesGetUnigrams) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  lm.loadExcludedPhrases(kExcludedPhrasesData, sizeof(kExcludedPhrasesData));
+
+  std::vector<std::string> keys = {"ㄉㄨㄥˋ-ㄗㄨㄛˋ", "ㄇㄧㄥˊ",  " ",
+                                   "ㄇㄧㄥˊ-ㄘˋ",    "ㄉㄨㄥˋ",  "ㄅㄚ",
+                                   "ㄔㄥˊ-ㄕˋ",      "ㄇㄧㄥˊ-ㄘˊ"};
+  auto results = lm.batchGetUnigrams(keys);
+  ASSERT_EQ(results.size(), keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto unigrams = lm.getUnigrams(keys[i]);
+    ASSERT_EQ(results[i].size(), unigrams.size()) << "key: " << keys[i];
+    for (size_t j = 0; j < unigrams.size(); ++j) {
+      EXPECT_EQ(results[i][j].value(), unigrams[j].value());
+      EXPECT_EQ(results[i][j].score(), unigrams[j].score());
+    }
+  }
+  EXPECT_TRUE(results[0].empty());
+  ASSERT_EQ(results[2].size(), 1);
+  EXPECT_EQ(results[2][0].value(), " ");
+}
+
+TEST(McBopomofoLMTest, KeyWithPrefix) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  EXPECT_TRUE(lm.hasKeyWithPrefix("ㄇㄧㄥˊ-"));
+  EXPECT_FALSE(lm.hasKeyWithPrefix("ㄉㄨㄥˋ-ㄗㄨㄛˋ-"));
+  EXPECT_FALSE(lm.hasKeyWithPrefix("ㄔㄥˊ-ㄕˋ-"));
+
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  lm.loadExcludedPhrases(kExcludedPhrasesData, sizeof(kExcludedPhrasesData));
+  EXPECT_TRUE(lm.hasKeyWithPrefix("ㄉㄨㄥˋ-"));
+  EXPECT_FALSE(lm.hasKeyWithPrefix("ㄔㄥˊ-ㄕˋ-"));
+}
+
 TEST(McBopomofoLMTest, ExcludedPhrases) {
   McBopomofoLM lm;
   auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
@@ -145,6 +204,26 @@ TEST(McBopomofoLMTest, PhraseReplacementMap) {
   EXPECT_EQ(unigrams[0].value(), "动作");
 }
 
+TEST(McBopomofoLMTest, OnlyTransformedUnigramsHaveRawValues) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadPhraseReplacementMap(kPhreaseReplacementMapData,
+                              sizeof(kPhreaseReplacementMapData));
+  lm.setPhraseReplacementEnabled(true);
+
+  auto unigrams = lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ");
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].valueView(), "动作");
+  EXPECT_EQ(unigrams[0].rawValue(), "動作");
+
+  unigrams = lm.getUnigrams("ㄉㄨㄥˋ");
+  ASSERT_FALSE(unigrams.empty());
+  EXPECT_EQ(unigrams[0].valueView(), "動");
+  EXPECT_EQ(unigrams[0].rawValue(), "動");
+}
+
 TEST(McBopomofoLMTest, PhraseReplacementMapDeduplicates) {
   McBopomofoLM lm;
   auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
@@ -285,4 +364,523 @@ TEST(McBopomofoLMTest, MacroValueNotRecognizedByMacroConverterIsFiltered) {
   EXPECT_EQ(unigrams[1].value(), "6/10/21");
 }
 
+TEST(McBopomofoLMTest, MacroConverterIsOnlyCalledForMacros) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+
+  std::vector<std::string> macros;
+  lm.setMacroConverter([&macros](const std::string& macro) {
+    macros.push_back(macro);
+    return macro;
+  });
+
+  lm.getUnigrams("ㄇㄧㄥˊ");
+  EXPECT_TRUE(macros.empty());
+
+  auto unigrams = lm.getUnigrams("ㄐㄧㄣ-ㄊㄧㄢ");
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].value(), "今天");
+  std::vector<std::string> expected = {"MACRO@DATE_TODAY_SHORT",
+                                       "MACRO@DATE_TODAY_MEDIUM"};
+  EXPECT_EQ(macros, expected);
+}
+
+TEST(McBopomofoLMTest, UnigramCacheHitsAndMisses) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+
+  auto unigrams = GetCachedUnigrams(lm, "ㄇㄧㄥˊ");
+  EXPECT_EQ(lm.unigramCacheStats().hits, 0);
+  EXPECT_EQ(lm.unigramCacheStats().misses, 1);
+
+  auto cached = GetCachedUnigrams(lm, "ㄇㄧㄥˊ");
+  EXPECT_EQ(lm.unigramCacheStats().hits, 1);
+  EXPECT_EQ(lm.unigramCacheStats().misses, 1);
+  ASSERT_EQ(cached.size(), unigrams.size());
+  for (size_t i = 0; i < unigrams.size(); ++i) {
+    EXPECT_EQ(cached[i].value(), unigrams[i].value());
+    EXPECT_EQ(cached[i].score(), unigrams[i].score());
+  }
+
+  std::vector<Formosa::Gramambular2::LanguageModel::RankedUnigrams> results;
+  lm.batchGetRankedUnigrams({"ㄇㄧㄥˊ", "ㄉㄨㄥˋ", " "}, &results);
+  EXPECT_EQ(lm.unigramCacheStats().hits, 2);
+  EXPECT_EQ(lm.unigramCacheStats().misses, 2);
+  ASSERT_EQ(results.size(), 3);
+  EXPECT_EQ(results[0]->size(), unigrams.size());
+  EXPECT_EQ((*results[1])[0].value(), "丼");
+  EXPECT_EQ((*results[2])[0].value(), " ");
+
+  // A hit shares the cached unigrams instead of copying them.
+  std::vector<Formosa::Gramambular2::LanguageModel::RankedUnigrams> again;
+  lm.batchGetRankedUnigrams({"ㄇㄧㄥˊ"}, &again);
+  EXPECT_EQ(again[0], results[0]);
+}
+
+TEST(McBopomofoLMTest, CachedUnigramsAreRankedByScore) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+
+  for (const char* key : {"ㄇㄧㄥˊ", "ㄔㄥˊ-ㄕˋ", "ㄐㄧㄣ-ㄊㄧㄢ"}) {
+    auto unigrams = lm.getUnigrams(key);
+    Formosa::Gramambular2::LanguageModel::RankByScore(&unigrams);
+    for (int i = 0; i < 2; ++i) {
+      auto cached = GetCachedUnigrams(lm, key);
+      ASSERT_EQ(cached.size(), unigrams.size()) << key;
+      for (size_t j = 0; j < unigrams.size(); ++j) {
+        EXPECT_EQ(cached[j].value(), unigrams[j].value()) << key;
+        EXPECT_EQ(cached[j].score(), unigrams[j].score()) << key;
+      }
+    }
+  }
+  // The unigrams of ㄐㄧㄣ-ㄊㄧㄢ contain macros, and are not cached.
+  EXPECT_EQ(lm.unigramCacheStats().hits, 2);
+}
+
+TEST(McBopomofoLMTest, UnigramCacheEvictsLeastRecentlyUsedReadings) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.setUnigramCacheCapacity(2);
+
+  GetCachedUnigrams(lm, "ㄇㄧㄥˊ");
+  GetCachedUnigrams(lm, "ㄉㄨㄥˋ");
+  GetCachedUnigrams(lm, "ㄇㄧㄥˊ");
+  GetCachedUnigrams(lm, "ㄔㄥˊ-ㄕˋ");
+  EXPECT_EQ(lm.unigramCacheStats().evictions, 1);
+
+  // ㄉㄨㄥˋ is the least recently used one and has been evicted.
+  GetCachedUnigrams(lm, "ㄇㄧㄥˊ");
+  EXPECT_EQ(lm.unigramCacheStats().hits, 2);
+  GetCachedUnigrams(lm, "ㄉㄨㄥˋ");
+  EXPECT_EQ(lm.unigramCacheStats().hits, 2);
+  EXPECT_EQ(lm.unigramCacheStats().misses, 4);
+  EXPECT_EQ(lm.unigramCacheStats().evictions, 2);
+
+  lm.setUnigramCacheCapacity(0);
+  EXPECT_EQ(lm.unigramCacheStats().evictions, 4);
+  GetCachedUnigrams(lm, "ㄉㄨㄥˋ");
+  EXPECT_EQ(lm.unigramCacheStats().hits, 2);
+  EXPECT_EQ(lm.unigramCacheStats().misses, 4);
+}
+
+TEST(McBopomofoLMTest, UnigramCacheIsInvalidatedBySettingChanges) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadPhraseReplacementMap(kPhreaseReplacementMapData,
+                              sizeof(kPhreaseReplacementMapData));
+
+  auto unigrams = GetCachedUnigrams(lm, "ㄉㄨㄥˋ-ㄗㄨㄛˋ");
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].value(), "動作");
+
+  uint64_t generation = lm.unigramCacheGeneration();
+  lm.setPhraseReplacementEnabled(true);
+  EXPECT_GT(lm.unigramCacheGeneration(), generation);
+  unigrams = GetCachedUnigrams(lm, "ㄉㄨㄥˋ-ㄗㄨㄛˋ");
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].value(), "动作");
+
+  // Setting the same value again does not invalidate the cache.
+  generation = lm.unigramCacheGeneration();
+  lm.setPhraseReplacementEnabled(true);
+  EXPECT_EQ(lm.unigramCacheGeneration(), generation);
+
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  EXPECT_GT(lm.unigramCacheGeneration(), generation);
+  lm.loadExcludedPhrases(kExcludedPhrasesData, sizeof(kExcludedPhrasesData));
+  unigrams = GetCachedUnigrams(lm, "ㄉㄨㄥˋ-ㄗㄨㄛˋ");
+  EXPECT_TRUE(unigrams.empty());
+  EXPECT_EQ(lm.unigramCacheStats().hits, 0);
+}
+
+TEST(McBopomofoLMTest, UnigramsWithMacrosAreNotCached) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+
+  int conversions = 0;
+  lm.setMacroConverter([&conversions](const std::string& macro) {
+    if (macro == "MACRO@DATE_TODAY_SHORT") {
+      return std::to_string(++conversions);
+    }
+    return macro;
+  });
+
+  EXPECT_EQ(GetCachedUnigrams(lm, "ㄐㄧㄣ-ㄊㄧㄢ")[1].value(), "1");
+  EXPECT_EQ(GetCachedUnigrams(lm, "ㄐㄧㄣ-ㄊㄧㄢ")[1].value(), "2");
+  EXPECT_EQ(lm.unigramCacheStats().hits, 0);
+}
+
+TEST(McBopomofoLMTest, UnigramsReplacedWithMacrosAreNotCached) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  constexpr char kMacroReplacement[] = "動作 MACRO@DATE_TODAY_SHORT\n";
+  lm.loadPhraseReplacementMap(kMacroReplacement, sizeof(kMacroReplacement));
+  lm.setPhraseReplacementEnabled(true);
+
+  int conversions = 0;
+  lm.setMacroConverter([&conversions](const std::string& macro) {
+    if (macro == "MACRO@DATE_TODAY_SHORT") {
+      return std::to_string(++conversions);
+    }
+    return macro;
+  });
+
+  EXPECT_EQ(GetCachedUnigrams(lm, "ㄉㄨㄥˋ-ㄗㄨㄛˋ")[0].value(), "1");
+  EXPECT_EQ(GetCachedUnigrams(lm, "ㄉㄨㄥˋ-ㄗㄨㄛˋ")[0].value(), "2");
+  std::vector<Formosa::Gramambular2::LanguageModel::RankedUnigrams> results;
+  lm.batchGetRankedUnigrams({"ㄉㄨㄥˋ-ㄗㄨㄛˋ"}, &results);
+  EXPECT_EQ((*results[0])[0].value(), "3");
+  EXPECT_EQ(lm.unigramCacheStats().hits, 0);
+}
+
+TEST(McBopomofoLMTest, ReloadingUserPhrasesPicksUpAppendedPhrases) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.mcbopomofolmtest.userphrases.txt";
+  std::ofstream(path, std::ios::binary) << "茗 ㄇㄧㄥˊ\n";
+
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadUserPhrases(path.c_str(), nullptr);
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "茗");
+  EXPECT_EQ(lm.getUnigrams("ㄉㄨㄥˋ")[0].value(), "動");
+
+  std::ofstream(path, std::ios::binary | std::ios::app) << "丼 ㄉㄨㄥˋ\n";
+  lm.loadUserPhrases(path.c_str(), nullptr);
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "茗");
+  EXPECT_EQ(lm.getUnigrams("ㄉㄨㄥˋ")[0].value(), "丼");
+
+  lm.loadUserPhrases(nullptr, nullptr);
+  EXPECT_EQ(lm.getUnigrams("ㄉㄨㄥˋ")[0].value(), "動");
+  std::filesystem::remove(path);
+}
+
+TEST(McBopomofoLMTest, SnapshotIsUnchangedByReloads) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+
+  auto snapshot = lm.snapshot();
+  lm.loadUserPhrases(nullptr, nullptr);
+  lm.loadExcludedPhrases(kExcludedPhrasesData, sizeof(kExcludedPhrasesData));
+  lm.setPhraseReplacementEnabled(true);
+  EXPECT_GT(lm.snapshot()->generation(), snapshot->generation());
+
+  EXPECT_EQ(snapshot->getUnigrams("ㄇㄧㄥˊ")[0].value(), "茗");
+  EXPECT_EQ(snapshot->getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ")[0].value(), "動作");
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "明");
+  EXPECT_TRUE(lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ").empty());
+  EXPECT_TRUE(lm.snapshot()->getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ").empty());
+}
+
+// Looks up from several threads while another one keeps reloading the models
+// and changing the settings. Build with ENABLE_TSAN to check for data races.
+TEST(McBopomofoLMTest, ConcurrentLookupsWhileReloading) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.mcbopomofolmtest.concurrent.txt";
+  std::ofstream(path, std::ios::binary) << "茗 ㄇㄧㄥˊ\n丼 ㄉㄨㄥˋ\n";
+
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadPhraseReplacementMap(kPhreaseReplacementMapData,
+                              sizeof(kPhreaseReplacementMapData));
+
+  constexpr int kReaders = 4;
+  constexpr int kReloads = 200;
+  std::atomic<bool> done = false;
+  std::atomic<int> inconsistencies = 0;
+  std::vector<std::thread> readers;
+  for (int r = 0; r < kReaders; ++r) {
+    readers.emplace_back([&lm, &done, &inconsistencies]() {
+      const std::vector<std::string> keys = {"ㄇㄧㄥˊ", "ㄉㄨㄥˋ",
+                                             "ㄉㄨㄥˋ-ㄗㄨㄛˋ"};
+      while (!done) {
+        // Within one snapshot, both user phrases are there or neither is.
+        auto snapshot = lm.snapshot();
+        auto results = snapshot->batchGetUnigrams(keys);
+        bool hasFirst = results[0][0].value() == "茗";
+        bool hasSecond = results[1][0].value() == "丼";
+        if (hasFirst != hasSecond ||
+            snapshot->getUnigrams(keys[0])[0].value() !=
+                results[0][0].value() ||
+            (!results[2].empty() && results[2][0].value() != "動作" &&
+             results[2][0].value() != "动作")) {
+          ++inconsistencies;
+        }
+
+        // The LM's own lookups, which go through the cache, may see any
+        // snapshot, but never a torn one.
+        std::string value = GetCachedUnigrams(lm, keys[0])[0].value();
+        if (value != "茗" && value != "明") {
+          ++inconsistencies;
+        }
+        lm.hasUnigrams(keys[1]);
+        lm.hasKeyWithPrefix("ㄉㄨㄥˋ-");
+      }
+    });
+  }
+
+  for (int i = 0; i < kReloads; ++i) {
+    switch (i % 4) {
+      case 0:
+        lm.loadUserPhrases(path.c_str(), nullptr);
+        break;
+      case 1:
+        lm.loadExcludedPhrases(kExcludedPhrasesData,
+                               sizeof(kExcludedPhrasesData));
+        lm.setPhraseReplacementEnabled(true);
+        break;
+      case 2:
+        lm.loadUserPhrases(nullptr, nullptr);
+        lm.setUnigramCacheCapacity(i % 8 == 2 ? 0 : 16);
+        break;
+      case 3:
+        lm.loadExcludedPhrases(nullptr, 0);
+        lm.setPhraseReplacementEnabled(false);
+        std::ofstream(path, std::ios::binary | std::ios::app)
+            << "茗 ㄇㄧㄥˊ\n";
+        break;
+    }
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(inconsistencies, 0);
+  std::filesystem::remove(path);
+}
+
+class McBopomofoLMReloadTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    std::string prefix = "org.openvanilla.mcbopomofo.mcbopomofolmtest." +
+                         std::string(::testing::UnitTest::GetInstance()
+                                         ->current_test_info()
+                                         ->name());
+    languageModelPath_ = (dir / (prefix + ".data.txt")).string();
+    userPhrasesPath_ = (dir / (prefix + ".userphrases.txt")).string();
+    phraseReplacementPath_ = (dir / (prefix + ".replacement.txt")).string();
+
+    // Skip the leading newline, as the file must start with the pragma.
+    WriteFile(languageModelPath_, kPrimaryLMData + 1);
+    WriteFile(userPhrasesPath_, kUserPhrasesData);
+    WriteFile(phraseReplacementPath_, kPhreaseReplacementMapData);
+  }
+
+  void TearDown() override {
+    std::filesystem::remove(languageModelPath_);
+    std::filesystem::remove(userPhrasesPath_);
+    std::filesystem::remove(phraseReplacementPath_);
+  }
+
+  static void WriteFile(const std::string& path, const std::string& data) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << data;
+  }
+
+  McBopomofoLM::ReloadRequest fullRequest() const {
+    McBopomofoLM::ReloadRequest request;
+    request.languageModelPath = languageModelPath_;
+    request.userPhrasesPath = userPhrasesPath_;
+    request.phraseReplacementPath = phraseReplacementPath_;
+    return request;
+  }
+
+  std::string languageModelPath_;
+  std::string userPhrasesPath_;
+  std::string phraseReplacementPath_;
+};
+
+TEST_F(McBopomofoLMReloadTest, ReloadAsyncPublishesAllModelsAtOnce) {
+  McBopomofoLM lm;
+  lm.setPhraseReplacementEnabled(true);
+  uint64_t generation = lm.snapshot()->generation();
+
+  std::atomic<int> published = 0;
+  lm.reloadAsync(fullRequest(), [&published](bool result) {
+    if (result) {
+      ++published;
+    }
+  });
+  lm.waitForReloads();
+
+  EXPECT_EQ(published, 1);
+  EXPECT_EQ(lm.snapshot()->generation(), generation + 1);
+  EXPECT_TRUE(lm.isDataModelLoaded());
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "茗");
+  EXPECT_EQ(lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ")[0].value(), "动作");
+  EXPECT_TRUE(lm.getUserFileIssues().empty());
+
+  // Reloading only the user phrases keeps the other models.
+  WriteFile(userPhrasesPath_, "丼 ㄉㄨㄥˋ\n");
+  McBopomofoLM::ReloadRequest request;
+  request.userPhrasesPath = userPhrasesPath_;
+  lm.reloadAsync(request);
+  lm.waitForReloads();
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "明");
+  EXPECT_EQ(lm.getUnigrams("ㄉㄨㄥˋ")[0].value(), "丼");
+  EXPECT_EQ(lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ")[0].value(), "动作");
+}
+
+TEST_F(McBopomofoLMReloadTest, ReloadsOnlyChangedFiles) {
+  McBopomofoLM lm;
+  ASSERT_TRUE(lm.reload(fullRequest()));
+  ASSERT_TRUE(lm.reload(fullRequest()));
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "茗");
+
+  // Replace the language model file, and the reload picks it up.
+  std::string newPath = languageModelPath_ + ".new";
+  WriteFile(newPath, std::string(SORTED_PRAGMA_HEADER) + "ㄇㄧㄥˊ 名 -1.0\n");
+  std::filesystem::rename(newPath, languageModelPath_);
+  ASSERT_TRUE(lm.reload(fullRequest()));
+  auto unigrams = lm.getUnigrams("ㄇㄧㄥˊ");
+  EXPECT_EQ(unigrams[0].value(), "茗");
+  ASSERT_EQ(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[1].value(), "名");
+}
+
+TEST_F(McBopomofoLMReloadTest, InvalidReloadKeepsOldModels) {
+  McBopomofoLM lm;
+  lm.reloadAsync(fullRequest());
+  lm.waitForReloads();
+  uint64_t generation = lm.snapshot()->generation();
+
+  // A missing file, and a file without the pragma, which would have no data.
+  std::vector<bool> results;
+  auto request = fullRequest();
+  request.languageModelPath = languageModelPath_ + ".missing";
+  request.userPhrasesPath = std::nullopt;
+  lm.reloadAsync(request,
+                 [&results](bool result) { results.push_back(result); });
+  lm.waitForReloads();
+
+  // The file in use stays mapped, and so it is not overwritten.
+  std::string invalidPath = languageModelPath_ + ".invalid";
+  WriteFile(invalidPath, "ㄇㄧㄥˊ 冥 -1.0\n");
+  request.languageModelPath = invalidPath;
+  lm.reloadAsync(request,
+                 [&results](bool result) { results.push_back(result); });
+  lm.waitForReloads();
+  std::filesystem::remove(invalidPath);
+
+  EXPECT_EQ(results, (std::vector<bool>{false, false}));
+  EXPECT_EQ(lm.snapshot()->generation(), generation);
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "茗");
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[1].value(), "明");
+}
+
+TEST_F(McBopomofoLMReloadTest, FailedModelKeepsTheRestOfTheRequest) {
+  McBopomofoLM lm;
+  ASSERT_TRUE(lm.reload(fullRequest()));
+
+  // A request for the user phrases merged with one for a missing language
+  // model still publishes the user phrases.
+  WriteFile(userPhrasesPath_, "丼 ㄉㄨㄥˋ\n");
+  McBopomofoLM::ReloadRequest request;
+  request.languageModelPath = languageModelPath_ + ".missing";
+  request.userPhrasesPath = userPhrasesPath_;
+  EXPECT_FALSE(lm.reload(request));
+  EXPECT_EQ(lm.getUnigrams("ㄉㄨㄥˋ")[0].value(), "丼");
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "明");
+
+  // An empty path unloads the user phrases.
+  request = McBopomofoLM::ReloadRequest();
+  request.userPhrasesPath = "";
+  EXPECT_TRUE(lm.reload(request));
+  EXPECT_NE(lm.getUnigrams("ㄉㄨㄥˋ")[0].value(), "丼");
+
+  // Nothing is published if nothing changed.
+  uint64_t generation = lm.snapshot()->generation();
+  request = fullRequest();
+  request.userPhrasesPath = std::nullopt;
+  EXPECT_TRUE(lm.reload(request));
+  EXPECT_EQ(lm.snapshot()->generation(), generation);
+}
+
+TEST_F(McBopomofoLMReloadTest, RequestsWaitingForTheReloadThreadAreMerged) {
+  McBopomofoLM lm;
+  constexpr int kRequests = 20;
+  std::atomic<int> completions = 0;
+  for (int i = 0; i < kRequests; ++i) {
+    McBopomofoLM::ReloadRequest request;
+    if (i % 2 == 0) {
+      request.languageModelPath = languageModelPath_;
+    } else {
+      request.userPhrasesPath = userPhrasesPath_;
+    }
+    lm.reloadAsync(request, [&completions](bool result) {
+      EXPECT_TRUE(result);
+      ++completions;
+    });
+  }
+  lm.waitForReloads();
+
+  EXPECT_EQ(completions, kRequests);
+  EXPECT_LE(lm.snapshot()->generation(), kRequests);
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "茗");
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[1].value(), "明");
+}
+
+// Readers must never see an empty model while the models are reloaded in the
+// background. Build with ENABLE_TSAN to check for data races.
+TEST_F(McBopomofoLMReloadTest, LookupsNeverSeeEmptyModelsDuringReloads) {
+  McBopomofoLM lm;
+  lm.reloadAsync(fullRequest());
+  lm.waitForReloads();
+
+  constexpr int kReaders = 4;
+  constexpr int kReloads = 50;
+  std::atomic<bool> done = false;
+  std::atomic<int> emptyResults = 0;
+  std::vector<std::thread> readers;
+  for (int r = 0; r < kReaders; ++r) {
+    readers.emplace_back([&lm, &done, &emptyResults]() {
+      while (!done) {
+        if (lm.getUnigrams("ㄇㄧㄥˊ").size() < 3 ||
+            lm.snapshot()->getUnigrams("ㄔㄥˊ-ㄕˋ").size() < 3) {
+          ++emptyResults;
+        }
+      }
+    });
+  }
+
+  for (int i = 0; i < kReloads; ++i) {
+    lm.reloadAsync(fullRequest());
+    if (i % 10 == 0) {
+      lm.waitForReloads();
+    }
+  }
+  lm.waitForReloads();
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(emptyResults, 0);
+}
+
 }  // namespace McBopomofo
@@ -28,53 +28,326 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
 #include <utility>
 
 namespace McBopomofo {
 
+// How many times a file that keeps changing while it is copied is read.
+static constexpr int kMaxCopyAttempts = 3;
+
+static size_t PageSize() {
+  static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return pageSize;
+}
+
+static MemoryMappedFile::FileIdentity IdentityOf(const struct stat& sb) {
+  MemoryMappedFile::FileIdentity identity;
+  identity.device = static_cast<uint64_t>(sb.st_dev);
+  identity.inode = static_cast<uint64_t>(sb.st_ino);
+#ifdef __APPLE__
+  const struct timespec& mtime = sb.st_mtimespec;
+#else
+  const struct timespec& mtime = sb.st_mtim;
+#endif
+  identity.modificationTime =
+      static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+  identity.size = static_cast<uint64_t>(sb.st_size);
+  return identity;
+}
+
+namespace {
+
+struct FileIdentityHash {
+  size_t operator()(const MemoryMappedFile::FileIdentity& identity) const {
+    size_t hash = std::hash<uint64_t>()(identity.inode);
+    auto combine = [&hash](size_t value) {
+      hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    };
+    combine(std::hash<uint64_t>()(identity.device));
+    combine(std::hash<int64_t>()(identity.modificationTime));
+    combine(std::hash<uint64_t>()(identity.size));
+    return hash;
+  }
+};
+
+using SharedMappingTable =
+    std::unordered_map<MemoryMappedFile::FileIdentity,
+                       std::weak_ptr<const MemoryMappedFile>, FileIdentityHash>;
+
+// The shared mappings. Only weak references are kept, so that a mapping is
+// unmapped once its last user releases it, and the entries of the released
+// mappings are swept when new ones are added. The copies of files are kept
+// apart, so that those who ask for a copy never get a mapping.
+struct SharedMappingRegistry {
+  std::mutex mutex;
+  SharedMappingTable mappings;
+  SharedMappingTable copies;
+
+  SharedMappingTable& table(bool copy) { return copy ? copies : mappings; }
+
+  void sweep(SharedMappingTable* table) {
+    for (auto it = table->begin(); it != table->end();) {
+      it = it->second.expired() ? table->erase(it) : std::next(it);
+    }
+  }
+};
+
+SharedMappingRegistry& Registry() {
+  // Never destroyed, so that mappings released during static destruction can
+  // still be looked up.
+  static auto* registry = new SharedMappingRegistry();
+  return *registry;
+}
+
+}  // namespace
+
+#if defined(__linux__)
+// The size of the huge pages that transparent huge pages use on Linux.
+static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Maps the file at an address aligned to the huge page size, which file-backed
+// transparent huge pages need. Returns MAP_FAILED if it cannot.
+static void* MapAlignedToHugePages(size_t length, int flags, int fd) {
+  // Reserve enough address space to find an aligned address in, then map the
+  // file over it and give back the rest.
+  size_t reservedLength = length + kHugePageSize;
+  void* reserved = mmap(nullptr, reservedLength, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (reserved == MAP_FAILED) {
+    return MAP_FAILED;
+  }
+  auto start = reinterpret_cast<uintptr_t>(reserved);
+  uintptr_t aligned = (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  void* data = mmap(reinterpret_cast<void*>(aligned), length, PROT_READ,
+                    flags | MAP_FIXED, fd, 0);
+  if (data == MAP_FAILED) {
+    munmap(reserved, reservedLength);
+    return MAP_FAILED;
+  }
+  uintptr_t end = aligned + ((length + PageSize() - 1) & ~(PageSize() - 1));
+  if (aligned > start) {
+    munmap(reserved, aligned - start);
+  }
+  if (start + reservedLength > end) {
+    munmap(reinterpret_cast<void*>(end), start + reservedLength - end);
+  }
+#if defined(MADV_HUGEPAGE)
+  madvise(data, length, MADV_HUGEPAGE);
+#endif
+  return data;
+}
+#endif
+
+std::shared_ptr<const MemoryMappedFile> MemoryMappedFile::OpenShared(
+    const char* path) {
+  return OpenShared(path, Options());
+}
+
+std::shared_ptr<const MemoryMappedFile> MemoryMappedFile::OpenShared(
+    const char* path, const Options& options) {
+  SharedMappingRegistry& registry = Registry();
+  SharedMappingTable& table = registry.table(options.copy);
+  FileIdentity identity;
+  if (StatFile(path, &identity)) {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto it = table.find(identity);
+    if (it != table.end()) {
+      if (auto mapping = it->second.lock(); mapping != nullptr) {
+        return mapping;
+      }
+    }
+  }
+
+  // Map the file without holding the lock, since that may read the whole
+  // file. The file may have changed since the stat above, and so the mapping
+  // is registered under the identity of what was actually mapped.
+  auto file = std::make_shared<MemoryMappedFile>();
+  if (!file->open(path, options)) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto& entry = table[file->identity()];
+  if (auto mapping = entry.lock(); mapping != nullptr) {
+    // Another thread mapped the same file in the meantime.
+    return mapping;
+  }
+  entry = file;
+  registry.sweep(&table);
+  return file;
+}
+
+std::shared_ptr<const MemoryMappedFile> MemoryMappedFile::Reopen(
+    const std::shared_ptr<const MemoryMappedFile>& file, const char* path,
+    const Options& options) {
+  if (file != nullptr && file->isUpToDate(path)) {
+    return file;
+  }
+  return OpenShared(path, options);
+}
+
+size_t MemoryMappedFile::SharedMappingCount() {
+  SharedMappingRegistry& registry = Registry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto isInUse = [](const auto& entry) { return !entry.second.expired(); };
+  return std::count_if(registry.mappings.begin(), registry.mappings.end(),
+                       isInUse) +
+         std::count_if(registry.copies.begin(), registry.copies.end(),
+                       isInUse);
+}
+
+bool MemoryMappedFile::StatFile(const char* path, FileIdentity* identity) {
+  struct stat sb;
+  if (stat(path, &sb) == -1) {
+    return false;
+  }
+  *identity = IdentityOf(sb);
+  return true;
+}
+
+bool MemoryMappedFile::StatFile(int fd, FileIdentity* identity) {
+  struct stat sb;
+  if (fstat(fd, &sb) == -1) {
+    return false;
+  }
+  *identity = IdentityOf(sb);
+  return true;
+}
+
 MemoryMappedFile::MemoryMappedFile(MemoryMappedFile&& other) noexcept
-    : fd_(std::exchange(other.fd_, -1)),
-      data_(std::exchange(other.data_, nullptr)),
-      length_(std::exchange(other.length_, -1)) {}
+    : data_(std::exchange(other.data_, nullptr)),
+      length_(std::exchange(other.length_, 0)),
+      locked_(std::exchange(other.locked_, false)),
+      copied_(std::exchange(other.copied_, false)),
+      identity_(std::exchange(other.identity_, FileIdentity())) {}
 
 MemoryMappedFile& MemoryMappedFile::operator=(
     MemoryMappedFile&& other) noexcept {
   close();
-  fd_ = std::exchange(other.fd_, -1);
   data_ = std::exchange(other.data_, nullptr);
   length_ = std::exchange(other.length_, 0);
+  locked_ = std::exchange(other.locked_, false);
+  copied_ = std::exchange(other.copied_, false);
+  identity_ = std::exchange(other.identity_, FileIdentity());
   return *this;
 }
 
 MemoryMappedFile::~MemoryMappedFile() { close(); }
 
-bool MemoryMappedFile::open(const char* path) {
+bool MemoryMappedFile::open(const char* path) { return open(path, Options()); }
+
+bool MemoryMappedFile::open(const char* path, const Options& options) {
   if (data_) {
     return false;
   }
 
-  fd_ = ::open(path, O_RDONLY);
-  if (fd_ == -1) {
+  int fd = ::open(path, O_RDONLY);
+  if (fd == -1) {
     return false;
   }
 
-  struct stat sb;
-  if (fstat(fd_, &sb) == -1) {
-    ::close(fd_);
-    fd_ = -1;
+  // A copy is made again if the file is written to while it is being read,
+  // so that the copy is of one version of the file.
+  bool opened = false;
+  for (int attempt = 0; attempt < kMaxCopyAttempts && !opened; ++attempt) {
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || sb.st_size == 0) {
+      break;
+    }
+    length_ = static_cast<size_t>(sb.st_size);
+    identity_ = IdentityOf(sb);
+    if (!options.copy) {
+      opened = map(fd, options);
+      break;
+    }
+    opened = copy(fd) && fstat(fd, &sb) == 0 && IdentityOf(sb) == identity_;
+    if (!opened) {
+      close();
+    }
+  }
+
+  // The mapping holds its own reference to the file.
+  ::close(fd);
+  if (!opened) {
+    close();
+    length_ = 0;
+    identity_ = FileIdentity();
     return false;
   }
+  return true;
+}
 
-  length_ = static_cast<size_t>(sb.st_size);
+bool MemoryMappedFile::map(int fd, const Options& options) {
+  int flags = MAP_SHARED;
+#if defined(MAP_POPULATE)
+  if (options.populate) {
+    flags |= MAP_POPULATE;
+  }
+#endif
 
-  data_ = mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd_, 0);
-  if (data_ == nullptr) {
-    ::close(fd_);
-    fd_ = -1;
-    length_ = 0;
+  void* data = MAP_FAILED;
+#if defined(__linux__)
+  if (options.hugePages && length_ >= kHugePageSize) {
+    data = MapAlignedToHugePages(length_, flags, fd);
+  }
+#endif
+  if (data == MAP_FAILED) {
+    data = mmap(nullptr, length_, PROT_READ, flags, fd, 0);
+  }
+  if (data == MAP_FAILED) {
     return false;
   }
+  data_ = data;
+
+  if (options.accessPattern != AccessPattern::NORMAL) {
+    setAccessPattern(options.accessPattern);
+  }
+  if (options.willNeed) {
+    madvise(data_, length_, MADV_WILLNEED);
+  }
 
+#if !defined(MAP_POPULATE)
+  if (options.populate) {
+    // Touch every page to fault it in.
+    const volatile char* bytes = data();
+    char sum = 0;
+    for (size_t i = 0; i < length_; i += PageSize()) {
+      sum = static_cast<char>(sum + bytes[i]);
+    }
+    static_cast<void>(sum);
+  }
+#endif
+
+  if (options.lock) {
+    locked_ = mlock(data_, length_) == 0;
+  }
+  return true;
+}
+
+bool MemoryMappedFile::copy(int fd) {
+  auto* buffer = new char[length_];
+  data_ = buffer;
+  copied_ = true;
+
+  size_t offset = 0;
+  while (offset < length_) {
+    ssize_t n = pread(fd, buffer + offset, length_ - offset,
+                      static_cast<off_t>(offset));
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      // The file was truncated, or cannot be read.
+      return false;
+    }
+    offset += static_cast<size_t>(n);
+  }
   return true;
 }
 
@@ -82,11 +355,54 @@ void MemoryMappedFile::close() {
   if (data_ == nullptr) {
     return;
   }
-  munmap(data_, length_);
-  ::close(fd_);
-  fd_ = -1;
+  if (copied_) {
+    delete[] static_cast<char*>(data_);
+  } else {
+    if (locked_) {
+      munlock(data_, length_);
+    }
+    munmap(data_, length_);
+  }
   length_ = 0;
   data_ = nullptr;
+  locked_ = false;
+  copied_ = false;
+  identity_ = FileIdentity();
+}
+
+bool MemoryMappedFile::isUpToDate(const char* path) const {
+  FileIdentity identity;
+  return data_ != nullptr && StatFile(path, &identity) &&
+         identity == identity_;
+}
+
+void MemoryMappedFile::prefetch(size_t offset, size_t length) const {
+  if (data_ == nullptr || copied_ || offset >= length_) {
+    return;
+  }
+  length = std::min(length, length_ - offset);
+
+  // madvise() takes page-aligned addresses.
+  size_t alignedOffset = offset & ~(PageSize() - 1);
+  madvise(static_cast<char*>(data_) + alignedOffset,
+          length + offset - alignedOffset, MADV_WILLNEED);
+}
+
+void MemoryMappedFile::setAccessPattern(AccessPattern accessPattern) const {
+  if (data_ == nullptr || copied_) {
+    return;
+  }
+  switch (accessPattern) {
+    case AccessPattern::NORMAL:
+      madvise(data_, length_, MADV_NORMAL);
+      break;
+    case AccessPattern::RANDOM:
+      madvise(data_, length_, MADV_RANDOM);
+      break;
+    case AccessPattern::SEQUENTIAL:
+      madvise(data_, length_, MADV_SEQUENTIAL);
+      break;
+  }
 }
 
 }  // namespace McBopomofo
@@ -25,17 +25,113 @@
 #define SRC_ENGINE_MEMORYMAPPEDFILE_H_
 
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 
 namespace McBopomofo {
 
 // A wrapper for managing a memory-mapped file.
 //
 // On POSIX systems, we obtain a readable (PROT_READ) shared page (MAP_SHARED),
-// and *file content* changes are reflected in the mapped memory. This class
-// does not track the underlying file: it is up to the user of this class to
-// decide what to do when the underlying file gets updated, resized, or removed.
+// and *file content* changes are reflected in the mapped memory. Rewriting the
+// file in place while it is mapped may therefore show half-written rows, and
+// truncating it makes reads past the new end fault. Files should be replaced
+// instead, for example by writing a new file and renaming it over the old
+// one, which leaves the old mapping as it was. isUpToDate() and Reopen() tell
+// when that has happened, and map the new file. Small files that are edited
+// in place should be opened as a copy instead. See Options::copy.
+//
+// The options tell the system how the data will be read, so that it can read
+// ahead or not, and whether the data is wanted in memory upfront. All of them
+// are hints: the ones the system does not support, or refuses, are ignored.
+//
+// The file descriptor is closed as soon as the file is mapped, since the
+// mapping keeps the file open by itself.
+//
+// Models that only read a file should obtain it with OpenShared(), so that
+// opening the same file again, for example upon a reload, or from another
+// model or tool in the same process, uses the same mapping.
 class MemoryMappedFile {
  public:
+  // How the data will be accessed, as given to madvise().
+  enum class AccessPattern {
+    NORMAL,
+    // For example, binary searches over the rows. Pages are not read ahead.
+    RANDOM,
+    // For example, parsing the data from start to end. Pages are read ahead
+    // aggressively, and may be dropped soon after they are read.
+    SEQUENTIAL,
+  };
+
+  struct Options {
+    AccessPattern accessPattern = AccessPattern::NORMAL;
+
+    // Starts reading the whole file into memory in the background, so that
+    // the first accesses do not wait for the disk.
+    bool willNeed = false;
+
+    // Reads the whole file and maps all of its pages in upon open, so that
+    // no access takes a page fault. This makes the open take longer.
+    bool populate = false;
+
+    // Locks the pages in memory, so that they are never paged out. This is
+    // subject to the limit on locked memory of the process.
+    bool lock = false;
+
+    // Asks for the data to be mapped with huge pages, which take fewer TLB
+    // entries. Only on Linux, and only where the kernel supports transparent
+    // huge pages for files.
+    bool hugePages = false;
+
+    // Reads the file into a buffer of its own instead of mapping it, for
+    // small files that are edited often, such as the user phrases. The data
+    // is then the file as it was upon open, however the file is written to
+    // afterwards. If the file is written to while it is read, it is read
+    // again. The options above do not apply to copies.
+    bool copy = false;
+  };
+
+  // What tells one version of a file from another: the same file has the
+  // same device and inode, and a file that has been written to has a new
+  // modification time, and usually a new size.
+  struct FileIdentity {
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    // In nanoseconds since the epoch.
+    int64_t modificationTime = 0;
+    uint64_t size = 0;
+
+    bool operator==(const FileIdentity& other) const {
+      return device == other.device && inode == other.inode &&
+             modificationTime == other.modificationTime && size == other.size;
+    }
+    bool operator!=(const FileIdentity& other) const {
+      return !(*this == other);
+    }
+  };
+
+  // Returns the mapping of the file at path, shared with everyone in the
+  // process who has it open, or nullptr if the file cannot be opened. The
+  // mappings are kept in a registry keyed by the identity of the file, and
+  // are unmapped when the last of their users releases them. Once the file
+  // changes on disk, the next call maps it again, while the users of the old
+  // mapping keep it until they release it. The options are used only by the
+  // call that maps the file.
+  static std::shared_ptr<const MemoryMappedFile> OpenShared(const char* path);
+  static std::shared_ptr<const MemoryMappedFile> OpenShared(
+      const char* path, const Options& options);
+
+  // Returns file if it is still the file at path, or else OpenShared(path,
+  // options). This does not change file, and so its users can keep reading it
+  // until they switch to the new mapping, which is complete when returned.
+  // file may be nullptr.
+  static std::shared_ptr<const MemoryMappedFile> Reopen(
+      const std::shared_ptr<const MemoryMappedFile>& file, const char* path,
+      const Options& options);
+
+  // The number of mappings in the registry that are in use.
+  static size_t SharedMappingCount();
+
   MemoryMappedFile() = default;
   MemoryMappedFile(MemoryMappedFile&& other) noexcept;
   MemoryMappedFile& operator=(MemoryMappedFile&& other) noexcept;
@@ -45,7 +141,12 @@ class MemoryMappedFile {
   MemoryMappedFile(const MemoryMappedFile&) = delete;
 
   ~MemoryMappedFile();
+
+  // Returns false if the file cannot be opened, or is empty, since an empty
+  // file cannot be mapped, or if it is to be copied but keeps changing while
+  // it is read.
   bool open(const char* path);
+  bool open(const char* path, const Options& options);
   void close();
 
   [[nodiscard]] const char* data() const {
@@ -55,10 +156,44 @@ class MemoryMappedFile {
   // Returns the length of the data, which is the length of the file upon open.
   [[nodiscard]] size_t length() const { return length_; }
 
+  // Starts reading the range of the data into memory in the background. The
+  // range is clamped to the data.
+  void prefetch(size_t offset, size_t length) const;
+
+  // Changes how the data will be accessed from now on, for example once data
+  // that has been parsed sequentially is only looked up.
+  void setAccessPattern(AccessPattern accessPattern) const;
+
+  // Whether the pages were locked in memory upon open.
+  [[nodiscard]] bool isLocked() const { return locked_; }
+
+  // Whether the data is a copy of the file. See Options::copy.
+  [[nodiscard]] bool isCopy() const { return copied_; }
+
+  // The identity of the file upon open.
+  [[nodiscard]] const FileIdentity& identity() const { return identity_; }
+
+  // Whether the file at path is the file as it was upon open, that is, it has
+  // not been written to, replaced, or removed since. This takes a stat() call,
+  // and so is cheap enough to decide whether a reload is needed at all.
+  [[nodiscard]] bool isUpToDate(const char* path) const;
+
+  // Returns the identity of the file at path, or false if it cannot be
+  // obtained.
+  static bool StatFile(const char* path, FileIdentity* identity);
+
+  // Returns the identity of the open file, or false if it cannot be obtained.
+  static bool StatFile(int fd, FileIdentity* identity);
+
  private:
-  int fd_ = -1;           // POSIX file descriptor used by the mmap call
-  void* data_ = nullptr;  // actual mapped data
+  bool map(int fd, const Options& options);
+  bool copy(int fd);
+
+  void* data_ = nullptr;  // actual mapped data, or the copy
   size_t length_ = 0;
+  bool locked_ = false;
+  bool copied_ = false;
+  FileIdentity identity_;
 };
 
 }  // namespace McBopomofo
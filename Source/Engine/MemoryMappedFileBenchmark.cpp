@@ -0,0 +1,154 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "MemoryMappedFile.h"
+#include "ParselessLM.h"
+
+namespace {
+
+using McBopomofo::MemoryMappedFile;
+using McBopomofo::ParselessLM;
+
+// About the size of the shipped language model.
+constexpr int kReadings = 150000;
+constexpr int kValuesPerReading = 4;
+constexpr int kLookups = 32;
+
+std::string Reading(int r) { return "r" + std::to_string(100000 + r); }
+
+const std::string& DataPath() {
+  static const std::string path = []() {
+    std::filesystem::path p =
+        std::filesystem::temp_directory_path() /
+        "org.openvanilla.mcbopomofo.memorymappedfilebenchmark.txt";
+    std::ofstream file(p, std::ios::binary | std::ios::trunc);
+    file << McBopomofo::SORTED_PRAGMA_HEADER;
+    for (int r = 0; r < kReadings; ++r) {
+      for (int v = 0; v < kValuesPerReading; ++v) {
+        file << Reading(r) << " v" << r << "_" << v << " " << -2.0 - v
+             << "\n";
+      }
+    }
+    return p.string();
+  }();
+  return path;
+}
+
+// Drops the file from the page cache, so that the next open finds it on
+// disk, as after a reboot. Returns false if the system cannot do that.
+bool EvictFromPageCache(const std::string& path) {
+#if defined(POSIX_FADV_DONTNEED)
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  // Dirty pages cannot be dropped.
+  fdatasync(fd);
+  bool evicted = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  close(fd);
+  return evicted;
+#else
+  static_cast<void>(path);
+  return false;
+#endif
+}
+
+MemoryMappedFile::Options OptionsForArg(int64_t arg) {
+  MemoryMappedFile::Options options;
+  switch (arg) {
+    case 0:
+      break;
+    case 1:
+      options.accessPattern = MemoryMappedFile::AccessPattern::RANDOM;
+      break;
+    case 2:
+      options = ParselessLM::kMappingOptions;
+      break;
+    case 3:
+      options.populate = true;
+      break;
+    case 4:
+      options = ParselessLM::kMappingOptions;
+      options.hugePages = true;
+      break;
+  }
+  return options;
+}
+
+// Opens the language model with its file evicted from the page cache, and
+// looks up a few readings scattered across it, as the first keystrokes after
+// a launch do. The time is that of the open and the lookups, and first_us is
+// the time of the first lookup alone.
+void BM_ParselessLMColdOpenAndLookup(benchmark::State& state) {
+  const std::string& path = DataPath();
+  MemoryMappedFile::Options options = OptionsForArg(state.range(0));
+  std::vector<std::string> keys;
+  for (int i = 0; i < kLookups; ++i) {
+    keys.push_back(Reading((i * 7919) % kReadings));
+  }
+
+  double firstLookupTime = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    if (!EvictFromPageCache(path)) {
+      state.SkipWithError("Cannot evict the file from the page cache");
+      break;
+    }
+    state.ResumeTiming();
+
+    ParselessLM lm;
+    lm.open(path.c_str(), options);
+    auto start = std::chrono::steady_clock::now();
+    benchmark::DoNotOptimize(lm.getUnigrams(keys[0]));
+    firstLookupTime += std::chrono::duration<double, std::micro>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    for (int i = 1; i < kLookups; ++i) {
+      benchmark::DoNotOptimize(lm.getUnigrams(keys[i]));
+    }
+
+    state.PauseTiming();
+    lm.close();
+    state.ResumeTiming();
+  }
+  state.counters["first_us"] =
+      benchmark::Counter(firstLookupTime, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_ParselessLMColdOpenAndLookup)
+    ->ArgName("options")
+    ->DenseRange(0, 4)
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -21,6 +21,8 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
 #include <filesystem>
 #include <fstream>
@@ -124,4 +126,235 @@ TEST(MemoryMappedFileTest, BasicFunctionalities) {
   EXPECT_EQ(mf5.data(), nullptr);
 }
 
+class MemoryMappedFileOptionsTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = std::filesystem::temp_directory_path() /
+            ("org.openvanilla.mcbopomofo.memorymappedfiletest." +
+             std::string(::testing::UnitTest::GetInstance()
+                             ->current_test_info()
+                             ->name()));
+  }
+
+  void TearDown() override { std::filesystem::remove(path_); }
+
+  // Writes a file of the length, with the byte at each offset being the
+  // offset modulo 251.
+  void WriteFile(size_t length) {
+    std::string data(length, 0);
+    for (size_t i = 0; i < length; ++i) {
+      data[i] = static_cast<char>(i % 251);
+    }
+    std::ofstream(path_, std::ios::binary | std::ios::trunc) << data;
+  }
+
+  static bool HasExpectedData(const MemoryMappedFile& mf, size_t length) {
+    if (mf.length() != length) {
+      return false;
+    }
+    for (size_t i = 0; i < length; ++i) {
+      if (mf.data()[i] != static_cast<char>(i % 251)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::filesystem::path path_;
+};
+
+TEST_F(MemoryMappedFileOptionsTest, EmptyFileCannotBeOpened) {
+  WriteFile(0);
+  MemoryMappedFile mf;
+  EXPECT_FALSE(mf.open(path_.c_str()));
+  EXPECT_EQ(mf.length(), 0);
+  EXPECT_EQ(mf.data(), nullptr);
+}
+
+TEST_F(MemoryMappedFileOptionsTest, OptionsDoNotChangeTheData) {
+  // Larger than a huge page, and not a multiple of the page size.
+  constexpr size_t kLength = 3 * 1024 * 1024 + 123;
+  WriteFile(kLength);
+
+  for (auto accessPattern : {MemoryMappedFile::AccessPattern::NORMAL,
+                             MemoryMappedFile::AccessPattern::RANDOM,
+                             MemoryMappedFile::AccessPattern::SEQUENTIAL}) {
+    for (int flags = 0; flags < 16; ++flags) {
+      MemoryMappedFile::Options options;
+      options.accessPattern = accessPattern;
+      options.willNeed = flags & 1;
+      options.populate = flags & 2;
+      options.lock = flags & 4;
+      options.hugePages = flags & 8;
+
+      MemoryMappedFile mf;
+      ASSERT_TRUE(mf.open(path_.c_str(), options)) << flags;
+      EXPECT_TRUE(HasExpectedData(mf, kLength)) << flags;
+      if (!options.lock) {
+        EXPECT_FALSE(mf.isLocked());
+      }
+#if defined(__linux__)
+      // File-backed huge pages need the mapping to be aligned to them.
+      if (options.hugePages) {
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(mf.data()) % (2 * 1024 * 1024),
+                  0);
+      }
+#endif
+
+      // Moving keeps the mapping, and leaves the other instance closed.
+      MemoryMappedFile moved(std::move(mf));
+      EXPECT_EQ(mf.data(), nullptr);
+      EXPECT_EQ(mf.length(), 0);
+      EXPECT_FALSE(mf.isLocked());
+      EXPECT_TRUE(HasExpectedData(moved, kLength)) << flags;
+    }
+  }
+}
+
+TEST_F(MemoryMappedFileOptionsTest, PrefetchAndAccessPatternChanges) {
+  constexpr size_t kLength = 100000;
+  WriteFile(kLength);
+
+  MemoryMappedFile mf;
+  // These are no-ops before the file is opened.
+  mf.prefetch(0, kLength);
+  mf.setAccessPattern(MemoryMappedFile::AccessPattern::RANDOM);
+
+  ASSERT_TRUE(mf.open(path_.c_str(),
+                      {MemoryMappedFile::AccessPattern::SEQUENTIAL}));
+  mf.prefetch(0, kLength);
+  mf.prefetch(12345, 100);
+  mf.prefetch(kLength - 1, 1000);
+  mf.prefetch(kLength, 1);
+  mf.prefetch(kLength * 2, SIZE_MAX);
+  mf.setAccessPattern(MemoryMappedFile::AccessPattern::RANDOM);
+  mf.setAccessPattern(MemoryMappedFile::AccessPattern::NORMAL);
+  EXPECT_TRUE(HasExpectedData(mf, kLength));
+}
+
+TEST_F(MemoryMappedFileOptionsTest, SharedMappingsOfTheSameFileAreReused) {
+  constexpr size_t kLength = 100000;
+  WriteFile(kLength);
+  size_t count = MemoryMappedFile::SharedMappingCount();
+
+  auto mf1 = MemoryMappedFile::OpenShared(path_.c_str());
+  ASSERT_NE(mf1, nullptr);
+  EXPECT_TRUE(HasExpectedData(*mf1, kLength));
+  EXPECT_EQ(MemoryMappedFile::SharedMappingCount(), count + 1);
+
+  // The options are only used by the first open.
+  auto mf2 = MemoryMappedFile::OpenShared(
+      path_.c_str(), {MemoryMappedFile::AccessPattern::RANDOM});
+  EXPECT_EQ(mf2, mf1);
+
+  // A hard link is the same file.
+  std::filesystem::path link = path_.string() + ".link";
+  std::filesystem::remove(link);
+  std::filesystem::create_hard_link(path_, link);
+  auto mf3 = MemoryMappedFile::OpenShared(link.c_str());
+  EXPECT_EQ(mf3, mf1);
+  std::filesystem::remove(link);
+  EXPECT_EQ(MemoryMappedFile::SharedMappingCount(), count + 1);
+
+  // The mapping is gone once the last user releases it.
+  mf1 = nullptr;
+  mf2 = nullptr;
+  EXPECT_EQ(MemoryMappedFile::SharedMappingCount(), count + 1);
+  mf3 = nullptr;
+  EXPECT_EQ(MemoryMappedFile::SharedMappingCount(), count);
+}
+
+TEST_F(MemoryMappedFileOptionsTest, ChangedFilesAreMappedAgain) {
+  constexpr size_t kLength = 100000;
+  WriteFile(kLength);
+  size_t count = MemoryMappedFile::SharedMappingCount();
+
+  auto oldFile = MemoryMappedFile::OpenShared(path_.c_str());
+  ASSERT_NE(oldFile, nullptr);
+
+  // Replace the file, as editors do.
+  std::filesystem::path original = path_;
+  path_ = original.string() + ".new";
+  WriteFile(kLength * 2);
+  std::filesystem::rename(path_, original);
+  path_ = original;
+
+  auto newFile = MemoryMappedFile::OpenShared(path_.c_str());
+  ASSERT_NE(newFile, nullptr);
+  EXPECT_NE(newFile, oldFile);
+  EXPECT_NE(newFile->identity(), oldFile->identity());
+  EXPECT_TRUE(HasExpectedData(*newFile, kLength * 2));
+  EXPECT_EQ(MemoryMappedFile::SharedMappingCount(), count + 2);
+
+  // The old mapping stays valid for those who still have it.
+  EXPECT_TRUE(HasExpectedData(*oldFile, kLength));
+  EXPECT_EQ(MemoryMappedFile::OpenShared(path_.c_str()), newFile);
+
+  oldFile = nullptr;
+  EXPECT_EQ(MemoryMappedFile::SharedMappingCount(), count + 1);
+
+  // A file that cannot be opened is not shared.
+  std::filesystem::remove(path_);
+  EXPECT_EQ(MemoryMappedFile::OpenShared(path_.c_str()), nullptr);
+}
+
+TEST_F(MemoryMappedFileOptionsTest, CopiesDoNotChangeWithTheFile) {
+  constexpr size_t kLength = 100000;
+  WriteFile(kLength);
+
+  MemoryMappedFile::Options options;
+  options.copy = true;
+  MemoryMappedFile mf;
+  ASSERT_TRUE(mf.open(path_.c_str(), options));
+  EXPECT_TRUE(mf.isCopy());
+  EXPECT_TRUE(mf.isUpToDate(path_.c_str()));
+  mf.prefetch(0, kLength);
+  mf.setAccessPattern(MemoryMappedFile::AccessPattern::RANDOM);
+
+  // Truncating and rewriting the file in place, which would make reading a
+  // mapping of it fault, leaves the copy as it was.
+  WriteFile(kLength / 2);
+  EXPECT_FALSE(mf.isUpToDate(path_.c_str()));
+  EXPECT_TRUE(HasExpectedData(mf, kLength));
+
+  MemoryMappedFile moved(std::move(mf));
+  EXPECT_FALSE(mf.isCopy());
+  EXPECT_TRUE(moved.isCopy());
+  EXPECT_TRUE(HasExpectedData(moved, kLength));
+  moved.close();
+  EXPECT_FALSE(moved.isCopy());
+  EXPECT_EQ(moved.data(), nullptr);
+}
+
+TEST_F(MemoryMappedFileOptionsTest, ReopenMapsOnlyChangedFiles) {
+  constexpr size_t kLength = 100000;
+  WriteFile(kLength);
+
+  MemoryMappedFile::Options options;
+  options.copy = true;
+  auto mapped = MemoryMappedFile::Reopen(nullptr, path_.c_str(), {});
+  auto copied = MemoryMappedFile::Reopen(nullptr, path_.c_str(), options);
+  ASSERT_NE(mapped, nullptr);
+  ASSERT_NE(copied, nullptr);
+  EXPECT_FALSE(mapped->isCopy());
+  EXPECT_TRUE(copied->isCopy());
+
+  EXPECT_EQ(MemoryMappedFile::Reopen(mapped, path_.c_str(), {}), mapped);
+  EXPECT_EQ(MemoryMappedFile::Reopen(copied, path_.c_str(), options), copied);
+
+  // Writing to the file, even without changing its size, makes a new one.
+  std::filesystem::last_write_time(
+      path_, std::filesystem::last_write_time(path_) + std::chrono::seconds(1));
+  auto copied2 = MemoryMappedFile::Reopen(copied, path_.c_str(), options);
+  ASSERT_NE(copied2, nullptr);
+  EXPECT_NE(copied2, copied);
+  EXPECT_TRUE(copied2->isUpToDate(path_.c_str()));
+  EXPECT_TRUE(HasExpectedData(*copied2, kLength));
+
+  std::filesystem::remove(path_);
+  EXPECT_FALSE(copied2->isUpToDate(path_.c_str()));
+  EXPECT_EQ(MemoryMappedFile::Reopen(copied2, path_.c_str(), options),
+            nullptr);
+}
+
 }  // namespace McBopomofo
@@ -28,6 +28,9 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <string>
 #include <string_view>
@@ -36,40 +39,25 @@
 
 namespace McBopomofo {
 
-bool ParselessLM::isLoaded() const { return db_ != nullptr; }
-
-bool ParselessLM::open(const char* path) {
-  if (!mmapedFile_.open(path)) {
-    return false;
-  }
-  db_ = std::unique_ptr<ParselessPhraseDB>(new ParselessPhraseDB(
-      mmapedFile_.data(), mmapedFile_.length(), /*validate_pragma=*/true));
-  return true;
-}
-
-void ParselessLM::close() {
-  mmapedFile_.close();
-  db_ = nullptr;
-}
+namespace {
 
-bool ParselessLM::open(std::unique_ptr<ParselessPhraseDB> db) {
-  if (db_ != nullptr) {
-    return false;
-  }
-
-  db_ = std::move(db);
-  return true;
+// Parses the score without making a std::string out of it.
+double ParseScore(const char* begin, const char* end) {
+  char buf[64];
+  size_t len = std::min(static_cast<size_t>(end - begin), sizeof(buf) - 1);
+  memcpy(buf, begin, len);
+  buf[len] = 0;
+  return strtod(buf, nullptr);
 }
 
-std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-ParselessLM::getUnigrams(const std::string& key) {
-  if (db_ == nullptr) {
-    return {};
-  }
-
+// Returns view unigrams of the rows. See Unigram for the lifetime rules.
+std::vector<Formosa::Gramambular2::LanguageModel::Unigram> RowsToUnigrams(
+    const std::vector<std::string_view>& rows,
+    const std::shared_ptr<const void>& storage) {
   std::vector<Formosa::Gramambular2::LanguageModel::Unigram> results;
-  for (const auto& row : db_->findRows(key + " ")) {
-    std::string value;
+  results.reserve(rows.size());
+  for (const auto& row : rows) {
+    std::string_view value;
     double score = 0;
 
     // Move ahead until we encounter the first space. This is the key.
@@ -94,7 +82,7 @@ ParselessLM::getUnigrams(const std::string& key) {
       while (it != row.end() && *it != ' ') {
         ++it;
       }
-      value = std::string(value_begin, it);
+      value = std::string_view(value_begin, it - value_begin);
     }
 
     // Read past the space. The remainder, if it exists, is the score.
@@ -103,14 +91,130 @@ ParselessLM::getUnigrams(const std::string& key) {
     }
 
     if (it != row.end()) {
-      score = std::stod(std::string(it, row.end()));
+      score = ParseScore(it, row.end());
     }
-    results.emplace_back(std::move(value), score);
+    results.emplace_back(value, score, storage);
   }
   return results;
 }
 
+}  // namespace
+
+bool ParselessLM::isLoaded() const { return db_ != nullptr; }
+
+bool ParselessLM::isIndexed() const { return db_ != nullptr && db_->hasIndex(); }
+
+bool ParselessLM::open(const char* path) {
+  return open(path, kMappingOptions);
+}
+
+bool ParselessLM::open(const char* path,
+                       const MemoryMappedFile::Options& options) {
+  if (mmapedFile_ != nullptr) {
+    return false;
+  }
+
+  mmapedFile_ = MemoryMappedFile::OpenShared(path, options);
+  if (mmapedFile_ == nullptr) {
+    return false;
+  }
+  db_ = std::unique_ptr<ParselessPhraseDB>(new ParselessPhraseDB(
+      mmapedFile_->data(), mmapedFile_->length(), /*validate_pragma=*/true));
+
+  // Use the compiled index if there is one.
+  std::string indexPath = std::string(path) + std::string(SORTED_INDEX_SUFFIX);
+  mmapedIndexFile_ = MemoryMappedFile::OpenShared(indexPath.c_str(), options);
+  if (mmapedIndexFile_ != nullptr &&
+      !db_->attachIndex(mmapedIndexFile_->data(), mmapedIndexFile_->length())) {
+    mmapedIndexFile_ = nullptr;
+  }
+  return true;
+}
+
+void ParselessLM::close() {
+  // Unigrams obtained from the file may still refer to it, and so it is only
+  // unmapped when the last of them is gone.
+  mmapedFile_ = nullptr;
+  mmapedIndexFile_ = nullptr;
+  db_ = nullptr;
+}
+
+bool ParselessLM::isUpToDate(const char* path) const {
+  if (mmapedFile_ == nullptr || !mmapedFile_->isUpToDate(path)) {
+    return false;
+  }
+
+  // The index must not have been added, replaced, or removed either.
+  std::string indexPath = std::string(path) + std::string(SORTED_INDEX_SUFFIX);
+  if (mmapedIndexFile_ != nullptr) {
+    return mmapedIndexFile_->isUpToDate(indexPath.c_str());
+  }
+  MemoryMappedFile::FileIdentity identity;
+  return !MemoryMappedFile::StatFile(indexPath.c_str(), &identity);
+}
+
+bool ParselessLM::open(std::unique_ptr<ParselessPhraseDB> db) {
+  if (db_ != nullptr) {
+    return false;
+  }
+
+  db_ = std::move(db);
+  return true;
+}
+
+std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
+ParselessLM::getUnigrams(const std::string& key) {
+  return std::as_const(*this).getUnigrams(key);
+}
+
+std::vector<std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>
+ParselessLM::batchGetUnigrams(const std::vector<std::string>& keys) {
+  return std::as_const(*this).batchGetUnigrams(keys);
+}
+
 bool ParselessLM::hasUnigrams(const std::string& key) {
+  return std::as_const(*this).hasUnigrams(key);
+}
+
+bool ParselessLM::hasKeyWithPrefix(const std::string& prefix) {
+  return std::as_const(*this).hasKeyWithPrefix(prefix);
+}
+
+std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
+ParselessLM::getUnigrams(const std::string& key) const {
+  if (db_ == nullptr) {
+    return {};
+  }
+
+  return RowsToUnigrams(db_->findRows(key + " "), mmapedFile_);
+}
+
+std::vector<std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>
+ParselessLM::batchGetUnigrams(const std::vector<std::string>& keys) const {
+  if (db_ == nullptr) {
+    return std::vector<
+        std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>(
+        keys.size());
+  }
+
+  // As in getUnigrams(), append a space to each key for exact matches.
+  std::vector<std::string> actualKeys;
+  actualKeys.reserve(keys.size());
+  for (const auto& key : keys) {
+    actualKeys.push_back(key + " ");
+  }
+  std::vector<std::string_view> keyViews(actualKeys.begin(), actualKeys.end());
+
+  std::vector<std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>
+      results;
+  results.reserve(keys.size());
+  for (const auto& rows : db_->batchFindRows(keyViews)) {
+    results.push_back(RowsToUnigrams(rows, mmapedFile_));
+  }
+  return results;
+}
+
+bool ParselessLM::hasUnigrams(const std::string& key) const {
   if (db_ == nullptr) {
     return false;
   }
@@ -118,6 +222,14 @@ bool ParselessLM::hasUnigrams(const std::string& key) {
   return db_->findFirstMatchingLine(key + " ") != nullptr;
 }
 
+bool ParselessLM::hasKeyWithPrefix(const std::string& prefix) const {
+  if (db_ == nullptr) {
+    return false;
+  }
+
+  return db_->hasRowWithPrefix(prefix);
+}
+
 std::vector<ParselessLM::FoundReading> ParselessLM::getReadings(
     const std::string& value) const {
   if (db_ == nullptr) {
@@ -43,15 +43,53 @@ class ParselessLM : public Formosa::Gramambular2::LanguageModel {
   ParselessLM& operator=(ParselessLM&&) = delete;
 
   bool isLoaded() const;
+
+  // Whether lookups use a compiled index.
+  bool isIndexed() const;
+
+  // The lookups binary-search the data, and so the files are mapped for
+  // random access, and read into memory in the background upon open.
+  static constexpr MemoryMappedFile::Options kMappingOptions = {
+      MemoryMappedFile::AccessPattern::RANDOM, /*willNeed=*/true};
+
+  // Opens the data file at path. If a compiled index exists at path plus
+  // SORTED_INDEX_SUFFIX and matches the data file, it is used for lookups.
+  // Both files are mapped with the options, kMappingOptions by default, and
+  // the mappings are shared with other models that open the same files. See
+  // MemoryMappedFile::OpenShared().
   bool open(const char* path);
+  bool open(const char* path, const MemoryMappedFile::Options& options);
   void close();
 
+  // Whether the files at path are the open files, unchanged since they were
+  // opened, in which case opening them again would give the same model.
+  bool isUpToDate(const char* path) const;
+
   // Allows the use of existing in-memory db.
   bool open(std::unique_ptr<ParselessPhraseDB> db);
 
+  // Returns view unigrams into the data. If the data is from a file, the
+  // unigrams keep the file mapped even after close(). If the data is from an
+  // in-memory db, the caller must keep the data alive as long as the unigrams.
   std::vector<Formosa::Gramambular2::LanguageModel::Unigram> getUnigrams(
       const std::string& key) override;
   bool hasUnigrams(const std::string& key) override;
+  bool hasKeyWithPrefix(const std::string& prefix) override;
+
+  // Looks up the keys in one pass over the db. See
+  // ParselessPhraseDB::batchFindRows().
+  std::vector<std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>
+  batchGetUnigrams(const std::vector<std::string>& keys) override;
+
+  // The same lookups, which only read the model, and so are safe to call
+  // from multiple threads at once as long as the model is not being opened
+  // or closed.
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> getUnigrams(
+      const std::string& key) const;
+  bool hasUnigrams(const std::string& key) const;
+  bool hasKeyWithPrefix(const std::string& prefix) const;
+  std::vector<std::vector<Formosa::Gramambular2::LanguageModel::Unigram>>
+  batchGetUnigrams(const std::vector<std::string>& keys) const;
 
   struct FoundReading {
     std::string reading;
@@ -62,7 +100,9 @@ class ParselessLM : public Formosa::Gramambular2::LanguageModel {
   std::vector<FoundReading> getReadings(const std::string& value) const;
 
  private:
-  MemoryMappedFile mmapedFile_;
+  // Shared with the view unigrams returned by getUnigrams(). See Unigram.
+  std::shared_ptr<const MemoryMappedFile> mmapedFile_;
+  std::shared_ptr<const MemoryMappedFile> mmapedIndexFile_;
   std::unique_ptr<ParselessPhraseDB> db_;
 };
 
@@ -22,11 +22,14 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
+#include "MemoryMappedFile.h"
 #include "ParselessLM.h"
 #include "gtest/gtest.h"
 
@@ -89,6 +92,169 @@ TEST(ParselessLMTest, ReturnsResults) {
   EXPECT_NEAR(readings[1].score, -3.59800309, 0.00000001);
 }
 
+TEST(ParselessLMTest, BatchGetUnigramsMatchesGetUnigrams) {
+  ParselessLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kSample, sizeof(kSample));
+  EXPECT_TRUE(lm.open(std::move(db)));
+
+  std::vector<std::string> keys = {"ㄅㄚ˙", "ㄅㄚ-ㄅㄞˇ", "ㄅ", "ㄅㄚ",
+                                   "ㄅㄚ-ㄅㄞˇ-ㄅㄚ"};
+  auto results = lm.batchGetUnigrams(keys);
+  ASSERT_EQ(results.size(), keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto unigrams = lm.getUnigrams(keys[i]);
+    ASSERT_EQ(results[i].size(), unigrams.size()) << "key: " << keys[i];
+    for (size_t j = 0; j < unigrams.size(); ++j) {
+      EXPECT_EQ(results[i][j].value(), unigrams[j].value());
+      EXPECT_EQ(results[i][j].score(), unigrams[j].score());
+    }
+  }
+  EXPECT_EQ(results[3].size(), 3);
+  EXPECT_TRUE(results[2].empty());
+}
+
+TEST(ParselessLMTest, KeyWithPrefix) {
+  ParselessLM lm;
+  EXPECT_FALSE(lm.hasKeyWithPrefix("ㄅㄚ-"));
+
+  auto db = std::make_unique<ParselessPhraseDB>(kSample, sizeof(kSample));
+  EXPECT_TRUE(lm.open(std::move(db)));
+  EXPECT_TRUE(lm.hasKeyWithPrefix("ㄅㄚ-"));
+  EXPECT_TRUE(lm.hasKeyWithPrefix("ㄅㄚ-ㄅㄞˇ"));
+  EXPECT_FALSE(lm.hasKeyWithPrefix("ㄅㄚ-ㄅㄞˇ-"));
+  EXPECT_FALSE(lm.hasKeyWithPrefix("ㄅㄚ˙-"));
+}
+
+TEST(ParselessLMTest, OpensCompiledIndex) {
+  std::filesystem::path path = std::filesystem::temp_directory_path() /
+                               "org.openvanilla.mcbopomofo.parselesslmtest.txt";
+  std::filesystem::path indexPath = path;
+  indexPath += SORTED_INDEX_SUFFIX;
+
+  // Skip the leading newline of the sample.
+  std::string data(kSample + 1);
+  std::ofstream(path, std::ios::binary) << data;
+
+  ParselessLM lm;
+  ASSERT_TRUE(lm.open(path.c_str()));
+  EXPECT_FALSE(lm.isIndexed());
+  lm.close();
+
+  std::ofstream(indexPath, std::ios::binary)
+      << ParselessPhraseDB::BuildIndex(data.c_str(), data.length());
+  ASSERT_TRUE(lm.open(path.c_str()));
+  EXPECT_TRUE(lm.isIndexed());
+  EXPECT_EQ(lm.getUnigrams("ㄅㄚ-ㄅㄞˇ").size(), 2);
+  EXPECT_EQ(lm.getUnigrams("ㄅㄚ").size(), 3);
+  EXPECT_TRUE(lm.hasUnigrams("ㄅㄚ˙"));
+  EXPECT_FALSE(lm.hasUnigrams("ㄅ"));
+  lm.close();
+
+  // A stale index is ignored.
+  std::ofstream(path, std::ios::binary) << data << "ㄅㄚ˙ 罷 -10\n";
+  ASSERT_TRUE(lm.open(path.c_str()));
+  EXPECT_FALSE(lm.isIndexed());
+  EXPECT_EQ(lm.getUnigrams("ㄅㄚ˙").size(), 2);
+  lm.close();
+
+  std::filesystem::remove(path);
+  std::filesystem::remove(indexPath);
+}
+
+TEST(ParselessLMTest, UnigramsOutliveCloseAndReload) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.parselesslmtest.lifetime.txt";
+  std::ofstream(path, std::ios::binary) << (kSample + 1);
+
+  ParselessLM lm;
+  ASSERT_TRUE(lm.open(path.c_str()));
+  auto unigrams = lm.getUnigrams("ㄅㄚ-ㄅㄞˇ");
+  lm.close();
+
+  // Replace the file (rather than overwriting it in place) and reload.
+  std::filesystem::remove(path);
+  std::ofstream(path, std::ios::binary)
+      << SORTED_PRAGMA_HEADER << "ㄅㄚ-ㄅㄞˇ 八佰 -5\n";
+  ASSERT_TRUE(lm.open(path.c_str()));
+
+  // The unigrams from before still refer to the old data.
+  ASSERT_EQ(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[0].valueView(), "八百");
+  EXPECT_EQ(unigrams[1].valueView(), "捌佰");
+  EXPECT_EQ(unigrams[1].rawValue(), "捌佰");
+
+  auto reloadedUnigrams = lm.getUnigrams("ㄅㄚ-ㄅㄞˇ");
+  ASSERT_EQ(reloadedUnigrams.size(), 1);
+  EXPECT_EQ(reloadedUnigrams[0].valueView(), "八佰");
+
+  // Copies share the same data, and the data stays valid after the LM is
+  // gone.
+  auto copy = reloadedUnigrams[0];
+  lm.close();
+  reloadedUnigrams.clear();
+  EXPECT_EQ(copy.valueView(), "八佰");
+  EXPECT_EQ(copy.score(), -5);
+
+  std::filesystem::remove(path);
+}
+
+TEST(ParselessLMTest, ModelsOpeningTheSameFileShareTheMapping) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.parselesslmtest.shared.txt";
+  std::ofstream(path, std::ios::binary) << (kSample + 1);
+  size_t count = MemoryMappedFile::SharedMappingCount();
+
+  ParselessLM lm1;
+  ParselessLM lm2;
+  ASSERT_TRUE(lm1.open(path.c_str()));
+  ASSERT_TRUE(lm2.open(path.c_str()));
+  EXPECT_EQ(MemoryMappedFile::SharedMappingCount(), count + 1);
+  EXPECT_EQ(lm1.getUnigrams("ㄅㄚ-ㄅㄞˇ")[0].valueView().data(),
+            lm2.getUnigrams("ㄅㄚ-ㄅㄞˇ")[0].valueView().data());
+
+  lm1.close();
+  EXPECT_EQ(lm2.getUnigrams("ㄅㄚ-ㄅㄞˇ").size(), 2);
+  lm2.close();
+  EXPECT_EQ(MemoryMappedFile::SharedMappingCount(), count);
+
+  std::filesystem::remove(path);
+}
+
+TEST(ParselessLMTest, IsUpToDateUntilTheFilesChange) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.parselesslmtest.uptodate.txt";
+  std::filesystem::path indexPath = path;
+  indexPath += SORTED_INDEX_SUFFIX;
+  std::string data(kSample + 1);
+  std::ofstream(path, std::ios::binary) << data;
+
+  ParselessLM lm;
+  EXPECT_FALSE(lm.isUpToDate(path.c_str()));
+  ASSERT_TRUE(lm.open(path.c_str()));
+  EXPECT_TRUE(lm.isUpToDate(path.c_str()));
+
+  // An index that was added since has not been used.
+  std::ofstream(indexPath, std::ios::binary)
+      << ParselessPhraseDB::BuildIndex(data.c_str(), data.length());
+  EXPECT_FALSE(lm.isUpToDate(path.c_str()));
+  lm.close();
+  ASSERT_TRUE(lm.open(path.c_str()));
+  ASSERT_TRUE(lm.isIndexed());
+  EXPECT_TRUE(lm.isUpToDate(path.c_str()));
+
+  std::filesystem::remove(indexPath);
+  EXPECT_FALSE(lm.isUpToDate(path.c_str()));
+  lm.close();
+  ASSERT_TRUE(lm.open(path.c_str()));
+  EXPECT_TRUE(lm.isUpToDate(path.c_str()));
+
+  std::filesystem::remove(path);
+  EXPECT_FALSE(lm.isUpToDate(path.c_str()));
+}
+
 TEST(ParselessLMTest, SanityCheckTest) {
   constexpr const char* data_path = "data.txt";
   if (!std::filesystem::exists(data_path)) {
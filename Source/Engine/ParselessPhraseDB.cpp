@@ -23,13 +23,87 @@
 
 #include "ParselessPhraseDB.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
+#include <limits>
 #include <string>
 #include <vector>
 
 namespace McBopomofo {
 
+namespace {
+
+constexpr uint32_t kIndexVersion = 3;
+constexpr size_t kIndexKeyPrefixLength = 12;
+
+constexpr size_t kIndexMagicOffset = 0;
+constexpr size_t kIndexVersionOffset = 8;
+constexpr size_t kIndexKeyPrefixLengthOffset = 12;
+constexpr size_t kIndexDataLengthOffset = 16;
+constexpr size_t kIndexRowCountOffset = 24;
+constexpr size_t kIndexFingerprintOffset = 32;
+constexpr size_t kIndexHeaderSize = 40;
+
+constexpr size_t kIndexRowSize = sizeof(uint32_t) + kIndexKeyPrefixLength;
+
+template <typename T>
+T ReadIndexValue(const char* ptr) {
+  T value;
+  memcpy(&value, ptr, sizeof(T));
+  return value;
+}
+
+template <typename T>
+void AppendIndexValue(std::string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+constexpr uint64_t kFingerprintPrime = 1099511628211ULL;
+constexpr uint64_t kFingerprintOffsetBasis = 14695981039346656037ULL;
+constexpr size_t kFingerprintSampleCount = 64;
+constexpr size_t kFingerprintSampleLength = 64;
+
+// FNV-1a over the bytes in 8-byte little-endian words, followed by the
+// remaining bytes one at a time.
+uint64_t HashBytes(uint64_t hash, const char* data, size_t length) {
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(uint64_t));
+    hash = (hash ^ word) * kFingerprintPrime;
+  }
+  for (; i < length; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * kFingerprintPrime;
+  }
+  return hash;
+}
+
+// The fingerprint of the database described by an index. See
+// SORTED_INDEX_MAGIC. Only a fixed number of samples are read, so that
+// checking an index does not page in the whole database.
+uint64_t IndexFingerprint(const char* data, size_t length) {
+  uint64_t hash = (kFingerprintOffsetBasis ^ static_cast<uint64_t>(length)) *
+                  kFingerprintPrime;
+  constexpr size_t kSampledLength =
+      kFingerprintSampleCount * kFingerprintSampleLength;
+  if (length <= kSampledLength) {
+    return HashBytes(hash, data, length);
+  }
+
+  // The samples are spread evenly, from the start to the end of the file.
+  const size_t last = length - kFingerprintSampleLength;
+  for (size_t i = 0; i < kFingerprintSampleCount; ++i) {
+    size_t offset = static_cast<size_t>(static_cast<uint64_t>(last) * i /
+                                        (kFingerprintSampleCount - 1));
+    hash = HashBytes(hash, data + offset, kFingerprintSampleLength);
+  }
+  return hash;
+}
+
+}  // namespace
+
 bool ParselessPhraseDB::ValidatePragma(const char* buf, size_t length) {
   if (length < SORTED_PRAGMA_HEADER.length()) {
     return false;
@@ -53,7 +127,7 @@ std::unique_ptr<ParselessPhraseDB> ParselessPhraseDB::CreateValidatedDB(const ch
 
 ParselessPhraseDB::ParselessPhraseDB(const char* buf, size_t length,
                                      bool validate_pragma)
-    : begin_(buf), end_(buf + length) {
+    : buf_(buf), begin_(buf), end_(buf + length) {
   assert(buf != nullptr);
   assert(length > 0);
 
@@ -69,13 +143,16 @@ ParselessPhraseDB::ParselessPhraseDB(const char* buf, size_t length,
 
 std::vector<std::string_view> ParselessPhraseDB::findRows(
     const std::string_view& key) const {
-  std::vector<std::string_view> rows;
-
   const char* ptr = findFirstMatchingLine(key);
   if (ptr == nullptr) {
-    return rows;
+    return {};
   }
+  return collectMatchingRows(key, ptr);
+}
 
+std::vector<std::string_view> ParselessPhraseDB::collectMatchingRows(
+    const std::string_view& key, const char* ptr) const {
+  std::vector<std::string_view> rows;
   while (ptr + key.length() <= end_ &&
          memcmp(ptr, key.data(), key.length()) == 0) {
     const char* eol = ptr;
@@ -95,6 +172,62 @@ std::vector<std::string_view> ParselessPhraseDB::findRows(
   return rows;
 }
 
+std::vector<std::vector<std::string_view>> ParselessPhraseDB::batchFindRows(
+    const std::vector<std::string_view>& keys) const {
+  std::vector<std::vector<std::string_view>> results(keys.size());
+
+  // The index is already fast enough for individual lookups.
+  if (indexRows_ != nullptr) {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      results[i] = findRows(keys[i]);
+    }
+    return results;
+  }
+
+  std::vector<size_t> order(keys.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(),
+            [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+  const char* top = begin_;
+  for (size_t i : order) {
+    const std::string_view& key = keys[i];
+    top = lowerBoundRow(key, top);
+    results[i] = collectMatchingRows(key, top);
+  }
+  return results;
+}
+
+const char* ParselessPhraseDB::lowerBoundRow(const std::string_view& key,
+                                             const char* top) const {
+  const char* bottom = end_;
+  while (top < bottom) {
+    const char* mid = top + ((bottom - top) / 2);
+
+    // Backtrack to the row start. Since top is a row start, this stays within
+    // [top, mid].
+    const char* ptr = mid;
+    while (ptr != top && *(ptr - 1) != '\n') {
+      --ptr;
+    }
+
+    const char* eol = ptr;
+    while (eol != end_ && *eol != '\n') {
+      ++eol;
+    }
+
+    std::string_view row(ptr, eol - ptr);
+    if (row.substr(0, key.length()) < key) {
+      top = (eol == end_) ? end_ : eol + 1;
+    } else {
+      bottom = ptr;
+    }
+  }
+  return top;
+}
+
 // Implements a binary search that returns the pointer to the first matching
 // row. In its core it's just a standard binary search, but we use backtracking
 // to locate the line start. We also check the previous line to see if the
@@ -107,6 +240,13 @@ const char* ParselessPhraseDB::findFirstMatchingLine(
     return begin_;
   }
 
+  if (indexRows_ != nullptr) {
+    const char* result = nullptr;
+    if (findFirstMatchingLineInIndex(key, &result)) {
+      return result;
+    }
+  }
+
   const char* top = begin_;
   const char* bottom = end_;
 
@@ -175,15 +315,264 @@ const char* ParselessPhraseDB::findFirstMatchingLine(
   return nullptr;
 }
 
+bool ParselessPhraseDB::attachIndex(const char* index, size_t length) {
+  if (index == nullptr || length < kIndexHeaderSize) {
+    return false;
+  }
+
+  if (std::string_view(index + kIndexMagicOffset,
+                       SORTED_INDEX_MAGIC.length()) != SORTED_INDEX_MAGIC) {
+    return false;
+  }
+
+  if (ReadIndexValue<uint32_t>(index + kIndexVersionOffset) != kIndexVersion ||
+      ReadIndexValue<uint32_t>(index + kIndexKeyPrefixLengthOffset) !=
+          kIndexKeyPrefixLength) {
+    return false;
+  }
+
+  auto dataLength = ReadIndexValue<uint64_t>(index + kIndexDataLengthOffset);
+  if (dataLength != static_cast<uint64_t>(end_ - buf_)) {
+    return false;
+  }
+
+  auto rowCount = ReadIndexValue<uint64_t>(index + kIndexRowCountOffset);
+  if (rowCount > (length - kIndexHeaderSize) / kIndexRowSize ||
+      kIndexHeaderSize + rowCount * kIndexRowSize != length) {
+    return false;
+  }
+
+  // The length alone does not tell an index of an earlier version of the
+  // file, whose stale key prefixes would make lookups miss rows. The
+  // fingerprint only samples the file, which keeps the check cheap. The rows
+  // that a lookup probes are checked against the text as well, see
+  // findFirstMatchingLineInIndex().
+  if (ReadIndexValue<uint64_t>(index + kIndexFingerprintOffset) !=
+      IndexFingerprint(buf_, static_cast<size_t>(end_ - buf_))) {
+    return false;
+  }
+
+  indexRows_ = index + kIndexHeaderSize;
+  indexRowCount_ = static_cast<size_t>(rowCount);
+  return true;
+}
+
+// A standard lower-bound binary search over the index rows. Each row carries
+// the first few bytes of the text row, and so most of the comparisons do not
+// need to touch the text at all. Since the index is an untrusted sidecar, we
+// check that every probed offset is a row start in the db, and that the row
+// starts with the key prefix of the index row.
+bool ParselessPhraseDB::findFirstMatchingLineInIndex(
+    const std::string_view& key, const char** result) const {
+  auto rowPtr = [this](size_t i) -> const char* {
+    const char* indexRow = indexRows_ + i * kIndexRowSize;
+    const char* ptr = buf_ + ReadIndexValue<uint32_t>(indexRow);
+    if (ptr < begin_ || ptr >= end_ || (ptr != begin_ && *(ptr - 1) != '\n')) {
+      return nullptr;
+    }
+    size_t prefixLength =
+        std::min(kIndexKeyPrefixLength, static_cast<size_t>(end_ - ptr));
+    if (memcmp(indexRow + sizeof(uint32_t), ptr, prefixLength) != 0) {
+      return nullptr;
+    }
+    return ptr;
+  };
+
+  // Returns the result of comparing the row's first key.length() bytes with
+  // the key. A row that ends before that compares less.
+  auto compare = [this, &key](size_t i, const char* ptr) -> int {
+    const char* prefix = indexRows_ + i * kIndexRowSize + sizeof(uint32_t);
+    auto available = static_cast<size_t>(end_ - ptr);
+    if (available < key.length()) {
+      int cmp = memcmp(ptr, key.data(), available);
+      return cmp != 0 ? cmp : -1;
+    }
+
+    size_t prefixLength = std::min(key.length(), kIndexKeyPrefixLength);
+    int cmp = memcmp(prefix, key.data(), prefixLength);
+    if (cmp != 0 || prefixLength == key.length()) {
+      return cmp;
+    }
+    return memcmp(ptr + prefixLength, key.data() + prefixLength,
+                  key.length() - prefixLength);
+  };
+
+  size_t low = 0;
+  size_t high = indexRowCount_;
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    const char* ptr = rowPtr(mid);
+    if (ptr == nullptr) {
+      return false;
+    }
+
+    if (compare(mid, ptr) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  *result = nullptr;
+  if (low < indexRowCount_) {
+    const char* ptr = rowPtr(low);
+    if (ptr == nullptr) {
+      return false;
+    }
+    if (compare(low, ptr) == 0) {
+      *result = ptr;
+    }
+  }
+  return true;
+}
+
+std::string ParselessPhraseDB::BuildIndex(const char* buf, size_t length) {
+  if (length > std::numeric_limits<uint32_t>::max()) {
+    return {};
+  }
+
+  const char* ptr = buf;
+  const char* end = buf + length;
+  if (ValidatePragma(buf, length)) {
+    ptr += SORTED_PRAGMA_HEADER.length();
+  }
+
+  std::string rows;
+  uint64_t rowCount = 0;
+  while (ptr < end) {
+    const char* eol = static_cast<const char*>(memchr(ptr, '\n', end - ptr));
+    if (eol == nullptr) {
+      eol = end;
+    }
+
+    if (eol != ptr) {
+      AppendIndexValue(rows, static_cast<uint32_t>(ptr - buf));
+      size_t prefixLength =
+          std::min(kIndexKeyPrefixLength, static_cast<size_t>(end - ptr));
+      rows.append(ptr, prefixLength);
+      rows.append(kIndexKeyPrefixLength - prefixLength, '\0');
+      ++rowCount;
+    }
+    ptr = eol + 1;
+  }
+
+  std::string index(SORTED_INDEX_MAGIC);
+  AppendIndexValue(index, kIndexVersion);
+  AppendIndexValue(index, static_cast<uint32_t>(kIndexKeyPrefixLength));
+  AppendIndexValue(index, static_cast<uint64_t>(length));
+  AppendIndexValue(index, rowCount);
+  AppendIndexValue(index, IndexFingerprint(buf, length));
+  index += rows;
+  return index;
+}
+
+namespace {
+
+// Returns the start of the value column of the row, that is, past the key and
+// the field separator. There should be just one separator, but we loop just in
+// case.
+const char* SkipKeyColumn(const char* ptr, const char* end) {
+  while (ptr < end && *ptr != ' ') {
+    ++ptr;
+  }
+  while (ptr < end && *ptr == ' ') {
+    ++ptr;
+  }
+  return ptr;
+}
+
+std::string_view RestOfLine(const char* ptr, const char* end) {
+  const auto* eol = static_cast<const char*>(memchr(ptr, '\n', end - ptr));
+  return {ptr, static_cast<size_t>((eol == nullptr ? end : eol) - ptr)};
+}
+
+}  // namespace
+
+void ParselessPhraseDB::buildReverseIndex() const {
+  // Offsets are 32-bit to halve the memory footprint. A db this large is not
+  // something we expect, but in that case reverseFindRows() falls back to
+  // the linear scan.
+  if (end_ - begin_ > std::numeric_limits<uint32_t>::max()) {
+    return;
+  }
+
+  const char* recordBegin = begin_;
+  while (recordBegin < end_) {
+    const char* ptr = SkipKeyColumn(recordBegin, end_);
+    std::string_view rest = RestOfLine(ptr, end_);
+    reverseIndex_.push_back({static_cast<uint32_t>(recordBegin - begin_),
+                             static_cast<uint32_t>(ptr - begin_)});
+
+    // skip over to the next line start
+    recordBegin = rest.data() + rest.length();
+    while (recordBegin < end_ && *recordBegin == '\n') {
+      ++recordBegin;
+    }
+  }
+
+  std::stable_sort(reverseIndex_.begin(), reverseIndex_.end(),
+                   [this](const auto& a, const auto& b) {
+                     return RestOfLine(begin_ + a.valueOffset, end_) <
+                            RestOfLine(begin_ + b.valueOffset, end_);
+                   });
+}
+
 std::vector<std::string> ParselessPhraseDB::reverseFindRows(
     const std::string_view& value) const {
+  // The index only covers matches within a line.
+  if (value.find('\n') != std::string_view::npos) {
+    return reverseFindRowsByLinearScan(value);
+  }
+
+  std::call_once(reverseIndexBuilt_, [this] { buildReverseIndex(); });
+  if (reverseIndex_.empty() && begin_ != end_) {
+    return reverseFindRowsByLinearScan(value);
+  }
+
+  // Since the values are sorted, the rows whose values have the prefix form a
+  // contiguous range.
+  auto it = std::lower_bound(
+      reverseIndex_.cbegin(), reverseIndex_.cend(), value,
+      [this](const ReverseIndexEntry& e, std::string_view v) {
+        return RestOfLine(begin_ + e.valueOffset, end_) < v;
+      });
+
+  std::vector<ReverseIndexEntry> matches;
+  for (; it != reverseIndex_.cend(); ++it) {
+    const char* ptr = begin_ + it->valueOffset;
+    if (RestOfLine(ptr, end_).substr(0, value.length()) != value) {
+      break;
+    }
+
+    // Same as the linear scan, which requires that the match is followed by
+    // at least one more byte.
+    if (ptr + value.length() < end_) {
+      matches.push_back(*it);
+    }
+  }
+
+  // Restore the db order.
+  std::sort(matches.begin(), matches.end(), [](const auto& a, const auto& b) {
+    return a.rowOffset < b.rowOffset;
+  });
+
+  std::vector<std::string> rows;
+  for (const auto& match : matches) {
+    const char* recordBegin = begin_ + match.rowOffset;
+    std::string_view rest = RestOfLine(begin_ + match.valueOffset, end_);
+    rows.emplace_back(recordBegin, rest.data() + rest.length() - recordBegin);
+  }
+  return rows;
+}
+
+std::vector<std::string> ParselessPhraseDB::reverseFindRowsByLinearScan(
+    const std::string_view& value) const {
   std::vector<std::string> rows;
 
   const char* recordBegin = begin_;
 
   while (recordBegin < end_) {
     const char* ptr = recordBegin;
-
     // skip over the key to find the field separator
     while (ptr < end_ && *ptr != ' ') {
       ++ptr;
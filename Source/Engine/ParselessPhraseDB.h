@@ -25,7 +25,9 @@
 #define SRC_ENGINE_PARSELESSPHRASEDB_H_
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -35,6 +37,29 @@ namespace McBopomofo {
 constexpr std::string_view SORTED_PRAGMA_HEADER =
     "# format org.openvanilla.mcbopomofo.sorted\n";
 
+// A compiled row index for a sorted database. The index is an optional
+// sidecar file whose path is that of the database plus SORTED_INDEX_SUFFIX.
+// The format, in native (little-endian) byte order, is:
+//
+//   char[8]  magic, SORTED_INDEX_MAGIC
+//   uint32   version, currently 3
+//   uint32   key prefix length, currently 12
+//   uint64   length of the database file that the index describes
+//   uint64   number of rows
+//   uint64   fingerprint of the database file
+//   rows of {uint32 offset of the row in the file, char[12] key prefix}
+//
+// The key prefix is the first 12 bytes of the row, padded with NUL if the file
+// ends before that. Empty lines are not indexed. The fingerprint is FNV-1a
+// over the length of the file, and then over 64 samples of 64 bytes spread
+// evenly from the start to the end of the file, or over the whole file if it
+// is shorter than that. The bytes are hashed in 8-byte little-endian words,
+// followed by the remaining bytes one at a time. An index whose fingerprint
+// does not match the file, such as one left over from an earlier build, is
+// rejected.
+constexpr std::string_view SORTED_INDEX_MAGIC = "MBPIDX01";
+constexpr std::string_view SORTED_INDEX_SUFFIX = ".idx";
+
 // Defines phrase database that consists of (key, value, score) rows that are
 // pre-sorted by the byte value of the keys. It is way faster than FastLM
 // because it does not need to parse anything. Instead, it relies on the fact
@@ -57,23 +82,89 @@ class ParselessPhraseDB {
 
   const char* findFirstMatchingLine(const std::string_view& key) const;
 
+  // Returns true if any row starts with the prefix.
+  bool hasRowWithPrefix(const std::string_view& prefix) const {
+    return begin_ != end_ && findFirstMatchingLine(prefix) != nullptr;
+  }
+
+  // Same as calling findRows() for each of the keys, and the results are in
+  // the order of the keys. The keys are looked up in sorted order, and since
+  // the first row matching a key cannot come before that of a smaller key,
+  // each search only covers the part of the db that is left over by the
+  // previous one. This helps with keys that share prefixes, such as "a ",
+  // "a-b ", and "a-b-c ".
+  std::vector<std::vector<std::string_view>> batchFindRows(
+      const std::vector<std::string_view>& keys) const;
+
+  // Attaches a compiled row index (see SORTED_INDEX_MAGIC) to the db. Once
+  // attached, lookups binary-search the fixed-size index rows instead of the
+  // text. Returns false, and the db stays in text-only mode, if the index is
+  // malformed or does not describe the buffer the db was created with. The
+  // check only reads a few samples of the buffer. Like the buffer, the index
+  // must outlive the db.
+  bool attachIndex(const char* index, size_t length);
+
+  [[nodiscard]] bool hasIndex() const { return indexRows_ != nullptr; }
+
   // Find the rows whose text past the key column plus the field separator
   // is a prefix match of the given value. For example, if the row is
   // "foo bar -1.00", the values "b", "ba", "bar", "bar ", "bar -1.00" are
-  // valid prefix matches, whereas the value "barr" isn't. This performs linear
-  // scan since, unlike lookup-by-key, it cannot take advantage of the fact that
-  // the underlying data is sorted by keys.
+  // valid prefix matches, whereas the value "barr" isn't. The rows are
+  // returned in the order they appear in the db.
+  //
+  // Since the underlying data is sorted by keys, not values, this uses a
+  // secondary index of the rows sorted by their values. The index is built in
+  // memory upon the first call, after which each lookup takes O(log n) time.
   std::vector<std::string> reverseFindRows(const std::string_view& value) const;
 
+  // Same as reverseFindRows(), but performs a linear scan of the db without
+  // building the secondary index.
+  std::vector<std::string> reverseFindRowsByLinearScan(
+      const std::string_view& value) const;
+
   static bool ValidatePragma(const char* buf, size_t length);
 
   // Convenient function for validating and returning a DB instance. nullptr if
   // the block is empty or is not valid.
   static std::unique_ptr<ParselessPhraseDB> CreateValidatedDB(const char* buf, size_t length);
 
+  // Builds the compiled row index for the buffer. Returns an empty string if
+  // the buffer is too large to be indexed.
+  static std::string BuildIndex(const char* buf, size_t length);
+
  private:
+  // Finds the first matching row using the index. Returns false if the index
+  // turns out to be inconsistent with the text, in which case the caller
+  // should fall back to the text search.
+  bool findFirstMatchingLineInIndex(const std::string_view& key,
+                                    const char** result) const;
+
+  // Returns the start of the first row, at or after top, whose first
+  // key.length() bytes are not less than the key; or end_ if there is no
+  // such row. top must be a row start.
+  const char* lowerBoundRow(const std::string_view& key,
+                            const char* top) const;
+
+  // Collects the consecutive rows, starting at ptr, that match the key.
+  std::vector<std::string_view> collectMatchingRows(
+      const std::string_view& key, const char* ptr) const;
+
+  const char* buf_;
   const char* begin_;
   const char* end_;
+
+  const char* indexRows_ = nullptr;
+  size_t indexRowCount_ = 0;
+
+  // The value-sorted secondary index used by reverseFindRows(). The offsets
+  // are relative to begin_.
+  struct ReverseIndexEntry {
+    uint32_t rowOffset;
+    uint32_t valueOffset;
+  };
+  void buildReverseIndex() const;
+  mutable std::once_flag reverseIndexBuilt_;
+  mutable std::vector<ReverseIndexEntry> reverseIndex_;
 };
 
 }  // namespace McBopomofo
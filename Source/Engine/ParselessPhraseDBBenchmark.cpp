@@ -0,0 +1,84 @@
+// Copyright (c) 2025 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <sstream>
+#include <string>
+
+#include "ParselessPhraseDB.h"
+
+namespace {
+
+constexpr int kKeys = 20000;
+constexpr int kValuesPerKey = 8;
+
+// A synthetic db shaped like the phrase-to-reading files, with values that
+// are scattered across the db.
+const std::string& GetTestData() {
+  static const std::string data = []() {
+    std::stringstream sst;
+    sst << McBopomofo::SORTED_PRAGMA_HEADER;
+    for (int k = 0; k < kKeys; ++k) {
+      for (int v = 0; v < kValuesPerKey; ++v) {
+        sst << "key_" << 100000 + k << " value_"
+            << 100000 + (k * 7919 + v) % kKeys << "\n";
+      }
+    }
+    return sst.str();
+  }();
+  return data;
+}
+
+void BM_ParselessPhraseDBReverseFindRowsByLinearScan(benchmark::State& state) {
+  const std::string& testData = GetTestData();
+  McBopomofo::ParselessPhraseDB db(testData.c_str(), testData.length(),
+                                   /*validate_pragma=*/true);
+
+  int i = 0;
+  for (auto _ : state) {
+    std::string value = "value_" + std::to_string(100000 + i++ % kKeys);
+    benchmark::DoNotOptimize(db.reverseFindRowsByLinearScan(value));
+  }
+}
+BENCHMARK(BM_ParselessPhraseDBReverseFindRowsByLinearScan);
+
+void BM_ParselessPhraseDBReverseFindRows(benchmark::State& state) {
+  const std::string& testData = GetTestData();
+  McBopomofo::ParselessPhraseDB db(testData.c_str(), testData.length(),
+                                   /*validate_pragma=*/true);
+
+  // Builds the index outside of the timed loop.
+  db.reverseFindRows("");
+
+  int i = 0;
+  for (auto _ : state) {
+    std::string value = "value_" + std::to_string(100000 + i++ % kKeys);
+    benchmark::DoNotOptimize(db.reverseFindRows(value));
+  }
+}
+BENCHMARK(BM_ParselessPhraseDBReverseFindRows);
+
+};  // namespace
+
+BENCHMARK_MAIN();
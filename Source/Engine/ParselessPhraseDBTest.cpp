@@ -21,6 +21,7 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <algorithm>
 #include <cstdio>
 #include <filesystem>
 #include <map>
@@ -202,6 +203,148 @@ TEST(ParselessPhraseDBTest, StressTest) {
   }
 }
 
+TEST(ParselessPhraseDBTest, IndexedLookUpMatchesTextLookUp) {
+  std::string data(SORTED_PRAGMA_HEADER);
+  std::vector<std::string> keys = {"a",       "a-b",     "a-b-c",  "ab",
+                                   "ㄅㄚ",    "ㄅㄚ-ㄅㄞˇ", "ㄅㄚ˙", "ㄅㄚ˙-ㄅㄚ˙",
+                                   "ㄅㄚㄅㄚ", "b"};
+  std::sort(keys.begin(), keys.end());
+  for (const auto& key : keys) {
+    for (int i = 0; i < 3; ++i) {
+      data += key + " v" + std::to_string(i) + " -" + std::to_string(i) + "\n";
+    }
+  }
+
+  std::string index =
+      ParselessPhraseDB::BuildIndex(data.c_str(), data.length());
+  ParselessPhraseDB textDB(data.c_str(), data.length(),
+                           /*validate_pragma=*/true);
+  ParselessPhraseDB indexedDB(data.c_str(), data.length(),
+                              /*validate_pragma=*/true);
+  ASSERT_TRUE(indexedDB.attachIndex(index.c_str(), index.length()));
+  ASSERT_TRUE(indexedDB.hasIndex());
+  ASSERT_FALSE(textDB.hasIndex());
+
+  // Try every prefix of every row, as well as some keys that don't exist.
+  std::vector<std::string> queries = {"", "0", "a-c", "ㄅㄚ-", "c", "ㄅㄚ v"};
+  std::stringstream sstr(data);
+  std::string line;
+  while (std::getline(sstr, line)) {
+    for (size_t i = 1; i <= line.length(); ++i) {
+      queries.emplace_back(line.substr(0, i));
+    }
+  }
+
+  for (const auto& query : queries) {
+    EXPECT_EQ(indexedDB.findFirstMatchingLine(query),
+              textDB.findFirstMatchingLine(query))
+        << "query: " << query;
+    EXPECT_EQ(indexedDB.findRows(query), textDB.findRows(query))
+        << "query: " << query;
+  }
+
+  EXPECT_EQ(indexedDB.findRows("ㄅㄚ "),
+            (StringViews{"ㄅㄚ v0 -0", "ㄅㄚ v1 -1", "ㄅㄚ v2 -2"}));
+}
+
+TEST(ParselessPhraseDBTest, StaleIndexIsRejected) {
+  std::string data = std::string(SORTED_PRAGMA_HEADER) + "a 1\nb 2\nc 3\n";
+  std::string otherData = std::string(SORTED_PRAGMA_HEADER) + "a 1\nb 2\n";
+  std::string index =
+      ParselessPhraseDB::BuildIndex(data.c_str(), data.length());
+  std::string otherIndex =
+      ParselessPhraseDB::BuildIndex(otherData.c_str(), otherData.length());
+  // An earlier version of the file with the same length.
+  std::string sameLengthData =
+      std::string(SORTED_PRAGMA_HEADER) + "a 1\nb 2\nd 3\n";
+  std::string sameLengthIndex = ParselessPhraseDB::BuildIndex(
+      sameLengthData.c_str(), sameLengthData.length());
+
+  ParselessPhraseDB db(data.c_str(), data.length(), /*validate_pragma=*/true);
+  EXPECT_FALSE(db.attachIndex(otherIndex.c_str(), otherIndex.length()));
+  EXPECT_FALSE(
+      db.attachIndex(sameLengthIndex.c_str(), sameLengthIndex.length()));
+  EXPECT_FALSE(db.attachIndex(index.c_str(), index.length() - 1));
+  EXPECT_FALSE(db.attachIndex(index.c_str(), 4));
+  EXPECT_FALSE(db.attachIndex(data.c_str(), data.length()));
+  EXPECT_FALSE(db.hasIndex());
+
+  // Still works in text-only mode.
+  EXPECT_EQ(db.findRows("b"), (StringViews{"b 2"}));
+}
+
+TEST(ParselessPhraseDBTest, InconsistentIndexFallsBackToTextLookUp) {
+  std::string data = std::string(SORTED_PRAGMA_HEADER) + "a 1\nb 2\nc 3\n";
+  std::string index =
+      ParselessPhraseDB::BuildIndex(data.c_str(), data.length());
+
+  // Same length, but with different rows, so the offsets in the index do not
+  // point at row starts any more.
+  std::string changedData =
+      std::string(SORTED_PRAGMA_HEADER) + "aa 1\nb 2\nc 3";
+  ASSERT_EQ(changedData.length(), data.length());
+
+  ParselessPhraseDB db(changedData.c_str(), changedData.length(),
+                       /*validate_pragma=*/true);
+  ASSERT_FALSE(db.attachIndex(index.c_str(), index.length()));
+
+  // The fingerprint (at offset 32) is what rejects such an index. An index
+  // that is inconsistent in spite of it, since it is an untrusted file, still
+  // does not make the lookups go wrong.
+  std::string changedIndex =
+      ParselessPhraseDB::BuildIndex(changedData.c_str(), changedData.length());
+  index.replace(32, sizeof(uint64_t), changedIndex, 32, sizeof(uint64_t));
+  ASSERT_TRUE(db.attachIndex(index.c_str(), index.length()));
+  EXPECT_EQ(db.findRows("aa"), (StringViews{"aa 1"}));
+  EXPECT_EQ(db.findRows("b"), (StringViews{"b 2"}));
+  EXPECT_EQ(db.findRows("c"), (StringViews{"c 3"}));
+}
+
+TEST(ParselessPhraseDBTest, IndexWithStaleKeyPrefixesFallsBackToTextLookUp) {
+  std::string data = std::string(SORTED_PRAGMA_HEADER) + "a 1\nb 2\nc 3\n";
+  std::string changedData =
+      std::string(SORTED_PRAGMA_HEADER) + "a 1\nbb2\nc 3\n";
+  std::string index =
+      ParselessPhraseDB::BuildIndex(data.c_str(), data.length());
+
+  // The rows start where they did, but the one in the middle has changed, and
+  // the fingerprint, which only samples larger files, is forged to match.
+  std::string changedIndex =
+      ParselessPhraseDB::BuildIndex(changedData.c_str(), changedData.length());
+  index.replace(32, sizeof(uint64_t), changedIndex, 32, sizeof(uint64_t));
+
+  ParselessPhraseDB db(changedData.c_str(), changedData.length(),
+                       /*validate_pragma=*/true);
+  ASSERT_TRUE(db.attachIndex(index.c_str(), index.length()));
+  EXPECT_EQ(db.findRows("bb"), (StringViews{"bb2"}));
+  EXPECT_TRUE(db.findRows("b ").empty());
+  EXPECT_EQ(db.findRows("c"), (StringViews{"c 3"}));
+}
+
+TEST(ParselessPhraseDBTest, IndexOfLargeFileIsCheckedBySamples) {
+  std::string data(SORTED_PRAGMA_HEADER);
+  for (int i = 0; i < 1000; ++i) {
+    data += "k" + std::to_string(100000 + i) + " v" + std::to_string(i) + "\n";
+  }
+  ASSERT_GT(data.length(), 4096);
+  std::string index =
+      ParselessPhraseDB::BuildIndex(data.c_str(), data.length());
+
+  ParselessPhraseDB db(data.c_str(), data.length(), /*validate_pragma=*/true);
+  ASSERT_TRUE(db.attachIndex(index.c_str(), index.length()));
+  EXPECT_EQ(db.findRows("k100500 "), (StringViews{"k100500 v500"}));
+
+  // The first and the last rows are always sampled.
+  for (size_t offset : {SORTED_PRAGMA_HEADER.length(), data.length() - 2}) {
+    std::string changedData = data;
+    changedData[offset] = 'z';
+    ParselessPhraseDB changedDB(changedData.c_str(), changedData.length(),
+                                /*validate_pragma=*/true);
+    EXPECT_FALSE(changedDB.attachIndex(index.c_str(), index.length()))
+        << "offset: " << offset;
+  }
+}
+
 TEST(ParselessPhraseDBTest, LookUpByValue) {
   std::string data = "a 1\nb 1 \nc 2\nd 3";
   ParselessPhraseDB db(data.c_str(), data.length());
@@ -227,4 +370,40 @@ TEST(ParselessPhraseDBTest, LookUpByValue) {
   ASSERT_TRUE(rows.empty());
 }
 
+TEST(ParselessPhraseDBTest, BatchFindRowsMatchesFindRows) {
+  std::string data =
+      "a 1\na 2\na-b 3\na-b-c 4\na-c 5\nb 6\nb-a 7\nc 8\nc-d 9\n";
+  ParselessPhraseDB db(data.c_str(), data.length());
+
+  // The keys are deliberately not sorted and contain duplicates and misses.
+  std::vector<std::string_view> keys = {"c ",     "a ",   "a-b ", "z ",
+                                        "a-b-c ", "a- ",  "",     "a ",
+                                        "0 ",     "b-a ", "c-d "};
+  auto results = db.batchFindRows(keys);
+  ASSERT_EQ(results.size(), keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(results[i], db.findRows(keys[i])) << "key: " << keys[i];
+  }
+
+  EXPECT_EQ(results[1], (std::vector<std::string_view>{"a 1", "a 2"}));
+  EXPECT_TRUE(results[3].empty());
+}
+
+TEST(ParselessPhraseDBTest, LookUpByValueMatchesLinearScan) {
+  std::string data = "a 1\nb 1 \nb 12\nc 2\nc 1 x\nd\ne  1\nf 3";
+  ParselessPhraseDB db(data.c_str(), data.length());
+
+  std::vector<std::string> values = {"", "1", "1 ", "12", "1 x", "2", "3",
+                                     "x", "e", "f 3"};
+  for (const auto& value : values) {
+    EXPECT_EQ(db.reverseFindRows(value), db.reverseFindRowsByLinearScan(value))
+        << "value: " << value;
+  }
+
+  // A keyless row runs into the next one, same as the linear scan.
+  EXPECT_EQ(db.reverseFindRows("1"), (std::vector<std::string>{
+                                         "a 1", "b 1 ", "b 12", "c 1 x",
+                                         "d\ne  1"}));
+}
+
 }  // namespace McBopomofo
@@ -34,17 +34,28 @@
 namespace McBopomofo {
 
 bool PhraseReplacementMap::open(const char* path) {
-  if (!mmapedFile_.open(path)) {
+  if (mmapedFile_ != nullptr) {
     return false;
   }
 
-  // MemoryMappedFile self-closes, and so this is fine.
-  return load(mmapedFile_.data(), mmapedFile_.length());
+  MemoryMappedFile::Options options;
+  options.copy = true;
+  mmapedFile_ = MemoryMappedFile::OpenShared(path, options);
+  if (mmapedFile_ == nullptr) {
+    return false;
+  }
+
+  // The copy is released upon close, and so this is fine.
+  return load(mmapedFile_->data(), mmapedFile_->length());
+}
+
+bool PhraseReplacementMap::isUpToDate(const char* path) const {
+  return mmapedFile_ != nullptr && mmapedFile_->isUpToDate(path);
 }
 
 void PhraseReplacementMap::close() {
   dictionary_.clear();
-  mmapedFile_.close();
+  mmapedFile_ = nullptr;
 }
 
 bool PhraseReplacementMap::load(const char* data, size_t length) {
@@ -54,12 +65,8 @@ bool PhraseReplacementMap::load(const char* data, size_t length) {
   return dictionary_.parse(data, length);
 }
 
-std::string PhraseReplacementMap::valueForKey(const std::string& key) const {
-  std::vector<std::string_view> values = dictionary_.getValues(key);
-  if (!values.empty()) {
-    return std::string(values[0]);
-  }
-  return {};
+std::string_view PhraseReplacementMap::valueForKey(std::string_view key) const {
+  return dictionary_.getFirstValue(key);
 }
 
 std::vector<ByteBlockBackedDictionary::Issue>
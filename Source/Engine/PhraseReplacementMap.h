@@ -25,7 +25,9 @@
 #define SRC_ENGINE_PHRASEREPLACEMENTMAP_H_
 
 #include <map>
+#include <memory>
 #include <string>
+#include <string_view>
 
 #include "ByteBlockBackedDictionary.h"
 #include "MemoryMappedFile.h"
@@ -40,20 +42,27 @@ class PhraseReplacementMap {
   PhraseReplacementMap& operator=(const PhraseReplacementMap&) = delete;
   PhraseReplacementMap& operator=(PhraseReplacementMap&&) = delete;
 
+  // The file is edited by the user, and so it is read into memory rather
+  // than mapped. See MemoryMappedFile::Options::copy.
   bool open(const char* path);
   void close();
 
+  // Whether the file at path is the open file, unchanged since it was opened.
+  bool isUpToDate(const char* path) const;
+
   // Allows loading existing in-memory data. It's the caller's responsibility
   // to make sure that data outlives this instance.
   bool load(const char* data, size_t length);
 
-  std::string valueForKey(const std::string& key) const;
+  // Returns the replacement for the key, or an empty view if there is none.
+  // The view is valid until the map is closed or reloaded.
+  std::string_view valueForKey(std::string_view key) const;
 
   std::vector<ByteBlockBackedDictionary::Issue> getParsingIssues() const;
 
  protected:
   ByteBlockBackedDictionary dictionary_;
-  MemoryMappedFile mmapedFile_;
+  std::shared_ptr<const MemoryMappedFile> mmapedFile_;
 };
 
 }  // namespace McBopomofo
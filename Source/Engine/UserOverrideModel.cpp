@@ -24,13 +24,22 @@
 
 #include "UserOverrideModel.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cmath>
-#include <list>
+#include <cstdio>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
+#include "MemoryMappedFile.h"
 #include "gramambular2/reading_grid.h"
 
 namespace McBopomofo {
@@ -40,27 +49,162 @@ static constexpr double kDecayThreshold = 1.0 / 1048576.0;
 
 static constexpr char kEmptyNodeString[] = "()";
 
+// The number of least recently used entries, among which the one with the
+// lowest score is evicted.
+static constexpr size_t kEvictionSampleSize = 8;
+
+// The number of entries that each observation sweeps.
+static constexpr size_t kSweepStep = 2;
+
 // A scoring function that balances between "recent but infrequently observed"
 // and "old but frequently observed".
 static double Score(size_t eventCount, size_t totalCount, double eventTimestamp,
                     double timestamp, double lambda);
 
-// Form the observation key from the nodes of a walk. This goes backward, but
-// we are using a const_iterator, the "end" here should be a .cbegin() of a
-// vector.
-static std::string FormObservationKey(
-    std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
-        head,
-    std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
-        end);
+// The persistent store. Both files start with a magic string, a format
+// version, and the generation of the snapshot, which is incremented by each
+// compaction. A journal only applies to the snapshot of the same generation,
+// and so if a compaction is interrupted after the new snapshot is in place,
+// the old journal is ignored instead of being applied twice.
+//
+// A snapshot is the header, the entry count, the payload length, and a
+// checksum of the payload, followed by the payload, which is the entries from
+// the most to the least recently used. Each entry is the key length, the
+// override count, the observation count, and the key, followed by the
+// overrides, each of which is the candidate length, the force-high-score
+// flag, the count, the timestamp, and the candidate.
+//
+// A journal is the header followed by observations, each of which is the key
+// length, the candidate length, the force-high-score flag, the timestamp, the
+// key, the candidate, and a checksum of all that. An observation torn by a
+// crash fails the length or the checksum check, and it and anything after it
+// are cut off when the journal is opened. Observations are written but not
+// synced to disk, so a crash of the process loses none of them, but a crash
+// of the system may lose the most recent ones.
+//
+// Integers and doubles are in the native byte order.
+static constexpr char kSnapshotMagic[] = "McBpUOMS";
+static constexpr char kJournalMagic[] = "McBpUOMJ";
+static constexpr size_t kMagicLength = sizeof(kSnapshotMagic) - 1;
+static constexpr uint32_t kFormatVersion = 1;
+static constexpr size_t kHeaderLength =
+    kMagicLength + sizeof(uint32_t) + sizeof(uint64_t);
+static constexpr size_t kSnapshotHeaderLength =
+    kHeaderLength + sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+template <typename T>
+static void AppendValue(std::string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static std::string FileHeader(const char* magic, uint64_t generation) {
+  std::string header(magic, kMagicLength);
+  AppendValue(&header, kFormatVersion);
+  AppendValue(&header, generation);
+  return header;
+}
+
+// FNV-1a, taking 8 bytes at a time, which is plenty for telling torn or
+// corrupted data.
+static uint64_t Checksum(const char* data, size_t length) {
+  constexpr uint64_t kPrime = 1099511628211ULL;
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(uint64_t));
+    hash = (hash ^ word) * kPrime;
+  }
+  for (; i < length; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * kPrime;
+  }
+  return hash;
+}
+
+// Reads values from a block of bytes, failing instead of reading past its end.
+class ByteReader {
+ public:
+  ByteReader(const char* data, size_t length)
+      : ptr_(data), end_(data + length) {}
+
+  template <typename T>
+  bool read(T* value) {
+    if (static_cast<size_t>(end_ - ptr_) < sizeof(T)) {
+      return false;
+    }
+    memcpy(value, ptr_, sizeof(T));
+    ptr_ += sizeof(T);
+    return true;
+  }
+
+  bool read(size_t length, std::string_view* value) {
+    if (static_cast<size_t>(end_ - ptr_) < length) {
+      return false;
+    }
+    *value = std::string_view(ptr_, length);
+    ptr_ += length;
+    return true;
+  }
+
+  // Reads and checks the header written by FileHeader().
+  bool readHeader(const char* magic, uint64_t* generation) {
+    std::string_view m;
+    uint32_t version = 0;
+    return read(kMagicLength, &m) && m == std::string_view(magic) &&
+           read(&version) && version == kFormatVersion && read(generation);
+  }
+
+  [[nodiscard]] const char* ptr() const { return ptr_; }
 
-UserOverrideModel::UserOverrideModel(size_t capacity, double decayConstant)
-    : capacity_(capacity) {
+ private:
+  const char* ptr_;
+  const char* end_;
+};
+
+// Writes all of the data, retrying when interrupted.
+static bool WriteAll(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += written;
+    length -= static_cast<size_t>(written);
+  }
+  return true;
+}
+
+// Replaces the file at the path with the data, such that a crash leaves
+// either the old or the new file, but never a partial one.
+static bool ReplaceFile(const std::string& path, const std::string& data) {
+  std::string tempPath = path + ".tmp";
+  int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return false;
+  }
+  bool written = WriteAll(fd, data.data(), data.length()) && fsync(fd) == 0;
+  ::close(fd);
+  if (!written || rename(tempPath.c_str(), path.c_str()) != 0) {
+    unlink(tempPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+UserOverrideModel::UserOverrideModel(size_t capacity, double decayConstant,
+                                     size_t byteBudget)
+    : capacity_(capacity), byteBudget_(byteBudget) {
   assert(capacity_ > 0);
   // NOLINTNEXTLINE(readability-magic-numbers)
   decayExponent_ = log(0.5) / decayConstant;
+  fullDecayAge_ = log(kDecayThreshold) / decayExponent_;
 }
 
+UserOverrideModel::~UserOverrideModel() { close(); }
+
 void UserOverrideModel::observe(
     const Formosa::Gramambular2::ReadingGrid::WalkResult&
         walkBeforeUserOverride,
@@ -142,63 +286,88 @@ void UserOverrideModel::observe(
   auto endPoint = breakingUp ? walkAfterUserOverride.nodes.begin()
                              : walkBeforeUserOverride.nodes.begin();
 
-  std::string key = FormObservationKey(nodeIter, endPoint);
-  observe(key, currentNode->currentUnigram().value(), timestamp,
-          forceHighScoreOverride);
+  ObservationKey key = FormObservationKey(nodeIter, endPoint);
+  std::string_view candidate = currentNode->valueView();
+  uint32_t index =
+      update(key, candidate, timestamp, forceHighScoreOverride);
+  if (journalFd_ == -1) {
+    return;
+  }
+
+  appendToJournal(entries_[index].key, candidate, timestamp,
+                  forceHighScoreOverride);
 }
 
 UserOverrideModel::Suggestion UserOverrideModel::suggest(
     const Formosa::Gramambular2::ReadingGrid::WalkResult& currentWalk,
     size_t cursor, double timestamp) {
   auto nodeIter = currentWalk.findNodeAt(cursor);
-  std::string key = FormObservationKey(nodeIter, currentWalk.nodes.begin());
-  return suggest(key, timestamp);
+  return suggest(FormObservationKey(nodeIter, currentWalk.nodes.begin()),
+                 timestamp);
 }
 
 void UserOverrideModel::observe(const std::string& key,
                                 const std::string& candidate, double timestamp,
                                 bool forceHighScoreOverride) {
-  auto mapIter = lruMap_.find(key);
-  if (mapIter == lruMap_.end()) {
-    auto keyValuePair = KeyObservationPair(key, Observation());
-    Observation& observation = keyValuePair.second;
-    observation.update(candidate, timestamp, forceHighScoreOverride);
-
-    lruList_.push_front(keyValuePair);
-    auto listIter = lruList_.begin();
-    auto lruKeyValue =
-        std::pair<std::string, std::list<KeyObservationPair>::iterator>(
-            key, listIter);
-    lruMap_.insert(lruKeyValue);
-
-    if (lruList_.size() > capacity_) {
-      auto lastKeyValuePair = lruList_.end();
-      --lastKeyValuePair;
-      lruMap_.erase(lastKeyValuePair->first);
-      lruList_.pop_back();
-    }
-  } else {
-    auto listIter = mapIter->second;
-    lruList_.splice(lruList_.begin(), lruList_, listIter);
-
-    auto& keyValuePair = *listIter;
-    Observation& observation = keyValuePair.second;
-    observation.update(candidate, timestamp, forceHighScoreOverride);
+  update(ObservationKey(key), candidate, timestamp, forceHighScoreOverride);
+  if (journalFd_ == -1) {
+    return;
   }
+
+  appendToJournal(key, candidate, timestamp, forceHighScoreOverride);
 }
 
 UserOverrideModel::Suggestion UserOverrideModel::suggest(const std::string& key,
                                                          double timestamp) {
-  auto mapIter = lruMap_.find(key);
-  if (mapIter == lruMap_.end()) {
+  return suggest(ObservationKey(key), timestamp);
+}
+
+uint32_t UserOverrideModel::update(const ObservationKey& key,
+                                   std::string_view candidate,
+                                   double timestamp,
+                                   bool forceHighScoreOverride) {
+  sweep(timestamp);
+
+  uint64_t hash = key.hash();
+  uint32_t index = findEntry(key, hash);
+  if (index == kNone) {
+    size_t bytes =
+        kEntryBytes + key.length() + kOverrideBytes + candidate.length();
+    while (entries_.size() >= capacity_) {
+      evict(timestamp, &stats_.capacityEvictions, kNone);
+    }
+    while (!entries_.empty() && bytes_ + bytes > byteBudget_) {
+      evict(timestamp, &stats_.byteBudgetEvictions, kNone);
+    }
+    index = addEntry(key, hash);
+  } else {
+    // The entry is unlinked first, so that it is not evicted itself.
+    unlink(index);
+    const auto& overrides = entries_[index].observation.overrides;
+    if (overrides.find(candidate) == overrides.end()) {
+      size_t bytes = kOverrideBytes + candidate.length();
+      while (entries_.size() > 1 && bytes_ + bytes > byteBudget_) {
+        index = evict(timestamp, &stats_.byteBudgetEvictions, index);
+      }
+    }
+  }
+  linkFront(index);
+  entries_[index].observation.update(candidate, timestamp,
+                                     forceHighScoreOverride);
+  updateBytes(index);
+  return index;
+}
+
+UserOverrideModel::Suggestion UserOverrideModel::suggest(
+    const ObservationKey& key, double timestamp) const {
+  uint32_t index = findEntry(key, key.hash());
+  if (index == kNone) {
     return UserOverrideModel::Suggestion{};
   }
 
-  auto listIter = mapIter->second;
-  auto& keyValuePair = *listIter;
-  const Observation& observation = keyValuePair.second;
+  const Observation& observation = entries_[index].observation;
 
-  std::string candidate;
+  std::string_view candidate;
   bool forceHighScoreOverride = false;
   double score = 0;
   for (auto i = observation.overrides.begin(); i != observation.overrides.end();
@@ -216,19 +385,528 @@ UserOverrideModel::Suggestion UserOverrideModel::suggest(const std::string& key,
       score = overrideScore;
     }
   }
-  return UserOverrideModel::Suggestion{candidate, forceHighScoreOverride};
+  return UserOverrideModel::Suggestion{std::string(candidate),
+                                       forceHighScoreOverride};
+}
+
+uint32_t UserOverrideModel::findEntry(const ObservationKey& key,
+                                      uint64_t hash) const {
+  if (slots_.empty()) {
+    return kNone;
+  }
+
+  size_t mask = slots_.size() - 1;
+  for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+    uint32_t index = slots_[slot];
+    if (index == kNone) {
+      return kNone;
+    }
+    const Entry& entry = entries_[index];
+    if (entry.hash == hash && key.equals(entry.key)) {
+      return index;
+    }
+  }
 }
 
-void UserOverrideModel::Observation::update(const std::string& candidate,
+uint32_t UserOverrideModel::addEntry(const ObservationKey& key,
+                                     uint64_t hash) {
+  if (slots_.empty()) {
+    // At most half full, so that probing stays short.
+    size_t slotCount = 1;
+    while (slotCount < capacity_ * 2) {
+      slotCount *= 2;
+    }
+    slots_.assign(slotCount, kNone);
+    entries_.reserve(capacity_);
+  }
+
+  assert(entries_.size() < capacity_);
+  auto index = static_cast<uint32_t>(entries_.size());
+  Entry& entry = entries_.emplace_back();
+  key.assignTo(&entry.key);
+  entry.hash = hash;
+
+  size_t mask = slots_.size() - 1;
+  size_t slot = hash & mask;
+  while (slots_[slot] != kNone) {
+    slot = (slot + 1) & mask;
+  }
+  slots_[slot] = index;
+  return index;
+}
+
+uint32_t UserOverrideModel::removeEntry(uint32_t index, uint32_t keep) {
+  removeFromTable(index);
+  unlink(index);
+  bytes_ -= entries_[index].bytes;
+
+  auto last = static_cast<uint32_t>(entries_.size() - 1);
+  if (index != last) {
+    moveInTable(last, index);
+    Entry& moved = entries_[index] = std::move(entries_[last]);
+    if (moved.prev != kNone) {
+      entries_[moved.prev].next = index;
+    } else if (mostRecent_ == last) {
+      mostRecent_ = index;
+    }
+    if (moved.next != kNone) {
+      entries_[moved.next].prev = index;
+    } else if (leastRecent_ == last) {
+      leastRecent_ = index;
+    }
+  }
+  entries_.pop_back();
+  return keep == last ? index : keep;
+}
+
+uint32_t UserOverrideModel::evict(double timestamp, size_t* evictionCount,
+                                  uint32_t keep) {
+  // Going from the least recently used entry, so that among entries of the
+  // same score, the least recently used one is evicted.
+  uint32_t victim = kNone;
+  double victimScore = 0;
+  size_t sampled = 0;
+  for (uint32_t i = leastRecent_; i != kNone && sampled < kEvictionSampleSize;
+       i = entries_[i].prev, ++sampled) {
+    double score = entries_[i].observation.score(timestamp, decayExponent_);
+    if (victim == kNone || score < victimScore) {
+      victim = i;
+      victimScore = score;
+    }
+  }
+  assert(victim != kNone);
+  ++*evictionCount;
+  return removeEntry(victim, keep);
+}
+
+void UserOverrideModel::sweep(double timestamp) {
+  for (size_t step = 0; step < kSweepStep && !entries_.empty(); ++step) {
+    if (sweepCursor_ >= entries_.size()) {
+      sweepCursor_ = 0;
+    }
+    auto index = static_cast<uint32_t>(sweepCursor_);
+    auto& overrides = entries_[index].observation.overrides;
+    size_t overrideCount = overrides.size();
+    for (auto i = overrides.begin(); i != overrides.end();) {
+      if (timestamp - i->second.timestamp > fullDecayAge_) {
+        i = overrides.erase(i);
+      } else {
+        ++i;
+      }
+    }
+
+    stats_.decayedOverrides += overrideCount - overrides.size();
+    if (overrides.empty()) {
+      // The last entry is moved into the index, and is swept next.
+      removeEntry(index, kNone);
+      ++stats_.decayedEntries;
+      continue;
+    }
+    if (overrides.size() != overrideCount) {
+      updateBytes(index);
+    }
+    ++sweepCursor_;
+  }
+}
+
+void UserOverrideModel::updateBytes(uint32_t index) {
+  Entry& entry = entries_[index];
+  size_t bytes = kEntryBytes + entry.key.length();
+  for (const auto& [candidate, o] : entry.observation.overrides) {
+    bytes += kOverrideBytes + candidate.length();
+  }
+  bytes_ = bytes_ - entry.bytes + bytes;
+  entry.bytes = bytes;
+}
+
+UserOverrideModel::Stats UserOverrideModel::stats() const {
+  Stats stats = stats_;
+  stats.entries = entries_.size();
+  stats.bytes = bytes_;
+  for (const Entry& entry : entries_) {
+    stats.overrides += entry.observation.overrides.size();
+  }
+  return stats;
+}
+
+void UserOverrideModel::moveInTable(uint32_t index, uint32_t newIndex) {
+  size_t mask = slots_.size() - 1;
+  size_t slot = entries_[index].hash & mask;
+  while (slots_[slot] != index) {
+    slot = (slot + 1) & mask;
+  }
+  slots_[slot] = newIndex;
+}
+
+void UserOverrideModel::removeFromTable(uint32_t index) {
+  size_t mask = slots_.size() - 1;
+  size_t slot = entries_[index].hash & mask;
+  while (slots_[slot] != index) {
+    slot = (slot + 1) & mask;
+  }
+
+  // Shift back the entries after the slot that would no longer be found by
+  // probing from their home slots, so that no tombstones are needed.
+  size_t next = slot;
+  while (true) {
+    next = (next + 1) & mask;
+    uint32_t nextIndex = slots_[next];
+    if (nextIndex == kNone) {
+      break;
+    }
+    size_t home = entries_[nextIndex].hash & mask;
+    if (((next - home) & mask) >= ((next - slot) & mask)) {
+      slots_[slot] = nextIndex;
+      slot = next;
+    }
+  }
+  slots_[slot] = kNone;
+}
+
+void UserOverrideModel::linkFront(uint32_t index) {
+  Entry& entry = entries_[index];
+  entry.prev = kNone;
+  entry.next = mostRecent_;
+  if (mostRecent_ != kNone) {
+    entries_[mostRecent_].prev = index;
+  } else {
+    leastRecent_ = index;
+  }
+  mostRecent_ = index;
+}
+
+void UserOverrideModel::linkBack(uint32_t index) {
+  Entry& entry = entries_[index];
+  entry.prev = leastRecent_;
+  entry.next = kNone;
+  if (leastRecent_ != kNone) {
+    entries_[leastRecent_].next = index;
+  } else {
+    mostRecent_ = index;
+  }
+  leastRecent_ = index;
+}
+
+void UserOverrideModel::unlink(uint32_t index) {
+  Entry& entry = entries_[index];
+  if (entry.prev != kNone) {
+    entries_[entry.prev].next = entry.next;
+  } else {
+    mostRecent_ = entry.next;
+  }
+  if (entry.next != kNone) {
+    entries_[entry.next].prev = entry.prev;
+  } else {
+    leastRecent_ = entry.prev;
+  }
+  entry.prev = kNone;
+  entry.next = kNone;
+}
+
+bool UserOverrideModel::open(const char* path) {
+  if (journalFd_ != -1 && path_ == path) {
+    return true;
+  }
+
+  // The store is loaded into a model of its own, so that the entries in
+  // memory are kept if it cannot be opened, such as in a read-only folder.
+  UserOverrideModel loaded(capacity_, 1, byteBudget_);
+  loaded.decayExponent_ = decayExponent_;
+  loaded.fullDecayAge_ = fullDecayAge_;
+  std::string journalPath = std::string(path) + kJournalSuffix;
+  uint64_t generation = loaded.loadSnapshot(path);
+  bool opened = loaded.replayJournal(journalPath, generation) ||
+                loaded.resetJournal(journalPath, generation);
+
+  close();
+  if (!opened) {
+    return false;
+  }
+
+  entries_ = std::move(loaded.entries_);
+  slots_ = std::move(loaded.slots_);
+  mostRecent_ = loaded.mostRecent_;
+  leastRecent_ = loaded.leastRecent_;
+  bytes_ = loaded.bytes_;
+  sweepCursor_ = loaded.sweepCursor_;
+  stats_.capacityEvictions += loaded.stats_.capacityEvictions;
+  stats_.byteBudgetEvictions += loaded.stats_.byteBudgetEvictions;
+  stats_.decayedOverrides += loaded.stats_.decayedOverrides;
+  stats_.decayedEntries += loaded.stats_.decayedEntries;
+
+  path_ = path;
+  generation_ = generation;
+  journalFd_ = loaded.journalFd_;
+  journalLength_ = loaded.journalLength_;
+  journalObservationCount_ = loaded.journalObservationCount_;
+  loaded.journalFd_ = -1;
+  return true;
+}
+
+void UserOverrideModel::close() {
+  if (journalFd_ != -1) {
+    ::close(journalFd_);
+  }
+  path_.clear();
+  generation_ = 0;
+  journalFd_ = -1;
+  journalLength_ = 0;
+  journalObservationCount_ = 0;
+}
+
+bool UserOverrideModel::compact() {
+  if (journalFd_ == -1) {
+    return false;
+  }
+
+  std::string payload;
+  for (uint32_t i = mostRecent_; i != kNone; i = entries_[i].next) {
+    const std::string& key = entries_[i].key;
+    const Observation& observation = entries_[i].observation;
+    AppendValue(&payload, static_cast<uint32_t>(key.length()));
+    AppendValue(&payload, static_cast<uint32_t>(observation.overrides.size()));
+    AppendValue(&payload, static_cast<uint64_t>(observation.count));
+    payload.append(key);
+    for (const auto& [candidate, o] : observation.overrides) {
+      AppendValue(&payload, static_cast<uint32_t>(candidate.length()));
+      AppendValue(&payload, static_cast<uint32_t>(o.forceHighScoreOverride));
+      AppendValue(&payload, static_cast<uint64_t>(o.count));
+      AppendValue(&payload, o.timestamp);
+      payload.append(candidate);
+    }
+  }
+
+  uint64_t generation = generation_ + 1;
+  std::string snapshot = FileHeader(kSnapshotMagic, generation);
+  AppendValue(&snapshot, static_cast<uint32_t>(entries_.size()));
+  AppendValue(&snapshot, static_cast<uint64_t>(payload.length()));
+  AppendValue(&snapshot, Checksum(payload.data(), payload.length()));
+  snapshot.append(payload);
+  if (!ReplaceFile(path_, snapshot)) {
+    return false;
+  }
+
+  // From here on, the old journal no longer applies, even if the new one
+  // cannot be written.
+  generation_ = generation;
+  if (!resetJournal(path_ + kJournalSuffix, generation)) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+uint64_t UserOverrideModel::loadSnapshot(const std::string& path) {
+  MemoryMappedFile file;
+  if (!file.open(path.c_str()) || file.length() < kSnapshotHeaderLength) {
+    return 0;
+  }
+
+  ByteReader header(file.data(), kSnapshotHeaderLength);
+  uint64_t generation = 0;
+  uint32_t entryCount = 0;
+  uint64_t payloadLength = 0;
+  uint64_t checksum = 0;
+  if (!header.readHeader(kSnapshotMagic, &generation) ||
+      !header.read(&entryCount) || !header.read(&payloadLength) ||
+      !header.read(&checksum) ||
+      payloadLength != file.length() - kSnapshotHeaderLength) {
+    return 0;
+  }
+
+  const char* payload = file.data() + kSnapshotHeaderLength;
+  if (Checksum(payload, payloadLength) != checksum) {
+    return 0;
+  }
+
+  // The entries are from the most to the least recently used, and so adding
+  // them to the back restores the LRU order.
+  ByteReader reader(payload, payloadLength);
+  for (uint32_t i = 0; i < entryCount && entries_.size() < capacity_; ++i) {
+    uint32_t keyLength = 0;
+    uint32_t overrideCount = 0;
+    uint64_t count = 0;
+    std::string_view key;
+    if (!reader.read(&keyLength) || !reader.read(&overrideCount) ||
+        !reader.read(&count) || !reader.read(keyLength, &key)) {
+      break;
+    }
+
+    Observation observation;
+    observation.count = count;
+    bool valid = true;
+    for (uint32_t j = 0; j < overrideCount; ++j) {
+      uint32_t candidateLength = 0;
+      uint32_t forceHighScoreOverride = 0;
+      uint64_t candidateCount = 0;
+      Override o;
+      std::string_view candidate;
+      if (!reader.read(&candidateLength) ||
+          !reader.read(&forceHighScoreOverride) ||
+          !reader.read(&candidateCount) || !reader.read(&o.timestamp) ||
+          !reader.read(candidateLength, &candidate)) {
+        valid = false;
+        break;
+      }
+      o.count = candidateCount;
+      o.forceHighScoreOverride = forceHighScoreOverride != 0;
+      observation.overrides.emplace_hint(observation.overrides.end(),
+                                         candidate, o);
+    }
+    if (!valid) {
+      break;
+    }
+
+    ObservationKey observationKey(key);
+    uint64_t hash = observationKey.hash();
+    if (findEntry(observationKey, hash) != kNone) {
+      continue;
+    }
+    uint32_t index = addEntry(observationKey, hash);
+    entries_[index].observation = std::move(observation);
+    linkBack(index);
+    updateBytes(index);
+    if (bytes_ > byteBudget_) {
+      removeEntry(index, kNone);
+      break;
+    }
+  }
+  return generation;
+}
+
+bool UserOverrideModel::replayJournal(const std::string& path,
+                                      uint64_t generation) {
+  size_t validLength = 0;
+  size_t observationCount = 0;
+  {
+    MemoryMappedFile file;
+    if (!file.open(path.c_str()) || file.length() < kHeaderLength) {
+      return false;
+    }
+
+    ByteReader reader(file.data(), file.length());
+    uint64_t journalGeneration = 0;
+    if (!reader.readHeader(kJournalMagic, &journalGeneration) ||
+        journalGeneration != generation) {
+      return false;
+    }
+
+    while (true) {
+      validLength = reader.ptr() - file.data();
+      const char* start = reader.ptr();
+      uint32_t keyLength = 0;
+      uint32_t candidateLength = 0;
+      uint32_t forceHighScoreOverride = 0;
+      double timestamp = 0;
+      std::string_view key;
+      std::string_view candidate;
+      uint64_t checksum = 0;
+      if (!reader.read(&keyLength) || !reader.read(&candidateLength) ||
+          !reader.read(&forceHighScoreOverride) || !reader.read(&timestamp) ||
+          !reader.read(keyLength, &key) ||
+          !reader.read(candidateLength, &candidate)) {
+        break;
+      }
+      size_t length = reader.ptr() - start;
+      if (!reader.read(&checksum) || checksum != Checksum(start, length)) {
+        break;
+      }
+      update(ObservationKey(key), candidate, timestamp,
+             forceHighScoreOverride != 0);
+      ++observationCount;
+    }
+  }
+
+  journalFd_ = ::open(path.c_str(), O_WRONLY | O_APPEND);
+  if (journalFd_ == -1) {
+    return false;
+  }
+
+  // Cut off a torn observation, so that new ones are not appended after it.
+  struct stat sb;
+  if (fstat(journalFd_, &sb) == -1 ||
+      (static_cast<size_t>(sb.st_size) != validLength &&
+       ftruncate(journalFd_, static_cast<off_t>(validLength)) != 0)) {
+    ::close(journalFd_);
+    journalFd_ = -1;
+    return false;
+  }
+
+  journalLength_ = validLength;
+  journalObservationCount_ = observationCount;
+  return true;
+}
+
+bool UserOverrideModel::resetJournal(const std::string& path,
+                                     uint64_t generation) {
+  if (journalFd_ != -1) {
+    ::close(journalFd_);
+    journalFd_ = -1;
+  }
+
+  std::string header = FileHeader(kJournalMagic, generation);
+  if (!ReplaceFile(path, header)) {
+    return false;
+  }
+
+  journalFd_ = ::open(path.c_str(), O_WRONLY | O_APPEND);
+  if (journalFd_ == -1) {
+    return false;
+  }
+  journalLength_ = header.length();
+  journalObservationCount_ = 0;
+  return true;
+}
+
+void UserOverrideModel::appendToJournal(std::string_view key,
+                                        std::string_view candidate,
+                                        double timestamp,
+                                        bool forceHighScoreOverride) {
+  std::string record;
+  AppendValue(&record, static_cast<uint32_t>(key.length()));
+  AppendValue(&record, static_cast<uint32_t>(candidate.length()));
+  AppendValue(&record, static_cast<uint32_t>(forceHighScoreOverride));
+  AppendValue(&record, timestamp);
+  record.append(key);
+  record.append(candidate);
+  AppendValue(&record, Checksum(record.data(), record.length()));
+
+  // If the write fails halfway, remove what has been written, so that later
+  // observations are not appended after a torn one.
+  if (!WriteAll(journalFd_, record.data(), record.length())) {
+    if (ftruncate(journalFd_, static_cast<off_t>(journalLength_)) != 0) {
+      close();
+    }
+    return;
+  }
+  journalLength_ += record.length();
+  ++journalObservationCount_;
+}
+
+void UserOverrideModel::Observation::update(std::string_view candidate,
                                             double timestamp,
                                             bool forceHighScoreOverride) {
   count++;
-  auto& o = overrides[candidate];
+  auto it = overrides.find(candidate);
+  if (it == overrides.end()) {
+    it = overrides.emplace(candidate, Override()).first;
+  }
+  auto& o = it->second;
   o.timestamp = timestamp;
   o.count++;
   o.forceHighScoreOverride = forceHighScoreOverride;
 }
 
+double UserOverrideModel::Observation::score(double timestamp,
+                                             double decayExponent) const {
+  double highest = 0;
+  for (const auto& [candidate, o] : overrides) {
+    highest = std::max(
+        highest, Score(o.count, count, o.timestamp, timestamp, decayExponent));
+  }
+  return highest;
+}
+
 static double Score(size_t eventCount, size_t totalCount, double eventTimestamp,
                     double timestamp, double lambda) {
   double decay = exp((timestamp - eventTimestamp) * lambda);
@@ -241,60 +919,134 @@ static double Score(size_t eventCount, size_t totalCount, double eventTimestamp,
   return prob * decay;
 }
 
-static std::string CombineReadingValue(const std::string& reading,
-                                       const std::string& value) {
-  return std::string("(") + reading + "," + value + ")";
+// FNV-1a over 8-byte words of the concatenated parts, with a final mix so
+// that the low bits, which pick the slot, depend on all of the key.
+uint64_t UserOverrideModel::ObservationKey::hash() const {
+  constexpr uint64_t kPrime = 1099511628211ULL;
+  uint64_t hash = 14695981039346656037ULL;
+  char word[sizeof(uint64_t)];
+  size_t filled = 0;
+  size_t length = 0;
+  for (size_t p = 0; p < size_; ++p) {
+    const char* data = parts_[p].data();
+    size_t remaining = parts_[p].length();
+    length += remaining;
+    while (remaining > 0) {
+      size_t n = std::min(sizeof(word) - filled, remaining);
+      memcpy(word + filled, data, n);
+      filled += n;
+      data += n;
+      remaining -= n;
+      if (filled == sizeof(word)) {
+        uint64_t w;
+        memcpy(&w, word, sizeof(w));
+        hash = (hash ^ w) * kPrime;
+        filled = 0;
+      }
+    }
+  }
+  if (filled > 0) {
+    uint64_t w = 0;
+    memcpy(&w, word, filled);
+    hash = (hash ^ w) * kPrime;
+  }
+
+  // The finalizer of SplitMix64.
+  hash ^= length;
+  hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+  return hash ^ (hash >> 31);
+}
+
+size_t UserOverrideModel::ObservationKey::length() const {
+  size_t length = 0;
+  for (size_t p = 0; p < size_; ++p) {
+    length += parts_[p].length();
+  }
+  return length;
+}
+
+bool UserOverrideModel::ObservationKey::equals(std::string_view key) const {
+  size_t offset = 0;
+  for (size_t p = 0; p < size_; ++p) {
+    std::string_view part = parts_[p];
+    if (key.length() - offset < part.length() ||
+        key.compare(offset, part.length(), part) != 0) {
+      return false;
+    }
+    offset += part.length();
+  }
+  return offset == key.length();
+}
+
+void UserOverrideModel::ObservationKey::assignTo(std::string* key) const {
+  key->clear();
+  for (size_t p = 0; p < size_; ++p) {
+    key->append(parts_[p]);
+  }
 }
 
 static bool IsPunctuation(
     const Formosa::Gramambular2::ReadingGrid::NodePtr& node) {
-  const std::string& reading = node->reading();
+  std::string_view reading = node->reading();
   return !reading.empty() && reading[0] == '_';
 }
 
-static std::string FormObservationKey(
+UserOverrideModel::ObservationKey UserOverrideModel::FormObservationKey(
     std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
         head,
     std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
         end) {
-  // Using the top unigram from the head node. Recall that this is an
-  // observation for *before* the user override, and when we provide
-  // a suggestion, this head node is never overridden yet.
-  std::string headStr =
-      CombineReadingValue((*head)->reading(), (*head)->unigrams()[0].value());
+  // The key is "(reading,value)" for each of the anterior, the previous, and
+  // the head nodes, joined by "-". The parts point into the nodes, which
+  // outlive the key.
+  const auto& headNode = *head;
 
   // For the next two nodes, use their current unigram values. If it's a
   // punctuation, we ignore the reading and the value altogether and treat
   // it as if it's like the beginning of the sentence.
-  std::string prevStr;
-  bool prevIsPunctuation = false;
+  const Formosa::Gramambular2::ReadingGrid::NodePtr* prevNode = nullptr;
+  const Formosa::Gramambular2::ReadingGrid::NodePtr* anteriorNode = nullptr;
   if (head != end) {
     --head;
-    prevIsPunctuation = IsPunctuation(*head);
-    if (prevIsPunctuation) {
-      prevStr = kEmptyNodeString;
-    } else {
-      prevStr = CombineReadingValue((*head)->reading(),
-                                    (*head)->currentUnigram().value());
+    if (!IsPunctuation(*head)) {
+      prevNode = &*head;
+      if (head != end) {
+        --head;
+        if (!IsPunctuation(*head)) {
+          anteriorNode = &*head;
+        }
+      }
     }
-  } else {
-    prevStr = kEmptyNodeString;
   }
 
-  std::string anteriorStr;
-  if (head != end && !prevIsPunctuation) {
-    --head;
-    if (IsPunctuation((*head))) {
-      anteriorStr = kEmptyNodeString;
-    } else {
-      anteriorStr = CombineReadingValue((*head)->reading(),
-                                        (*head)->currentUnigram().value());
-    }
+  ObservationKey key;
+  auto addNode = [&key](std::string_view reading, std::string_view value) {
+    key.add("(");
+    key.add(reading);
+    key.add(",");
+    key.add(value);
+    key.add(")");
+  };
+
+  if (anteriorNode != nullptr) {
+    addNode((*anteriorNode)->reading(), (*anteriorNode)->valueView());
+  } else {
+    key.add(kEmptyNodeString);
+  }
+  key.add("-");
+  if (prevNode != nullptr) {
+    addNode((*prevNode)->reading(), (*prevNode)->valueView());
   } else {
-    anteriorStr = kEmptyNodeString;
+    key.add(kEmptyNodeString);
   }
+  key.add("-");
 
-  return anteriorStr + "-" + prevStr + "-" + headStr;
+  // Using the top unigram from the head node. Recall that this is an
+  // observation for *before* the user override, and when we provide
+  // a suggestion, this head node is never overridden yet.
+  addNode(headNode->reading(), headNode->unigrams()[0].valueView());
+  return key;
 }
 
 }  // namespace McBopomofo
@@ -24,10 +24,15 @@
 #ifndef SRC_ENGINE_USEROVERRIDEMODEL_H_
 #define SRC_ENGINE_USEROVERRIDEMODEL_H_
 
-#include <list>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 #include "gramambular2/reading_grid.h"
 
@@ -35,7 +40,18 @@ namespace McBopomofo {
 
 class UserOverrideModel {
  public:
-  UserOverrideModel(size_t capacity, double decayConstant);
+  // The model keeps at most capacity entries, and, if a byte budget is
+  // given, at most about that many bytes of them. When either limit is
+  // reached, the entry with the lowest decayed score among the least recently
+  // used ones is evicted.
+  UserOverrideModel(size_t capacity, double decayConstant,
+                    size_t byteBudget = kNoByteBudget);
+  ~UserOverrideModel();
+
+  static constexpr size_t kNoByteBudget = SIZE_MAX;
+
+  UserOverrideModel(const UserOverrideModel&) = delete;
+  UserOverrideModel& operator=(const UserOverrideModel&) = delete;
 
   struct Suggestion {
     Suggestion() = default;
@@ -62,6 +78,57 @@ class UserOverrideModel {
 
   Suggestion suggest(const std::string& key, double timestamp);
 
+  // Keeps the model in a persistent store at the path, replacing what is in
+  // memory with what is in the store. The store is a binary snapshot of the
+  // model at the path, which is memory-mapped to load, and a journal of the
+  // observations made since, at the path plus kJournalSuffix. Each
+  // observation is appended to the journal, which takes one write and no
+  // sync, and so can be done while typing. A journal torn by a crash is cut
+  // back to its last complete observation.
+  // Returns true if already open at the path. Returns false if the journal
+  // cannot be written, in which case the model keeps what is in memory and is
+  // not persisted.
+  bool open(const char* path);
+
+  // Stops persisting the model, which is kept in memory.
+  void close();
+
+  [[nodiscard]] bool isOpen() const { return journalFd_ != -1; }
+
+  // Writes a new snapshot of the model and empties the journal. This syncs
+  // the snapshot to disk, and so observe() does not do it; the owner of the
+  // model calls this when the user is not typing, such as when the input
+  // method is deactivated, once needsCompaction() is true.
+  bool compact();
+
+  // Whether the journal has as many observations as the capacity. Until it is
+  // compacted, the journal keeps growing, and opening the store replays all
+  // of it.
+  [[nodiscard]] bool needsCompaction() const {
+    return journalFd_ != -1 && journalObservationCount_ >= capacity_;
+  }
+
+  static constexpr char kJournalSuffix[] = "-journal";
+
+  struct Stats {
+    size_t entries = 0;
+    size_t overrides = 0;
+
+    // An estimate of the heap memory used by the entries.
+    size_t bytes = 0;
+
+    // Entries evicted to make room under the capacity or the byte budget.
+    size_t capacityEvictions = 0;
+    size_t byteBudgetEvictions = 0;
+
+    // Overrides dropped by the sweep because they had fully decayed, and
+    // entries dropped because all of their overrides had.
+    size_t decayedOverrides = 0;
+    size_t decayedEntries = 0;
+  };
+
+  [[nodiscard]] Stats stats() const;
+
  private:
   struct Override {
     size_t count = 0;
@@ -71,19 +138,155 @@ class UserOverrideModel {
 
   struct Observation {
     size_t count;
-    std::map<std::string, Override> overrides;
+    std::map<std::string, Override, std::less<>> overrides;
 
     Observation() : count(0) {}
-    void update(const std::string& candidate, double timestamp,
+    void update(std::string_view candidate, double timestamp,
                 bool forceHighScoreOverride);
+
+    // Returns the highest score among the overrides.
+    [[nodiscard]] double score(double timestamp, double decayExponent) const;
+  };
+
+  // An observation key, given as the parts that form the key when they are
+  // concatenated. This way, a key formed from the nodes of a walk can be
+  // hashed and looked up without building the string.
+  class ObservationKey {
+   public:
+    ObservationKey() = default;
+    explicit ObservationKey(std::string_view key) { add(key); }
+
+    void add(std::string_view part) {
+      assert(size_ < kMaxParts);
+      parts_[size_++] = part;
+    }
+
+    [[nodiscard]] uint64_t hash() const;
+
+    [[nodiscard]] size_t length() const;
+
+    // Returns true if the parts form the key.
+    [[nodiscard]] bool equals(std::string_view key) const;
+
+    void assignTo(std::string* key) const;
+
+   private:
+    // Three nodes of five parts each, and two separators.
+    static constexpr size_t kMaxParts = 17;
+    std::array<std::string_view, kMaxParts> parts_;
+    size_t size_ = 0;
   };
 
-  typedef std::pair<std::string, Observation> KeyObservationPair;
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  // An entry of the model. The entries form the LRU list through their
+  // indices, from the most recently used one, where prev is kNone, to the
+  // least recently used one, where next is kNone. The key is kept for telling
+  // apart keys with the same hash, and for persistence.
+  struct Entry {
+    std::string key;
+    uint64_t hash = 0;
+    Observation observation;
+    uint32_t prev = kNone;
+    uint32_t next = kNone;
+
+    // The estimate of the memory used by the entry, as last computed.
+    size_t bytes = 0;
+  };
+
+  // Estimates of the memory used by an entry, including its hash table
+  // slots, and by an override, besides their strings.
+  static constexpr size_t kEntryBytes = sizeof(Entry) + 2 * sizeof(uint32_t);
+  static constexpr size_t kOverrideBytes =
+      sizeof(std::string) + sizeof(Override) + 4 * sizeof(void*);
+
+  // Forms the observation key from the nodes of a walk. This goes backward,
+  // and the "end" here should be a .cbegin() of a vector.
+  static ObservationKey FormObservationKey(
+      std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
+          head,
+      std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
+          end);
+
+  // Updates the model without journaling the observation, and returns the
+  // index of the entry of the key.
+  uint32_t update(const ObservationKey& key, std::string_view candidate,
+                  double timestamp, bool forceHighScoreOverride);
+
+  Suggestion suggest(const ObservationKey& key, double timestamp) const;
+
+  // Returns the index of the entry of the key, or kNone.
+  [[nodiscard]] uint32_t findEntry(const ObservationKey& key,
+                                   uint64_t hash) const;
+
+  // Adds an entry for a key that is not in the model. The model must not be
+  // full, and the entry is not linked into the LRU list.
+  uint32_t addEntry(const ObservationKey& key, uint64_t hash);
+
+  // Removes the entry, moving the last entry into its place. Returns the
+  // index that the entry at the index keep is at afterwards.
+  uint32_t removeEntry(uint32_t index, uint32_t keep);
+
+  // Evicts the entry with the lowest score among the least recently used
+  // ones in the LRU list, and counts it. Returns the index that the entry at
+  // the index keep is at afterwards.
+  uint32_t evict(double timestamp, size_t* evictionCount, uint32_t keep);
+
+  // Drops the fully decayed overrides of a few entries, going around the
+  // entries a few at a time, so that the sweep is spread over observations.
+  void sweep(double timestamp);
+
+  // Recomputes the memory used by the entry.
+  void updateBytes(uint32_t index);
+
+  // Removes the entry from the hash table.
+  void removeFromTable(uint32_t index);
+
+  // Points the hash table slot of the entry at the index to newIndex.
+  void moveInTable(uint32_t index, uint32_t newIndex);
+
+  void linkFront(uint32_t index);
+  void linkBack(uint32_t index);
+  void unlink(uint32_t index);
+
+  // Loads the snapshot, and returns its generation, or 0 if there is no
+  // valid snapshot.
+  uint64_t loadSnapshot(const std::string& path);
+
+  // Replays the journal if it follows the snapshot of the generation, and
+  // opens it for appending. Returns false if the journal does not follow the
+  // snapshot or cannot be opened.
+  bool replayJournal(const std::string& path, uint64_t generation);
+
+  // Replaces the journal with an empty one following the snapshot of the
+  // generation, and opens it for appending.
+  bool resetJournal(const std::string& path, uint64_t generation);
+
+  void appendToJournal(std::string_view key, std::string_view candidate,
+                       double timestamp, bool forceHighScoreOverride);
 
   size_t capacity_;
   double decayExponent_;
-  std::list<KeyObservationPair> lruList_;
-  std::map<std::string, std::list<KeyObservationPair>::iterator> lruMap_;
+  // The age at which an override has fully decayed and no longer scores.
+  double fullDecayAge_;
+  size_t byteBudget_;
+
+  // At most capacity_ entries, indexed by a hash table whose slots hold
+  // indices into entries_, or kNone. The table is kept at most half full.
+  std::vector<Entry> entries_;
+  std::vector<uint32_t> slots_;
+  uint32_t mostRecent_ = kNone;
+  uint32_t leastRecent_ = kNone;
+  size_t bytes_ = 0;
+  size_t sweepCursor_ = 0;
+  Stats stats_;
+
+  // The persistent store, if open.
+  std::string path_;
+  uint64_t generation_ = 0;
+  int journalFd_ = -1;
+  size_t journalLength_ = 0;
+  size_t journalObservationCount_ = 0;
 };
 
 }  // namespace McBopomofo
@@ -0,0 +1,196 @@
+// Copyright (c) 2025 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "UserOverrideModel.h"
+#include "gramambular2/allocation_counter.h"
+#include "gramambular2/reading_grid.h"
+
+namespace {
+
+using Formosa::Gramambular2::HeapAllocationCount;
+using Formosa::Gramambular2::LanguageModel;
+using Formosa::Gramambular2::ReadingGrid;
+using McBopomofo::UserOverrideModel;
+
+// The capacity and the half-life used by the input method.
+constexpr int kCapacity = 500;
+constexpr double kHalflife = 5400.0;
+constexpr double kNow = 1657772432;
+
+// An observation key in the shape of the ones formed from walks.
+std::string Key(int i) {
+  return "(ㄉㄚˋ,大" + std::to_string(i) + ")-(ㄐㄧㄚ,家)-(ㄏㄠˇ,好" +
+         std::to_string(i) + ")";
+}
+
+std::string StorePath() {
+  return (std::filesystem::temp_directory_path() /
+          "org.openvanilla.mcbopomofo.useroverridemodelbenchmark.db")
+      .string();
+}
+
+void RemoveStore(const std::string& path) {
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + UserOverrideModel::kJournalSuffix);
+}
+
+// Loads a full model from a snapshot and a half-full journal.
+static void BM_UserOverrideModelOpen(benchmark::State& state) {
+  std::string path = StorePath();
+  RemoveStore(path);
+  {
+    UserOverrideModel uom(kCapacity, kHalflife);
+    uom.open(path.c_str());
+    for (int i = 0; i < kCapacity * 3 / 2; ++i) {
+      uom.observe(Key(i % kCapacity), "值" + std::to_string(i % 7), kNow + i);
+    }
+  }
+
+  UserOverrideModel uom(kCapacity, kHalflife);
+  for (auto _ : state) {
+    uom.open(path.c_str());
+    uom.close();
+  }
+  RemoveStore(path);
+}
+BENCHMARK(BM_UserOverrideModelOpen)->Unit(benchmark::kMicrosecond);
+
+// Observes with the journal, which observe() never compacts.
+static void BM_UserOverrideModelObserve(benchmark::State& state) {
+  std::string path = StorePath();
+  RemoveStore(path);
+  UserOverrideModel uom(kCapacity, kHalflife);
+  if (state.range(0) != 0) {
+    uom.open(path.c_str());
+  }
+  int i = 0;
+  for (auto _ : state) {
+    uom.observe(Key(i % (kCapacity * 2)), "值" + std::to_string(i % 7),
+                kNow + i);
+    ++i;
+  }
+  uom.close();
+  RemoveStore(path);
+}
+BENCHMARK(BM_UserOverrideModelObserve)
+    ->ArgName("persistent")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMicrosecond);
+
+// A language model with one single-character phrase per reading.
+class SingleCharacterLM : public LanguageModel {
+ public:
+  std::vector<Unigram> getUnigrams(const std::string& reading) override {
+    if (!hasUnigrams(reading)) {
+      return {};
+    }
+    return {Unigram("字" + reading, -1)};
+  }
+
+  bool hasUnigrams(const std::string& reading) override {
+    return reading.find('-') == std::string::npos;
+  }
+};
+
+constexpr int kWalkLength = 20;
+
+std::string Reading(int i) { return "ㄅ" + std::to_string(i); }
+
+std::string Node(int i) {
+  return "(" + Reading(i) + ",字" + Reading(i) + ")";
+}
+
+// Fills the model with observations for the nodes of the walk, and then with
+// other keys up to the capacity.
+void FillModel(UserOverrideModel* uom) {
+  for (int i = 0; i < kCapacity - kWalkLength; ++i) {
+    uom->observe(Key(i), "值", kNow);
+  }
+  for (int i = 0; i < kWalkLength; ++i) {
+    std::string anterior = i >= 2 ? Node(i - 2) : "()";
+    std::string prev = i >= 1 ? Node(i - 1) : "()";
+    uom->observe(anterior + "-" + prev + "-" + Node(i), "值", kNow);
+  }
+}
+
+// Suggests for the cursor moving along a walk, which is what happens after
+// every reading typed.
+static void BM_UserOverrideModelSuggest(benchmark::State& state) {
+  ReadingGrid grid(std::make_shared<SingleCharacterLM>());
+  for (int i = 0; i < kWalkLength; ++i) {
+    grid.insertReading(Reading(i));
+  }
+  ReadingGrid::WalkResult walk = grid.walk();
+
+  UserOverrideModel uom(kCapacity, kHalflife);
+  FillModel(&uom);
+
+  size_t cursor = 0;
+  size_t hits = 0;
+  size_t allocations = HeapAllocationCount();
+  for (auto _ : state) {
+    auto suggestion = uom.suggest(walk, cursor, kNow);
+    hits += suggestion.empty() ? 0 : 1;
+    cursor = (cursor + 1) % kWalkLength;
+  }
+  state.counters["allocs/suggest"] = benchmark::Counter(
+      static_cast<double>(HeapAllocationCount() - allocations),
+      benchmark::Counter::kAvgIterations);
+  if (hits == 0) {
+    state.SkipWithError("no suggestions");
+  }
+}
+BENCHMARK(BM_UserOverrideModelSuggest);
+
+// Suggests for a key, half of which are in the model.
+static void BM_UserOverrideModelSuggestByKey(benchmark::State& state) {
+  UserOverrideModel uom(kCapacity, kHalflife);
+  FillModel(&uom);
+
+  std::vector<std::string> keys;
+  for (int i = 0; i < kCapacity * 2; ++i) {
+    keys.push_back(Key(i));
+  }
+  size_t i = 0;
+  size_t allocations = HeapAllocationCount();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(uom.suggest(keys[i], kNow));
+    i = (i + 1) % keys.size();
+  }
+  state.counters["allocs/suggest"] = benchmark::Counter(
+      static_cast<double>(HeapAllocationCount() - allocations),
+      benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_UserOverrideModelSuggestByKey);
+
+}  // namespace
+
+BENCHMARK_MAIN();
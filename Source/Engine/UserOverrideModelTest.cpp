@@ -21,7 +21,13 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <list>
 #include <string>
+#include <vector>
 
 #include "UserOverrideModel.h"
 #include "gtest/gtest.h"
@@ -119,4 +125,313 @@ TEST(UserOverrideModelTest, LRUBehavior) {
   ASSERT_TRUE(v.empty());
 }
 
+TEST(UserOverrideModelTest, LRUBehaviorWithManyKeys) {
+  constexpr size_t kManyKeysCapacity = 100;
+  constexpr int kKeys = 300;
+  UserOverrideModel uom(kManyKeysCapacity, kHalflife);
+
+  // Keys from the most to the least recently observed. Each key has one
+  // candidate, so that all entries score the same, and the least recently
+  // used one is evicted.
+  std::list<int> expected;
+  uint32_t r = 1;
+  for (int i = 0; i < 5000; ++i) {
+    r = r * 1103515245 + 12345;
+    int k = static_cast<int>((r >> 16) % kKeys);
+    uom.observe("key" + std::to_string(k), "value" + std::to_string(k),
+                kFakeNow);
+    expected.remove(k);
+    expected.push_front(k);
+    if (expected.size() > kManyKeysCapacity) {
+      expected.pop_back();
+    }
+  }
+
+  for (int k = 0; k < kKeys; ++k) {
+    bool kept = std::find(expected.begin(), expected.end(), k) !=
+                expected.end();
+    auto v = uom.suggest("key" + std::to_string(k), kFakeNow);
+    EXPECT_EQ(!v.empty(), kept) << k;
+  }
+  EXPECT_EQ(uom.stats().entries, kManyKeysCapacity);
+}
+
+TEST(UserOverrideModelTest, LowerScoredEntryIsEvictedFirst) {
+  UserOverrideModel uom(2, kHalflife);
+  uom.observe("abc", "x", kFakeNow);
+  uom.observe("def", "y", kFakeNow);
+  uom.observe("def", "z", kFakeNow);
+
+  // abc is the least recently used, but def, with two candidates, scores
+  // lower.
+  uom.observe("ghi", "w", kFakeNow);
+  EXPECT_EQ(uom.suggest("abc", kFakeNow).candidate, "x");
+  EXPECT_TRUE(uom.suggest("def", kFakeNow).empty());
+  EXPECT_EQ(uom.suggest("ghi", kFakeNow).candidate, "w");
+  EXPECT_EQ(uom.stats().capacityEvictions, 1);
+}
+
+TEST(UserOverrideModelTest, ByteBudget) {
+  constexpr size_t kByteBudget = 4096;
+  UserOverrideModel uom(1000, kHalflife, kByteBudget);
+  for (int i = 0; i < 200; ++i) {
+    uom.observe("key" + std::to_string(i), "value" + std::to_string(i),
+                kFakeNow + i);
+    ASSERT_LE(uom.stats().bytes, kByteBudget);
+  }
+
+  auto stats = uom.stats();
+  EXPECT_GT(stats.byteBudgetEvictions, 0);
+  EXPECT_EQ(stats.capacityEvictions, 0);
+  EXPECT_EQ(stats.entries + stats.byteBudgetEvictions, 200);
+  EXPECT_EQ(uom.suggest("key199", kFakeNow + 200).candidate, "value199");
+
+  // Growing an entry evicts the others, but not the entry itself, even once
+  // it alone is over the budget.
+  for (int i = 0; i < 100; ++i) {
+    uom.observe("key199", "value" + std::to_string(i), kFakeNow + 200);
+  }
+  EXPECT_EQ(uom.stats().entries, 1);
+  EXPECT_FALSE(uom.suggest("key199", kFakeNow + 200).empty());
+}
+
+TEST(UserOverrideModelTest, DecayedOverridesAreSwept) {
+  UserOverrideModel uom(kCapacity, kHalflife);
+  uom.observe("abc", "x", kFakeNow);
+  uom.observe("def", "y", kFakeNow);
+  uom.observe("def", "z", kFakeNow + kHalflife * 10);
+
+  // By now, x and y have fully decayed, and the sweep, which goes a few
+  // entries per observation, drops them, and abc along with x.
+  double later = kFakeNow + kHalflife * 25;
+  for (int i = 0; i < kCapacity; ++i) {
+    uom.observe("ghi", "w", later);
+  }
+
+  auto stats = uom.stats();
+  EXPECT_EQ(stats.entries, 2);
+  EXPECT_EQ(stats.overrides, 2);
+  EXPECT_EQ(stats.decayedOverrides, 2);
+  EXPECT_EQ(stats.decayedEntries, 1);
+  EXPECT_EQ(uom.suggest("def", kFakeNow + kHalflife * 11).candidate, "z");
+  EXPECT_TRUE(uom.suggest("abc", kFakeNow).empty());
+}
+
+class UserOverrideModelStoreTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = (std::filesystem::temp_directory_path() /
+             ("org.openvanilla.mcbopomofo.useroverridemodeltest." +
+              std::string(::testing::UnitTest::GetInstance()
+                              ->current_test_info()
+                              ->name()) +
+              ".db"))
+                .string();
+    journalPath_ = path_ + UserOverrideModel::kJournalSuffix;
+    TearDown();
+  }
+
+  void TearDown() override {
+    std::filesystem::remove(path_);
+    std::filesystem::remove(journalPath_);
+  }
+
+  static std::string ReadFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(file),
+            std::istreambuf_iterator<char>()};
+  }
+
+  static void WriteFile(const std::string& path, const std::string& data) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << data;
+  }
+
+  // Observes "value{i}" for "key{i % keys}", so that the oldest keys get
+  // evicted once there are more keys than the capacity.
+  static void Observe(UserOverrideModel* uom, int from, int to, int keys) {
+    for (int i = from; i < to; ++i) {
+      uom->observe("key" + std::to_string(i % keys),
+                   "value" + std::to_string(i), kFakeNow + i, i % 3 == 0);
+    }
+  }
+
+  static void ExpectSameSuggestions(UserOverrideModel* expected,
+                                    UserOverrideModel* actual, int keys) {
+    for (int i = 0; i < keys; ++i) {
+      std::string key = "key" + std::to_string(i);
+      auto e = expected->suggest(key, kFakeNow + kHalflife);
+      auto a = actual->suggest(key, kFakeNow + kHalflife);
+      EXPECT_EQ(e.candidate, a.candidate) << key;
+      EXPECT_EQ(e.forceHighScoreOverride, a.forceHighScoreOverride) << key;
+    }
+  }
+
+  std::string path_;
+  std::string journalPath_;
+};
+
+TEST_F(UserOverrideModelStoreTest, ObservationsArePersisted) {
+  UserOverrideModel reference(kCapacity, kHalflife);
+  Observe(&reference, 0, 4, 7);
+
+  {
+    UserOverrideModel uom(kCapacity, kHalflife);
+    ASSERT_TRUE(uom.open(path_.c_str()));
+    EXPECT_TRUE(uom.isOpen());
+    Observe(&uom, 0, 4, 7);
+  }
+
+  UserOverrideModel uom(kCapacity, kHalflife);
+  ASSERT_TRUE(uom.open(path_.c_str()));
+  ExpectSameSuggestions(&reference, &uom, 7);
+
+  // Observing more evicts the same keys, as the LRU order is kept.
+  Observe(&reference, 4, 9, 7);
+  Observe(&uom, 4, 9, 7);
+  ExpectSameSuggestions(&reference, &uom, 7);
+}
+
+TEST_F(UserOverrideModelStoreTest, FailedOpenKeepsTheEntriesInMemory) {
+  UserOverrideModel reference(kCapacity, kHalflife);
+  Observe(&reference, 0, 4, 7);
+
+  UserOverrideModel uom(kCapacity, kHalflife);
+  ASSERT_TRUE(uom.open(path_.c_str()));
+  Observe(&uom, 0, 4, 7);
+
+  // The journal cannot be created in a folder that does not exist. The
+  // entries are kept, also when opening is retried.
+  std::string unwritablePath = path_ + ".missing/uom";
+  EXPECT_FALSE(uom.open(unwritablePath.c_str()));
+  EXPECT_FALSE(uom.isOpen());
+  EXPECT_FALSE(uom.open(unwritablePath.c_str()));
+  ExpectSameSuggestions(&reference, &uom, 7);
+
+  Observe(&reference, 4, 9, 7);
+  Observe(&uom, 4, 9, 7);
+  ExpectSameSuggestions(&reference, &uom, 7);
+}
+
+TEST_F(UserOverrideModelStoreTest, JournalIsCompactedIntoSnapshot) {
+  UserOverrideModel reference(kCapacity, kHalflife);
+  Observe(&reference, 0, 23, 8);
+
+  {
+    UserOverrideModel uom(kCapacity, kHalflife);
+    ASSERT_TRUE(uom.open(path_.c_str()));
+    Observe(&uom, 0, 23, 8);
+  }
+
+  // Observing does not compact the journal, which now has all 23
+  // observations.
+  EXPECT_FALSE(std::filesystem::exists(path_));
+  UserOverrideModel uom(kCapacity, kHalflife);
+  ASSERT_TRUE(uom.open(path_.c_str()));
+  ExpectSameSuggestions(&reference, &uom, 8);
+  EXPECT_TRUE(uom.needsCompaction());
+
+  ASSERT_TRUE(uom.compact());
+  EXPECT_FALSE(uom.needsCompaction());
+  EXPECT_TRUE(std::filesystem::exists(path_));
+  std::string emptyJournal = ReadFile(journalPath_);
+  UserOverrideModel reloaded(kCapacity, kHalflife);
+  ASSERT_TRUE(reloaded.open(path_.c_str()));
+  ExpectSameSuggestions(&reference, &reloaded, 8);
+
+  uom.observe("key0", "value", kFakeNow);
+  EXPECT_GT(ReadFile(journalPath_).length(), emptyJournal.length());
+}
+
+TEST_F(UserOverrideModelStoreTest, TornJournalWriteIsCutOff) {
+  {
+    UserOverrideModel uom(kCapacity, kHalflife);
+    ASSERT_TRUE(uom.open(path_.c_str()));
+    uom.observe("key0", "a", kFakeNow);
+    uom.observe("key1", "b", kFakeNow);
+  }
+
+  // Tear the last observation at every possible length.
+  std::string journal = ReadFile(journalPath_);
+  std::string journalWithOne;
+  {
+    UserOverrideModel uom(kCapacity, kHalflife);
+    std::filesystem::remove(journalPath_);
+    ASSERT_TRUE(uom.open(path_.c_str()));
+    uom.observe("key0", "a", kFakeNow);
+    journalWithOne = ReadFile(journalPath_);
+  }
+  ASSERT_LT(journalWithOne.length(), journal.length());
+
+  for (size_t length = journalWithOne.length(); length < journal.length();
+       ++length) {
+    WriteFile(journalPath_, journal.substr(0, length));
+    UserOverrideModel uom(kCapacity, kHalflife);
+    ASSERT_TRUE(uom.open(path_.c_str()));
+    EXPECT_EQ(uom.suggest("key0", kFakeNow).candidate, "a");
+    EXPECT_TRUE(uom.suggest("key1", kFakeNow).empty()) << length;
+    EXPECT_EQ(std::filesystem::file_size(journalPath_),
+              journalWithOne.length());
+  }
+
+  // A corrupted observation is cut off too, and new observations are
+  // appended after the last good one.
+  std::string corrupted = journal;
+  corrupted[journal.length() - 10] ^= 0x20;
+  WriteFile(journalPath_, corrupted);
+  {
+    UserOverrideModel uom(kCapacity, kHalflife);
+    ASSERT_TRUE(uom.open(path_.c_str()));
+    EXPECT_TRUE(uom.suggest("key1", kFakeNow).empty());
+    uom.observe("key2", "c", kFakeNow);
+  }
+  UserOverrideModel uom(kCapacity, kHalflife);
+  ASSERT_TRUE(uom.open(path_.c_str()));
+  EXPECT_EQ(uom.suggest("key0", kFakeNow).candidate, "a");
+  EXPECT_TRUE(uom.suggest("key1", kFakeNow).empty());
+  EXPECT_EQ(uom.suggest("key2", kFakeNow).candidate, "c");
+}
+
+TEST_F(UserOverrideModelStoreTest, StaleJournalIsNotAppliedTwice) {
+  std::string staleJournal;
+  {
+    UserOverrideModel uom(kCapacity, kHalflife);
+    ASSERT_TRUE(uom.open(path_.c_str()));
+    uom.observe("key", "older", kFakeNow);
+    staleJournal = ReadFile(journalPath_);
+    uom.observe("key", "newer", kFakeNow + 1);
+    ASSERT_TRUE(uom.compact());
+  }
+
+  // Simulate a crash after the new snapshot is in place but before the
+  // journal is emptied. Applying the journal again would make "older" count
+  // twice, and win over "newer".
+  WriteFile(journalPath_, staleJournal);
+  UserOverrideModel uom(kCapacity, kHalflife);
+  ASSERT_TRUE(uom.open(path_.c_str()));
+  EXPECT_EQ(uom.suggest("key", kFakeNow + 1).candidate, "newer");
+}
+
+TEST_F(UserOverrideModelStoreTest, CorruptedSnapshotIsIgnored) {
+  {
+    UserOverrideModel uom(kCapacity, kHalflife);
+    ASSERT_TRUE(uom.open(path_.c_str()));
+    uom.observe("key", "value", kFakeNow);
+    ASSERT_TRUE(uom.compact());
+  }
+
+  std::string snapshot = ReadFile(path_);
+  snapshot[snapshot.length() - 1] ^= 0x20;
+  WriteFile(path_, snapshot);
+
+  UserOverrideModel uom(kCapacity, kHalflife);
+  uom.observe("key", "value", kFakeNow);
+  ASSERT_TRUE(uom.open(path_.c_str()));
+  EXPECT_TRUE(uom.suggest("key", kFakeNow).empty());
+
+  uom.observe("key", "value", kFakeNow);
+  uom.close();
+  EXPECT_FALSE(uom.isOpen());
+  EXPECT_EQ(uom.suggest("key", kFakeNow).candidate, "value");
+}
+
 }  // namespace McBopomofo
@@ -28,53 +28,334 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <cerrno>
+#include <cstdint>
 #include <fstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace McBopomofo {
 
+namespace {
+
+// The files are edited by the user, possibly in place, and so they are read
+// into memory rather than mapped. See MemoryMappedFile::Options::copy.
+constexpr MemoryMappedFile::Options kFileOptions = [] {
+  MemoryMappedFile::Options options;
+  options.copy = true;
+  return options;
+}();
+
+// The parsed content is checked against the file by samples rather than by
+// reading all of it again. Content of up to kSampleCount * kSampleLength bytes
+// is sampled in full; of longer content, kSampleCount samples are spread
+// evenly from the start to the end.
+constexpr size_t kSampleCount = 64;
+constexpr size_t kSampleLength = 64;
+
+// Calls read(offset, length) for each sample of content of the length, and
+// returns false as soon as a call does.
+template <typename Read>
+bool ForEachSample(size_t length, Read read) {
+  if (length <= kSampleCount * kSampleLength) {
+    return read(0, length);
+  }
+  const size_t last = length - kSampleLength;
+  for (size_t i = 0; i < kSampleCount; ++i) {
+    size_t offset = static_cast<size_t>(static_cast<uint64_t>(last) * i /
+                                        (kSampleCount - 1));
+    if (!read(offset, kSampleLength)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string SamplesOf(const char* data, size_t length) {
+  std::string samples;
+  ForEachSample(length, [&](size_t offset, size_t sampleLength) {
+    samples.append(data + offset, sampleLength);
+    return true;
+  });
+  return samples;
+}
+
+// Reads exactly length bytes of the file at the offset.
+bool ReadAt(int fd, size_t offset, size_t length, char* buffer) {
+  size_t done = 0;
+  while (done < length) {
+    ssize_t n = pread(fd, buffer + done, length - done,
+                      static_cast<off_t>(offset + done));
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    done += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool ReadSamples(int fd, size_t length, std::string* samples) {
+  samples->clear();
+  return ForEachSample(length, [&](size_t offset, size_t sampleLength) {
+    size_t end = samples->size();
+    samples->resize(end + sampleLength);
+    return ReadAt(fd, offset, sampleLength, samples->data() + end);
+  });
+}
+
+// Closes the file descriptor when it goes out of scope.
+class ScopedFileDescriptor {
+ public:
+  explicit ScopedFileDescriptor(int fd) : fd_(fd) {}
+  ScopedFileDescriptor(const ScopedFileDescriptor&) = delete;
+  ScopedFileDescriptor& operator=(const ScopedFileDescriptor&) = delete;
+  ~ScopedFileDescriptor() {
+    if (fd_ != -1) {
+      ::close(fd_);
+    }
+  }
+  [[nodiscard]] int get() const { return fd_; }
+
+ private:
+  int fd_;
+};
+
+// The text of the lines appended to a file, read after the file was opened.
+struct AppendedText {
+  std::shared_ptr<const void> previous;
+  std::string text;
+};
+
+}  // namespace
+
 bool UserPhrasesLM::open(const char* path) {
-  if (!mmapedFile_.open(path)) {
+  if (mmapedFile_ != nullptr) {
     return false;
   }
 
-  // MemoryMappedFile self-closes, and so this is fine.
-  return load(mmapedFile_.data(), mmapedFile_.length());
+  auto mmapedFile = MemoryMappedFile::OpenShared(path, kFileOptions);
+  if (mmapedFile == nullptr) {
+    return false;
+  }
+
+  // The copy is released upon close, and so this is fine.
+  mmapedFile_ = std::move(mmapedFile);
+  storage_ = mmapedFile_;
+  if (!parse(mmapedFile_->data(), mmapedFile_->length())) {
+    return false;
+  }
+
+  // The file may have grown since it was read, so use the length read.
+  FileState state;
+  state.path = path;
+  state.identity = mmapedFile_->identity();
+  state.identity.size = mmapedFile_->length();
+  state.samples = SamplesOf(mmapedFile_->data(), mmapedFile_->length());
+  fileState_ = std::move(state);
+  return true;
+}
+
+UserPhrasesLM::ReopenResult UserPhrasesLM::reopen(const char* path) {
+  if (mmapedFile_ != nullptr && !fileState_.path.empty() &&
+      fileState_.path == path) {
+    if (auto result = parseAppendedLines(path); result.has_value()) {
+      return *result;
+    }
+  }
+
+  close();
+  return open(path) ? ReopenResult::RELOADED : ReopenResult::FAILED;
+}
+
+bool UserPhrasesLM::isUpToDate(const char* path) const {
+  MemoryMappedFile::FileIdentity identity;
+  return mmapedFile_ != nullptr && !fileState_.path.empty() &&
+         fileState_.path == path &&
+         MemoryMappedFile::StatFile(path, &identity) &&
+         identity == fileState_.identity;
+}
+
+std::optional<UserPhrasesLM::ReopenResult> UserPhrasesLM::parseAppendedLines(
+    const char* path) {
+  const MemoryMappedFile::FileIdentity& parsed = fileState_.identity;
+  MemoryMappedFile::FileIdentity identity;
+  if (!MemoryMappedFile::StatFile(path, &identity) ||
+      identity.device != parsed.device || identity.inode != parsed.inode) {
+    return std::nullopt;
+  }
+
+  if (identity == parsed) {
+    return ReopenResult::UNCHANGED;
+  }
+
+  if (identity.size <= parsed.size) {
+    return std::nullopt;
+  }
+
+  // The appended entries are copied upon every reopen, and so once there are
+  // too many of them, the file is loaded in full instead.
+  size_t parsedSize = parsed.size;
+  size_t appendedLength =
+      fileState_.appendedLength + (identity.size - parsedSize);
+  if (appendedLength > kMaxAppendedLength) {
+    return std::nullopt;
+  }
+
+  // Only the samples and the new lines are read; the parsed content stays
+  // where it is. The file may have been replaced since the stat above.
+  ScopedFileDescriptor fd(::open(path, O_RDONLY));
+  MemoryMappedFile::FileIdentity opened;
+  if (fd.get() == -1 || !MemoryMappedFile::StatFile(fd.get(), &opened) ||
+      opened.device != parsed.device || opened.inode != parsed.inode ||
+      opened.size <= parsedSize) {
+    return std::nullopt;
+  }
+  size_t length = opened.size;
+
+  // The parsed content may have been overwritten in place.
+  std::string samples;
+  if (!ReadSamples(fd.get(), parsedSize, &samples) ||
+      samples != fileState_.samples) {
+    return std::nullopt;
+  }
+
+  // The new lines must not continue the last parsed line. They are copied,
+  // since the parsed entries still point into the old copy, which only covers
+  // the old length.
+  char lastParsedByte;
+  auto appendedText = std::make_shared<AppendedText>();
+  appendedText->previous = storage_;
+  appendedText->text.resize(length - parsedSize);
+  if (!ReadAt(fd.get(), parsedSize - 1, 1, &lastParsedByte) ||
+      !ReadAt(fd.get(), parsedSize, length - parsedSize,
+              appendedText->text.data())) {
+    return std::nullopt;
+  }
+  const std::string& text = appendedText->text;
+  if (lastParsedByte != '\n' && text[0] != '\n' && text[0] != '\r') {
+    return std::nullopt;
+  }
+
+  FileState state;
+  state.path = fileState_.path;
+  state.identity = opened;
+  state.appendedLength = appendedLength;
+  if (!ReadSamples(fd.get(), length, &state.samples)) {
+    return std::nullopt;
+  }
+
+  // The file must not have been written to while it was read.
+  MemoryMappedFile::FileIdentity afterRead;
+  if (!MemoryMappedFile::StatFile(fd.get(), &afterRead) ||
+      afterRead != opened) {
+    return std::nullopt;
+  }
+
+  // Only the appended entries are copied; those parsed upon open are shared.
+  auto appendedDictionary =
+      appendedDictionary_ != nullptr
+          ? std::make_shared<ByteBlockBackedDictionary>(*appendedDictionary_)
+          : std::make_shared<ByteBlockBackedDictionary>();
+  if (!appendedDictionary->append(
+          text.data(), text.length(),
+          ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY)) {
+    return std::nullopt;
+  }
+  appendedDictionary_ = std::move(appendedDictionary);
+  storage_ = std::move(appendedText);
+  fileState_ = std::move(state);
+  return ReopenResult::APPENDED;
 }
 
 void UserPhrasesLM::close() {
-  dictionary_.clear();
-  mmapedFile_.close();
+  dictionary_ = std::make_shared<const ByteBlockBackedDictionary>();
+  appendedDictionary_ = nullptr;
+  fileState_ = FileState();
+
+  // Unigrams obtained from the file may still refer to it, and so it is only
+  // released when the last of them is gone.
+  mmapedFile_ = nullptr;
+  storage_ = nullptr;
 }
 
 bool UserPhrasesLM::load(const char* data, size_t length) {
+  mmapedFile_ = nullptr;
+  storage_ = nullptr;
+  fileState_ = FileState();
+  return parse(data, length);
+}
+
+bool UserPhrasesLM::parse(const char* data, size_t length) {
   if (data == nullptr || length == 0) {
     return false;
   }
 
-  return dictionary_.parse(
+  auto dictionary = std::make_shared<ByteBlockBackedDictionary>();
+  bool parsed = dictionary->parse(
       data, length, ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+  dictionary_ = std::move(dictionary);
+  appendedDictionary_ = nullptr;
+  return parsed;
 }
+
 std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
 UserPhrasesLM::getUnigrams(const std::string& key) {
+  return std::as_const(*this).getUnigrams(key);
+}
+
+bool UserPhrasesLM::hasUnigrams(const std::string& key) {
+  return std::as_const(*this).hasUnigrams(key);
+}
+
+bool UserPhrasesLM::hasKeyWithPrefix(const std::string& prefix) {
+  return std::as_const(*this).hasKeyWithPrefix(prefix);
+}
+
+std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
+UserPhrasesLM::getUnigrams(const std::string& key) const {
   std::vector<Formosa::Gramambular2::LanguageModel::Unigram> v;
 
-  std::vector<std::string_view> values = dictionary_.getValues(key);
+  ByteBlockBackedDictionary::ValueSpan values = dictionary_->getValues(key);
+  ByteBlockBackedDictionary::ValueSpan appendedValues =
+      appendedDictionary_ != nullptr ? appendedDictionary_->getValues(key)
+                                     : ByteBlockBackedDictionary::ValueSpan();
+  v.reserve(values.size() + appendedValues.size());
   for (const auto& value : values) {
-    v.emplace_back(std::string(value), kUserUnigramScore);
+    v.emplace_back(value, kUserUnigramScore, storage_);
+  }
+  for (const auto& value : appendedValues) {
+    v.emplace_back(value, kUserUnigramScore, storage_);
   }
 
   return v;
 }
 
-bool UserPhrasesLM::hasUnigrams(const std::string& key) {
-  return dictionary_.hasKey(key);
+bool UserPhrasesLM::hasUnigrams(const std::string& key) const {
+  return dictionary_->hasKey(key) ||
+         (appendedDictionary_ != nullptr && appendedDictionary_->hasKey(key));
+}
+
+bool UserPhrasesLM::hasKeyWithPrefix(const std::string& prefix) const {
+  return dictionary_->hasKeyWithPrefix(prefix) ||
+         (appendedDictionary_ != nullptr &&
+          appendedDictionary_->hasKeyWithPrefix(prefix));
 }
 
 std::vector<ByteBlockBackedDictionary::Issue> UserPhrasesLM::getParsingIssues()
     const {
-  return dictionary_.issues();
+  std::vector<ByteBlockBackedDictionary::Issue> issues = dictionary_->issues();
+  if (appendedDictionary_ != nullptr) {
+    // The line numbers of the appended entries count from their first line.
+    size_t lineOffset = dictionary_->nextLineNumber() - 1;
+    for (const auto& issue : appendedDictionary_->issues()) {
+      issues.emplace_back(issue.type, issue.lineNumber + lineOffset);
+    }
+  }
+  return issues;
 }
 
 }  // namespace McBopomofo
@@ -24,7 +24,11 @@
 #ifndef SRC_ENGINE_USERPHRASESLM_H_
 #define SRC_ENGINE_USERPHRASESLM_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -37,29 +41,107 @@ namespace McBopomofo {
 class UserPhrasesLM : public Formosa::Gramambular2::LanguageModel {
  public:
   UserPhrasesLM() = default;
-  UserPhrasesLM(const UserPhrasesLM&) = delete;
+  // A copy shares the parsed text and the entries parsed upon open with the
+  // original, and can be reopened while the original is still being read.
+  UserPhrasesLM(const UserPhrasesLM&) = default;
   UserPhrasesLM(UserPhrasesLM&&) = delete;
   UserPhrasesLM& operator=(const UserPhrasesLM&) = delete;
   UserPhrasesLM& operator=(UserPhrasesLM&&) = delete;
 
+  // The file is edited by the user, and so it is read into memory rather
+  // than mapped. See MemoryMappedFile::Options::copy.
   bool open(const char* path);
   void close();
 
+  enum class ReopenResult {
+    // The file could not be opened, and the model is now empty.
+    FAILED,
+    // The file has not changed since it was opened.
+    UNCHANGED,
+    // Lines were appended to the file, and only those lines were parsed.
+    APPENDED,
+    // The file was fully reloaded.
+    RELOADED,
+  };
+
+  // Opens the file at the path again. If it is the file that is already open,
+  // and it has only grown by lines appended at the end, only the new lines are
+  // read and parsed, and their entries are kept apart from those parsed upon
+  // open. To tell, the file's identity, size, and modification time are
+  // compared, and samples of the previously parsed content are read again,
+  // which covers all of it in files of up to 4 KiB. An edit in place that
+  // leaves the samples as they were goes unnoticed until the file is next
+  // loaded in full. In all other cases, including once more than
+  // kMaxAppendedLength bytes have been appended, the file is closed and opened
+  // again.
+  ReopenResult reopen(const char* path);
+
+  static constexpr size_t kMaxAppendedLength = 64 * 1024;
+
+  // Returns true if the file at the path is the open file, unchanged since it
+  // was parsed, in which case reopen() would return UNCHANGED.
+  [[nodiscard]] bool isUpToDate(const char* path) const;
+
   // Allows loading existing in-memory data. It's the caller's responsibility
-  // to make sure that data outlives this instance.
+  // to make sure that data outlives this instance, as well as the unigrams
+  // returned by getUnigrams().
   bool load(const char* data, size_t length);
 
+  // Returns view unigrams into the data. If the data is from a file, the
+  // unigrams keep the data of the file even after close() or a reload.
   std::vector<Formosa::Gramambular2::LanguageModel::Unigram> getUnigrams(
       const std::string& key) override;
   bool hasUnigrams(const std::string& key) override;
+  bool hasKeyWithPrefix(const std::string& prefix) override;
+
+  // The same lookups, which only read the model, and so are safe to call
+  // from multiple threads at once as long as the model is not being changed.
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> getUnigrams(
+      const std::string& key) const;
+  bool hasUnigrams(const std::string& key) const;
+  bool hasKeyWithPrefix(const std::string& prefix) const;
 
   std::vector<ByteBlockBackedDictionary::Issue> getParsingIssues() const;
 
   static constexpr double kUserUnigramScore = 0;
 
  protected:
-  MemoryMappedFile mmapedFile_;
-  ByteBlockBackedDictionary dictionary_;
+  bool parse(const char* data, size_t length);
+
+  // Parses only the lines appended to the open file, if that is all that has
+  // changed. Returns std::nullopt if the file needs a full reload.
+  std::optional<ReopenResult> parseAppendedLines(const char* path);
+
+  std::shared_ptr<const MemoryMappedFile> mmapedFile_;
+
+  // Shared with the view unigrams returned by getUnigrams(). See Unigram.
+  // This is the copy of the file, or the text of the lines appended to it
+  // since, which in turn keeps the previous text alive.
+  std::shared_ptr<const void> storage_;
+
+  // The entries parsed upon open, which are never changed, and so are shared
+  // by the copies of the model.
+  std::shared_ptr<const ByteBlockBackedDictionary> dictionary_ =
+      std::make_shared<const ByteBlockBackedDictionary>();
+
+  // The entries of the lines appended since, if any. Reopening replaces this
+  // with a copy that has the new entries.
+  std::shared_ptr<const ByteBlockBackedDictionary> appendedDictionary_;
+
+  // The state of the open file when it was last parsed, used by reopen().
+  struct FileState {
+    std::string path;
+    // The size is that of the parsed content.
+    MemoryMappedFile::FileIdentity identity;
+
+    // Samples of the parsed content, which are compared with the file to
+    // tell whether the content has been overwritten.
+    std::string samples;
+
+    // The length of the text parsed into appendedDictionary_.
+    size_t appendedLength = 0;
+  };
+  FileState fileState_;
 };
 
 }  // namespace McBopomofo
@@ -0,0 +1,130 @@
+// Copyright (c) 2025 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "UserPhrasesLM.h"
+
+namespace {
+
+using McBopomofo::UserPhrasesLM;
+
+std::filesystem::path WriteUserPhrasesFile(int lines) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.userphraseslmbenchmark.txt";
+  std::ofstream file(path, std::ios::binary);
+  for (int i = 0; i < lines; ++i) {
+    file << "v" << i << " r" << (i % 5000) << "-r" << (i % 7) << "\n";
+  }
+  return path;
+}
+
+void AppendUserPhrase(const std::filesystem::path& path, int64_t i) {
+  std::ofstream(path, std::ios::binary | std::ios::app)
+      << "new" << i << " r" << (i % 5000) << "-r" << (i % 7) << "\n";
+}
+
+// Reloads the file after a phrase is appended, which only parses the new line,
+// apart from the full load that follows every
+// UserPhrasesLM::kMaxAppendedLength bytes appended.
+static void BM_UserPhrasesLMReopenAfterAppend(benchmark::State& state) {
+  std::filesystem::path path =
+      WriteUserPhrasesFile(static_cast<int>(state.range(0)));
+  UserPhrasesLM lm;
+  lm.open(path.c_str());
+  int64_t i = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    AppendUserPhrase(path, i++);
+    state.ResumeTiming();
+    if (lm.reopen(path.c_str()) == UserPhrasesLM::ReopenResult::FAILED) {
+      state.SkipWithError("failed");
+      break;
+    }
+  }
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_UserPhrasesLMReopenAfterAppend)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000)
+    ->Unit(benchmark::kMicrosecond);
+
+// Reopens a copy of the model after a phrase is appended, which is what
+// McBopomofoLM does, so that the published model does not change. The copy
+// shares the entries parsed upon open, and so this takes about as long with
+// 1k lines as with 100k, apart from the full load that follows every
+// UserPhrasesLM::kMaxAppendedLength bytes appended.
+static void BM_UserPhrasesLMReopenCopyAfterAppend(benchmark::State& state) {
+  std::filesystem::path path =
+      WriteUserPhrasesFile(static_cast<int>(state.range(0)));
+  auto lm = std::make_shared<UserPhrasesLM>();
+  lm->open(path.c_str());
+  int64_t i = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    AppendUserPhrase(path, i++);
+    state.ResumeTiming();
+    auto copy = std::make_shared<UserPhrasesLM>(*lm);
+    if (copy->reopen(path.c_str()) == UserPhrasesLM::ReopenResult::FAILED) {
+      state.SkipWithError("failed");
+      break;
+    }
+    lm = std::move(copy);
+  }
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_UserPhrasesLMReopenCopyAfterAppend)
+    ->Arg(1000)
+    ->Arg(100000)
+    ->Unit(benchmark::kMicrosecond);
+
+// Reloads the whole file after a phrase is appended, for comparison.
+static void BM_UserPhrasesLMFullReloadAfterAppend(benchmark::State& state) {
+  std::filesystem::path path =
+      WriteUserPhrasesFile(static_cast<int>(state.range(0)));
+  UserPhrasesLM lm;
+  lm.open(path.c_str());
+  int64_t i = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    AppendUserPhrase(path, i++);
+    state.ResumeTiming();
+    lm.close();
+    lm.open(path.c_str());
+  }
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_UserPhrasesLMFullReloadAfterAppend)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000)
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -23,6 +23,7 @@
 
 #include <cstdio>
 #include <filesystem>
+#include <fstream>
 #include <string>
 #include <vector>
 
@@ -59,4 +60,228 @@ TEST(UserPhrasesLMTest, ValuesContainingSpaces) {
   EXPECT_EQ(results[0].score(), UserPhrasesLM::kUserUnigramScore);
 }
 
+TEST(UserPhrasesLMTest, KeyWithPrefix) {
+  constexpr char kTestData[] = "value1 reading1-reading2\nvalue2 reading3";
+
+  UserPhrasesLM lm;
+  ASSERT_TRUE(lm.load(kTestData, sizeof(kTestData)));
+  EXPECT_TRUE(lm.hasKeyWithPrefix("reading1-"));
+  EXPECT_TRUE(lm.hasKeyWithPrefix("reading3"));
+  EXPECT_FALSE(lm.hasKeyWithPrefix("reading3-"));
+  EXPECT_FALSE(lm.hasKeyWithPrefix("value1"));
+}
+
+TEST(UserPhrasesLMTest, UnigramsOutliveCloseAndReload) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.userphraseslmtest.lifetime.txt";
+  std::ofstream(path, std::ios::binary) << "value1 reading1\n";
+
+  UserPhrasesLM lm;
+  ASSERT_TRUE(lm.open(path.c_str()));
+  auto unigrams = lm.getUnigrams("reading1");
+  lm.close();
+
+  // Replace the file (rather than overwriting it in place) and reload.
+  std::filesystem::remove(path);
+  std::ofstream(path, std::ios::binary) << "value2 reading1\n";
+  ASSERT_TRUE(lm.open(path.c_str()));
+
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].valueView(), "value1");
+  auto reloadedUnigrams = lm.getUnigrams("reading1");
+  ASSERT_EQ(reloadedUnigrams.size(), 1);
+  EXPECT_EQ(reloadedUnigrams[0].valueView(), "value2");
+
+  // Loading in-memory data releases the file.
+  constexpr char kTestData[] = "value3 reading1";
+  ASSERT_TRUE(lm.load(kTestData, sizeof(kTestData)));
+  EXPECT_EQ(lm.getUnigrams("reading1")[0].valueView(), "value3");
+  EXPECT_EQ(reloadedUnigrams[0].valueView(), "value2");
+
+  std::filesystem::remove(path);
+}
+
+class UserPhrasesLMReopenTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = std::filesystem::temp_directory_path() /
+            ("org.openvanilla.mcbopomofo.userphraseslmtest.reopen." +
+             std::string(::testing::UnitTest::GetInstance()
+                             ->current_test_info()
+                             ->name()) +
+             ".txt");
+    write("value1 reading1\nvalue2 reading2\n");
+  }
+
+  void TearDown() override { std::filesystem::remove(path_); }
+
+  void write(const std::string& text) {
+    std::ofstream(path_, std::ios::binary) << text;
+  }
+
+  void append(const std::string& text) {
+    std::ofstream(path_, std::ios::binary | std::ios::app) << text;
+  }
+
+  std::filesystem::path path_;
+};
+
+TEST_F(UserPhrasesLMReopenTest, ParsesOnlyAppendedLines) {
+  UserPhrasesLM lm;
+  ASSERT_TRUE(lm.open(path_.c_str()));
+  auto unigrams = lm.getUnigrams("reading1");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::UNCHANGED);
+
+  append("value3 reading1\nvalue4 reading3\n");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::APPENDED);
+  auto reopenedUnigrams = lm.getUnigrams("reading1");
+  ASSERT_EQ(reopenedUnigrams.size(), 2);
+  EXPECT_EQ(reopenedUnigrams[0].valueView(), "value1");
+  EXPECT_EQ(reopenedUnigrams[1].valueView(), "value3");
+  EXPECT_EQ(lm.getUnigrams("reading2")[0].valueView(), "value2");
+  EXPECT_EQ(lm.getUnigrams("reading3")[0].valueView(), "value4");
+
+  // Earlier unigrams are still valid.
+  ASSERT_EQ(unigrams.size(), 1);
+  EXPECT_EQ(unigrams[0].valueView(), "value1");
+
+  // Appending again continues from the new end.
+  append("value5 reading4\n");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::APPENDED);
+  EXPECT_EQ(lm.getUnigrams("reading4")[0].valueView(), "value5");
+  EXPECT_EQ(lm.getUnigrams("reading1").size(), 2);
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::UNCHANGED);
+}
+
+TEST_F(UserPhrasesLMReopenTest, ReloadsModifiedFile) {
+  UserPhrasesLM lm;
+  ASSERT_TRUE(lm.open(path_.c_str()));
+
+  // Overwrite the file in place, growing it, but changing the parsed part.
+  {
+    std::fstream file(path_, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(5);
+    file << "X";
+  }
+  append("value3 reading3\n");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::RELOADED);
+  EXPECT_EQ(lm.getUnigrams("reading1")[0].valueView(), "valueX");
+  EXPECT_EQ(lm.getUnigrams("reading3")[0].valueView(), "value3");
+
+  // Shrinking the file also reloads it.
+  write("value4 reading4\n");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::RELOADED);
+  EXPECT_FALSE(lm.hasUnigrams("reading1"));
+  EXPECT_TRUE(lm.hasUnigrams("reading4"));
+}
+
+TEST_F(UserPhrasesLMReopenTest, ReloadsReplacedFile) {
+  UserPhrasesLM lm;
+  ASSERT_TRUE(lm.open(path_.c_str()));
+
+  // The new file has the old content as its prefix, but is a different file.
+  // It is written before the old one is gone, since the open file is only
+  // read, and so its inode could otherwise be reused for the new one.
+  std::filesystem::path oldPath = path_;
+  path_ += ".new";
+  write("value1 reading1\nvalue2 reading2\nvalue3 reading3\n");
+  std::filesystem::rename(path_, oldPath);
+  path_ = oldPath;
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::RELOADED);
+  EXPECT_TRUE(lm.hasUnigrams("reading3"));
+
+  std::filesystem::remove(path_);
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::FAILED);
+  EXPECT_FALSE(lm.hasUnigrams("reading1"));
+}
+
+TEST_F(UserPhrasesLMReopenTest, ReloadsContinuedLastLine) {
+  write("value1 reading1\nvalue2 reading");
+  UserPhrasesLM lm;
+  ASSERT_TRUE(lm.open(path_.c_str()));
+  EXPECT_TRUE(lm.hasUnigrams("reading"));
+
+  append("2\n");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::RELOADED);
+  EXPECT_FALSE(lm.hasUnigrams("reading"));
+  EXPECT_EQ(lm.getUnigrams("reading2")[0].valueView(), "value2");
+
+  // A line appended after a line without a line break is fine.
+  write("value1 reading1");
+  ASSERT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::RELOADED);
+  append("\nvalue2 reading2\n");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::APPENDED);
+  EXPECT_EQ(lm.getUnigrams("reading1")[0].valueView(), "value1");
+  EXPECT_EQ(lm.getUnigrams("reading2")[0].valueView(), "value2");
+}
+
+TEST_F(UserPhrasesLMReopenTest, ChecksSamplesOfLargeFiles) {
+  std::string text;
+  for (int i = 0; i < 1000; ++i) {
+    text += "value" + std::to_string(i) + " reading" + std::to_string(i) + "\n";
+  }
+  write(text);
+  UserPhrasesLM lm;
+  ASSERT_TRUE(lm.open(path_.c_str()));
+  append("new1 reading1\n");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::APPENDED);
+  EXPECT_EQ(lm.getUnigrams("reading1").size(), 2);
+
+  // The first and the last bytes of the parsed content are always sampled.
+  {
+    std::fstream file(path_, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(5);
+    file << "X";
+  }
+  append("new2 reading2\n");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::RELOADED);
+  EXPECT_EQ(lm.getUnigrams("reading0")[0].valueView(), "valueX");
+  EXPECT_EQ(lm.getUnigrams("reading2").size(), 2);
+}
+
+TEST_F(UserPhrasesLMReopenTest, ReloadsAfterManyAppendedLines) {
+  UserPhrasesLM lm;
+  ASSERT_TRUE(lm.open(path_.c_str()));
+  append("value3 reading3\n");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::APPENDED);
+
+  append(std::string(UserPhrasesLM::kMaxAppendedLength, '#') + "\n");
+  append("value4 reading4\n");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::RELOADED);
+  EXPECT_TRUE(lm.hasUnigrams("reading3"));
+  EXPECT_TRUE(lm.hasUnigrams("reading4"));
+
+  // Appending continues from the reload.
+  append("value5 reading5\n");
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::APPENDED);
+  EXPECT_TRUE(lm.hasUnigrams("reading5"));
+}
+
+TEST_F(UserPhrasesLMReopenTest, CopiesShareTheEntriesParsedUponOpen) {
+  UserPhrasesLM lm;
+  ASSERT_TRUE(lm.open(path_.c_str()));
+  append("value3 reading1\nvalue4\n");
+
+  UserPhrasesLM copy(lm);
+  EXPECT_EQ(copy.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::APPENDED);
+  EXPECT_EQ(copy.getUnigrams("reading1").size(), 2);
+  EXPECT_EQ(lm.getUnigrams("reading1").size(), 1);
+  EXPECT_TRUE(lm.getParsingIssues().empty());
+
+  // The issues of the appended lines have their line numbers in the file.
+  auto issues = copy.getParsingIssues();
+  ASSERT_EQ(issues.size(), 1);
+  EXPECT_EQ(issues[0].lineNumber, 4);
+}
+
+TEST_F(UserPhrasesLMReopenTest, ReopeningAnotherPathReloads) {
+  UserPhrasesLM lm;
+  constexpr char kTestData[] = "value3 reading3";
+  ASSERT_TRUE(lm.load(kTestData, sizeof(kTestData)));
+  EXPECT_EQ(lm.reopen(path_.c_str()), UserPhrasesLM::ReopenResult::RELOADED);
+  EXPECT_FALSE(lm.hasUnigrams("reading3"));
+  EXPECT_TRUE(lm.hasUnigrams("reading1"));
+}
+
 }  // namespace McBopomofo
@@ -29,6 +29,10 @@ static constexpr char kDelimiterChar = ' ';
 static constexpr char kSeparatorChar = '-';
 static constexpr const char* kUnannotatedReading = "na";
 
+// The databases are binary-searched, and small enough to be read in upfront.
+static constexpr McBopomofo::MemoryMappedFile::Options kMappingOptions = {
+    McBopomofo::MemoryMappedFile::AccessPattern::RANDOM, /*willNeed=*/true};
+
 namespace McBopomofo {
 
 static std::string GetSecondColumn(std::string_view row) {
@@ -44,14 +48,14 @@ static std::string GetSecondColumn(std::string_view row) {
 }
 
 bool VariantAnnotator::loadPUAFile(const std::filesystem::path& bpmfvsPUAPath) {
-  MemoryMappedFile file;
-  if (!file.open(bpmfvsPUAPath.c_str())) {
+  auto file =
+      MemoryMappedFile::OpenShared(bpmfvsPUAPath.c_str(), kMappingOptions);
+  if (file == nullptr) {
     return false;
   }
 
-  auto db = ParselessPhraseDB::CreateValidatedDB(file.data(), file.length());
+  auto db = ParselessPhraseDB::CreateValidatedDB(file->data(), file->length());
   if (!db) {
-    file.close();
     return false;
   }
 
@@ -62,14 +66,14 @@ bool VariantAnnotator::loadPUAFile(const std::filesystem::path& bpmfvsPUAPath) {
 
 bool VariantAnnotator::loadVariantsFile(
     const std::filesystem::path& bpmfvsVariantsPath) {
-  MemoryMappedFile file;
-  if (!file.open(bpmfvsVariantsPath.c_str())) {
+  auto file =
+      MemoryMappedFile::OpenShared(bpmfvsVariantsPath.c_str(), kMappingOptions);
+  if (file == nullptr) {
     return false;
   }
 
-  auto db = ParselessPhraseDB::CreateValidatedDB(file.data(), file.length());
+  auto db = ParselessPhraseDB::CreateValidatedDB(file->data(), file->length());
   if (!db) {
-    file.close();
     return false;
   }
 
@@ -79,13 +83,13 @@ bool VariantAnnotator::loadVariantsFile(
 }
 
 void VariantAnnotator::loadPUAMap(std::unique_ptr<ParselessPhraseDB> puaMap) {
-  bpmfvsPUAFile_.close();
+  bpmfvsPUAFile_ = nullptr;
   puaMap_ = std::move(puaMap);
 }
 
 void VariantAnnotator::loadVariantsMap(
     std::unique_ptr<ParselessPhraseDB> variantsMap) {
-  bpmfvsVariantsFile_.close();
+  bpmfvsVariantsFile_ = nullptr;
   variantsMap_ = std::move(variantsMap);
 }
 
@@ -184,8 +188,8 @@ std::string VariantAnnotator::findUnannotatedVariant(
 void VariantAnnotator::closeMemoryMapFiles() {
   puaMap_ = nullptr;
   variantsMap_ = nullptr;
-  bpmfvsPUAFile_.close();
-  bpmfvsVariantsFile_.close();
+  bpmfvsPUAFile_ = nullptr;
+  bpmfvsVariantsFile_ = nullptr;
 }
 
 }  // namespace McBopomofo
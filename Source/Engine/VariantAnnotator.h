@@ -102,8 +102,8 @@ class VariantAnnotator {
   std::unique_ptr<ParselessPhraseDB> variantsMap_;
   std::unique_ptr<ParselessPhraseDB> puaMap_;
 
-  MemoryMappedFile bpmfvsVariantsFile_;
-  MemoryMappedFile bpmfvsPUAFile_;
+  std::shared_ptr<const MemoryMappedFile> bpmfvsVariantsFile_;
+  std::shared_ptr<const MemoryMappedFile> bpmfvsPUAFile_;
 };
 
 }  // namespace McBopomofo
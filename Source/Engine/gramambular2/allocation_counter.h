@@ -0,0 +1,41 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_ENGINE_GRAMAMBULAR2_ALLOCATION_COUNTER_H_
+#define SRC_ENGINE_GRAMAMBULAR2_ALLOCATION_COUNTER_H_
+
+#include <cstddef>
+
+namespace Formosa::Gramambular2 {
+
+// Returns the number of heap allocations made so far by the program. This is
+// for tests and benchmarks that check how much their code allocates. Linking
+// allocation_counter.cpp into a program replaces the global operator new and
+// operator delete, in their plain, array, sized, and nothrow forms, with ones
+// that count the allocations and use malloc() and free(). The library itself
+// does not include it.
+size_t HeapAllocationCount();
+
+}  // namespace Formosa::Gramambular2
+
+#endif  // SRC_ENGINE_GRAMAMBULAR2_ALLOCATION_COUNTER_H_
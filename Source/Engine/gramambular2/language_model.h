@@ -24,7 +24,10 @@
 #ifndef SRC_ENGINE_GRAMAMBULAR2_LANGUAGE_MODEL_H_
 #define SRC_ENGINE_GRAMAMBULAR2_LANGUAGE_MODEL_H_
 
+#include <algorithm>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -41,25 +44,123 @@ class LanguageModel {
   virtual std::vector<Unigram> getUnigrams(const std::string& reading) = 0;
   virtual bool hasUnigrams(const std::string& reading) = 0;
 
+  // Returns true if there may be a reading that starts with the prefix. The
+  // grid uses this to stop looking up longer readings that cannot exist. The
+  // default implementation always returns true, which disables the pruning.
+  virtual bool hasKeyWithPrefix(const std::string&) { return true; }
+
+  // Returns the unigrams for each of the readings, in the same order as the
+  // readings. The default implementation calls getUnigrams() for each reading.
+  // A model that can share work among the lookups, for example by narrowing
+  // the search range for readings with common prefixes, should override this.
+  virtual std::vector<std::vector<Unigram>> batchGetUnigrams(
+      const std::vector<std::string>& readings) {
+    std::vector<std::vector<Unigram>> results;
+    results.reserve(readings.size());
+    for (const auto& reading : readings) {
+      results.push_back(getUnigrams(reading));
+    }
+    return results;
+  }
+
+  // The unigrams of a reading sorted by score, the highest first. They are
+  // shared, so that a model that caches its results can hand out the same
+  // vector to every lookup of the reading.
+  using RankedUnigrams = std::shared_ptr<const std::vector<Unigram>>;
+
+  // Looks up the unigrams for each of the readings, like batchGetUnigrams(),
+  // but sorted by score, the highest first, with the ties in the order that
+  // batchGetUnigrams() returns them. The results are resized to the number of
+  // readings, and a reading without unigrams gets nullptr or an empty vector.
+  // The default
+  // implementation sorts the results of batchGetUnigrams(). A model that
+  // caches its results should override this, so that a cache hit only copies
+  // a pointer.
+  virtual void batchGetRankedUnigrams(const std::vector<std::string>& readings,
+                                      std::vector<RankedUnigrams>* results) {
+    auto unigrams = batchGetUnigrams(readings);
+    results->resize(readings.size());
+    for (size_t i = 0; i < readings.size(); ++i) {
+      if (unigrams[i].empty()) {
+        (*results)[i] = nullptr;
+        continue;
+      }
+      RankByScore(&unigrams[i]);
+      (*results)[i] =
+          std::make_shared<const std::vector<Unigram>>(std::move(unigrams[i]));
+    }
+  }
+
+  // Sorts the unigrams by score, the highest first, keeping the order of the
+  // ties.
+  static void RankByScore(std::vector<Unigram>* unigrams);
+
   // An immutable unigram with an actual value, along with a score, which is
   // usually a log probability from a language model.
+  //
+  // A unigram either owns its value, or is a view into the data of the
+  // language model that produced it, which saves a copy per unigram. A view
+  // holds a reference to the storage of that data, so it stays valid after
+  // the language model is closed or reloaded. If the storage is nullptr, the
+  // data belongs to the caller that loaded it into the language model (for
+  // example, in-memory data used by tests), and the caller must keep the data
+  // alive as long as the unigram.
   class Unigram {
    public:
     explicit Unigram(std::string val = "", double sc = 0,
                      std::string rawValue = "")
         : value_(std::move(val)), score_(sc), rawValue_(std::move(rawValue)) {}
 
-    [[nodiscard]] const std::string& value() const { return value_; }
-    [[nodiscard]] const std::string& rawValue() const { return rawValue_; }
+    // Creates a view unigram. See the class comment for the lifetime rules.
+    Unigram(std::string_view val, double sc,
+            std::shared_ptr<const void> storage)
+        : score_(sc),
+          valueView_(val),
+          isView_(true),
+          storage_(std::move(storage)) {}
+
+    [[nodiscard]] std::string value() const { return std::string(valueView()); }
+
+    [[nodiscard]] std::string_view valueView() const {
+      return isView_ ? valueView_ : std::string_view(value_);
+    }
+
+    // Returns the value before it was transformed (for example, by a phrase
+    // replacement), or the value itself if it was not transformed.
+    [[nodiscard]] std::string_view rawValue() const {
+      return rawValue_.empty() ? valueView() : std::string_view(rawValue_);
+    }
+
     [[nodiscard]] double score() const { return score_; }
 
+    // Returns a copy of the unigram with a different score. A view stays a
+    // view.
+    [[nodiscard]] Unigram withScore(double sc) const {
+      Unigram copy = *this;
+      copy.score_ = sc;
+      return copy;
+    }
+
    private:
     std::string value_;
-    std::string rawValue_;
     double score_;
+    std::string rawValue_;
+    std::string_view valueView_;
+    bool isView_ = false;
+    std::shared_ptr<const void> storage_;
   };
 };
 
+inline void LanguageModel::RankByScore(std::vector<Unigram>* unigrams) {
+  // std::stable_sort may allocate a buffer even if there is nothing to sort.
+  if (unigrams->size() < 2) {
+    return;
+  }
+  std::stable_sort(
+      unigrams->begin(), unigrams->end(),
+      [](const auto& u1, const auto& u2) { return u1.score() > u2.score(); });
+}
+
 }  // namespace Formosa::Gramambular2
 
 #endif  // SRC_ENGINE_GRAMAMBULAR2_LANGUAGE_MODEL_H_
@@ -25,7 +25,10 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstddef>
+#include <cstring>
 #include <limits>
+#include <memory>
 #include <stack>
 #include <string>
 #include <utility>
@@ -37,6 +40,22 @@ void ReadingGrid::clear() {
   cursor_ = 0;
   readings_.clear();
   spans_.clear();
+  committedNodes_.clear();
+  committedReadings_ = 0;
+  autoCommitCrossedUpTo_ = 0;
+  invalidateWalk();
+}
+
+void ReadingGrid::setAutoCommitWindow(size_t window) {
+  autoCommitWindow_ = window == 0 ? 0 : std::max(window, kMaximumSpanLength);
+}
+
+void ReadingGrid::setApproximateAutoCommit(bool approximate) {
+  approximateAutoCommit_ = approximate;
+}
+
+std::vector<ReadingGrid::NodePtr> ReadingGrid::takeCommittedNodes() {
+  return std::exchange(committedNodes_, {});
 }
 
 void ReadingGrid::setCursor(size_t cursor) {
@@ -57,23 +76,114 @@ bool ReadingGrid::insertReading(const std::string& reading) {
     return false;
   }
 
-  readings_.insert(readings_.begin() + static_cast<ptrdiff_t>(cursor_),
-                   reading);
+  readings_.insert(cursor_, reading);
   expandGridAt(cursor_);
   update();
 
   // Cursor must only move after update().
   ++cursor_;
+  autoCommit();
   return true;
 }
 
+void ReadingGrid::autoCommit() {
+  if (autoCommitWindow_ == 0 || readings_.size() <= autoCommitWindow_) {
+    return;
+  }
+
+  // The nodes that start before the location are at most kMaximumSpanLength
+  // long, and since the window is at least that long, all of them already
+  // exist. Edits near the cursor are kept from being cut off.
+  size_t limit = std::min(readings_.size() - autoCommitWindow_,
+                          cursor_ - std::min(cursor_, kMaximumSpanLength - 1));
+
+  // Only the locations not yet known to be crossed are checked, which are
+  // mostly the ones settled by this insertion.
+  size_t loc = limit;
+  for (; loc > autoCommitCrossedUpTo_; --loc) {
+    if (!isCrossedAt(loc)) {
+      // Every path goes through the location, and so the best path up to
+      // there is the beginning of the best path.
+      walk();
+      commitPrefix(loc, limit);
+      return;
+    }
+  }
+  autoCommitCrossedUpTo_ = std::max(autoCommitCrossedUpTo_, limit);
+
+  if (!approximateAutoCommit_ || readings_.size() <= 2 * autoCommitWindow_) {
+    return;
+  }
+
+  // The grid has grown to twice the window without a location that no node
+  // crosses, as happens with a dense lexicon. Commit at the location on the
+  // best path that the best of the paths crossing it trails the most.
+  walk();
+  std::vector<double> forward;
+  std::vector<double> backward;
+  computeContextScores(&forward, &backward);
+  const double bestScore = forward[readings_.size()];
+  size_t bestLoc = 0;
+  double bestMargin = -std::numeric_limits<double>::infinity();
+  for (size_t curr = readings_.size(); curr > 0;
+       curr = viterbi_[curr].fromIndex) {
+    if (curr > limit) {
+      continue;
+    }
+    double crossingScore = -std::numeric_limits<double>::infinity();
+    for (size_t i = curr - std::min(curr, kMaximumSpanLength - 1); i < curr;
+         ++i) {
+      const Span& span = spans_[i];
+      for (size_t len = curr - i + 1; len <= span.maxLength(); ++len) {
+        const NodePtr& node = span.nodeOf(len);
+        if (node != nullptr) {
+          crossingScore = std::max(
+              crossingScore, forward[i] + node->score() + backward[i + len]);
+        }
+      }
+    }
+    if (bestScore - crossingScore > bestMargin) {
+      bestMargin = bestScore - crossingScore;
+      bestLoc = curr;
+    }
+  }
+  if (bestLoc != 0) {
+    commitPrefix(bestLoc, autoCommitCrossedUpTo_);
+  }
+}
+
+bool ReadingGrid::isCrossedAt(size_t loc) const {
+  for (size_t i = loc - std::min(loc, kMaximumSpanLength - 1); i < loc; ++i) {
+    if (i + spans_[i].maxLength() > loc) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void ReadingGrid::commitPrefix(size_t loc, size_t crossedUpTo) {
+  size_t firstCommitted = committedNodes_.size();
+  for (size_t curr = loc; curr > 0; curr = viterbi_[curr].fromIndex) {
+    assert(viterbi_[curr].fromNode != nullptr);
+    committedNodes_.push_back(viterbi_[curr].fromNode);
+  }
+  std::reverse(committedNodes_.begin() + static_cast<ptrdiff_t>(firstCommitted),
+               committedNodes_.end());
+
+  readings_.erase(0, loc);
+  spans_.erase(0, loc);
+  cursor_ -= loc;
+  committedReadings_ += loc;
+  invalidateWalk();
+  autoCommitCrossedUpTo_ = crossedUpTo - std::min(crossedUpTo, loc);
+}
+
 bool ReadingGrid::deleteReadingBeforeCursor() {
   if (!cursor_) {
     return false;
   }
 
-  readings_.erase(readings_.begin() + static_cast<ptrdiff_t>(cursor_ - 1),
-                  readings_.begin() + static_cast<ptrdiff_t>(cursor_));
+  readings_.erase(cursor_ - 1, cursor_);
   // Cursor must decrement for grid-shrinking and update to work.
   --cursor_;
   shrinkGridAt(cursor_);
@@ -86,8 +196,7 @@ bool ReadingGrid::deleteReadingAfterCursor() {
     return false;
   }
 
-  readings_.erase(readings_.begin() + static_cast<ptrdiff_t>(cursor_),
-                  readings_.begin() + static_cast<ptrdiff_t>(cursor_ + 1));
+  readings_.erase(cursor_, cursor_ + 1);
   shrinkGridAt(cursor_);
   update();
   return true;
@@ -129,6 +238,12 @@ int64_t GetEpochNowInMicroseconds() {
 // probability a larger value means a larger probability. The algorithm runs in
 // O(|V| + |E|) time for G = (V, E) where G is a DAG. This means the walk is
 // fairly economical even when the grid is large.
+//
+// The DP table is kept between walks. An edit at a location only changes the
+// nodes that start within kMaximumSpanLength of it, and so only the states
+// past the first changed span need to be recomputed. Since the states are
+// relaxed in exactly the same order as in a walk from scratch, the result is
+// also exactly the same, including how ties are broken.
 ReadingGrid::WalkResult ReadingGrid::walk() {
   WalkResult result;
   if (spans_.empty()) {
@@ -136,72 +251,206 @@ ReadingGrid::WalkResult ReadingGrid::walk() {
   }
   int64_t start = GetEpochNowInMicroseconds();
 
-  // Defines a state in the DP table. This structure tracks the maximum
-  // accumulated score and the back-pointer required for path reconstruction in
-  // the Viterbi algorithm.
-  struct State {
-    size_t fromIndex = 0;
-    ReadingGrid::NodePtr fromNode = nullptr;
-    double maxScore = -std::numeric_limits<double>::infinity();
-  };
-
   const size_t readingLen = readings_.size();
-  std::vector<State> viterbi(readingLen + 1);
-  viterbi[0].maxScore = 0.0;
+  viterbiValidUpTo_ = std::min(viterbiValidUpTo_, readingLen);
+  viterbi_.resize(readingLen + 1);
+  viterbi_[0].maxScore = 0.0;
+  for (size_t i = viterbiValidUpTo_ + 1; i <= readingLen; ++i) {
+    viterbi_[i] = State();
+  }
 
   // Iterate through the grid and compute the maximum accumulated score for each
   // reachable position. Since the grid is a lattice where edges only point
   // forward, processing nodes in index order is equivalent to processing them
-  // in topological order.
-  size_t reachableStates = 0;
-  size_t evaluatedEdges = 0;
-  for (size_t i = 0; i < readingLen; ++i) {
-    ++reachableStates;
-
+  // in topological order. The stale states are reached from at most
+  // (kMaximumSpanLength - 1) spans before the first of them.
+  const size_t validUpTo = viterbiValidUpTo_;
+  const size_t begin = validUpTo < kMaximumSpanLength - 1
+                           ? 0
+                           : validUpTo - (kMaximumSpanLength - 1);
+  for (size_t i = begin; i < readingLen; ++i) {
     const ReadingGrid::Span& span = spans_[i];
     const size_t maxSpanLen = span.maxLength();
+    size_t spanEdges = 0;
 
     for (size_t spanLen = 1; spanLen <= maxSpanLen; ++spanLen) {
       const ReadingGrid::NodePtr& node = span.nodeOf(spanLen);
       if (node == nullptr) {
         continue;
       }
-      ++evaluatedEdges;
+      ++spanEdges;
+
+      if (i + spanLen <= validUpTo) {
+        // The target state is still valid.
+        continue;
+      }
 
       // Performs a relaxation on a transition. This updates the destination
       // state if the path through the current node yields a higher score than
       // the previously known best path. This is the core operation of the
       // Viterbi algorithm, adapted for finding the maximum likelihood path.
-      double score = viterbi[i].maxScore + node->score();
-      State& target = viterbi[i + spanLen];
+      double score = viterbi_[i].maxScore + node->score();
+      State& target = viterbi_[i + spanLen];
       if (score > target.maxScore) {
         target.maxScore = score;
         target.fromNode = node;
         target.fromIndex = i;
       }
     }
+    viterbi_[i + 1].edgesBefore = viterbi_[i].edgesBefore + spanEdges;
   }
+  viterbiValidUpTo_ = readingLen;
+
   // Vertices are the reachable states
   // Edges are the candidate word transitions
-  result.vertices = reachableStates;
-  result.edges = evaluatedEdges;
+  result.vertices = readingLen;
+  result.edges = viterbi_[readingLen].edgesBefore;
+  result.recomputedStates = readingLen - validUpTo;
 
   // Reconstruct the most likely path by tracing back from the end of the grid
-  // to the root using the back-pointers
+  // to the root using the back-pointers. The nodes are counted first, so that
+  // the node vector is allocated only once.
+  size_t nodeCount = 0;
+  for (size_t curr = readingLen; curr > 0; curr = viterbi_[curr].fromIndex) {
+    ++nodeCount;
+  }
+  result.nodes.resize(nodeCount);
   size_t totalReadingLen = 0;
-  for (size_t curr = readingLen; curr > 0; curr = viterbi[curr].fromIndex) {
-    assert(viterbi[curr].fromNode != nullptr);
-    totalReadingLen += viterbi[curr].fromNode->spanningLength();
-    result.nodes.emplace_back(std::move(viterbi[curr].fromNode));
+  for (size_t curr = readingLen; curr > 0; curr = viterbi_[curr].fromIndex) {
+    assert(viterbi_[curr].fromNode != nullptr);
+    totalReadingLen += viterbi_[curr].fromNode->spanningLength();
+    result.nodes[--nodeCount] = viterbi_[curr].fromNode;
   }
-  std::reverse(result.nodes.begin(), result.nodes.end());
   assert(totalReadingLen == readingLen);
   result.totalReadings = totalReadingLen;
+  result.score = viterbi_[readingLen].maxScore;
 
   result.elapsedMicroseconds = GetEpochNowInMicroseconds() - start;
   return result;
 }
 
+// The k-best generalization of the Viterbi algorithm above. Instead of only the
+// best path to each state, the k best ones are kept, each as a back-pointer to
+// one of the k best paths to the state that its last node starts from. The
+// paths to a state are obtained by merging the already sorted lists of the
+// states that it is reached from, each offset by the score of the node in
+// between, which takes O(k * kMaximumSpanLength) per state.
+std::vector<ReadingGrid::WalkResult> ReadingGrid::walkNBest(size_t k) const {
+  std::vector<WalkResult> results;
+  if (spans_.empty() || k == 0) {
+    return results;
+  }
+  int64_t start = GetEpochNowInMicroseconds();
+
+  // A path to a state, as its score, its last node, and the state and the rank
+  // of the path that it extends.
+  struct Path {
+    double score = 0;
+    const NodePtr* node = nullptr;
+    size_t fromIndex = 0;
+    size_t fromRank = 0;
+  };
+
+  // A node that ends at the state being computed, and the rank of the next
+  // path to the state that it starts from to be merged.
+  struct Incoming {
+    const NodePtr* node;
+    double score;
+    size_t fromIndex;
+    size_t nextRank;
+  };
+
+  // The paths to each state, k per state, best first.
+  const size_t readingLen = readings_.size();
+  std::vector<Path> paths((readingLen + 1) * k);
+  std::vector<size_t> pathCounts(readingLen + 1, 0);
+  pathCounts[0] = 1;
+
+  std::array<Incoming, kMaximumSpanLength> incoming;
+  size_t evaluatedEdges = 0;
+  for (size_t j = 1; j <= readingLen; ++j) {
+    // The nodes are taken in the order in which walk() relaxes them, and the
+    // first of the paths with the same score is kept first, so that the best
+    // path is the one that walk() finds.
+    size_t incomingCount = 0;
+    for (size_t spanLen = std::min(j, kMaximumSpanLength); spanLen > 0;
+         --spanLen) {
+      size_t i = j - spanLen;
+      if (pathCounts[i] == 0 || spanLen > spans_[i].maxLength()) {
+        continue;
+      }
+      const NodePtr& node = spans_[i].nodeOf(spanLen);
+      if (node == nullptr) {
+        continue;
+      }
+      ++evaluatedEdges;
+      incoming[incomingCount++] = {&node, node->score(), i, 0};
+    }
+
+    Path* statePaths = &paths[j * k];
+    size_t& count = pathCounts[j];
+    while (count < k) {
+      Incoming* best = nullptr;
+      double bestScore = 0;
+      for (size_t n = 0; n < incomingCount; ++n) {
+        Incoming& in = incoming[n];
+        if (in.nextRank == pathCounts[in.fromIndex]) {
+          continue;
+        }
+        double score = paths[in.fromIndex * k + in.nextRank].score + in.score;
+        if (best == nullptr || score > bestScore) {
+          best = &in;
+          bestScore = score;
+        }
+      }
+      if (best == nullptr) {
+        break;
+      }
+      statePaths[count++] = {bestScore, best->node, best->fromIndex,
+                             best->nextRank};
+      ++best->nextRank;
+    }
+  }
+
+  // Reconstruct each path by following the back-pointers.
+  results.reserve(pathCounts[readingLen]);
+  for (size_t rank = 0; rank < pathCounts[readingLen]; ++rank) {
+    WalkResult result;
+    result.score = paths[readingLen * k + rank].score;
+    size_t curr = readingLen;
+    size_t currRank = rank;
+    while (curr > 0) {
+      const Path& path = paths[curr * k + currRank];
+      result.nodes.emplace_back(*path.node);
+      result.totalReadings += (*path.node)->spanningLength();
+      curr = path.fromIndex;
+      currRank = path.fromRank;
+    }
+    std::reverse(result.nodes.begin(), result.nodes.end());
+    assert(result.totalReadings == readingLen);
+    result.vertices = readingLen;
+    result.edges = evaluatedEdges;
+    result.recomputedStates = readingLen;
+    results.push_back(std::move(result));
+  }
+
+  uint64_t elapsed = GetEpochNowInMicroseconds() - start;
+  for (WalkResult& result : results) {
+    result.elapsedMicroseconds = elapsed;
+  }
+  return results;
+}
+
+void ReadingGrid::invalidateWalk() {
+  viterbi_.clear();
+  viterbiValidUpTo_ = 0;
+}
+
+void ReadingGrid::invalidateWalkFrom(size_t loc) {
+  viterbiValidUpTo_ = std::min(viterbiValidUpTo_, loc);
+  autoCommitCrossedUpTo_ = std::min(autoCommitCrossedUpTo_, loc);
+}
+
 std::vector<ReadingGrid::Candidate> ReadingGrid::candidatesAt(size_t loc) {
   std::vector<ReadingGrid::Candidate> result;
   if (readings_.empty()) {
@@ -223,12 +472,147 @@ std::vector<ReadingGrid::Candidate> ReadingGrid::candidatesAt(size_t loc) {
 
   for (const NodeInSpan& nodeInSpan : nodes) {
     for (const LanguageModel::Unigram& unigram : nodeInSpan.node->unigrams()) {
-        result.emplace_back(nodeInSpan.node->reading(), unigram.value(), unigram.rawValue());
+      result.emplace_back(std::string(nodeInSpan.node->reading()),
+                          std::string(unigram.valueView()),
+                          std::string(unigram.rawValue()));
+    }
+  }
+  return result;
+}
+
+namespace {
+
+// The score that the node would have with the unigram: the score of the node
+// for its current unigram, and the score of the unigram otherwise.
+double ScoreWithUnigram(const ReadingGrid::Node& node,
+                        const LanguageModel::Unigram& unigram) {
+  return unigram.valueView() == node.valueView() ? node.score()
+                                                 : unigram.score();
+}
+
+}  // namespace
+
+std::vector<ReadingGrid::RankedCandidate> ReadingGrid::rankedCandidatesAt(
+    size_t loc) const {
+  std::vector<RankedCandidate> result;
+  if (readings_.empty() || loc > readings_.size()) {
+    return result;
+  }
+
+  std::vector<double> forward;
+  std::vector<double> backward;
+  computeContextScores(&forward, &backward);
+
+  // Same as candidatesAt().
+  std::vector<NodeInSpan> nodes =
+      overlappingNodesAt(loc == readings_.size() ? loc - 1 : loc);
+  std::stable_sort(
+      nodes.begin(), nodes.end(), [](const auto& n1, const auto& n2) {
+        return n1.node->spanningLength() > n2.node->spanningLength();
+      });
+
+  struct Scored {
+    double score;
+    const NodeInSpan* nodeInSpan;
+    const LanguageModel::Unigram* unigram;
+  };
+  std::vector<Scored> scored;
+  for (const NodeInSpan& nodeInSpan : nodes) {
+    const Node& node = *nodeInSpan.node;
+    double context = forward[nodeInSpan.spanIndex] +
+                     backward[nodeInSpan.spanIndex + node.spanningLength()];
+    for (const LanguageModel::Unigram& unigram : node.unigrams()) {
+      scored.push_back(
+          {context + ScoreWithUnigram(node, unigram), &nodeInSpan, &unigram});
     }
   }
+  std::stable_sort(
+      scored.begin(), scored.end(),
+      [](const auto& s1, const auto& s2) { return s1.score > s2.score; });
+
+  result.reserve(scored.size());
+  for (const Scored& s : scored) {
+    result.emplace_back(Candidate(std::string(s.nodeInSpan->node->reading()),
+                                  std::string(s.unigram->valueView()),
+                                  std::string(s.unigram->rawValue())),
+                        s.score);
+  }
   return result;
 }
 
+std::vector<double> ReadingGrid::confidenceMarginsOf(
+    const WalkResult& result) const {
+  std::vector<double> margins;
+  if (readings_.empty()) {
+    return margins;
+  }
+
+  std::vector<double> forward;
+  std::vector<double> backward;
+  computeContextScores(&forward, &backward);
+
+  margins.reserve(result.nodes.size());
+  size_t loc = 0;
+  for (const NodePtr& walked : result.nodes) {
+    size_t end = loc + walked->spanningLength();
+    double best = forward[loc] + walked->score() + backward[end];
+
+    // Any other path has another node, or another unigram of the node, at
+    // the start of the node.
+    double alternative = -std::numeric_limits<double>::infinity();
+    for (const NodeInSpan& nodeInSpan : overlappingNodesAt(loc)) {
+      const Node& node = *nodeInSpan.node;
+      double context = forward[nodeInSpan.spanIndex] +
+                       backward[nodeInSpan.spanIndex + node.spanningLength()];
+      if (nodeInSpan.node != walked) {
+        alternative = std::max(alternative, context + node.score());
+        continue;
+      }
+      for (const LanguageModel::Unigram& unigram : node.unigrams()) {
+        if (unigram.valueView() != node.valueView()) {
+          alternative = std::max(alternative, context + unigram.score());
+        }
+      }
+    }
+    margins.push_back(best - alternative);
+    loc = end;
+  }
+  return margins;
+}
+
+void ReadingGrid::computeContextScores(std::vector<double>* forward,
+                                       std::vector<double>* backward) const {
+  const size_t readingLen = readings_.size();
+  constexpr double kUnreachable = -std::numeric_limits<double>::infinity();
+  forward->assign(readingLen + 1, kUnreachable);
+  backward->assign(readingLen + 1, kUnreachable);
+  (*forward)[0] = 0;
+  (*backward)[readingLen] = 0;
+
+  // The same relaxation as in walk(), from the start of the grid, and then
+  // from the end of it.
+  for (size_t i = 0; i < readingLen; ++i) {
+    const Span& span = spans_[i];
+    for (size_t spanLen = 1; spanLen <= span.maxLength(); ++spanLen) {
+      const NodePtr& node = span.nodeOf(spanLen);
+      if (node != nullptr) {
+        (*forward)[i + spanLen] =
+            std::max((*forward)[i + spanLen], (*forward)[i] + node->score());
+      }
+    }
+  }
+  for (size_t i = readingLen; i > 0; --i) {
+    const Span& span = spans_[i - 1];
+    for (size_t spanLen = 1; spanLen <= span.maxLength(); ++spanLen) {
+      const NodePtr& node = span.nodeOf(spanLen);
+      if (node != nullptr) {
+        (*backward)[i - 1] = std::max(
+            (*backward)[i - 1], node->score() + (*backward)[i - 1 + spanLen]);
+      }
+    }
+  }
+}
+
 bool ReadingGrid::overrideCandidate(
     size_t loc, const ReadingGrid::Candidate& candidate,
     ReadingGrid::Node::OverrideType overrideType) {
@@ -243,11 +627,12 @@ bool ReadingGrid::overrideCandidate(
 }
 
 void ReadingGrid::expandGridAt(size_t loc) {
+  invalidateWalkFrom(loc);
   if (!loc || loc == spans_.size()) {
-    spans_.insert(spans_.begin() + static_cast<ptrdiff_t>(loc), Span());
+    spans_.insert(loc, Span());
     return;
   }
-  spans_.insert(spans_.begin() + static_cast<ptrdiff_t>(loc), Span());
+  spans_.insert(loc, Span());
   removeAffectedNodes(loc);
 }
 
@@ -255,7 +640,8 @@ void ReadingGrid::shrinkGridAt(size_t loc) {
   if (loc == spans_.size()) {
     return;
   }
-  spans_.erase(spans_.begin() + static_cast<ptrdiff_t>(loc));
+  invalidateWalkFrom(loc);
+  spans_.erase(loc, loc + 1);
   removeAffectedNodes(loc);
 }
 
@@ -295,6 +681,7 @@ void ReadingGrid::removeAffectedNodes(size_t loc) {
   size_t affectedLength = kMaximumSpanLength - 1;
   size_t begin = loc <= affectedLength ? 0 : loc - affectedLength;
   size_t end = loc >= 1 ? loc - 1 : 0;
+  invalidateWalkFrom(begin);
   for (size_t i = begin; i <= end; ++i) {
     spans_[i].removeNodesOfOrLongerThan(loc - i + 1);
   }
@@ -302,21 +689,20 @@ void ReadingGrid::removeAffectedNodes(size_t loc) {
 
 void ReadingGrid::insert(size_t loc, const ReadingGrid::NodePtr& node) {
   assert(loc < spans_.size());
+  invalidateWalkFrom(loc);
   spans_[loc].add(node);
 }
 
-std::string ReadingGrid::combineReading(
-    std::vector<std::string>::const_iterator begin,
-    std::vector<std::string>::const_iterator end) {
-  std::string result;
-  for (auto iter = begin; iter != end;) {
-    result += *iter;
-    ++iter;
-    if (iter != end) {
-      result += separator_;
+void ReadingGrid::combineReading(size_t begin, size_t end,
+                                 std::string* result) {
+  result->clear();
+  for (size_t i = begin; i < end;) {
+    *result += readings_[i];
+    ++i;
+    if (i != end) {
+      *result += separator_;
     }
   }
-  return result;
 }
 
 bool ReadingGrid::hasNodeAt(size_t loc, size_t readingLen,
@@ -339,22 +725,67 @@ void ReadingGrid::update() {
     end = readings_.size();
   }
 
+  // Collect the readings that need a lookup, so that the language model can
+  // look them up in one batch.
+  lookupLocations_.clear();
+  for (auto& reading : lookupReadings_) {
+    spareLookupReadings_.push_back(std::move(reading));
+  }
+  lookupReadings_.clear();
+  lastUpdateStats_ = UpdateStats();
   for (size_t pos = begin; pos < end; pos++) {
-    for (size_t len = 1; len <= kMaximumSpanLength && pos + len <= end; len++) {
-      std::string combinedReading =
-          combineReading(readings_.begin() + static_cast<ptrdiff_t>(pos),
-                         readings_.begin() + static_cast<ptrdiff_t>(pos + len));
-
-      if (!hasNodeAt(pos, len, combinedReading)) {
-        auto unigrams = lm_.getUnigrams(combinedReading);
-        if (unigrams.empty()) {
-          continue;
+    size_t maxLen = std::min(kMaximumSpanLength, end - pos);
+    for (size_t len = 1; len <= maxLen; len++) {
+      combineReading(pos, pos + len, &readingBuffer_);
+
+      // Unless a longer node already exists here, stop extending the reading
+      // if the language model has nothing that starts with it.
+      bool isPrefixDead = false;
+      if (len < maxLen && spans_[pos].maxLength() <= len) {
+        ++lastUpdateStats_.prefixQueries;
+        prefixBuffer_ = readingBuffer_;
+        prefixBuffer_ += separator_;
+        isPrefixDead = !lm_.hasKeyWithPrefix(prefixBuffer_);
+      }
+
+      if (!hasNodeAt(pos, len, readingBuffer_)) {
+        lookupLocations_.emplace_back(pos, len);
+        if (spareLookupReadings_.empty()) {
+          lookupReadings_.emplace_back();
+        } else {
+          lookupReadings_.push_back(std::move(spareLookupReadings_.back()));
+          spareLookupReadings_.pop_back();
         }
+        lookupReadings_.back().assign(readingBuffer_);
+      }
 
-        insert(pos, std::make_shared<Node>(combinedReading, len, unigrams));
+      if (isPrefixDead) {
+        lastUpdateStats_.skippedLookups += maxLen - len;
+        break;
       }
     }
   }
+
+  lastUpdateStats_.lookups = lookupReadings_.size();
+  if (lookupReadings_.empty()) {
+    return;
+  }
+
+  // The unigrams are shared with the language model, which may have them
+  // cached.
+  lm_.batchGetRankedUnigrams(lookupReadings_, &lookupResults_);
+  for (size_t i = 0; i < lookupResults_.size(); i++) {
+    if (lookupResults_[i] == nullptr || lookupResults_[i]->empty()) {
+      continue;
+    }
+
+    auto [pos, len] = lookupLocations_[i];
+    // The lookup string is kept for reuse, and the node copies the reading
+    // into its own storage.
+    insert(pos, std::allocate_shared<Node>(NodePoolAllocator<Node>(nodePool_),
+                                           lookupReadings_[i], len,
+                                           std::move(lookupResults_[i])));
+  }
 }
 
 bool ReadingGrid::overrideCandidate(
@@ -382,6 +813,7 @@ bool ReadingGrid::overrideCandidate(
     // Nothing gets overridden.
     return false;
   }
+  invalidateWalkFrom(overridden.spanIndex);
 
   for (size_t i = overridden.spanIndex;
        i < overridden.spanIndex + overridden.node->spanningLength() &&
@@ -395,6 +827,11 @@ bool ReadingGrid::overrideCandidate(
     std::vector<NodeInSpan> nodes = overlappingNodesAt(i);
     for (NodeInSpan& nis : nodes) {
       if (nis.node != overridden.node) {
+        // Only an overridden node changes its score upon reset, and so the
+        // walk past the others is still valid.
+        if (nis.node->isOverridden()) {
+          invalidateWalkFrom(nis.spanIndex);
+        }
         nis.node->reset();
       }
     }
@@ -435,16 +872,35 @@ std::vector<ReadingGrid::NodeInSpan> ReadingGrid::overlappingNodesAt(
   return results;
 }
 
+ReadingGrid::Node::Node(std::string_view reading, size_t spanningLength,
+                        LanguageModel::RankedUnigrams unigrams)
+    : readingLength_(reading.size()),
+      longReading_(readingLength_ > kInlineReadingCapacity
+                       ? reading
+                       : std::string_view()),
+      spanningLength_(spanningLength),
+      unigrams_(std::move(unigrams)),
+      unigramIter_(unigrams_->begin()),
+      overrideType_(OverrideType::kNone) {
+  if (readingLength_ <= kInlineReadingCapacity) {
+    std::memcpy(inlineReading_, reading.data(), readingLength_);
+  }
+}
+
 LanguageModel::Unigram ReadingGrid::Node::currentUnigram() const {
-  return unigrams_.empty() ? LanguageModel::Unigram{} : *unigramIter_;
+  return unigrams_->empty() ? LanguageModel::Unigram{} : *unigramIter_;
 }
 
 std::string ReadingGrid::Node::value() const {
-  return unigrams_.empty() ? "" : unigramIter_->value();
+  return unigrams_->empty() ? "" : unigramIter_->value();
+}
+
+std::string_view ReadingGrid::Node::valueView() const {
+  return unigrams_->empty() ? std::string_view() : unigramIter_->valueView();
 }
 
 double ReadingGrid::Node::score() const {
-  if (unigrams_.empty()) {
+  if (unigrams_->empty()) {
     return 0;
   }
 
@@ -452,7 +908,7 @@ double ReadingGrid::Node::score() const {
     case OverrideType::kOverrideValueWithHighScore:
       return kOverridingScore;
     case OverrideType::kOverrideValueWithScoreFromTopUnigram:
-      return unigrams_[0].score();
+      return (*unigrams_)[0].score();
     case OverrideType::kNone:
     default:
       return unigramIter_->score();
@@ -464,15 +920,15 @@ bool ReadingGrid::Node::isOverridden() const {
 }
 
 void ReadingGrid::Node::reset() {
-  unigramIter_ = unigrams_.begin();
+  unigramIter_ = unigrams_->begin();
   overrideType_ = OverrideType::kNone;
 }
 
 bool ReadingGrid::Node::selectOverrideUnigram(
     const std::string& value, ReadingGrid::Node::OverrideType type) {
   assert(type != ReadingGrid::Node::OverrideType::kNone);
-  for (auto it = unigrams_.begin(), end = unigrams_.end(); it != end; ++it) {
-    if (value == it->value()) {
+  for (auto it = unigrams_->begin(), end = unigrams_->end(); it != end; ++it) {
+    if (value == it->valueView()) {
       unigramIter_ = it;
       overrideType_ = type;
       return true;
@@ -579,17 +1035,54 @@ void ReadingGrid::Span::removeNodesOfOrLongerThan(size_t length) {
   }
 }
 
-ReadingGrid::NodePtr ReadingGrid::Span::nodeOf(size_t length) const {
+const ReadingGrid::NodePtr& ReadingGrid::Span::nodeOf(size_t length) const {
   assert(length > 0 && length <= kMaximumSpanLength);
   return nodes_[length - 1];
 }
 
+void* ReadingGrid::NodePool::allocate(size_t size) {
+  constexpr size_t kAlignment = alignof(std::max_align_t);
+  size_t roundedSize = (size + kAlignment - 1) / kAlignment * kAlignment;
+  if (blockSize_ == 0) {
+    blockSize_ = std::max(roundedSize, sizeof(FreeBlock));
+  }
+  if (roundedSize != blockSize_) {
+    return ::operator new(size);
+  }
+
+  if (freeList_ == nullptr) {
+    auto chunk = std::make_unique<std::byte[]>(blockSize_ * kBlocksPerChunk);
+    for (size_t i = kBlocksPerChunk; i > 0; --i) {
+      auto* block = reinterpret_cast<FreeBlock*>(chunk.get() +
+                                                 (i - 1) * blockSize_);
+      block->next = freeList_;
+      freeList_ = block;
+    }
+    chunks_.push_back(std::move(chunk));
+  }
+
+  FreeBlock* block = freeList_;
+  freeList_ = block->next;
+  return block;
+}
+
+void ReadingGrid::NodePool::deallocate(void* ptr, size_t size) {
+  constexpr size_t kAlignment = alignof(std::max_align_t);
+  size_t roundedSize = (size + kAlignment - 1) / kAlignment * kAlignment;
+  if (roundedSize != blockSize_) {
+    ::operator delete(ptr);
+    return;
+  }
+
+  auto* block = static_cast<FreeBlock*>(ptr);
+  block->next = freeList_;
+  freeList_ = block;
+}
+
 std::vector<LanguageModel::Unigram>
 ReadingGrid::ScoreRankedLanguageModel::getUnigrams(const std::string& reading) {
   auto unigrams = lm_->getUnigrams(reading);
-  std::stable_sort(
-      unigrams.begin(), unigrams.end(),
-      [](const auto& u1, const auto& u2) { return u1.score() > u2.score(); });
+  RankByScore(&unigrams);
   return unigrams;
 }
 
@@ -598,4 +1091,25 @@ bool ReadingGrid::ScoreRankedLanguageModel::hasUnigrams(
   return lm_->hasUnigrams(reading);
 }
 
+bool ReadingGrid::ScoreRankedLanguageModel::hasKeyWithPrefix(
+    const std::string& prefix) {
+  return lm_->hasKeyWithPrefix(prefix);
+}
+
+std::vector<std::vector<LanguageModel::Unigram>>
+ReadingGrid::ScoreRankedLanguageModel::batchGetUnigrams(
+    const std::vector<std::string>& readings) {
+  auto results = lm_->batchGetUnigrams(readings);
+  for (auto& unigrams : results) {
+    RankByScore(&unigrams);
+  }
+  return results;
+}
+
+void ReadingGrid::ScoreRankedLanguageModel::batchGetRankedUnigrams(
+    const std::vector<std::string>& readings,
+    std::vector<RankedUnigrams>* results) {
+  lm_->batchGetRankedUnigrams(readings, results);
+}
+
 }  // namespace Formosa::Gramambular2
@@ -24,13 +24,18 @@
 #ifndef SRC_ENGINE_GRAMAMBULAR2_READING_GRID_H_
 #define SRC_ENGINE_GRAMAMBULAR2_READING_GRID_H_
 
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -52,7 +57,7 @@ namespace Formosa::Gramambular2 {
 class ReadingGrid {
  public:
   explicit ReadingGrid(std::shared_ptr<LanguageModel> lm)
-      : lm_(std::move(lm)) {}
+      : lm_(std::move(lm)), nodePool_(std::make_shared<NodePool>()) {}
 
   void clear();
 
@@ -103,20 +108,29 @@ class ReadingGrid {
       kOverrideValueWithScoreFromTopUnigram
     };
 
-    Node(std::string reading, size_t spanningLength,
+    Node(std::string_view reading, size_t spanningLength,
          std::vector<LanguageModel::Unigram> unigrams)
-        : reading_(std::move(reading)),
-          spanningLength_(spanningLength),
-          unigrams_(std::move(unigrams)),
-          unigramIter_(unigrams_.begin()),
-          overrideType_(OverrideType::kNone) {}
-
-    [[nodiscard]] const std::string& reading() const { return reading_; }
+        : Node(reading, spanningLength,
+               std::make_shared<const std::vector<LanguageModel::Unigram>>(
+                   std::move(unigrams))) {}
+
+    // Shares the unigrams, which must not be nullptr, with the language model
+    // that looked them up.
+    Node(std::string_view reading, size_t spanningLength,
+         LanguageModel::RankedUnigrams unigrams);
+
+    // The reading is kept in the node itself, and so in the node's pool
+    // block, unless it is longer than kInlineReadingCapacity.
+    [[nodiscard]] std::string_view reading() const {
+      return readingLength_ <= kInlineReadingCapacity
+                 ? std::string_view(inlineReading_, readingLength_)
+                 : std::string_view(longReading_);
+    }
 
     [[nodiscard]] size_t spanningLength() const { return spanningLength_; }
 
     [[nodiscard]] const std::vector<LanguageModel::Unigram>& unigrams() const {
-      return unigrams_;
+      return *unigrams_;
     }
 
     // Returns the top or overridden unigram.
@@ -124,6 +138,9 @@ class ReadingGrid {
 
     [[nodiscard]] std::string value() const;
 
+    // Returns the value of the current unigram without copying it.
+    [[nodiscard]] std::string_view valueView() const;
+
     [[nodiscard]] double score() const;
 
     [[nodiscard]] bool isOverridden() const;
@@ -145,10 +162,16 @@ class ReadingGrid {
     // A->B, which gives "c" a better chance.
     static constexpr double kOverridingScore = 42;
 
+    // Enough for the readings of kMaximumSpanLength Bopomofo syllables, which
+    // take up to 11 bytes each, joined by the default separator.
+    static constexpr size_t kInlineReadingCapacity = 96;
+
    protected:
-    const std::string reading_;
+    char inlineReading_[kInlineReadingCapacity];
+    const size_t readingLength_;
+    const std::string longReading_;
     const size_t spanningLength_;
-    const std::vector<LanguageModel::Unigram> unigrams_;
+    const LanguageModel::RankedUnigrams unigrams_;
     std::vector<LanguageModel::Unigram>::const_iterator unigramIter_;
     OverrideType overrideType_;
   };
@@ -166,8 +189,16 @@ class ReadingGrid {
     size_t totalReadings = 0;
     size_t vertices = 0;
     size_t edges = 0;
+
+    // The number of DP states that this walk had to recompute. A walk that
+    // follows an edit only recomputes the states past the first position
+    // affected by the edit; a full walk recomputes all totalReadings states.
+    size_t recomputedStates = 0;
     uint64_t elapsedMicroseconds = 0;
 
+    // The sum of the scores of the nodes.
+    double score = 0;
+
     // Convenient method for finding the node at the cursor. Returns
     // nodes.cend() if the value of cursor argument doesn't make sense. An
     // optional ourCursorPastNode argument can be used to obtain the cursor
@@ -180,8 +211,86 @@ class ReadingGrid {
     std::vector<std::string> readingsAsStrings() const;
   };
 
+  // Walks the grid. The grid keeps the DP table of the previous walk, and
+  // only recomputes the states that are affected by the edits (insertions,
+  // deletions, and overrides) made since then. The result is identical to
+  // that of a walk from scratch.
   WalkResult walk();
 
+  // Returns up to k paths through the grid with the highest scores, best
+  // first. The first one is the path that walk() returns. The paths differ in
+  // the nodes they go through, and like in walk(), each node contributes its
+  // current unigram. Each state keeps the k best paths to it, merged from
+  // those of the states it is reached from, and so this takes about
+  // O(k * (|V| + |E|)) time. This does not use or change the DP table kept by
+  // walk(). The statistics of each result are those of the whole search.
+  std::vector<WalkResult> walkNBest(size_t k) const;
+
+  // Discards the DP table kept from the previous walk, so that the next walk
+  // starts from scratch. The grid tracks all the changes made through its own
+  // methods; this is only needed if a node is modified directly, for example
+  // by calling selectOverrideUnigram() on a NodePtr obtained from a walk.
+  void invalidateWalk();
+
+  // Turns on the streaming mode, for input that can grow to hundreds of
+  // readings, such as pasted or dictated text. Once an insertion makes the
+  // grid longer than the window, the readings before the last location that
+  // no node crosses are committed, as long as they are at least the window
+  // from the end of the grid, and (kMaximumSpanLength - 1) from the cursor.
+  // Every path goes through such a location, and no node added by appending
+  // readings can cross it, and so the best path up to there can no longer
+  // change. Its nodes are kept for takeCommittedNodes(), and they and their
+  // readings are removed from the grid. The committed readings can no longer
+  // be edited, and no new node spans across them. An insertion and a walk
+  // thus take time bounded by the distance between such locations rather
+  // than by the whole input. With a dense lexicon, every location may be
+  // crossed by some node, in which case nothing is committed and the grid
+  // grows; see setApproximateAutoCommit(). A window of 0, the default, turns
+  // the mode off, and windows shorter than kMaximumSpanLength are taken as
+  // kMaximumSpanLength.
+  void setAutoCommitWindow(size_t window);
+
+  [[nodiscard]] size_t autoCommitWindow() const { return autoCommitWindow_; }
+
+  // Lets the streaming mode commit a prefix that could still change. Once the
+  // grid grows to twice the window without a location that no node crosses,
+  // the best path is committed up to the location on it where the best path
+  // crossing it trails by the widest margin. Later readings could have
+  // changed the best path across that location, and so the committed nodes
+  // may differ from those of a walk of the whole input. In exchange, the grid
+  // stays within twice the window as long as the cursor is at the end. Off by
+  // default.
+  void setApproximateAutoCommit(bool approximate);
+
+  [[nodiscard]] bool approximateAutoCommit() const {
+    return approximateAutoCommit_;
+  }
+
+  // Returns the nodes committed since the last call, in order, and forgets
+  // them.
+  std::vector<NodePtr> takeCommittedNodes();
+
+  // The number of readings committed since the grid was created or cleared.
+  [[nodiscard]] size_t committedReadings() const { return committedReadings_; }
+
+  // Statistics of the language model lookups made by the last update of the
+  // grid, which happens when a reading is inserted or deleted.
+  struct UpdateStats {
+    // The number of readings looked up.
+    size_t lookups = 0;
+
+    // The number of prefix queries (LanguageModel::hasKeyWithPrefix) made.
+    size_t prefixQueries = 0;
+
+    // The number of readings not looked up because no reading in the language
+    // model starts with a shorter reading at the same location.
+    size_t skippedLookups = 0;
+  };
+
+  [[nodiscard]] const UpdateStats& lastUpdateStats() const {
+    return lastUpdateStats_;
+  }
+
   struct Candidate {
     Candidate(std::string r, std::string v, std::string rv = "")
         : reading(std::move(r)), value(std::move(v)), rawValue(std::move(rv)) {}
@@ -195,6 +304,30 @@ class ReadingGrid {
   // not have to care about this boundary condition.
   std::vector<Candidate> candidatesAt(size_t loc);
 
+  // A candidate with the score of the best path through the grid that goes
+  // through it, that is, of the best sentence that has the candidate.
+  struct RankedCandidate {
+    RankedCandidate(Candidate c, double s) : candidate(std::move(c)), score(s) {}
+    const Candidate candidate;
+    const double score;
+  };
+
+  // Returns the candidates of candidatesAt(loc), ordered by the score of the
+  // best path through each of them, best first, and in the order of
+  // candidatesAt() among equal scores. The node of a candidate counts with the
+  // score of the candidate's unigram, or with the score of the node if that is
+  // its current unigram, so that overrides are taken into account. The scores
+  // of all candidates come from one forward and one backward pass over the
+  // grid, in O(|V| + |E|) time, and not from a walk per candidate.
+  std::vector<RankedCandidate> rankedCandidatesAt(size_t loc) const;
+
+  // For each node of the walk result, how much higher the score of the best
+  // path through the node is than that of the best path with another
+  // candidate at the start of the node, or infinity if there is no other
+  // candidate. A margin near 0 means that the context hardly prefers the
+  // value of the node. The result must be from a walk of the grid as it is.
+  std::vector<double> confidenceMarginsOf(const WalkResult& result) const;
+
   // Adds weight to the node with the unigram that has the designated candidate
   // value and applies the desired override type, essentially resulting in user
   // override. An overridden node would influence the grid walk to favor walking
@@ -216,7 +349,7 @@ class ReadingGrid {
     void clear();
     void add(const NodePtr& node);
     void removeNodesOfOrLongerThan(size_t length);
-    [[nodiscard]] NodePtr nodeOf(size_t length) const;
+    [[nodiscard]] const NodePtr& nodeOf(size_t length) const;
     [[nodiscard]] size_t maxLength() const { return maxLength_; }
 
    protected:
@@ -233,32 +366,316 @@ class ReadingGrid {
     }
     std::vector<Unigram> getUnigrams(const std::string& reading) override;
     bool hasUnigrams(const std::string& reading) override;
+    bool hasKeyWithPrefix(const std::string& prefix) override;
+    std::vector<std::vector<Unigram>> batchGetUnigrams(
+        const std::vector<std::string>& readings) override;
+    void batchGetRankedUnigrams(const std::vector<std::string>& readings,
+                                std::vector<RankedUnigrams>* results) override;
 
    protected:
     std::shared_ptr<LanguageModel> lm_;
   };
 
-  [[nodiscard]] const std::vector<Span>& spans() const { return spans_; }
+  // A read-only view of the readings or the spans of the grid. The elements
+  // are kept in two runs, the ones before the last edit and the ones after it.
+  // Like a reference into a vector, a view is invalidated by any change to the
+  // grid.
+  template <typename T>
+  class View {
+   public:
+    class const_iterator {
+     public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = T;
+      using difference_type = ptrdiff_t;
+      using pointer = const T*;
+      using reference = const T&;
+
+      const T& operator*() const { return view_[index_]; }
+      const T* operator->() const { return &view_[index_]; }
+      const_iterator& operator++() {
+        ++index_;
+        return *this;
+      }
+      const_iterator operator++(int) {
+        const_iterator result = *this;
+        ++index_;
+        return result;
+      }
+      bool operator==(const const_iterator& other) const {
+        return index_ == other.index_;
+      }
+      bool operator!=(const const_iterator& other) const {
+        return index_ != other.index_;
+      }
+
+     private:
+      friend class View;
+      const_iterator(const View& view, size_t index)
+          : view_(view), index_(index) {}
+
+      View view_;
+      size_t index_;
+    };
+
+    [[nodiscard]] size_t size() const { return frontSize_ + backSize_; }
+    [[nodiscard]] bool empty() const { return size() == 0; }
+    const T& operator[](size_t i) const {
+      assert(i < size());
+      return i < frontSize_ ? front_[i] : back_[i - frontSize_];
+    }
+    [[nodiscard]] const_iterator begin() const {
+      return const_iterator(*this, 0);
+    }
+    [[nodiscard]] const_iterator end() const {
+      return const_iterator(*this, size());
+    }
+
+   private:
+    friend class ReadingGrid;
+    View(const T* front, size_t frontSize, const T* back, size_t backSize)
+        : front_(front),
+          frontSize_(frontSize),
+          back_(back),
+          backSize_(backSize) {}
+
+    const T* front_;
+    size_t frontSize_;
+    const T* back_;
+    size_t backSize_;
+  };
 
-  [[nodiscard]] const std::vector<std::string>& readings() const {
-    return readings_;
+  [[nodiscard]] View<Span> spans() const { return spans_.view(); }
+
+  [[nodiscard]] View<std::string> readings() const {
+    return readings_.view();
   }
 
  protected:
+  // A vector with a gap at the position of the last edit. Since the edits are
+  // made at the cursor, which mostly stays put or moves by a few readings, an
+  // insertion or an erasure only moves the elements between it and the
+  // previous edit, rather than all the elements after it. The elements in the
+  // gap are moved-from or default-constructed, and so hold no nodes.
+  template <typename T>
+  class GapBuffer {
+   public:
+    [[nodiscard]] size_t size() const {
+      return buffer_.size() - (gapEnd_ - gapBegin_);
+    }
+    [[nodiscard]] bool empty() const { return size() == 0; }
+
+    T& operator[](size_t i) { return buffer_[indexOf(i)]; }
+    const T& operator[](size_t i) const { return buffer_[indexOf(i)]; }
+
+    [[nodiscard]] View<T> view() const {
+      return View<T>(buffer_.data(), gapBegin_, buffer_.data() + gapEnd_,
+                     buffer_.size() - gapEnd_);
+    }
+
+    void insert(size_t pos, T value) {
+      assert(pos <= size());
+      if (gapBegin_ == gapEnd_) {
+        grow();
+      }
+      moveGapTo(pos);
+      buffer_[gapBegin_++] = std::move(value);
+    }
+
+    // Erases the elements in [begin, end).
+    void erase(size_t begin, size_t end) {
+      assert(begin <= end && end <= size());
+      moveGapTo(end);
+      while (gapBegin_ > begin) {
+        buffer_[--gapBegin_] = T();
+      }
+    }
+
+    void clear() {
+      buffer_.clear();
+      gapBegin_ = 0;
+      gapEnd_ = 0;
+    }
+
+   private:
+    static constexpr size_t kMinimumCapacity = 16;
+
+    [[nodiscard]] size_t indexOf(size_t i) const {
+      assert(i < size());
+      return i < gapBegin_ ? i : i + (gapEnd_ - gapBegin_);
+    }
+
+    void moveGapTo(size_t pos) {
+      auto base = buffer_.begin();
+      if (gapBegin_ == gapEnd_) {
+        // Nothing to move.
+      } else if (pos < gapBegin_) {
+        std::move_backward(base + static_cast<ptrdiff_t>(pos),
+                           base + static_cast<ptrdiff_t>(gapBegin_),
+                           base + static_cast<ptrdiff_t>(gapEnd_));
+      } else if (pos > gapBegin_) {
+        std::move(base + static_cast<ptrdiff_t>(gapEnd_),
+                  base + static_cast<ptrdiff_t>(gapEnd_ + pos - gapBegin_),
+                  base + static_cast<ptrdiff_t>(gapBegin_));
+      }
+      gapEnd_ = gapEnd_ - gapBegin_ + pos;
+      gapBegin_ = pos;
+    }
+
+    void grow() {
+      size_t capacity = std::max(buffer_.size() * 2, kMinimumCapacity);
+      size_t backSize = buffer_.size() - gapEnd_;
+      std::vector<T> buffer(capacity);
+      std::move(buffer_.begin(),
+                buffer_.begin() + static_cast<ptrdiff_t>(gapBegin_),
+                buffer.begin());
+      std::move(buffer_.begin() + static_cast<ptrdiff_t>(gapEnd_),
+                buffer_.end(),
+                buffer.end() - static_cast<ptrdiff_t>(backSize));
+      buffer_ = std::move(buffer);
+      gapEnd_ = capacity - backSize;
+    }
+
+    std::vector<T> buffer_;
+    size_t gapBegin_ = 0;
+    size_t gapEnd_ = 0;
+  };
+
   size_t cursor_ = 0;
   std::string separator_ = kDefaultSeparator;
-  std::vector<std::string> readings_;
-  std::vector<Span> spans_;
+  GapBuffer<std::string> readings_;
+  GapBuffer<Span> spans_;
   ScoreRankedLanguageModel lm_;
 
+  // A state in the DP table. This structure tracks the maximum accumulated
+  // score and the back-pointer required for path reconstruction in the
+  // Viterbi algorithm.
+  struct State {
+    size_t fromIndex = 0;
+    NodePtr fromNode = nullptr;
+    double maxScore = -std::numeric_limits<double>::infinity();
+    // The number of nodes that start before the state, so that a walk that
+    // only recomputes the last states can still tell the edges of the grid.
+    size_t edgesBefore = 0;
+  };
+
+  // The DP table from the last walk. States at or before viterbiValidUpTo_ are
+  // still valid, since a state only depends on the nodes that end there, and
+  // those nodes all start from a location before the state.
+  std::vector<State> viterbi_;
+  size_t viterbiValidUpTo_ = 0;
+
+  UpdateStats lastUpdateStats_;
+
+  // The streaming mode. See setAutoCommitWindow().
+  size_t autoCommitWindow_ = 0;
+  bool approximateAutoCommit_ = false;
+  std::vector<NodePtr> committedNodes_;
+  size_t committedReadings_ = 0;
+  // Every location in (0, autoCommitCrossedUpTo_] is known to be crossed by
+  // a node, and so is not checked again.
+  size_t autoCommitCrossedUpTo_ = 0;
+
+  // A pool of fixed-size memory blocks for the nodes. The grid creates its
+  // nodes with std::allocate_shared and a NodePoolAllocator, and so a node and
+  // its shared_ptr control block take up one block. The blocks of removed
+  // nodes are reused by new nodes without going to the heap. Since each node
+  // holds a reference to the pool, nodes, such as those in a WalkResult, can
+  // safely outlive the grid. Like the grid, the pool is not thread-safe.
+  class NodePool {
+   public:
+    NodePool() = default;
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    void* allocate(size_t size);
+    void deallocate(void* ptr, size_t size);
+
+   protected:
+    static constexpr size_t kBlocksPerChunk = 64;
+
+    struct FreeBlock {
+      FreeBlock* next;
+    };
+
+    // Set by the first allocation. Allocations of other sizes, which are not
+    // expected, go to the heap.
+    size_t blockSize_ = 0;
+    FreeBlock* freeList_ = nullptr;
+    std::vector<std::unique_ptr<std::byte[]>> chunks_;
+  };
+
+  template <typename T>
+  class NodePoolAllocator {
+   public:
+    using value_type = T;
+
+    explicit NodePoolAllocator(std::shared_ptr<NodePool> pool)
+        : pool_(std::move(pool)) {}
+
+    template <typename U>
+    NodePoolAllocator(const NodePoolAllocator<U>& other)  // NOLINT
+        : pool_(other.pool_) {}
+
+    T* allocate(size_t n) {
+      static_assert(alignof(T) <= alignof(std::max_align_t));
+      return static_cast<T*>(pool_->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) { pool_->deallocate(ptr, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const NodePoolAllocator<U>& other) const {
+      return pool_ == other.pool_;
+    }
+
+    template <typename U>
+    bool operator!=(const NodePoolAllocator<U>& other) const {
+      return pool_ != other.pool_;
+    }
+
+   private:
+    template <typename U>
+    friend class NodePoolAllocator;
+
+    std::shared_ptr<NodePool> pool_;
+  };
+
+  std::shared_ptr<NodePool> nodePool_;
+
+  // Scratch buffers reused by update(), so that a keystroke does not need to
+  // allocate them anew.
+  std::string readingBuffer_;
+  std::string prefixBuffer_;
+  std::vector<std::pair<size_t, size_t>> lookupLocations_;
+  std::vector<std::string> lookupReadings_;
+  // The strings of the earlier lookups, kept with their capacity, so that the
+  // combined readings, which are mostly longer than what std::string holds
+  // inline, are copied into them rather than into new strings.
+  std::vector<std::string> spareLookupReadings_;
+  std::vector<LanguageModel::RankedUnigrams> lookupResults_;
+
+  // Marks the states past loc as stale, for the nodes in the span at loc (or
+  // any spans after it) have been changed.
+  void invalidateWalkFrom(size_t loc);
+
+  // Commits what can be committed in the streaming mode.
+  void autoCommit();
+  // Whether a node starts before the location and ends after it.
+  [[nodiscard]] bool isCrossedAt(size_t loc) const;
+  // Commits the best path up to the location, which must be on the best path
+  // of a walk of the grid as it is. Every location in (0, crossedUpTo] is
+  // known to be crossed.
+  void commitPrefix(size_t loc, size_t crossedUpTo);
+
   // Internal methods for maintaining the grid.
 
   void expandGridAt(size_t loc);
   void shrinkGridAt(size_t loc);
   void removeAffectedNodes(size_t loc);
   void insert(size_t loc, const NodePtr& node);
-  std::string combineReading(std::vector<std::string>::const_iterator begin,
-                             std::vector<std::string>::const_iterator end);
+  // Joins the readings in [begin, end) with the separator.
+  void combineReading(size_t begin, size_t end, std::string* result);
   bool hasNodeAt(size_t loc, size_t readingLen, const std::string& reading);
   void update();
 
@@ -275,6 +692,13 @@ class ReadingGrid {
   // Find all nodes that overlap with the location. The return value is a list
   // of nodes along with their starting location in the grid.
   std::vector<NodeInSpan> overlappingNodesAt(size_t loc) const;
+
+  // Computes, for each location, the score of the best path from the start of
+  // the grid to it (forward) and from it to the end of the grid (backward).
+  // The best path through a node from i to j then scores forward[i] +
+  // node->score() + backward[j].
+  void computeContextScores(std::vector<double>* forward,
+                            std::vector<double>* backward) const;
 };
 
 }  // namespace Formosa::Gramambular2
@@ -0,0 +1,149 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "language_model.h"
+#include "reading_grid.h"
+
+namespace {
+
+using Formosa::Gramambular2::LanguageModel;
+using Formosa::Gramambular2::ReadingGrid;
+
+// Every single reading has unigrams, and about two thirds of the longer
+// readings do, which gives a dense grid with many competing paths.
+class HashedScoreLM : public LanguageModel {
+ public:
+  std::vector<Unigram> getUnigrams(const std::string& reading) override {
+    size_t h = std::hash<std::string>()(reading);
+    std::vector<Unigram> unigrams;
+    if (reading.size() > 1 && h % 3 == 0) {
+      return unigrams;
+    }
+    unigrams.emplace_back(reading, -1.0 - static_cast<double>(h % 1000) / 100);
+    return unigrams;
+  }
+  bool hasUnigrams(const std::string& reading) override {
+    return !getUnigrams(reading).empty();
+  }
+};
+
+ReadingGrid MakeGrid(size_t length) {
+  ReadingGrid grid(std::make_shared<HashedScoreLM>());
+  grid.setReadingSeparator("");
+  for (size_t i = 0; i < length; ++i) {
+    grid.insertReading(std::string(1, "abcd"[(i * 7 + i / 3) % 4]));
+  }
+  return grid;
+}
+
+// The single best path from scratch, for comparison.
+static void BM_ReadingGridWalk(benchmark::State& state) {
+  ReadingGrid grid = MakeGrid(state.range(0));
+  for (auto _ : state) {
+    grid.invalidateWalk();
+    benchmark::DoNotOptimize(grid.walk());
+  }
+}
+BENCHMARK(BM_ReadingGridWalk)->Arg(10)->Arg(50)->Arg(100)->Arg(500);
+
+static void BM_ReadingGridWalkNBest(benchmark::State& state) {
+  ReadingGrid grid = MakeGrid(state.range(0));
+  size_t k = state.range(1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(grid.walkNBest(k));
+  }
+}
+BENCHMARK(BM_ReadingGridWalkNBest)
+    ->ArgsProduct({{10, 50, 100, 500}, {1, 5, 20}});
+
+// Types and deletes a reading in the middle of a grid, as when correcting a
+// long composition, and so measures the edits rather than the walk.
+static void BM_ReadingGridMiddleInsertion(benchmark::State& state) {
+  ReadingGrid grid = MakeGrid(state.range(0));
+  grid.setCursor(grid.length() / 2);
+  for (auto _ : state) {
+    grid.insertReading("a");
+    grid.deleteReadingBeforeCursor();
+  }
+}
+BENCHMARK(BM_ReadingGridMiddleInsertion)->Arg(100)->Arg(1000)->Arg(10000);
+
+// Like a real lexicon, a part of the two-reading combinations are words, a
+// few of the three-reading ones are, and none of the longer ones, and so there
+// are often locations that no node crosses.
+class SparseLexiconLM : public LanguageModel {
+ public:
+  std::vector<Unigram> getUnigrams(const std::string& reading) override {
+    size_t h = std::hash<std::string>()(reading);
+    std::vector<Unigram> unigrams;
+    if ((reading.size() == 2 && h % 10 >= 3) ||
+        (reading.size() == 3 && h % 20 != 0) || reading.size() > 3) {
+      return unigrams;
+    }
+    unigrams.emplace_back(reading, -1.0 - static_cast<double>(h % 1000) / 100);
+    return unigrams;
+  }
+  bool hasUnigrams(const std::string& reading) override {
+    return !getUnigrams(reading).empty();
+  }
+};
+
+// Types 10,000 readings with a walk after each, as an input method does, with
+// the streaming mode off (window 0) or on, and with a sparse (0) or a dense (1)
+// lexicon. With the dense one, every location is crossed by some node, and so
+// the approximate commit is turned on.
+static void BM_ReadingGridStreamingInput(benchmark::State& state) {
+  constexpr size_t kReadings = 10000;
+  std::shared_ptr<LanguageModel> lm;
+  if (state.range(1) == 0) {
+    lm = std::make_shared<SparseLexiconLM>();
+  } else {
+    lm = std::make_shared<HashedScoreLM>();
+  }
+  for (auto _ : state) {
+    ReadingGrid grid(lm);
+    grid.setReadingSeparator("");
+    grid.setAutoCommitWindow(state.range(0));
+    grid.setApproximateAutoCommit(state.range(1) != 0);
+    for (size_t i = 0; i < kReadings; ++i) {
+      grid.insertReading(std::string(1, "abcd"[(i * 7 + i / 3) % 4]));
+      benchmark::DoNotOptimize(grid.walk());
+    }
+    benchmark::DoNotOptimize(grid.takeCommittedNodes());
+  }
+  state.SetItemsProcessed(state.iterations() * kReadings);
+}
+BENCHMARK(BM_ReadingGridStreamingInput)
+    ->ArgsProduct({{0, 16, 64}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
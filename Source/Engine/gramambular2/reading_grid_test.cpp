@@ -23,11 +23,16 @@
 
 #include "reading_grid.h"
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <random>
 #include <string>
 #include <vector>
 
+#include "allocation_counter.h"
 #include "gtest/gtest.h"
 #include "language_model.h"
 
@@ -152,6 +157,11 @@ class SimpleLM : public LanguageModel {
     return db_.find(key) != db_.end();
   }
 
+  bool hasKeyWithPrefix(const std::string& prefix) override {
+    const auto f = db_.lower_bound(prefix);
+    return f != db_.end() && f->first.compare(0, prefix.length(), prefix) == 0;
+  }
+
  protected:
   std::map<std::string, std::vector<Unigram>> db_;
 };
@@ -547,6 +557,566 @@ TEST(ReadingGridTest, StressTest) {
             << ", edges: " << result.edges << "\n";
 }
 
+TEST(ReadingGridTest, IncrementalWalkRecomputesOnlyAffectedStates) {
+  ReadingGrid grid(std::make_shared<MockLM>());
+  grid.setReadingSeparator("");
+  for (char c = 'a'; c <= 't'; ++c) {
+    grid.insertReading(std::string(1, c));
+  }
+  ReadingGrid::WalkResult result = grid.walk();
+  ASSERT_EQ(result.recomputedStates, 20);
+
+  // Nothing has changed.
+  result = grid.walk();
+  ASSERT_EQ(result.recomputedStates, 0);
+  ASSERT_EQ(result.totalReadings, 20);
+  ASSERT_EQ(result.vertices, 20);
+
+  // Appending only affects the states reachable from the last
+  // kMaximumSpanLength spans.
+  grid.insertReading("u");
+  result = grid.walk();
+  ASSERT_EQ(result.recomputedStates, ReadingGrid::kMaximumSpanLength);
+  ASSERT_EQ(result.totalReadings, 21);
+
+  grid.setCursor(2);
+  grid.deleteReadingBeforeCursor();
+  result = grid.walk();
+  ASSERT_EQ(result.recomputedStates, 20);
+
+  grid.invalidateWalk();
+  result = grid.walk();
+  ASSERT_EQ(result.recomputedStates, 20);
+}
+
+TEST(ReadingGridTest, IncrementalWalkMatchesFullWalk) {
+  // Scores are derived from the readings, and are deliberately coarse so that
+  // there are many ties for the walk to break.
+  class HashedScoreLM : public LanguageModel {
+   public:
+    std::vector<Unigram> getUnigrams(const std::string& reading) override {
+      size_t h = std::hash<std::string>()(reading);
+      std::vector<Unigram> unigrams;
+      if (reading.size() > 1 && h % 3 == 0) {
+        return unigrams;
+      }
+      unigrams.emplace_back(reading + "1", -static_cast<double>(h % 4));
+      unigrams.emplace_back(reading + "2", -static_cast<double>((h >> 4) % 4));
+      return unigrams;
+    }
+    bool hasUnigrams(const std::string& reading) override {
+      return !getUnigrams(reading).empty();
+    }
+  };
+
+  std::mt19937 gen(42);
+  auto rand = [&](size_t n) {
+    return std::uniform_int_distribution<size_t>(0, n - 1)(gen);
+  };
+
+  constexpr char kReadings[] = "abcd";
+  ReadingGrid grid(std::make_shared<HashedScoreLM>());
+  grid.setReadingSeparator("");
+  for (int step = 0; step < 2000; ++step) {
+    switch (rand(6)) {
+      case 0:
+      case 1:
+      case 2:
+        grid.setCursor(rand(grid.length() + 1));
+        grid.insertReading(std::string(1, kReadings[rand(4)]));
+        break;
+      case 3:
+        grid.setCursor(rand(grid.length() + 1));
+        grid.deleteReadingBeforeCursor();
+        break;
+      case 4:
+        grid.setCursor(rand(grid.length() + 1));
+        grid.deleteReadingAfterCursor();
+        break;
+      case 5: {
+        size_t loc = rand(grid.length() + 1);
+        auto candidates = grid.candidatesAt(loc);
+        if (!candidates.empty()) {
+          grid.overrideCandidate(
+              loc, candidates[rand(candidates.size())],
+              rand(2) ? ReadingGrid::Node::OverrideType::
+                            kOverrideValueWithHighScore
+                      : ReadingGrid::Node::OverrideType::
+                            kOverrideValueWithScoreFromTopUnigram);
+        }
+        break;
+      }
+    }
+
+    // Walk only every now and then to accumulate edits between walks.
+    if (rand(3) != 0) {
+      continue;
+    }
+
+    ReadingGrid::WalkResult incremental = grid.walk();
+    ASSERT_LE(incremental.recomputedStates, grid.length());
+    grid.invalidateWalk();
+    ReadingGrid::WalkResult full = grid.walk();
+    ASSERT_EQ(full.recomputedStates, grid.length());
+    ASSERT_EQ(incremental.nodes, full.nodes) << "at step " << step;
+    ASSERT_EQ(incremental.totalReadings, full.totalReadings);
+    ASSERT_EQ(incremental.vertices, full.vertices);
+    ASSERT_EQ(incremental.edges, full.edges);
+  }
+}
+
+TEST(ReadingGridTest, WalkNBestReturnsTheBestPathsInOrder) {
+  ReadingGrid grid(std::make_shared<SimpleLM>(kSampleData));
+  grid.setReadingSeparator("");
+  for (const char* reading :
+       {"ㄍㄠ", "ㄎㄜ", "ㄐㄧˋ", "ㄍㄨㄥ", "ㄙ", "ㄉㄜ˙", "ㄋㄧㄢˊ", "ㄓㄨㄥ",
+        "ㄐㄧㄤˇ", "ㄐㄧㄣ"}) {
+    grid.insertReading(reading);
+  }
+
+  ASSERT_TRUE(grid.walkNBest(0).empty());
+  ReadingGrid::WalkResult best = grid.walk();
+  std::vector<ReadingGrid::WalkResult> results = grid.walkNBest(5);
+  ASSERT_EQ(results.size(), 5);
+  EXPECT_EQ(results[0].nodes, best.nodes);
+  EXPECT_EQ(results[0].score, best.score);
+  EXPECT_EQ(results[0].valuesAsStrings(),
+            (std::vector<std::string>{"高科技", "公司", "的", "年中", "獎金"}));
+  // 年終 is not the current unigram of its node, and so no path has it.
+  EXPECT_EQ(results[1].valuesAsStrings(),
+            (std::vector<std::string>{"高科技", "公司", "的", "年", "中",
+                                      "獎金"}));
+
+  for (size_t i = 0; i < results.size(); ++i) {
+    EXPECT_EQ(results[i].totalReadings, grid.length());
+    double score = 0;
+    for (const auto& node : results[i].nodes) {
+      score += node->score();
+    }
+    EXPECT_DOUBLE_EQ(results[i].score, score);
+    if (i > 0) {
+      EXPECT_LE(results[i].score, results[i - 1].score);
+      EXPECT_NE(results[i].nodes, results[i - 1].nodes);
+    }
+  }
+}
+
+TEST(ReadingGridTest, WalkNBestMatchesAllPathsEnumerated) {
+  // See IncrementalWalkMatchesFullWalk.
+  class HashedScoreLM : public LanguageModel {
+   public:
+    std::vector<Unigram> getUnigrams(const std::string& reading) override {
+      size_t h = std::hash<std::string>()(reading);
+      std::vector<Unigram> unigrams;
+      if (reading.size() > 1 && h % 3 == 0) {
+        return unigrams;
+      }
+      unigrams.emplace_back(reading, -static_cast<double>(h % 7));
+      return unigrams;
+    }
+    bool hasUnigrams(const std::string& reading) override {
+      return !getUnigrams(reading).empty();
+    }
+  };
+
+  std::mt19937 gen(42);
+  constexpr char kReadings[] = "abcd";
+  for (int round = 0; round < 20; ++round) {
+    ReadingGrid grid(std::make_shared<HashedScoreLM>());
+    grid.setReadingSeparator("");
+    size_t length = 1 + gen() % 12;
+    for (size_t i = 0; i < length; ++i) {
+      grid.insertReading(std::string(1, kReadings[gen() % 4]));
+    }
+
+    // Enumerate the scores of all paths.
+    std::vector<double> allScores;
+    std::function<void(size_t, double)> enumerate = [&](size_t loc,
+                                                        double score) {
+      if (loc == grid.length()) {
+        allScores.push_back(score);
+        return;
+      }
+      const ReadingGrid::Span& span = grid.spans()[loc];
+      for (size_t len = 1; len <= span.maxLength(); ++len) {
+        if (span.nodeOf(len) != nullptr) {
+          enumerate(loc + len, score + span.nodeOf(len)->score());
+        }
+      }
+    };
+    enumerate(0, 0);
+    std::sort(allScores.begin(), allScores.end(), std::greater<>());
+
+    constexpr size_t kK = 20;
+    std::vector<ReadingGrid::WalkResult> results = grid.walkNBest(kK);
+    ASSERT_EQ(results.size(), std::min(kK, allScores.size()));
+    for (size_t i = 0; i < results.size(); ++i) {
+      ASSERT_DOUBLE_EQ(results[i].score, allScores[i]) << "round " << round;
+    }
+    ASSERT_EQ(results[0].nodes, grid.walk().nodes);
+  }
+}
+
+TEST(ReadingGridTest, AutoCommitMatchesTheWalkOfTheWholeInput) {
+  // Integer scores, so that the sums are exact and ties are broken the same
+  // way however the path is split. Like in a real lexicon, a good part of the
+  // two-reading combinations are words, a few of the three-reading ones are,
+  // and none of the longer ones.
+  class HashedScoreLM : public LanguageModel {
+   public:
+    std::vector<Unigram> getUnigrams(const std::string& reading) override {
+      size_t h = std::hash<std::string>()(reading);
+      std::vector<Unigram> unigrams;
+      if ((reading.size() == 2 && h % 10 >= 3) ||
+          (reading.size() == 3 && h % 20 != 0) || reading.size() > 3) {
+        return unigrams;
+      }
+      unigrams.emplace_back(reading, -static_cast<double>(h % 5));
+      return unigrams;
+    }
+    bool hasUnigrams(const std::string& reading) override {
+      return !getUnigrams(reading).empty();
+    }
+  };
+
+  auto lm = std::make_shared<HashedScoreLM>();
+  ReadingGrid full(lm);
+  ReadingGrid streaming(lm);
+  full.setReadingSeparator("");
+  streaming.setReadingSeparator("");
+  streaming.setAutoCommitWindow(3);
+  ASSERT_EQ(streaming.autoCommitWindow(), ReadingGrid::kMaximumSpanLength);
+  streaming.setAutoCommitWindow(16);
+
+  std::mt19937 gen(42);
+  constexpr char kReadings[] = "abcd";
+  std::vector<std::string> committed;
+  size_t maxLength = 0;
+  for (int i = 0; i < 500; ++i) {
+    std::string reading(1, kReadings[gen() % 4]);
+    full.insertReading(reading);
+    streaming.insertReading(reading);
+    maxLength = std::max(maxLength, streaming.length());
+    ASSERT_EQ(streaming.cursor(), streaming.length());
+    ASSERT_EQ(streaming.committedReadings() + streaming.length(),
+              full.length());
+    if (gen() % 5 == 0) {
+      for (const auto& node : streaming.takeCommittedNodes()) {
+        committed.push_back(node->value());
+      }
+      ASSERT_TRUE(streaming.takeCommittedNodes().empty());
+    }
+  }
+  ASSERT_GT(streaming.committedReadings(), 400);
+  ASSERT_LE(maxLength, 2 * streaming.autoCommitWindow());
+
+  for (const auto& node : streaming.takeCommittedNodes()) {
+    committed.push_back(node->value());
+  }
+  for (const auto& value : streaming.walk().valuesAsStrings()) {
+    committed.push_back(value);
+  }
+  ASSERT_EQ(committed, full.walk().valuesAsStrings());
+
+  // Nothing is committed within (kMaximumSpanLength - 1) of the cursor.
+  streaming.setCursor(4);
+  streaming.insertReading("a");
+  ASSERT_EQ(streaming.cursor(), 5);
+  ASSERT_TRUE(streaming.takeCommittedNodes().empty());
+
+  streaming.clear();
+  ASSERT_EQ(streaming.committedReadings(), 0);
+  ASSERT_EQ(streaming.autoCommitWindow(), 16);
+}
+
+TEST(ReadingGridTest, ApproximateAutoCommitBoundsTheGridWhenEveryLocationIsCrossed) {
+  // Every combination of up to three readings is a word, and so every
+  // location is crossed by some node.
+  class DenseLM : public LanguageModel {
+   public:
+    std::vector<Unigram> getUnigrams(const std::string& reading) override {
+      std::vector<Unigram> unigrams;
+      if (reading.size() <= 3) {
+        size_t h = std::hash<std::string>()(reading);
+        unigrams.emplace_back(reading, -1.0 - static_cast<double>(h % 7));
+      }
+      return unigrams;
+    }
+    bool hasUnigrams(const std::string& reading) override {
+      return reading.size() <= 3;
+    }
+  };
+
+  auto lm = std::make_shared<DenseLM>();
+  ReadingGrid exact(lm);
+  ReadingGrid grid(lm);
+  exact.setReadingSeparator("");
+  grid.setReadingSeparator("");
+  exact.setAutoCommitWindow(16);
+  grid.setAutoCommitWindow(16);
+  ASSERT_FALSE(grid.approximateAutoCommit());
+  grid.setApproximateAutoCommit(true);
+  std::mt19937 gen(11);
+  constexpr char kReadings[] = "abcd";
+  std::string input;
+  std::string output;
+  for (int i = 0; i < 1000; ++i) {
+    std::string reading(1, kReadings[gen() % 4]);
+    input += reading;
+    ASSERT_TRUE(grid.insertReading(reading));
+    ASSERT_LE(grid.length(), 2 * grid.autoCommitWindow());
+    ASSERT_EQ(grid.committedReadings() + grid.length(), input.size());
+    if (i < 200) {
+      ASSERT_TRUE(exact.insertReading(reading));
+    }
+  }
+
+  // Without the approximate commit, nothing that could still change is
+  // committed, and so the grid grows.
+  ASSERT_EQ(exact.committedReadings(), 0);
+  ASSERT_EQ(exact.length(), 200);
+
+  // The committed nodes and the rest of the grid still cover the input.
+  for (const auto& node : grid.takeCommittedNodes()) {
+    output += node->reading();
+  }
+  for (const auto& node : grid.walk().nodes) {
+    output += node->reading();
+  }
+  ASSERT_EQ(output, input);
+}
+
+TEST(ReadingGridTest, EditsAnywhereKeepTheReadingsAndSpansInOrder) {
+  // Every combination of up to three readings is a word.
+  class ShortWordsLM : public LanguageModel {
+   public:
+    std::vector<Unigram> getUnigrams(const std::string& reading) override {
+      std::vector<Unigram> unigrams;
+      if (reading.size() <= 3) {
+        unigrams.emplace_back(reading, -1.0);
+      }
+      return unigrams;
+    }
+    bool hasUnigrams(const std::string& reading) override {
+      return reading.size() <= 3;
+    }
+  };
+
+  auto lm = std::make_shared<ShortWordsLM>();
+  ReadingGrid grid(lm);
+  grid.setReadingSeparator("");
+  std::vector<std::string> readings;
+  std::mt19937 gen(7);
+  constexpr char kReadings[] = "abcd";
+  for (int i = 0; i < 500; ++i) {
+    grid.setCursor(gen() % (grid.length() + 1));
+    size_t cursor = grid.cursor();
+    size_t edit = gen() % 5;
+    if (edit == 0 && grid.deleteReadingAfterCursor()) {
+      readings.erase(readings.begin() + static_cast<ptrdiff_t>(cursor));
+    } else if (edit == 1 && grid.deleteReadingBeforeCursor()) {
+      readings.erase(readings.begin() + static_cast<ptrdiff_t>(cursor - 1));
+    } else {
+      std::string reading(1, kReadings[gen() % 4]);
+      ASSERT_TRUE(grid.insertReading(reading));
+      readings.insert(readings.begin() + static_cast<ptrdiff_t>(cursor),
+                      reading);
+    }
+  }
+  ASSERT_GT(readings.size(), 50);
+  ASSERT_EQ(std::vector<std::string>(grid.readings().begin(),
+                                     grid.readings().end()),
+            readings);
+
+  ReadingGrid expected(lm);
+  expected.setReadingSeparator("");
+  for (const auto& reading : readings) {
+    expected.insertReading(reading);
+  }
+  ASSERT_EQ(grid.spans().size(), expected.spans().size());
+  for (size_t i = 0; i < expected.spans().size(); ++i) {
+    const auto& span = grid.spans()[i];
+    const auto& expectedSpan = expected.spans()[i];
+    ASSERT_EQ(span.maxLength(), expectedSpan.maxLength());
+    for (size_t len = 1; len <= expectedSpan.maxLength(); ++len) {
+      ASSERT_EQ(span.nodeOf(len) == nullptr,
+                expectedSpan.nodeOf(len) == nullptr);
+      if (span.nodeOf(len) != nullptr) {
+        ASSERT_EQ(span.nodeOf(len)->reading(),
+                  expectedSpan.nodeOf(len)->reading());
+      }
+    }
+  }
+  ASSERT_EQ(grid.walk().valuesAsStrings(),
+            expected.walk().valuesAsStrings());
+}
+
+TEST(ReadingGridTest, UpdateLooksUpReadingsInOneBatch) {
+  class BatchCountingLM : public MockLM {
+   public:
+    std::vector<std::vector<Unigram>> batchGetUnigrams(
+        const std::vector<std::string>& readings) override {
+      batches.push_back(readings);
+      return MockLM::batchGetUnigrams(readings);
+    }
+    std::vector<std::vector<std::string>> batches;
+  };
+
+  auto lm = std::make_shared<BatchCountingLM>();
+  ReadingGrid grid(lm);
+  grid.insertReading("a");
+  grid.insertReading("b");
+  grid.insertReading("c");
+
+  // Only the readings without nodes are looked up.
+  ASSERT_EQ(lm->batches.size(), 3);
+  EXPECT_EQ(lm->batches[0], (std::vector<std::string>{"a"}));
+  EXPECT_EQ(lm->batches[1], (std::vector<std::string>{"a-b", "b"}));
+  EXPECT_EQ(lm->batches[2], (std::vector<std::string>{"a-b-c", "b-c", "c"}));
+
+  auto result = grid.walk();
+  EXPECT_EQ(result.valuesAsStrings(), (std::vector<std::string>{"a-b-c"}));
+}
+
+TEST(ReadingGridTest, UpdateSkipsReadingsWithDeadPrefixes) {
+  auto lm = std::make_shared<SimpleLM>(
+      "a A -1\nb B -1\nc C -1\nd D -1\na-b AB -1\nb-c-d BCD -1\n");
+  ReadingGrid grid(lm);
+  grid.insertReading("a");
+  grid.insertReading("b");
+  grid.insertReading("c");
+
+  // Nothing starts with a-b-, and so a-b-c is not looked up. There is no
+  // prefix query for a- since the node a-b already exists.
+  EXPECT_EQ(grid.lastUpdateStats().lookups, 2);         // b-c, c
+  EXPECT_EQ(grid.lastUpdateStats().prefixQueries, 2);   // a-b-, b-
+  EXPECT_EQ(grid.lastUpdateStats().skippedLookups, 1);  // a-b-c
+
+  grid.insertReading("d");
+  EXPECT_EQ(grid.lastUpdateStats().lookups, 3);         // b-c, b-c-d, d
+  EXPECT_EQ(grid.lastUpdateStats().prefixQueries, 4);   // a-b-, b-, b-c-, c-
+  EXPECT_EQ(grid.lastUpdateStats().skippedLookups, 3);  // a-b-c, a-b-c-d, c-d
+  auto result = grid.walk();
+  EXPECT_EQ(result.valuesAsStrings(), (std::vector<std::string>{"A", "BCD"}));
+
+  // Pruning does not change the results.
+  auto unprunedLM = std::make_shared<MockLM>();
+  ReadingGrid unprunedGrid(unprunedLM);
+  for (const auto* reading : {"a", "b", "c", "d"}) {
+    unprunedGrid.insertReading(reading);
+  }
+  EXPECT_EQ(unprunedGrid.lastUpdateStats().prefixQueries, 3);
+  EXPECT_EQ(unprunedGrid.lastUpdateStats().skippedLookups, 0);
+}
+
+TEST(ReadingGridTest, KeystrokesDoNotAllocateFromHeap) {
+  // Like McBopomofoLM, keeps the ranked unigrams of each reading once looked
+  // up, and shares them with the grid. If singleOnly, only the readings of one
+  // syllable have unigrams.
+  class CachingLM : public LanguageModel {
+   public:
+    explicit CachingLM(bool singleOnly) : singleOnly_(singleOnly) {}
+    std::vector<Unigram> getUnigrams(const std::string& reading) override {
+      if (!hasUnigrams(reading)) {
+        return {};
+      }
+      return {Unigram(reading, -1)};
+    }
+    bool hasUnigrams(const std::string& reading) override {
+      return !singleOnly_ || reading.find('-') == std::string::npos;
+    }
+    void batchGetRankedUnigrams(const std::vector<std::string>& readings,
+                                std::vector<RankedUnigrams>* results) override {
+      results->resize(readings.size());
+      for (size_t i = 0; i < readings.size(); ++i) {
+        auto it = cache_.find(readings[i]);
+        if (it == cache_.end()) {
+          it = cache_
+                   .emplace(readings[i],
+                            std::make_shared<const std::vector<Unigram>>(
+                                getUnigrams(readings[i])))
+                   .first;
+        }
+        (*results)[i] = it->second;
+      }
+    }
+
+   private:
+    bool singleOnly_;
+    std::map<std::string, RankedUnigrams> cache_;
+  };
+
+  // A combined reading of two or more of these is longer than what a
+  // std::string holds inline.
+  std::vector<std::string> readings = {"ㄓㄨㄥ", "ㄍㄨㄛˊ", "ㄖㄣˊ", "ㄇㄧㄣˊ",
+                                       "ㄍㄨㄥˋ", "ㄏㄜˊ",  "ㄍㄨㄛˊ", "ㄐㄧㄚ"};
+  ASSERT_GT(readings[0].size() + 1 + readings[1].size(),
+            std::string().capacity());
+
+  for (bool singleOnly : {true, false}) {
+    auto lm = std::make_shared<CachingLM>(singleOnly);
+    auto grid = std::make_unique<ReadingGrid>(lm);
+    for (const auto& reading : readings) {
+      grid->insertReading(reading);
+    }
+
+    // Warm up the grid's buffers and the LM's cache.
+    for (size_t i = 0; i < readings.size() * 2; ++i) {
+      grid->deleteReadingBeforeCursor();
+      grid->insertReading(readings[i % readings.size()]);
+      grid->walk();
+    }
+
+    // Every allocation is counted, those of the LM included.
+    constexpr size_t kRounds = 100;
+    size_t before = HeapAllocationCount();
+    for (size_t i = 0; i < kRounds; ++i) {
+      grid->deleteReadingBeforeCursor();
+      grid->insertReading(readings[i % readings.size()]);
+      ASSERT_GE(grid->lastUpdateStats().lookups, 8);
+      grid->walk();
+    }
+    size_t allocations = HeapAllocationCount() - before;
+
+    // Each round looks up eight readings and replaces as many nodes, most of
+    // them with multi-syllable readings if the LM has them, yet the only
+    // allocation is that of the node vector in the WalkResult.
+    EXPECT_EQ(allocations, kRounds);
+
+    // Nodes can outlive the grid.
+    auto result = grid->walk();
+    grid = nullptr;
+    std::string lastReading = readings[(kRounds - 1) % readings.size()];
+    if (singleOnly) {
+      ASSERT_EQ(result.nodes.size(), readings.size());
+      EXPECT_EQ(result.nodes.back()->reading(), lastReading);
+    } else {
+      ASSERT_EQ(result.nodes.size(), 1);
+      std::string combined;
+      for (size_t i = 0; i + 1 < readings.size(); ++i) {
+        combined += readings[i] + "-";
+      }
+      EXPECT_EQ(result.nodes[0]->reading(), combined + lastReading);
+    }
+  }
+}
+
+TEST(ReadingGridTest, NodesKeepReadingsOfAnyLength) {
+  std::string shortReading = "ㄓㄨㄥ-ㄍㄨㄛˊ";
+  std::string longReading(ReadingGrid::Node::kInlineReadingCapacity + 1, 'a');
+  ReadingGrid::Node shortNode(shortReading, 2, {LanguageModel::Unigram("中國", -1)});
+  ReadingGrid::Node longNode(longReading, 1, {LanguageModel::Unigram("A", -1)});
+  ReadingGrid::Node emptyNode("", 1, {LanguageModel::Unigram("B", -1)});
+  EXPECT_EQ(shortNode.reading(), shortReading);
+  EXPECT_EQ(longNode.reading(), longReading);
+  EXPECT_EQ(emptyNode.reading(), "");
+
+  // The reading is copied with the node.
+  ReadingGrid::Node copy = shortNode;
+  EXPECT_EQ(copy.reading(), shortReading);
+  EXPECT_NE(copy.reading().data(), shortNode.reading().data());
+}
+
 TEST(ReadingGridTest, LongGridInsertion) {
   ReadingGrid grid(std::make_shared<MockLM>());
   grid.setReadingSeparator("");
@@ -641,6 +1211,142 @@ TEST(ReadingGridTest, InputTest) {
             (std::vector<std::string>{"高科技", "公司", "的", "年終", "獎金"}));
 }
 
+namespace {
+
+// A complete path through the grid, as its nodes and their start locations.
+struct Path {
+  std::vector<ReadingGrid::NodePtr> nodes;
+  std::vector<size_t> locations;
+  double score = 0;
+};
+
+std::vector<Path> AllPaths(const ReadingGrid& grid) {
+  std::vector<Path> paths;
+  Path path;
+  std::function<void(size_t)> enumerate = [&](size_t loc) {
+    if (loc == grid.length()) {
+      paths.push_back(path);
+      return;
+    }
+    const ReadingGrid::Span& span = grid.spans()[loc];
+    for (size_t len = 1; len <= span.maxLength(); ++len) {
+      const ReadingGrid::NodePtr& node = span.nodeOf(len);
+      if (node == nullptr) {
+        continue;
+      }
+      path.nodes.push_back(node);
+      path.locations.push_back(loc);
+      path.score += node->score();
+      enumerate(loc + len);
+      path.score -= node->score();
+      path.locations.pop_back();
+      path.nodes.pop_back();
+    }
+  };
+  enumerate(0);
+  return paths;
+}
+
+// The score of the best path with the candidate, found by going through all
+// the paths.
+double BestScoreWith(const std::vector<Path>& paths, size_t loc,
+                     const ReadingGrid::Candidate& candidate) {
+  double best = -std::numeric_limits<double>::infinity();
+  for (const Path& path : paths) {
+    for (size_t i = 0; i < path.nodes.size(); ++i) {
+      const ReadingGrid::NodePtr& node = path.nodes[i];
+      if (path.locations[i] > loc ||
+          path.locations[i] + node->spanningLength() <= loc ||
+          node->reading() != candidate.reading) {
+        continue;
+      }
+      for (const auto& unigram : node->unigrams()) {
+        if (unigram.value() != candidate.value) {
+          continue;
+        }
+        double score = unigram.value() == node->value() ? node->score()
+                                                        : unigram.score();
+        best = std::max(best, path.score - node->score() + score);
+      }
+    }
+  }
+  return best;
+}
+
+}  // namespace
+
+TEST(ReadingGridTest, RankedCandidatesAreScoredByTheBestPathThroughThem) {
+  ReadingGrid grid(std::make_shared<SimpleLM>(kSampleData));
+  grid.setReadingSeparator("");
+  for (const char* reading :
+       {"ㄍㄠ", "ㄎㄜ", "ㄐㄧˋ", "ㄍㄨㄥ", "ㄙ", "ㄉㄜ˙", "ㄋㄧㄢˊ", "ㄓㄨㄥ",
+        "ㄐㄧㄤˇ", "ㄐㄧㄣ"}) {
+    grid.insertReading(reading);
+  }
+  ReadingGrid::WalkResult walk = grid.walk();
+  std::vector<Path> paths = AllPaths(grid);
+
+  for (size_t loc = 0; loc <= grid.length(); ++loc) {
+    std::vector<ReadingGrid::RankedCandidate> ranked =
+        grid.rankedCandidatesAt(loc);
+    ASSERT_EQ(ranked.size(), grid.candidatesAt(loc).size());
+    size_t candidateLoc = loc == grid.length() ? loc - 1 : loc;
+    for (size_t i = 0; i < ranked.size(); ++i) {
+      EXPECT_NEAR(ranked[i].score,
+                  BestScoreWith(paths, candidateLoc, ranked[i].candidate),
+                  1e-9)
+          << ranked[i].candidate.value << " at " << loc;
+      if (i > 0) {
+        EXPECT_LE(ranked[i].score, ranked[i - 1].score);
+      }
+    }
+    // The best candidate is on the best path.
+    ASSERT_FALSE(ranked.empty());
+    EXPECT_DOUBLE_EQ(ranked[0].score, walk.score);
+  }
+
+  std::vector<ReadingGrid::RankedCandidate> ranked = grid.rankedCandidatesAt(7);
+  EXPECT_EQ(ranked[0].candidate.value, "年中");
+  EXPECT_EQ(ranked[1].candidate.value, "年終");
+
+  // Overriding a candidate makes it the best.
+  ASSERT_TRUE(grid.overrideCandidate(7, "年終"));
+  ranked = grid.rankedCandidatesAt(7);
+  EXPECT_EQ(ranked[0].candidate.value, "年終");
+  EXPECT_DOUBLE_EQ(ranked[0].score, grid.walk().score);
+}
+
+TEST(ReadingGridTest, ConfidenceMarginsOfWalkedNodes) {
+  ReadingGrid grid(std::make_shared<SimpleLM>(kSampleData));
+  grid.setReadingSeparator("");
+  for (const char* reading :
+       {"ㄍㄠ", "ㄎㄜ", "ㄐㄧˋ", "ㄍㄨㄥ", "ㄙ", "ㄉㄜ˙", "ㄋㄧㄢˊ", "ㄓㄨㄥ",
+        "ㄐㄧㄤˇ", "ㄐㄧㄣ"}) {
+    grid.insertReading(reading);
+  }
+  ReadingGrid::WalkResult walk = grid.walk();
+  std::vector<double> margins = grid.confidenceMarginsOf(walk);
+  ASSERT_EQ(margins.size(), walk.nodes.size());
+
+  // The best other candidate at the start of each walked node is the one
+  // ranked next.
+  size_t loc = 0;
+  for (size_t i = 0; i < walk.nodes.size(); ++i) {
+    std::vector<ReadingGrid::RankedCandidate> ranked =
+        grid.rankedCandidatesAt(loc);
+    ASSERT_GE(ranked.size(), 2);
+    EXPECT_EQ(ranked[0].candidate.value, walk.nodes[i]->value());
+    EXPECT_GE(margins[i], 0);
+    EXPECT_NEAR(margins[i], ranked[0].score - ranked[1].score, 1e-9)
+        << walk.nodes[i]->value();
+    loc += walk.nodes[i]->spanningLength();
+  }
+
+  // 年中 is only slightly more likely than 年終.
+  EXPECT_NEAR(margins[3], -11.373044 - -11.668947, 1e-9);
+  EXPECT_TRUE(grid.confidenceMarginsOf(ReadingGrid::WalkResult()).empty());
+}
+
 TEST(ReadingGridTest, OverrideResetOverlappingNodes) {
   ReadingGrid grid(std::make_shared<SimpleLM>(kSampleData));
   grid.setReadingSeparator("");
@@ -119,9 +119,12 @@ extension McBopomofoInputMethodController: KeyHandlerDelegate {
         return result
     }
 
-    func keyHandlerDidRequestReloadLanguageModel(_ keyHandler: KeyHandler) -> Bool {
-        LanguageModelManager.loadUserPhrases(enableForPlainBopomofo: false)
-        return true
+    func keyHandler(
+        _ keyHandler: KeyHandler,
+        didRequestReloadLanguageModelWithCompletion completion: @escaping () -> Void
+    ) {
+        LanguageModelManager.reloadUserPhrases(
+            enableForPlainBopomofo: false, completion: completion)
     }
 
 }
@@ -185,6 +185,7 @@ class McBopomofoInputMethodController: IMKInputController {
         currentClient = nil
         keyHandler.clear()
         self.handle(state: .Deactivated(), client: client)
+        LanguageModelManager.compactUserOverrideModelIfNeeded()
     }
 
     override func setValue(_ value: Any!, forTag tag: Int, client: Any!) {
@@ -347,14 +348,14 @@ class McBopomofoInputMethodController: IMKInputController {
     }
 
     @objc func reloadUserPhrases(_ sender: Any?) {
-        LanguageModelManager.loadUserPhrases(
-            enableForPlainBopomofo: Preferences.enableUserPhrasesInPlainBopomofo)
-        LanguageModelManager.loadUserPhraseReplacement()
-
-        // Empty the issues so that if there are still the same issues, a
-        // notification will be shown.
-        McBopomofoInputMethodController.latestUserFileIssues = []
-        checkUserFileIssues()
+        LanguageModelManager.reloadUserPhrases(
+            enableForPlainBopomofo: Preferences.enableUserPhrasesInPlainBopomofo
+        ) {
+            // Empty the issues so that if there are still the same issues, a
+            // notification will be shown.
+            McBopomofoInputMethodController.latestUserFileIssues = []
+            self.checkUserFileIssues()
+        }
     }
 
     @objc func showUserFileIssues(_ sender: Any?) {
@@ -40,7 +40,9 @@ extern InputMode InputModePlainBopomofo;
 - (BOOL)keyHandler:(KeyHandler *)keyHandler didRequestWriteUserPhraseWithState:(InputState *)state;
 - (BOOL)keyHandler:(KeyHandler *)keyHandler didRequestBoostScoreForPhrase:(NSString *)phrase reading:(NSString *)reading;
 - (BOOL)keyHandler:(KeyHandler *)keyHandler didRequestExcludePhrase:(NSString *)phrase reading:(NSString *)reading;
-- (BOOL)keyHandlerDidRequestReloadLanguageModel:(KeyHandler *)keyHandler;
+/// Reloads the language model, and calls the completion on the main queue once
+/// the reloaded model is in use.
+- (void)keyHandler:(KeyHandler *)keyHandler didRequestReloadLanguageModelWithCompletion:(void (^)(void))completion;
 @end
 
 @interface KeyHandler : NSObject
@@ -1148,7 +1148,7 @@ InputMode InputModePlainBopomofo = @"org.openvanilla.inputmethod.McBopomofo.Plai
 {
     std::string composed;
     for (const auto& node : _latestWalk.nodes) {
-        std::string key = node->reading();
+        std::string key(node->reading());
         std::replace(key.begin(), key.end(), '-', ' ');
         std::string value = node->value();
 
@@ -1171,7 +1171,7 @@ InputMode InputModePlainBopomofo = @"org.openvanilla.inputmethod.McBopomofo.Plai
     NSMutableString *composingBuffer = [[NSMutableString alloc] init];
     for (const auto& node : _latestWalk.nodes) {
         std::string value = node->currentUnigram().value();
-        std::string reading = node->reading();
+        std::string reading(node->reading());
         if (reading[0] == '_') {
             NSString *punctuation = [[NSString alloc] initWithUTF8String:value.c_str()];
             NSString *converted = [BopomofoBrailleConverter convertFromBopomofo:punctuation];
@@ -1199,7 +1199,7 @@ InputMode InputModePlainBopomofo = @"org.openvanilla.inputmethod.McBopomofo.Plai
 {
     NSMutableArray *array = [[NSMutableArray alloc] init];
     for (const auto& node : _latestWalk.nodes) {
-        std::string key = node->reading();
+        std::string key(node->reading());
         std::string value = node->value();
 
         if (key.rfind(std::string("_"), 0) == 0) {
@@ -1479,10 +1479,16 @@ InputMode InputModePlainBopomofo = @"org.openvanilla.inputmethod.McBopomofo.Plai
                         return;
                     }
                     [strongSelf.delegate keyHandler:strongSelf didRequestBoostScoreForPhrase:candidate.value reading:reading];
-                    [strongSelf.delegate keyHandlerDidRequestReloadLanguageModel:strongSelf];
-                    [strongSelf _walk];
-                    InputStateInputting *inputting = (InputStateInputting *)[strongSelf buildInputtingState];
-                    stateCallback(inputting);
+                    // Walk only once the reloaded user phrases are in use.
+                    [strongSelf.delegate keyHandler:strongSelf didRequestReloadLanguageModelWithCompletion:^{
+                        __strong __typeof(weakSelf) reloadedSelf = weakSelf;
+                        if (!reloadedSelf) {
+                            return;
+                        }
+                        [reloadedSelf _walk];
+                        InputStateInputting *inputting = (InputStateInputting *)[reloadedSelf buildInputtingState];
+                        stateCallback(inputting);
+                    }];
                 }];
                 [entries addObject:boost];
                 title = [NSString stringWithFormat:NSLocalizedString(@"Do you want to boost the score of the phrase \"%@\"?", @""), candidate.value];
@@ -1493,10 +1499,16 @@ InputMode InputModePlainBopomofo = @"org.openvanilla.inputmethod.McBopomofo.Plai
                         return;
                     }
                     [strongSelf.delegate keyHandler:strongSelf didRequestExcludePhrase:candidate.value reading:reading];
-                    [strongSelf.delegate keyHandlerDidRequestReloadLanguageModel:strongSelf];
-                    [strongSelf _walk];
-                    InputStateInputting *inputting = (InputStateInputting *)[strongSelf buildInputtingState];
-                    stateCallback(inputting);
+                    // Walk only once the reloaded user phrases are in use.
+                    [strongSelf.delegate keyHandler:strongSelf didRequestReloadLanguageModelWithCompletion:^{
+                        __strong __typeof(weakSelf) reloadedSelf = weakSelf;
+                        if (!reloadedSelf) {
+                            return;
+                        }
+                        [reloadedSelf _walk];
+                        InputStateInputting *inputting = (InputStateInputting *)[reloadedSelf buildInputtingState];
+                        stateCallback(inputting);
+                    }];
                 }];
                 [entries addObject:exclude];
                 title = [NSString stringWithFormat:NSLocalizedString(@"Do you want to exclude the phrase \"%@\"?", @""), candidate.value];
@@ -2145,7 +2157,7 @@ InputMode InputModePlainBopomofo = @"org.openvanilla.inputmethod.McBopomofo.Plai
     // Validate that the value's codepoint count is the same as the number
     // of readings. This is a strict requirement for the associated phrases.
     std::vector<std::string> codepoints = McBopomofo::Split((*nodePtrIt)->value());
-    std::vector<std::string> readings = McBopomofo::AssociatedPhrasesV2::SplitReadings((*nodePtrIt)->reading());
+    std::vector<std::string> readings = McBopomofo::AssociatedPhrasesV2::SplitReadings(std::string((*nodePtrIt)->reading()));
     if (codepoints.size() != readings.size()) {
         errorCallback();
         return YES;
@@ -2270,7 +2282,7 @@ InputMode InputModePlainBopomofo = @"org.openvanilla.inputmethod.McBopomofo.Plai
                 composed += value;
             } else {
                 std::vector<std::string> characters = McBopomofo::Split(value);
-                std::vector<std::string> readings = McBopomofo::AssociatedPhrasesV2::SplitReadings(node->reading());
+                std::vector<std::string> readings = McBopomofo::AssociatedPhrasesV2::SplitReadings(std::string(node->reading()));
                 if (readings.size() != cpLen) {
                     composed += value;
                 } else {
@@ -2435,7 +2447,6 @@ InputMode InputModePlainBopomofo = @"org.openvanilla.inputmethod.McBopomofo.Plai
 - (NSArray *)_currentReadings
 {
     NSMutableArray *readingsArray = [[NSMutableArray alloc] init];
-    std::vector<std::string> v = _grid->readings();
     for (const auto& reading : _grid->readings()) {
         [readingsArray addObject:@(reading.c_str())];
     }
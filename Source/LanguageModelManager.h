@@ -28,10 +28,21 @@ NS_ASSUME_NONNULL_BEGIN
 
 @interface LanguageModelManager : NSObject
 
+/// Loads the data models of both input modes, the variant annotator and the
+/// user files at once, on a few threads, and returns once all are ready. The
+/// models already loaded, and the user files that have not changed, are
+/// skipped.
++ (void)loadDataModels;
 + (void)loadDataModel:(InputMode)mode;
-+ (void)loadUserPhrasesWithPlainBopomofoEnabled:(BOOL)userPhraseForPlainBopomofo NS_SWIFT_NAME(loadUserPhrases(enableForPlainBopomofo:));
-+ (void)loadUserPhraseReplacement;
+/// Reloads the user phrases, the excluded phrases and the phrase replacement
+/// map on a background thread, so that typing goes on with the old ones
+/// meanwhile. The completion, if any, is called on the main queue once the
+/// new ones are in use.
++ (void)reloadUserPhrasesWithPlainBopomofoEnabled:(BOOL)userPhraseForPlainBopomofo completion:(nullable void (^)(void))completion NS_SWIFT_NAME(reloadUserPhrases(enableForPlainBopomofo:completion:));
 + (void)setupDataModelValueConverter;
+/// Compacts the journal of the user override model into a new snapshot if it
+/// is full. This syncs to disk, and so is done when the user is not typing.
++ (void)compactUserOverrideModelIfNeeded;
 + (BOOL)checkIfUserLanguageModelFilesExist;
 
 + (BOOL)checkIfUserPhraseExist:(NSString *)userPhrase key:(NSString *)key NS_SWIFT_NAME(checkIfExist(userPhrase:key:));
@@ -46,15 +57,11 @@ NS_ASSUME_NONNULL_BEGIN
 @property (class, readonly, nonatomic) NSString *excludedPhrasesDataPathMcBopomofo;
 @property (class, readonly, nonatomic) NSString *excludedPhrasesDataPathPlainBopomofo;
 @property (class, readonly, nonatomic) NSString *phraseReplacementDataPathMcBopomofo;
+@property (class, readonly, nonatomic) NSString *userOverrideModelDataPath;
 @property (class, assign, nonatomic) BOOL phraseReplacementEnabled;
 
 @end
 
-/// The following methods are merely for testing.
-@interface LanguageModelManager ()
-+ (void)loadDataModels;
-@end
-
 @interface LanguageModelManager ()
 + (NSString *)annotateVariantForCharacters:(NSString *)characters readings:(NSString *)readings NS_SWIFT_NAME(annotateVariant(characters:readings:));
 @end
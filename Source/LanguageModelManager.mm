@@ -27,6 +27,7 @@
 
 #include "UTF8Helper.h"
 #include "AssociatedPhrasesV2.h"
+#include "DataModelLoader.h"
 
 @import OpenCCBridge;
 
@@ -85,21 +86,50 @@ static void LTLoadVariantAnnotatorData()
 
 + (void)loadDataModels
 {
+    Class cls = NSClassFromString(@"McBopomofoInputMethodController");
+    NSBundle *bundle = [NSBundle bundleForClass:cls];
+    auto resourcePath = [bundle](NSString *name) {
+        NSString *path = [bundle pathForResource:name ofType:@"txt"];
+        return path != nil ? std::string(path.UTF8String) : std::string();
+    };
+
+    // The models are independent of each other, and so they are loaded at
+    // the same time.
+    McBopomofo::DataModelLoader loader;
     if (!gLanguageModelMcBopomofo.isDataModelLoaded()) {
-        LTLoadLanguageModelFile(@"data", gLanguageModelMcBopomofo);
+        loader.addLanguageModel("data", &gLanguageModelMcBopomofo, resourcePath(@"data"));
     }
     if (!gLanguageModelMcBopomofo.isAssociatedPhrasesV2Loaded()) {
-        LTLoadAssociatedPhrases(gLanguageModelMcBopomofo);
+        loader.addAssociatedPhrases("associated-phrases-v2", &gLanguageModelMcBopomofo, resourcePath(@"associated-phrases-v2"));
     }
 
     if (!gLanguageModelPlainBopomofo.isDataModelLoaded()) {
-        LTLoadLanguageModelFile(@"data-plain-bpmf", gLanguageModelPlainBopomofo);
+        loader.addLanguageModel("data-plain-bpmf", &gLanguageModelPlainBopomofo, resourcePath(@"data-plain-bpmf"));
     }
     if (!gLanguageModelPlainBopomofo.isAssociatedPhrasesV2Loaded()) {
-        LTLoadAssociatedPhrases(gLanguageModelPlainBopomofo);
+        loader.addAssociatedPhrases("associated-phrases-v2 (plain)", &gLanguageModelPlainBopomofo, resourcePath(@"associated-phrases-v2"));
     }
     if (!gVariantAnnotator.loaded()) {
-        LTLoadVariantAnnotatorData();
+        loader.addVariantAnnotator("bpmfvs", &gVariantAnnotator, resourcePath(@"bpmfvs-pua"), resourcePath(@"bpmfvs-variants"));
+    }
+
+    // The user files are reloaded only if they have changed since they were
+    // last loaded. The user phrases of Plain Bopomofo are opt-in.
+    loader.addUserPhrases("user phrases", &gLanguageModelMcBopomofo, [self userPhrasesDataPathMcBopomofo].UTF8String, [self excludedPhrasesDataPathMcBopomofo].UTF8String);
+    loader.addPhraseReplacementMap("phrase replacement", &gLanguageModelMcBopomofo, [self phraseReplacementDataPathMcBopomofo].UTF8String);
+    std::string plainBopomofoUserPhrasesPath = Preferences.enableUserPhrasesInPlainBopomofo ? std::string([self userPhrasesDataPathPlainBopomofo].UTF8String) : std::string();
+    loader.addUserPhrases("user phrases (plain)", &gLanguageModelPlainBopomofo, plainBopomofoUserPhrasesPath, [self excludedPhrasesDataPathPlainBopomofo].UTF8String);
+
+    McBopomofo::DataModelLoader::Stats stats = loader.load();
+    for (const auto& component : stats.components) {
+        if (!component.loaded) {
+            NSLog(@"Error: Cannot load %s", component.name.c_str());
+        }
+    }
+    NSLog(@"Loaded %zu data models in %lld us", stats.components.size(), static_cast<long long>(stats.totalTime.count()));
+
+    if (!gUserOverrideModel.open([self userOverrideModelDataPath].UTF8String)) {
+        NSLog(@"Error: Cannot open the user override model at %@", [self userOverrideModelDataPath]);
     }
 }
 
@@ -130,16 +160,39 @@ static void LTLoadVariantAnnotatorData()
     }
 }
 
-+ (void)loadUserPhrasesWithPlainBopomofoEnabled:(BOOL)userPhraseForPlainBopomofo
++ (void)reloadUserPhrasesWithPlainBopomofoEnabled:(BOOL)userPhraseForPlainBopomofo completion:(nullable void (^)(void))completion
 {
-    gLanguageModelMcBopomofo.loadUserPhrases([self userPhrasesDataPathMcBopomofo].UTF8String, [self excludedPhrasesDataPathMcBopomofo].UTF8String);
-    gLanguageModelPlainBopomofo.loadUserPhrases(userPhraseForPlainBopomofo ? [self userPhrasesDataPathPlainBopomofo].UTF8String : NULL,
-        [self excludedPhrasesDataPathPlainBopomofo].UTF8String);
+    McBopomofo::McBopomofoLM::ReloadRequest mcBopomofoRequest;
+    mcBopomofoRequest.userPhrasesPath = std::string([self userPhrasesDataPathMcBopomofo].UTF8String);
+    mcBopomofoRequest.excludedPhrasesPath = std::string([self excludedPhrasesDataPathMcBopomofo].UTF8String);
+    mcBopomofoRequest.phraseReplacementPath = std::string([self phraseReplacementDataPathMcBopomofo].UTF8String);
+
+    // An empty path unloads the user phrases of Plain Bopomofo.
+    McBopomofo::McBopomofoLM::ReloadRequest plainBopomofoRequest;
+    plainBopomofoRequest.userPhrasesPath = userPhraseForPlainBopomofo ? std::string([self userPhrasesDataPathPlainBopomofo].UTF8String) : std::string();
+    plainBopomofoRequest.excludedPhrasesPath = std::string([self excludedPhrasesDataPathPlainBopomofo].UTF8String);
+
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_enter(group);
+    dispatch_group_enter(group);
+    gLanguageModelMcBopomofo.reloadAsync(mcBopomofoRequest, [group](bool) { dispatch_group_leave(group); });
+    gLanguageModelPlainBopomofo.reloadAsync(plainBopomofoRequest, [group](bool) { dispatch_group_leave(group); });
+    if (completion) {
+        dispatch_group_notify(group, dispatch_get_main_queue(), completion);
+    }
+
+    // The user override model is kept next to the user phrases, and is
+    // reloaded only if that location changes.
+    if (!gUserOverrideModel.open([self userOverrideModelDataPath].UTF8String)) {
+        NSLog(@"Error: Cannot open the user override model at %@", [self userOverrideModelDataPath]);
+    }
 }
 
-+ (void)loadUserPhraseReplacement
++ (void)compactUserOverrideModelIfNeeded
 {
-    gLanguageModelMcBopomofo.loadPhraseReplacementMap([self phraseReplacementDataPathMcBopomofo].UTF8String);
+    if (gUserOverrideModel.needsCompaction() && !gUserOverrideModel.compact()) {
+        NSLog(@"Error: Cannot compact the user override model at %@", [self userOverrideModelDataPath]);
+    }
 }
 
 + (void)setupDataModelValueConverter
@@ -450,6 +503,11 @@ static void LTLoadVariantAnnotatorData()
     return [[self dataFolderPath] stringByAppendingPathComponent:@"phrases-replacement.txt"];
 }
 
++ (NSString *)userOverrideModelDataPath
+{
+    return [[self dataFolderPath] stringByAppendingPathComponent:@"user-override-model.db"];
+}
+
 + (McBopomofo::McBopomofoLM *)languageModelMcBopomofo
 {
     return &gLanguageModelMcBopomofo;